@@ -0,0 +1,363 @@
+/**
+ * @file bench_quality.c
+ *
+ * @brief Tracking quality benchmark
+ *
+ *        Runs every dynamic calibration, step, ramp, sine and chirp, on the
+ *        simulated board against a fixed set of tank models, and compares
+ *        the #QUALITY metrics each test reports with baselines checked in
+ *        next to this file. A metric worse than its baseline by more than
+ *        the rig's own allowance, QUALITY_TOLERANCE and the slacks in
+ *        quality.h, fails the benchmark, so a controller change that
+ *        degrades tracking is caught before it reaches the rig.
+ *
+ *          bench_quality <baselines>      Compares, exit status 1 on a
+ *                                         regression or missing baseline
+ *          bench_quality -w <baselines>   Writes the metrics as the new
+ *                                         baselines
+ *
+ *        The simulation is deterministic, so metrics only move when the
+ *        firmware or the models do. With BENCH_ECHO set in the environment,
+ *        everything the board transmits is copied to stderr.
+ */
+
+#include "pressure.h"
+#include "quality.h"
+#include "sim.h"
+#include "tank.h"
+#include "waveform.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_NAME_SIZE 16
+#define BENCH_TIMEOUT 600.0f /*!< Longest batch in sec */
+
+/* Struct describing a tank the tests run against */
+struct BenchTank
+{
+  const char *name;
+  float supply; /*!< Compressor outlet pressure in psi */
+  float fill;   /*!< Compressor conductance in 1/sec */
+  float vent;   /*!< Exhaust conductance in 1/sec */
+  float leak;   /*!< Leak conductance in 1/sec */
+  float noise;  /*!< Sensor noise in psi */
+};
+
+/* Struct describing a test and the settings it runs with */
+struct BenchTest
+{
+  const char *name;
+  uint8_t waveform; /*!< enum waveform */
+  float per;        /*!< Period in sec */
+  float ampl;       /*!< Amplitude in psi */
+  float offset;     /*!< Offset in psi */
+  uint8_t end;      /*!< enum test_end */
+  float limit;      /*!< Cycles or seconds */
+};
+
+/* Struct containing the metrics of a test, as reported or as baseline */
+struct BenchResult
+{
+  char tank[BENCH_NAME_SIZE];
+  char test[BENCH_NAME_SIZE];
+  struct QualityMetrics m;
+};
+
+static const struct BenchTank bench_tanks[] = {
+  { "nominal", 180.0f, 0.15f, 0.5f, 0.002f, 0.0f },
+  { "slow", 150.0f, 0.1f, 0.3f, 0.002f, 0.0f },
+  { "leaky", 180.0f, 0.15f, 0.5f, 0.01f, 0.05f },
+};
+
+/* The chirp runs until its sweep, set by bench_chirp, is over */
+static const struct BenchTest bench_tests[] = {
+  { "step", WAVEFORM_STEP, 8.0f, 20.0f, 30.0f, TEST_END_CYCLES, 3 },
+  { "ramp", WAVEFORM_RAMP, 10.0f, 20.0f, 30.0f, TEST_END_CYCLES, 3 },
+  { "sine", WAVEFORM_SINE, 8.0f, 10.0f, 30.0f, TEST_END_CYCLES, 3 },
+  { "chirp", WAVEFORM_CHIRP, 1.0f, 10.0f, 30.0f, TEST_END_DURATION, 60 },
+};
+
+static const char *const bench_chirp[] = {
+  "SET CHIRPF0 0.05",
+  "SET CHIRPF1 0.2",
+  "SET CHIRPT 30",
+};
+
+#define BENCH_TANKS (sizeof (bench_tanks) / sizeof (bench_tanks[0]))
+#define BENCH_TESTS (sizeof (bench_tests) / sizeof (bench_tests[0]))
+#define BENCH_RUNS (BENCH_TANKS * BENCH_TESTS)
+
+/**
+ * @brief Sends a command and checks that it was accepted
+ *
+ * @param line Command without line ending
+ *
+ * @retval None
+ */
+static void
+bench_command (const char *line)
+{
+  size_t mark = sim_uart_mark ();
+
+  sim_uart_rx (line);
+  sim_uart_rx ("\r\n");
+  sim_run (0.3f);
+
+  if (sim_uart_line (mark, "#OK") == NULL)
+    {
+      fprintf (stderr, "bench: %s refused\n", line);
+      exit (EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Runs every test on one tank and reads back their metrics
+ *
+ *        The tests run as one batch, each reports its metrics as it ends.
+ *
+ * @param tank Tank to run against
+ * @param res Filled with the metrics of every test, in the order of
+ *            bench_tests
+ *
+ * @retval None
+ */
+static void
+bench_run (const struct BenchTank *tank, struct BenchResult *res)
+{
+  struct TankModel *model = tank_get_model (0);
+  char line[128];
+
+  model->supply = tank->supply;
+  model->fill = tank->fill;
+  model->vent = tank->vent;
+  model->leak = tank->leak;
+  model->noise = tank->noise;
+
+  bench_command ("SCRIPT CLEAR");
+  for (size_t i = 0; i < BENCH_TESTS; i++)
+    {
+      const struct BenchTest *test = &bench_tests[i];
+
+      snprintf (line, sizeof (line), "SCRIPT %u:%g:%g:%g:%u:%g",
+                test->waveform, test->per, test->ampl, test->offset,
+                test->end, test->limit);
+      bench_command (line);
+    }
+
+  snprintf (line, sizeof (line), "SET WAVE %u", WAVEFORM_BATCH);
+  bench_command (line);
+
+  size_t mark = sim_uart_mark ();
+  bench_command ("START");
+
+  /* Every test is vented before the next */
+  const struct Pressure *pressure = pressure_get_station (0);
+  float t = 0.0f;
+  while (pressure->menu.output && t < BENCH_TIMEOUT)
+    {
+      sim_run (1.0f);
+      t += 1.0f;
+    }
+
+  if (pressure->menu.output)
+    {
+      fprintf (stderr, "bench: batch on %s didn't finish\n", tank->name);
+      exit (EXIT_FAILURE);
+    }
+
+  const char *q = sim_uart_since (mark);
+  for (size_t i = 0; i < BENCH_TESTS; i++)
+    {
+      unsigned long n, sw;
+
+      q = strstr (q, "#QUALITY ");
+      if (q == NULL
+          || sscanf (q, "#QUALITY %*s %*s %*s %*s n=%lu rms=%f over=%f "
+                        "lag=%f sw=%lu",
+                     &n, &res[i].m.rms, &res[i].m.overshoot, &res[i].m.lag,
+                     &sw)
+                 != 5)
+        {
+          fprintf (stderr, "bench: %s on %s didn't report\n",
+                   bench_tests[i].name, tank->name);
+          exit (EXIT_FAILURE);
+        }
+      q++;
+
+      snprintf (res[i].tank, sizeof (res[i].tank), "%s", tank->name);
+      snprintf (res[i].test, sizeof (res[i].test), "%s", bench_tests[i].name);
+      res[i].m.n = n;
+      res[i].m.switches = sw;
+    }
+}
+
+/**
+ * @brief Reads the baselines
+ *
+ *        One line per run: tank, test, n, rms, overshoot, lag, switches.
+ *        Lines starting with '#' are comments.
+ *
+ * @param path File to read
+ * @param base Filled with the baselines
+ *
+ * @retval size_t Number of baselines read
+ */
+static size_t
+bench_load (const char *path, struct BenchResult *base)
+{
+  FILE *file = fopen (path, "r");
+  char line[256];
+  size_t count = 0;
+
+  if (file == NULL)
+    return 0;
+
+  while (count < BENCH_RUNS && fgets (line, sizeof (line), file) != NULL)
+    {
+      struct BenchResult *b = &base[count];
+      unsigned long n, sw;
+
+      if (line[0] == '#')
+        continue;
+      if (sscanf (line, "%15s %15s %lu %f %f %f %lu", b->tank, b->test, &n,
+                  &b->m.rms, &b->m.overshoot, &b->m.lag, &sw)
+          == 7)
+        {
+          b->m.n = n;
+          b->m.switches = sw;
+          count++;
+        }
+    }
+
+  fclose (file);
+  return count;
+}
+
+/**
+ * @brief Writes the metrics of every run as the baselines
+ *
+ * @param path File to write
+ * @param res Metrics of every run
+ *
+ * @retval int 0 : Written, 1 : Failed
+ */
+static int
+bench_save (const char *path, const struct BenchResult *res)
+{
+  FILE *file = fopen (path, "w");
+
+  if (file == NULL)
+    {
+      perror (path);
+      return 1;
+    }
+
+  fprintf (file, "# Tracking quality baselines, written by bench_quality -w\n"
+                 "# tank test n rms overshoot lag switches\n");
+  for (size_t i = 0; i < BENCH_RUNS; i++)
+    fprintf (file, "%s %s %lu %.4f %.4f %.2f %lu\n", res[i].tank,
+             res[i].test, (unsigned long)res[i].m.n, res[i].m.rms,
+             res[i].m.overshoot, res[i].m.lag,
+             (unsigned long)res[i].m.switches);
+
+  return fclose (file) != 0;
+}
+
+/**
+ * @brief Checks whether a metric has regressed, the way the rig does
+ *
+ * @param val Measured value
+ * @param base Baseline value
+ * @param slack Absolute allowance
+ *
+ * @retval uint8_t 1 : Worse than allowed
+ *                 0 : Within tolerance
+ */
+static uint8_t
+bench_worse (float val, float base, float slack)
+{
+  return fabsf (val) > (fabsf (base) * (1.0f + QUALITY_TOLERANCE)) + slack;
+}
+
+/**
+ * @brief Compares a run against its baseline
+ *
+ * @param res Metrics of the run
+ * @param base Baselines
+ * @param count Number of baselines
+ *
+ * @retval const char* Verdict
+ */
+static const char *
+bench_verdict (const struct BenchResult *res, const struct BenchResult *base,
+               size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    {
+      const struct QualityMetrics *b = &base[i].m;
+
+      if (strcmp (base[i].tank, res->tank) != 0
+          || strcmp (base[i].test, res->test) != 0)
+        continue;
+
+      if (bench_worse (res->m.rms, b->rms, QUALITY_SLACK_PSI)
+          || bench_worse (res->m.overshoot, b->overshoot, QUALITY_SLACK_PSI)
+          || bench_worse (res->m.lag, b->lag, QUALITY_SLACK_DEG)
+          || bench_worse (res->m.switches, b->switches,
+                          QUALITY_SLACK_SWITCH))
+        return "FAIL";
+
+      return "PASS";
+    }
+
+  return "NOBASE";
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct BenchResult res[BENCH_RUNS];
+  static struct BenchResult base[BENCH_RUNS];
+  uint8_t write = (argc == 3 && strcmp (argv[1], "-w") == 0);
+  int failed = 0;
+
+  if (argc != 2 && !write)
+    {
+      fprintf (stderr, "usage: bench_quality [-w] <baselines>\n");
+      return EXIT_FAILURE;
+    }
+
+  const char *path = argv[argc - 1];
+  size_t count = write ? 0 : bench_load (path, base);
+
+  sim_boot ();
+  if (getenv ("BENCH_ECHO") != NULL)
+    sim_uart_echo (stderr);
+  sim_run (1.0f);
+
+  for (size_t i = 0; i < sizeof (bench_chirp) / sizeof (bench_chirp[0]); i++)
+    bench_command (bench_chirp[i]);
+  for (size_t i = 0; i < BENCH_TANKS; i++)
+    bench_run (&bench_tanks[i], &res[i * BENCH_TESTS]);
+
+  for (size_t i = 0; i < BENCH_RUNS; i++)
+    {
+      struct BenchResult *r = &res[i];
+      const char *verdict = write ? "" : bench_verdict (r, base, count);
+      if (strcmp (verdict, "PASS") != 0 && !write)
+        failed = 1;
+
+      printf ("%-8s %-6s n=%-6lu rms=%.3f over=%.3f lag=%.1f sw=%-4lu%s\n",
+              r->tank, r->test, (unsigned long)r->m.n, r->m.rms,
+              r->m.overshoot, r->m.lag, (unsigned long)r->m.switches,
+              verdict);
+    }
+
+  if (write)
+    return bench_save (path, res);
+
+  printf ("bench_quality: %s\n", failed ? "FAIL" : "ok");
+  return failed;
+}
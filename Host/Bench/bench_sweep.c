@@ -0,0 +1,632 @@
+/**
+ * @file bench_sweep.c
+ *
+ * @brief Parallel parameter sweep over simulated rigs
+ *
+ *        Runs one test on a simulated rig for every combination of the
+ *        axes, and prints the results as one table in the format of the
+ *        sequencer's, with the tank, perr and switching time added:
+ *
+ *          #TABLE n=<rigs> cols=idx,tank,wave,per,ampl,offs,perr,switch,
+ *                 cycles,rms,over,lag,sw,verdict
+ *          #ROW <values>
+ *          #END
+ *
+ *        The firmware keeps its state in statics, so every rig is a process
+ *        of its own, forked from a worker and booted from scratch, with its
+ *        own struct Pressure and simulated peripherals. It sends its row
+ *        back through a pipe. The rigs are shared out among one worker per
+ *        core, each with a deque of its own: a worker runs its rigs newest
+ *        first, and once out of them takes the oldest of another's. Rigs with
+ *        long periods or slow tanks run for longer, so the workers stay busy
+ *        to the end and the sweep scales with the cores.
+ *
+ *          bench_sweep [-j <workers>] [-t <tank>,...] [-w <wave>]
+ *                      [-c <cycles> | -d <sec>] [<axis>=<start>:<stop>:<count>]...
+ *
+ *        The axes are per, ampl, offs, perr and sw, perr and sw as set with
+ *        SET PERR and SET SWITCH, 0 keeping the test's own. An axis not
+ *        given has a single value: per 8, ampl 20, offs 30, perr and sw 0.
+ *        The tanks are those of bench_quality. Periods can't be shorter than
+ *        the switching time.
+ */
+
+#include "pressure.h"
+#include "sim.h"
+#include "tank.h"
+#include "waveform.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SWEEP_AXES 5
+#define SWEEP_TANKS 3
+#define SWEEP_WORKERS 64  /*!< Most workers */
+#define SWEEP_GRACE 120.0f /*!< Time allowed to reach the offset and vent in
+                                sec */
+
+/* Axes of a sweep */
+enum sweep_axis
+{
+  SWEEP_PER,
+  SWEEP_AMPL,
+  SWEEP_OFFS,
+  SWEEP_PERR,
+  SWEEP_SW
+};
+
+/* Struct describing a tank the rigs run against */
+struct SweepTank
+{
+  const char *name;
+  float supply; /*!< Compressor outlet pressure in psi */
+  float fill;   /*!< Compressor conductance in 1/sec */
+  float vent;   /*!< Exhaust conductance in 1/sec */
+  float leak;   /*!< Leak conductance in 1/sec */
+  float noise;  /*!< Sensor noise in psi */
+};
+
+/* Struct describing an axis, count evenly spaced values */
+struct SweepRange
+{
+  float start;
+  float stop;
+  uint16_t count;
+};
+
+/* Struct containing what a rig sends back */
+struct SweepRow
+{
+  uint8_t ok; /*!< Set if the test ran and reported */
+  unsigned long cycles;
+  float rms;
+  float over;
+  float lag;
+  unsigned long sw;
+  unsigned verdict; /*!< enum quality_verdict */
+};
+
+/* Struct containing the rigs a worker has yet to run */
+struct SweepDeque
+{
+  pthread_mutex_t lock;
+  size_t *rigs; /*!< Indices of the rigs */
+  size_t head;  /*!< Oldest, taken by the other workers */
+  size_t tail;  /*!< One past the newest, run by the owner */
+};
+
+/* Struct containing a worker */
+struct SweepWorker
+{
+  pthread_t thread;
+  uint8_t index;
+  size_t ran;    /*!< Rigs run */
+  size_t stolen; /*!< Rigs taken from another worker */
+};
+
+static const struct SweepTank sweep_tanks[SWEEP_TANKS] = {
+  { "nominal", 180.0f, 0.15f, 0.5f, 0.002f, 0.0f },
+  { "slow", 150.0f, 0.1f, 0.3f, 0.002f, 0.0f },
+  { "leaky", 180.0f, 0.15f, 0.5f, 0.01f, 0.05f },
+};
+
+static const char *const sweep_names[SWEEP_AXES]
+    = { "per", "ampl", "offs", "perr", "sw" };
+
+static struct SweepRange sweep_axes[SWEEP_AXES] = {
+  { 8.0f, 8.0f, 1 }, { 20.0f, 20.0f, 1 }, { 30.0f, 30.0f, 1 },
+  { 0.0f, 0.0f, 1 }, { 0.0f, 0.0f, 1 },
+};
+
+static uint8_t sweep_tank_list[SWEEP_TANKS] = { 0 };
+static uint8_t sweep_tank_count = 1;
+static uint8_t sweep_wave = WAVEFORM_STEP;
+static uint8_t sweep_end = TEST_END_CYCLES;
+static float sweep_limit = 3.0f;
+
+static struct SweepDeque sweep_deques[SWEEP_WORKERS];
+static uint8_t sweep_workers;
+static struct SweepRow *sweep_rows;
+
+/**
+ * @brief Returns a value of an axis
+ *
+ * @param axis enum sweep_axis
+ * @param i Index of the value
+ *
+ * @retval float Value
+ */
+static float
+sweep_value (uint8_t axis, uint16_t i)
+{
+  const struct SweepRange *r = &sweep_axes[axis];
+
+  if (r->count < 2)
+    return r->start;
+
+  return r->start + (((r->stop - r->start) * i) / (r->count - 1));
+}
+
+/**
+ * @brief Returns the settings of a rig
+ *
+ *        Rigs are numbered with the tank slowest and the switching time
+ *        fastest.
+ *
+ * @param rig Index of the rig
+ * @param val Filled with the value of every axis
+ *
+ * @retval const struct SweepTank* Tank of the rig
+ */
+static const struct SweepTank *
+sweep_point (size_t rig, float val[SWEEP_AXES])
+{
+  for (int8_t a = SWEEP_AXES - 1; a >= 0; a--)
+    {
+      val[a] = sweep_value (a, rig % sweep_axes[a].count);
+      rig /= sweep_axes[a].count;
+    }
+
+  return &sweep_tanks[sweep_tank_list[rig]];
+}
+
+/**
+ * @brief Sends a command to the rig and checks that it was accepted
+ *
+ * @param line Command without line ending
+ *
+ * @retval uint8_t 1 : Accepted
+ *                 0 : Refused
+ */
+static uint8_t
+sweep_command (const char *line)
+{
+  size_t mark = sim_uart_mark ();
+
+  sim_uart_rx (line);
+  sim_uart_rx ("\r\n");
+  sim_run (0.3f);
+
+  return sim_uart_line (mark, "#OK") != NULL;
+}
+
+/**
+ * @brief Boots a rig and runs its test as a one test batch
+ *
+ *        Only ever called in the rig's own process.
+ *
+ * @param rig Index of the rig
+ * @param row Filled with the row the batch reports
+ *
+ * @retval None
+ */
+static void
+sweep_rig (size_t rig, struct SweepRow *row)
+{
+  float val[SWEEP_AXES];
+  const struct SweepTank *tank = sweep_point (rig, val);
+  struct TankModel *model = tank_get_model (0);
+  char line[128];
+
+  sim_boot ();
+  sim_run (1.0f);
+
+  model->supply = tank->supply;
+  model->fill = tank->fill;
+  model->vent = tank->vent;
+  model->leak = tank->leak;
+  model->noise = tank->noise;
+
+  snprintf (line, sizeof (line), "SET PERR %g", val[SWEEP_PERR]);
+  if (!sweep_command (line))
+    return;
+  snprintf (line, sizeof (line), "SET SWITCH %g", val[SWEEP_SW]);
+  if (!sweep_command (line))
+    return;
+  snprintf (line, sizeof (line), "SCRIPT %u:%g:%g:%g:%u:%g", sweep_wave,
+            val[SWEEP_PER], val[SWEEP_AMPL], val[SWEEP_OFFS], sweep_end,
+            sweep_limit);
+  if (!sweep_command ("SCRIPT CLEAR") || !sweep_command (line))
+    return;
+  snprintf (line, sizeof (line), "SET WAVE %u", WAVEFORM_BATCH);
+  if (!sweep_command (line))
+    return;
+
+  size_t mark = sim_uart_mark ();
+  if (!sweep_command ("START"))
+    return;
+
+  /* The table goes out once the test has been vented */
+  const struct Pressure *pressure = pressure_get_station (0);
+  float timeout = SWEEP_GRACE + sweep_limit
+                  * ((sweep_end == TEST_END_CYCLES) ? val[SWEEP_PER] : 1.0f);
+  for (float t = 0.0f; pressure->menu.output && t < timeout; t += 1.0f)
+    sim_run (1.0f);
+  sim_run (1.0f);
+
+  const char *q = sim_uart_line (mark, "#ROW ");
+  if (q != NULL
+      && sscanf (q, "#ROW %*u,%*[^,],%*f,%*f,%*f,%lu,%f,%f,%f,%lu,%u",
+                 &row->cycles, &row->rms, &row->over, &row->lag, &row->sw,
+                 &row->verdict)
+             == 6)
+    row->ok = 1;
+}
+
+/**
+ * @brief Runs a rig in a process of its own
+ *
+ * @param rig Index of the rig
+ * @param row Filled with the row the rig sends back
+ *
+ * @retval None
+ */
+static void
+sweep_fork (size_t rig, struct SweepRow *row)
+{
+  int fd[2];
+  pid_t pid;
+
+  memset (row, 0, sizeof (*row));
+  if (pipe (fd) != 0)
+    return;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      struct SweepRow res = { 0 };
+
+      close (fd[0]);
+      sweep_rig (rig, &res);
+      _exit (write (fd[1], &res, sizeof (res)) != sizeof (res));
+    }
+
+  close (fd[1]);
+  if (pid > 0)
+    {
+      if (read (fd[0], row, sizeof (*row)) != sizeof (*row))
+        row->ok = 0;
+      waitpid (pid, NULL, 0);
+    }
+  close (fd[0]);
+}
+
+/**
+ * @brief Takes the next rig of a worker, newest first
+ *
+ * @param deque Deque of the worker
+ * @param rig Filled with the index of the rig
+ *
+ * @retval uint8_t 1 : Taken
+ *                 0 : Empty
+ */
+static uint8_t
+sweep_pop (struct SweepDeque *deque, size_t *rig)
+{
+  uint8_t taken = 0;
+
+  pthread_mutex_lock (&deque->lock);
+  if (deque->tail > deque->head)
+    {
+      *rig = deque->rigs[--deque->tail];
+      taken = 1;
+    }
+  pthread_mutex_unlock (&deque->lock);
+
+  return taken;
+}
+
+/**
+ * @brief Takes the oldest rig of another worker
+ *
+ * @param deque Deque of the other worker
+ * @param rig Filled with the index of the rig
+ *
+ * @retval uint8_t 1 : Taken
+ *                 0 : Empty
+ */
+static uint8_t
+sweep_steal (struct SweepDeque *deque, size_t *rig)
+{
+  uint8_t taken = 0;
+
+  pthread_mutex_lock (&deque->lock);
+  if (deque->tail > deque->head)
+    {
+      *rig = deque->rigs[deque->head++];
+      taken = 1;
+    }
+  pthread_mutex_unlock (&deque->lock);
+
+  return taken;
+}
+
+/**
+ * @brief Runs rigs until every deque is empty
+ *
+ *        No rig adds rigs, so once every deque has been seen empty the
+ *        sweep is over for this worker.
+ *
+ * @param arg struct SweepWorker
+ *
+ * @retval void* NULL
+ */
+static void *
+sweep_work (void *arg)
+{
+  struct SweepWorker *worker = arg;
+  size_t rig;
+
+  for (;;)
+    {
+      uint8_t found = sweep_pop (&sweep_deques[worker->index], &rig);
+
+      for (uint8_t i = 1; !found && i < sweep_workers; i++)
+        {
+          found = sweep_steal (
+              &sweep_deques[(worker->index + i) % sweep_workers], &rig);
+          worker->stolen += found;
+        }
+
+      if (!found)
+        return NULL;
+
+      sweep_fork (rig, &sweep_rows[rig]);
+      worker->ran++;
+    }
+}
+
+/**
+ * @brief Parses an axis, <name>=<start>:<stop>:<count>
+ *
+ * @param arg Argument
+ *
+ * @retval uint8_t 1 : Parsed
+ *                 0 : Not an axis, or out of range
+ */
+static uint8_t
+sweep_parse_axis (const char *arg)
+{
+  struct SweepRange r;
+  unsigned count;
+  int len = 0;
+
+  for (uint8_t a = 0; a < SWEEP_AXES; a++)
+    {
+      size_t n = strlen (sweep_names[a]);
+
+      if (strncmp (arg, sweep_names[a], n) != 0 || arg[n] != '=')
+        continue;
+
+      if (sscanf (arg + n + 1, "%f:%f:%u%n", &r.start, &r.stop, &count, &len)
+              != 3
+          || arg[n + 1 + len] != '\0' || count < 1 || count > UINT16_MAX
+          || r.start < 0 || r.stop < 0)
+        return 0;
+
+      r.count = count;
+      sweep_axes[a] = r;
+      return 1;
+    }
+
+  return 0;
+}
+
+/**
+ * @brief Parses the tanks, a comma separated list of names
+ *
+ * @param arg Argument
+ *
+ * @retval uint8_t 1 : Parsed
+ *                 0 : Unknown tank, or too many
+ */
+static uint8_t
+sweep_parse_tanks (char *arg)
+{
+  sweep_tank_count = 0;
+
+  for (char *name = strtok (arg, ","); name != NULL;
+       name = strtok (NULL, ","))
+    {
+      uint8_t t = 0;
+
+      while (t < SWEEP_TANKS && strcmp (name, sweep_tanks[t].name) != 0)
+        t++;
+      if (t == SWEEP_TANKS || sweep_tank_count == SWEEP_TANKS)
+        return 0;
+
+      sweep_tank_list[sweep_tank_count++] = t;
+    }
+
+  return sweep_tank_count > 0;
+}
+
+/**
+ * @brief Parses a waveform, by name or number
+ *
+ * @param arg Argument
+ *
+ * @retval uint8_t 1 : Parsed
+ *                 0 : Unknown waveform
+ */
+static uint8_t
+sweep_parse_wave (const char *arg)
+{
+  char *end;
+  unsigned long w = strtoul (arg, &end, 10);
+
+  if (*end == '\0' && end != arg && w < WAVEFORM_BATCH)
+    {
+      sweep_wave = w;
+      return 1;
+    }
+
+  for (uint8_t i = 0; i < WAVEFORM_BATCH; i++)
+    if (strcasecmp (arg, waveform_name (i)) == 0)
+      {
+        sweep_wave = i;
+        return 1;
+      }
+
+  return 0;
+}
+
+/**
+ * @brief Returns the smallest or largest value of an axis
+ *
+ * @param axis enum sweep_axis
+ * @param largest Set for the largest
+ *
+ * @retval float Value
+ */
+static float
+sweep_bound (uint8_t axis, uint8_t largest)
+{
+  const struct SweepRange *r = &sweep_axes[axis];
+  float stop = (r->count < 2) ? r->start : r->stop;
+
+  return ((r->start > stop) == (largest != 0)) ? r->start : stop;
+}
+
+int
+main (int argc, char **argv)
+{
+  static struct SweepWorker workers[SWEEP_WORKERS];
+  long cores = sysconf (_SC_NPROCESSORS_ONLN);
+  struct timespec t0, t1;
+  int opt;
+
+  sweep_workers = (cores < 1) ? 1 : (cores > SWEEP_WORKERS) ? SWEEP_WORKERS
+                                                              : cores;
+
+  while ((opt = getopt (argc, argv, "j:t:w:c:d:")) != -1)
+    {
+      uint8_t ok = 1;
+
+      switch (opt)
+        {
+        case 'j':
+          sweep_workers = atoi (optarg);
+          ok = (sweep_workers > 0 && atoi (optarg) <= SWEEP_WORKERS);
+          break;
+        case 't':
+          ok = sweep_parse_tanks (optarg);
+          break;
+        case 'w':
+          ok = sweep_parse_wave (optarg);
+          break;
+        case 'c':
+        case 'd':
+          sweep_end = (opt == 'c') ? TEST_END_CYCLES : TEST_END_DURATION;
+          sweep_limit = atof (optarg);
+          ok = (sweep_limit > 0);
+          break;
+        default:
+          ok = 0;
+        }
+
+      if (!ok)
+        {
+          fprintf (stderr, "bench_sweep: bad option -%c\n", opt);
+          return EXIT_FAILURE;
+        }
+    }
+
+  for (int i = optind; i < argc; i++)
+    if (!sweep_parse_axis (argv[i]))
+      {
+        fprintf (stderr, "bench_sweep: bad axis %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+
+  float sw = sweep_bound (SWEEP_SW, 1);
+  if (sweep_bound (SWEEP_PER, 0) < ((sw > 0) ? sw : PRESSURE_SWITCH_TIME))
+    {
+      fprintf (stderr, "bench_sweep: per shorter than the switching time\n");
+      return EXIT_FAILURE;
+    }
+
+  size_t rigs = sweep_tank_count;
+  for (uint8_t a = 0; a < SWEEP_AXES; a++)
+    rigs *= sweep_axes[a].count;
+
+  sweep_rows = calloc (rigs, sizeof (*sweep_rows));
+  size_t *order = malloc (rigs * sizeof (*order));
+  if (sweep_rows == NULL || order == NULL)
+    {
+      fprintf (stderr, "bench_sweep: %zu rigs don't fit\n", rigs);
+      return EXIT_FAILURE;
+    }
+
+  /* Dealt out in blocks, so a worker handed the long periods or the slow
+   * tank is left with rigs to run after the others are done with theirs,
+   * unless they take them */
+  for (size_t i = 0; i < rigs; i++)
+    order[i] = i;
+  for (uint8_t w = 0; w < sweep_workers; w++)
+    {
+      struct SweepDeque *deque = &sweep_deques[w];
+
+      pthread_mutex_init (&deque->lock, NULL);
+      deque->rigs = order;
+      deque->head = (rigs * w) / sweep_workers;
+      deque->tail = (rigs * (w + 1)) / sweep_workers;
+    }
+
+  /* Nothing buffered is to be copied into the rigs */
+  fflush (NULL);
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (uint8_t w = 0; w < sweep_workers; w++)
+    {
+      workers[w].index = w;
+      pthread_create (&workers[w].thread, NULL, sweep_work, &workers[w]);
+    }
+  for (uint8_t w = 0; w < sweep_workers; w++)
+    pthread_join (workers[w].thread, NULL);
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+
+  size_t reported = 0;
+  size_t stolen = 0;
+  for (size_t i = 0; i < rigs; i++)
+    reported += sweep_rows[i].ok;
+  for (uint8_t w = 0; w < sweep_workers; w++)
+    stolen += workers[w].stolen;
+
+  printf ("#TABLE n=%zu cols=idx,tank,wave,per,ampl,offs,perr,switch,cycles,"
+          "rms,over,lag,sw,verdict\n",
+          reported);
+  for (size_t i = 0; i < rigs; i++)
+    {
+      const struct SweepRow *row = &sweep_rows[i];
+      float val[SWEEP_AXES];
+      const struct SweepTank *tank = sweep_point (i, val);
+
+      if (!row->ok)
+        {
+          fprintf (stderr, "bench_sweep: rig %zu didn't report\n", i + 1);
+          continue;
+        }
+
+      printf ("#ROW %zu,%s,%s,%.2f,%.2f,%.2f,%.3f,%.2f,%lu,%.3f,%.3f,%.1f,"
+              "%lu,%u\n",
+              i + 1, tank->name, waveform_name (sweep_wave), val[SWEEP_PER],
+              val[SWEEP_AMPL], val[SWEEP_OFFS], val[SWEEP_PERR],
+              val[SWEEP_SW], row->cycles, row->rms, row->over, row->lag,
+              row->sw, row->verdict);
+    }
+  printf ("#END\n");
+
+  double sec = (t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9);
+  fprintf (stderr, "bench_sweep: %zu rigs on %u workers in %.2f sec, %zu "
+                   "stolen\n",
+           rigs, sweep_workers, sec, stolen);
+
+  free (order);
+  free (sweep_rows);
+  return (reported == rigs) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
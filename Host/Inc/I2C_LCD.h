@@ -0,0 +1,26 @@
+/**
+ * @file I2C_LCD.h
+ *
+ * @brief Simulated I2C_LCD driver header
+ *
+ *        The firmware only initializes the panel and its custom characters
+ *        through this driver, see i2c_lcd.c.
+ */
+
+#ifndef I2C_LCD_H_
+#define I2C_LCD_H_
+
+#include <stdint.h>
+
+#define I2C_LCD_1 0
+
+void I2C_LCD_Init (uint8_t lcd);
+void I2C_LCD_Clear (uint8_t lcd);
+void I2C_LCD_SetCursor (uint8_t lcd, uint8_t col, uint8_t row);
+void I2C_LCD_WriteString (uint8_t lcd, char *str);
+void I2C_LCD_WriteChar (uint8_t lcd, char ch);
+void I2C_LCD_CreateCustomChar (uint8_t lcd, uint8_t loc,
+                               unsigned char *pattern);
+void I2C_LCD_PrintCustomChar (uint8_t lcd, uint8_t loc);
+
+#endif // I2C_LCD_H_
@@ -0,0 +1,17 @@
+/**
+ * @file main.h
+ *
+ * @brief Simulated board header
+ *
+ *        Stands in for the CubeMX generated main.h, declaring the handles
+ *        the firmware reaches by name.
+ */
+
+#ifndef MAIN_H_
+#define MAIN_H_
+
+#include "stm32f4xx_hal.h"
+
+extern I2C_HandleTypeDef hi2c2;
+
+#endif // MAIN_H_
@@ -0,0 +1,50 @@
+/**
+ * @file sim.h
+ *
+ * @brief Simulated board header
+ *
+ *        Contains the timing of the simulated peripherals and function
+ *        prototypes for running the firmware on simulated time, driving its
+ *        inputs and watching its outputs.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "lcd.h"
+#include "stm32f4xx_hal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SIM_TIMER_CLOCK 84000000U /*!< TIM input clock, 2 * PCLK1 */
+#define SIM_POLL_US 500           /*!< Main loop iteration in sim_run */
+#define SIM_UART_US 87            /*!< One byte at 115200 baud */
+#define SIM_I2C_US 23             /*!< One byte at 400kHz */
+#define SIM_ADC_US 20             /*!< One scan */
+#define SIM_PRESS_US 150000       /*!< Encoder button held down */
+#define SIM_ERASE_US 1000000      /*!< Flash sector erase, CPU stalled */
+#define SIM_PROGRAM_US 16         /*!< Flash word program, CPU stalled */
+
+#define SIM_FLASH_BASE 0x08000000UL /*!< Flash mapped at its real address */
+#define SIM_FLASH_SIZE 0x80000UL    /*!< 512K, sectors 0 to 7 */
+
+void sim_init (void);
+void sim_boot (void);
+uint64_t sim_now (void);
+void sim_advance (uint64_t us);
+void sim_run (float sec);
+void sim_uart_rx (const char *str);
+size_t sim_uart_mark (void);
+const char *sim_uart_since (size_t mark);
+const char *sim_uart_line (size_t mark, const char *prefix);
+void sim_uart_echo (FILE *file);
+void sim_rotary_turn (int8_t dir);
+void sim_rotary_press (void);
+uint8_t sim_pins (void);
+void sim_adc_feed (void (*source) (uint16_t *codes, uint32_t len));
+void sim_pins_watch (void (*watcher) (uint8_t pins));
+void sim_lcd_watch (void (*watcher) (void));
+void sim_lcd_frame (uint8_t frame[LCD_ROWS][LCD_COLS]);
+
+#endif // SIM_H_
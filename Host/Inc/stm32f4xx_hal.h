@@ -0,0 +1,409 @@
+/**
+ * @file stm32f4xx_hal.h
+ *
+ * @brief Simulated STM32F4 HAL header
+ *
+ *        Declares the subset of the HAL and CMSIS the firmware uses, with
+ *        the same names and register layouts. Peripherals are structs in RAM
+ *        driven by sim.c. TIM2 and TIM5 are reached through functions, so
+ *        the simulation sees every access to the registers the firmware
+ *        polls or rewrites without a HAL call.
+ */
+
+#ifndef STM32F4XX_HAL_H_
+#define STM32F4XX_HAL_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+  HAL_OK,
+  HAL_ERROR,
+  HAL_BUSY,
+  HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+  RESET = 0,
+  SET = 1
+} FlagStatus;
+
+typedef enum
+{
+  DISABLE = 0,
+  ENABLE = 1
+} FunctionalState;
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+/* GPIO */
+typedef struct
+{
+  volatile uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR,
+      AFR[2];
+} GPIO_TypeDef;
+
+typedef struct
+{
+  uint32_t Pin, Mode, Pull, Speed, Alternate;
+} GPIO_InitTypeDef;
+
+extern GPIO_TypeDef sim_gpio[3];
+#define GPIOA (&sim_gpio[0])
+#define GPIOB (&sim_gpio[1])
+#define GPIOC (&sim_gpio[2])
+
+#define GPIO_PIN_0 0x0001
+#define GPIO_PIN_1 0x0002
+#define GPIO_PIN_2 0x0004
+#define GPIO_PIN_3 0x0008
+#define GPIO_PIN_4 0x0010
+#define GPIO_PIN_5 0x0020
+#define GPIO_PIN_8 0x0100
+#define GPIO_PIN_9 0x0200
+#define GPIO_PIN_10 0x0400
+
+#define GPIO_MODE_INPUT 0
+#define GPIO_MODE_OUTPUT_PP 1
+#define GPIO_MODE_AF_PP 2
+#define GPIO_MODE_ANALOG 3
+#define GPIO_NOPULL 0
+#define GPIO_SPEED_FREQ_LOW 0
+#define GPIO_SPEED_FREQ_HIGH 2
+#define GPIO_AF1_TIM2 1
+
+/* Timers */
+typedef struct
+{
+  volatile uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT,
+      PSC, ARR, RCR, CCR1, CCR2, CCR3, CCR4;
+} TIM_TypeDef;
+
+extern TIM_TypeDef sim_tim[5];
+TIM_TypeDef *sim_tim2 (void);
+TIM_TypeDef *sim_tim5 (void);
+#define TIM1 (&sim_tim[0])
+#define TIM2 (sim_tim2 ())
+#define TIM3 (&sim_tim[2])
+#define TIM4 (&sim_tim[3])
+#define TIM5 (sim_tim5 ())
+
+typedef struct
+{
+  uint32_t Prescaler, CounterMode, Period, ClockDivision, AutoReloadPreload;
+} TIM_Base_InitTypeDef;
+
+typedef struct
+{
+  TIM_TypeDef *Instance;
+  TIM_Base_InitTypeDef Init;
+  uint32_t Channel;
+} TIM_HandleTypeDef;
+
+typedef struct
+{
+  uint32_t OCMode, Pulse, OCPolarity, OCFastMode;
+} TIM_OC_InitTypeDef;
+
+#define TIM_CHANNEL_1 0x0
+#define TIM_CHANNEL_2 0x4
+#define TIM_CHANNEL_3 0x8
+#define TIM_CHANNEL_4 0xC
+#define TIM_CHANNEL_ALL 0x3C
+#define HAL_TIM_ACTIVE_CHANNEL_1 0x01
+#define HAL_TIM_ACTIVE_CHANNEL_2 0x02
+#define HAL_TIM_ACTIVE_CHANNEL_3 0x04
+#define HAL_TIM_ACTIVE_CHANNEL_4 0x08
+#define TIM_COUNTERMODE_UP 0
+#define TIM_CLOCKDIVISION_DIV1 0
+#define TIM_AUTORELOAD_PRELOAD_DISABLE 0
+#define TIM_OCMODE_TIMING 0x00
+#define TIM_OCMODE_ACTIVE 0x10
+#define TIM_OCMODE_INACTIVE 0x20
+#define TIM_OCMODE_FORCED_INACTIVE 0x40
+#define TIM_OCMODE_FORCED_ACTIVE 0x50
+#define TIM_OCPOLARITY_HIGH 0
+#define TIM_OCFAST_DISABLE 0
+#define TIM_IT_UPDATE 0x01
+#define TIM_IT_CC1 0x02
+#define TIM_IT_CC2 0x04
+#define TIM_IT_CC3 0x08
+#define TIM_IT_CC4 0x10
+#define TIM_FLAG_UPDATE 0x01
+#define TIM_SR_UIF 0x01u
+#define TIM_CCMR1_OC1M (7u << 4)
+#define TIM_CCMR1_OC2M (7u << 12)
+#define TIM_CCMR1_OC1M_Pos 4
+#define TIM_CCMR1_OC2M_Pos 12
+
+#define __HAL_TIM_GET_COUNTER(h) ((h)->Instance->CNT)
+#define __HAL_TIM_SET_COUNTER(h, v) ((h)->Instance->CNT = (v))
+#define __HAL_TIM_SET_COMPARE(h, c, v)                                        \
+  (*(&(h)->Instance->CCR1 + ((c) >> 2)) = (v))
+#define __HAL_TIM_GET_COMPARE(h, c) (*(&(h)->Instance->CCR1 + ((c) >> 2)))
+#define __HAL_TIM_SET_AUTORELOAD(h, v) ((h)->Instance->ARR = (v))
+#define __HAL_TIM_GET_FLAG(h, f) (((h)->Instance->SR & (f)) == (f))
+#define __HAL_TIM_CLEAR_FLAG(h, f) ((h)->Instance->SR = ~(f))
+#define __HAL_TIM_ENABLE_IT(h, f) ((h)->Instance->DIER |= (f))
+#define __HAL_TIM_DISABLE_IT(h, f) ((h)->Instance->DIER &= ~(f))
+
+#define __HAL_RCC_TIM2_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_TIM4_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_TIM5_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_GPIOA_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE() ((void)0)
+#define __HAL_RCC_GPIOC_CLK_ENABLE() ((void)0)
+
+HAL_StatusTypeDef HAL_TIM_Base_Init (TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_DeInit (TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start (TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Start_IT (TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop_IT (TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Encoder_Start_IT (TIM_HandleTypeDef *htim,
+                                            uint32_t channel);
+HAL_StatusTypeDef HAL_TIM_OC_Init (TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_OC_ConfigChannel (TIM_HandleTypeDef *htim,
+                                            TIM_OC_InitTypeDef *conf,
+                                            uint32_t channel);
+HAL_StatusTypeDef HAL_TIM_OC_Start (TIM_HandleTypeDef *htim,
+                                    uint32_t channel);
+HAL_StatusTypeDef HAL_TIM_OC_Start_IT (TIM_HandleTypeDef *htim,
+                                       uint32_t channel);
+void HAL_TIM_IRQHandler (TIM_HandleTypeDef *htim);
+void HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef *htim);
+void HAL_TIM_OC_DelayElapsedCallback (TIM_HandleTypeDef *htim);
+void HAL_TIM_IC_CaptureCallback (TIM_HandleTypeDef *htim);
+
+/* ADC */
+typedef struct
+{
+  volatile uint32_t SR, CR1, CR2, SMPR1, SMPR2, JOFR1, HTR, LTR, DR;
+} ADC_TypeDef;
+
+extern ADC_TypeDef sim_adc;
+#define ADC1 (&sim_adc)
+
+typedef struct
+{
+  uint32_t ClockPrescaler, Resolution, DataAlign;
+  FunctionalState ScanConvMode;
+  uint32_t EOCSelection;
+  FunctionalState ContinuousConvMode;
+  uint32_t NbrOfConversion;
+  FunctionalState DiscontinuousConvMode;
+  uint32_t ExternalTrigConv, ExternalTrigConvEdge;
+  FunctionalState DMAContinuousRequests;
+} ADC_InitTypeDef;
+
+typedef struct
+{
+  ADC_TypeDef *Instance;
+  ADC_InitTypeDef Init;
+} ADC_HandleTypeDef;
+
+typedef struct
+{
+  uint32_t Channel, Rank, SamplingTime, Offset;
+} ADC_ChannelConfTypeDef;
+
+typedef struct
+{
+  uint32_t WatchdogMode, HighThreshold, LowThreshold, Channel;
+  FunctionalState ITMode;
+  uint32_t WatchdogNumber;
+} ADC_AnalogWDGConfTypeDef;
+
+#define ADC_CHANNEL_0 0
+#define ADC_CHANNEL_1 1
+#define ADC_CHANNEL_4 4
+#define ADC_CHANNEL_8 8
+#define ADC_CHANNEL_9 9
+#define ADC_SAMPLETIME_84CYCLES 4
+#define ADC_SAMPLETIME_480CYCLES 7
+#define ADC_EOC_SEQ_CONV 0
+#define ADC_SOFTWARE_START 0
+#define ADC_EXTERNALTRIGCONVEDGE_NONE 0
+#define ADC_ANALOGWATCHDOG_SINGLE_REG 1
+#define ADC_CR1_AWDEN (1u << 23)
+
+HAL_StatusTypeDef HAL_ADC_Init (ADC_HandleTypeDef *hadc);
+HAL_StatusTypeDef HAL_ADC_ConfigChannel (ADC_HandleTypeDef *hadc,
+                                         ADC_ChannelConfTypeDef *conf);
+HAL_StatusTypeDef HAL_ADC_AnalogWDGConfig (ADC_HandleTypeDef *hadc,
+                                           ADC_AnalogWDGConfTypeDef *conf);
+HAL_StatusTypeDef HAL_ADC_Start_DMA (ADC_HandleTypeDef *hadc, uint32_t *buf,
+                                     uint32_t len);
+HAL_StatusTypeDef HAL_ADC_Stop_DMA (ADC_HandleTypeDef *hadc);
+void HAL_ADC_IRQHandler (ADC_HandleTypeDef *hadc);
+void HAL_ADC_ConvCpltCallback (ADC_HandleTypeDef *hadc);
+void HAL_ADC_LevelOutOfWindowCallback (ADC_HandleTypeDef *hadc);
+
+/* UART */
+typedef struct
+{
+  uint32_t dummy;
+} USART_TypeDef;
+
+typedef struct
+{
+  USART_TypeDef *Instance;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Transmit (UART_HandleTypeDef *huart,
+                                     const uint8_t *data, uint16_t len,
+                                     uint32_t timeout);
+HAL_StatusTypeDef HAL_UART_Receive_IT (UART_HandleTypeDef *huart,
+                                       uint8_t *data, uint16_t len);
+void HAL_UART_RxCpltCallback (UART_HandleTypeDef *huart);
+void HAL_UART_ErrorCallback (UART_HandleTypeDef *huart);
+
+/* I2C */
+typedef struct
+{
+  uint32_t dummy;
+} I2C_TypeDef;
+
+typedef struct
+{
+  I2C_TypeDef *Instance;
+} I2C_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_DMA (I2C_HandleTypeDef *hi2c,
+                                               uint16_t addr, uint8_t *data,
+                                               uint16_t len);
+void HAL_I2C_MasterTxCpltCallback (I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback (I2C_HandleTypeDef *hi2c);
+
+/* GPIO */
+void HAL_GPIO_Init (GPIO_TypeDef *port, GPIO_InitTypeDef *init);
+void HAL_GPIO_WritePin (GPIO_TypeDef *port, uint16_t pin,
+                        GPIO_PinState state);
+GPIO_PinState HAL_GPIO_ReadPin (GPIO_TypeDef *port, uint16_t pin);
+void HAL_GPIO_EXTI_Callback (uint16_t pin);
+
+/* NVIC, clocks */
+typedef enum
+{
+  ADC_IRQn = 18,
+  EXTI9_5_IRQn = 23,
+  TIM2_IRQn = 28,
+  TIM4_IRQn = 30,
+  TIM5_IRQn = 50
+} IRQn_Type;
+
+void HAL_NVIC_EnableIRQ (IRQn_Type irq);
+void HAL_NVIC_DisableIRQ (IRQn_Type irq);
+void HAL_NVIC_SetPriority (IRQn_Type irq, uint32_t pre, uint32_t sub);
+void HAL_Delay (uint32_t ms);
+uint32_t HAL_GetTick (void);
+uint32_t HAL_RCC_GetPCLK1Freq (void);
+uint32_t HAL_RCC_GetHCLKFreq (void);
+
+extern uint32_t SystemCoreClock;
+
+/* Interrupt handlers defined by the firmware */
+void TIM2_IRQHandler (void);
+void TIM4_IRQHandler (void);
+void TIM5_IRQHandler (void);
+void ADC_IRQHandler (void);
+
+/* Cycle counter */
+typedef struct
+{
+  volatile uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+#define DWT (&sim_dwt)
+#define CoreDebug (&sim_core_debug)
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+#define DWT_CTRL_CYCCNTENA_Msk 1u
+
+/* Flash */
+typedef struct
+{
+  uint32_t TypeErase, Banks, Sector, NbSectors, VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+#define FLASH_TYPEERASE_SECTORS 0
+#define FLASH_SECTOR_5 5
+#define FLASH_SECTOR_6 6
+#define FLASH_SECTOR_7 7
+#define FLASH_VOLTAGE_RANGE_3 2
+#define FLASH_TYPEPROGRAM_WORD 2
+
+HAL_StatusTypeDef HAL_FLASH_Unlock (void);
+HAL_StatusTypeDef HAL_FLASH_Lock (void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase (FLASH_EraseInitTypeDef *erase,
+                                     uint32_t *error);
+HAL_StatusTypeDef HAL_FLASH_Program (uint32_t type, uint32_t addr,
+                                     uint64_t data);
+
+/* Core intrinsics. Interrupts are only dispatched by sim.c while PRIMASK is
+ * clear, on a single thread. The exclusive accesses and barriers also hold
+ * between threads, so the shared state primitives can be tested on several:
+ * a store-exclusive fails if the word changed since the load-exclusive of
+ * the same thread */
+extern volatile uint32_t sim_primask;
+extern _Thread_local uint32_t sim_exclusive;
+
+static inline void
+__disable_irq (void)
+{
+  sim_primask = 1;
+}
+
+static inline void
+__enable_irq (void)
+{
+  sim_primask = 0;
+}
+
+static inline uint32_t
+__get_PRIMASK (void)
+{
+  return sim_primask;
+}
+
+static inline void
+__set_PRIMASK (uint32_t primask)
+{
+  sim_primask = primask;
+}
+
+static inline void
+__DMB (void)
+{
+  atomic_thread_fence (memory_order_seq_cst);
+}
+
+static inline uint32_t
+__LDREXW (volatile uint32_t *addr)
+{
+  sim_exclusive = atomic_load ((_Atomic uint32_t *)addr);
+  return sim_exclusive;
+}
+
+static inline uint32_t
+__STREXW (uint32_t val, volatile uint32_t *addr)
+{
+  uint32_t expected = sim_exclusive;
+
+  return !atomic_compare_exchange_strong ((_Atomic uint32_t *)addr,
+                                          &expected, val);
+}
+
+#endif // STM32F4XX_HAL_H_
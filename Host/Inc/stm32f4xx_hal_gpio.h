@@ -0,0 +1,12 @@
+/**
+ * @file stm32f4xx_hal_gpio.h
+ *
+ * @brief Simulated STM32F4 HAL GPIO header, declared by stm32f4xx_hal.h
+ */
+
+#ifndef STM32F4XX_HAL_GPIO_H_
+#define STM32F4XX_HAL_GPIO_H_
+
+#include "stm32f4xx_hal.h"
+
+#endif // STM32F4XX_HAL_GPIO_H_
@@ -0,0 +1,37 @@
+/**
+ * @file tank.h
+ *
+ * @brief Simulated pneumatics header
+ *
+ *        Contains the tank model parameters and function prototypes for the
+ *        pressure seen by the simulated sensors.
+ */
+
+#ifndef TANK_H_
+#define TANK_H_
+
+#include "pressure.h"
+#include <stdint.h>
+
+#define TANK_DUTS 3 /*!< DUT sensors, plumbed into the first tank */
+
+/* Struct containing the model of one tank, pressures in gauge psi */
+struct TankModel
+{
+  float supply;                /*!< Compressor outlet pressure */
+  float fill;                  /*!< Compressor conductance in 1/sec */
+  float vent;                  /*!< Exhaust conductance in 1/sec */
+  float leak;                  /*!< Leak conductance in 1/sec */
+  float noise;                 /*!< Sensor noise, standard deviation */
+  float dut_gain[TANK_DUTS];   /*!< Gain error of each DUT */
+  float dut_offset[TANK_DUTS]; /*!< Offset of each DUT in psi */
+};
+
+void tank_init (void);
+struct TankModel *tank_get_model (uint8_t station);
+float tank_get (uint8_t station);
+void tank_set (uint8_t station, float p);
+void tank_step (float dt, uint8_t pins);
+uint16_t tank_code (uint32_t channel);
+
+#endif // TANK_H_
@@ -0,0 +1,370 @@
+/**
+ * @file replay.c
+ *
+ * @brief Deterministic replay of a recording through the firmware
+ *
+ *        Boots the unmodified firmware on the simulated board and feeds it
+ *        recorded ADC scans in place of the tank model, one per scan of the
+ *        sample clock, along with the encoder turns, button presses and UART
+ *        lines of an event script at the times they happened. Every change
+ *        of the actuator pins and every frame the panel shows is logged with
+ *        the simulated time:
+ *
+ *          #ACT t=<us> pins=<levels>
+ *          #LCD t=<us> <row 0>|<row 1>|<row 2>|<row 3>
+ *
+ *        pins has one bit per TIM2 channel, as sim_pins returns them, and
+ *        custom characters are logged as '~'. The simulation is
+ *        deterministic, so two builds replaying the same recording and
+ *        script log the same lines unless they behave differently, and diff
+ *        shows where. Time moves as fast as the host runs the firmware, many
+ *        times real time.
+ *
+ *          replay [-e <events>] [-u] <recording>
+ *
+ *        The recording is the CSV burst_decode.py writes, n and t followed by
+ *        the raw codes of the scan, reference first. Channels it doesn't
+ *        cover keep the tank model's codes. The replay ends with the
+ *        recording. The event script has one event per line, at a time in
+ *        sec from power up, in order:
+ *
+ *          <t> TURN <1|-1>      Turns the encoder by one detent
+ *          <t> PRESS            Presses the encoder button
+ *          <t> UART <line>      Sends a line to the board's UART
+ *
+ *        Lines starting with '#' are comments. With -u, everything the board
+ *        transmits is copied to stderr.
+ */
+
+#include "acquisition.h"
+#include "pressure.h"
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_LINE_SIZE 256
+
+/* Events of the script */
+enum replay_kind
+{
+  REPLAY_TURN,
+  REPLAY_PRESS,
+  REPLAY_UART
+};
+
+/* Struct containing one event of the script */
+struct ReplayEvent
+{
+  uint64_t t;    /*!< Time in us */
+  uint8_t kind;  /*!< enum replay_kind */
+  int8_t dir;    /*!< TURN: direction */
+  char *line;    /*!< UART: line, without line ending */
+};
+
+static uint16_t (*replay_scans)[ACQUISITION_CHANNELS]; /*!< Recording */
+static size_t replay_count = 0; /*!< Scans in the recording */
+static size_t replay_next = 0;  /*!< Next scan to feed */
+static uint8_t replay_channels = ACQUISITION_CHANNELS; /*!< Recorded */
+
+static struct ReplayEvent *replay_events;
+static size_t replay_event_count = 0;
+
+static uint8_t replay_frame[LCD_ROWS][LCD_COLS]; /*!< Last frame logged */
+
+/**
+ * @brief Reads a recording
+ *
+ * @param path CSV written by burst_decode.py
+ *
+ * @retval uint8_t 1 : Read
+ *                 0 : Unreadable, or a line with no codes
+ */
+static uint8_t
+replay_load (const char *path)
+{
+  FILE *file = fopen (path, "r");
+  char line[REPLAY_LINE_SIZE];
+  size_t cap = 0;
+
+  if (file == NULL)
+    {
+      perror (path);
+      return 0;
+    }
+
+  while (fgets (line, sizeof (line), file) != NULL)
+    {
+      uint16_t codes[ACQUISITION_CHANNELS];
+      uint8_t n = 0;
+      char *field = strtok (line, ",");
+
+      /* Skips n and t, and any header */
+      if (field == NULL || *field < '0' || *field > '9'
+          || strtok (NULL, ",") == NULL)
+        continue;
+
+      while (n < ACQUISITION_CHANNELS && (field = strtok (NULL, ",")) != NULL)
+        codes[n++] = strtoul (field, NULL, 10);
+
+      if (n == 0)
+        {
+          fprintf (stderr, "replay: scan %zu has no codes\n", replay_count);
+          fclose (file);
+          return 0;
+        }
+      if (n < replay_channels)
+        replay_channels = n;
+
+      if (replay_count == cap)
+        {
+          cap = (cap > 0) ? cap * 2 : 65536;
+          replay_scans = realloc (replay_scans, cap * sizeof (*replay_scans));
+          if (replay_scans == NULL)
+            {
+              fprintf (stderr, "replay: %s doesn't fit\n", path);
+              exit (EXIT_FAILURE);
+            }
+        }
+      memcpy (replay_scans[replay_count++], codes, sizeof (codes));
+    }
+
+  fclose (file);
+  return 1;
+}
+
+/**
+ * @brief Reads an event script
+ *
+ * @param path Script
+ *
+ * @retval uint8_t 1 : Read
+ *                 0 : Unreadable, or a bad event
+ */
+static uint8_t
+replay_load_events (const char *path)
+{
+  FILE *file = fopen (path, "r");
+  char line[REPLAY_LINE_SIZE];
+  uint64_t last = 0;
+  size_t cap = 0;
+  unsigned n = 0;
+
+  if (file == NULL)
+    {
+      perror (path);
+      return 0;
+    }
+
+  while (fgets (line, sizeof (line), file) != NULL)
+    {
+      struct ReplayEvent ev = { 0 };
+      char kind[8];
+      double t;
+      int pos = 0;
+
+      n++;
+      line[strcspn (line, "\r\n")] = '\0';
+      if (line[0] == '#' || line[strspn (line, " \t")] == '\0')
+        continue;
+
+      if (sscanf (line, "%lf %7s %n", &t, kind, &pos) < 2 || t < 0)
+        goto bad;
+
+      ev.t = (uint64_t)(t * 1000000.0);
+      if (ev.t < last)
+        goto bad;
+      last = ev.t;
+
+      const char *arg = line + pos;
+      if (strcmp (kind, "TURN") == 0)
+        {
+          ev.kind = REPLAY_TURN;
+          ev.dir = atoi (arg);
+          if (ev.dir != 1 && ev.dir != -1)
+            goto bad;
+        }
+      else if (strcmp (kind, "PRESS") == 0 && *arg == '\0')
+        ev.kind = REPLAY_PRESS;
+      else if (strcmp (kind, "UART") == 0 && *arg != '\0')
+        {
+          ev.kind = REPLAY_UART;
+          ev.line = strdup (arg);
+        }
+      else
+        goto bad;
+
+      if (replay_event_count == cap)
+        {
+          cap = (cap > 0) ? cap * 2 : 64;
+          replay_events
+              = realloc (replay_events, cap * sizeof (*replay_events));
+          if (replay_events == NULL)
+            goto bad;
+        }
+      replay_events[replay_event_count++] = ev;
+    }
+
+  fclose (file);
+  return 1;
+
+bad:
+  fprintf (stderr, "replay: %s:%u: bad event\n", path, n);
+  fclose (file);
+  return 0;
+}
+
+/**
+ * @brief Overwrites a scan with the next one of the recording
+ *
+ *        Called by the simulation as every scan completes.
+ *
+ * @param codes Codes of the tank model, one per rank, reference first
+ * @param len Number of ranks
+ *
+ * @retval None
+ */
+static void
+replay_scan (uint16_t *codes, uint32_t len)
+{
+  if (replay_next >= replay_count)
+    return;
+
+  const uint16_t *rec = replay_scans[replay_next++];
+  for (uint32_t i = 0; i < len && i < replay_channels; i++)
+    codes[i] = rec[i];
+}
+
+/**
+ * @brief Logs the actuator pins
+ *
+ * @param pins Levels, one bit per TIM2 channel
+ *
+ * @retval None
+ */
+static void
+replay_pins (uint8_t pins)
+{
+  printf ("#ACT t=%llu pins=%u\n", (unsigned long long)sim_now (), pins);
+}
+
+/**
+ * @brief Logs the panel if it shows something new
+ *
+ * @retval None
+ */
+static void
+replay_lcd (void)
+{
+  uint8_t frame[LCD_ROWS][LCD_COLS];
+
+  sim_lcd_frame (frame);
+  if (memcmp (frame, replay_frame, sizeof (frame)) == 0)
+    return;
+  memcpy (replay_frame, frame, sizeof (frame));
+
+  printf ("#LCD t=%llu ", (unsigned long long)sim_now ());
+  for (uint8_t y = 0; y < LCD_ROWS; y++)
+    {
+      for (uint8_t x = 0; x < LCD_COLS; x++)
+        putchar ((frame[y][x] < ' ' || frame[y][x] > '~') ? '~'
+                                                           : frame[y][x]);
+      putchar ((y < LCD_ROWS - 1) ? '|' : '\n');
+    }
+}
+
+/**
+ * @brief Applies an event of the script
+ *
+ * @param ev Event
+ *
+ * @retval None
+ */
+static void
+replay_apply (const struct ReplayEvent *ev)
+{
+  switch (ev->kind)
+    {
+    case REPLAY_TURN:
+      sim_rotary_turn (ev->dir);
+      break;
+
+    case REPLAY_PRESS:
+      sim_rotary_press ();
+      break;
+
+    case REPLAY_UART:
+      sim_uart_rx (ev->line);
+      sim_uart_rx ("\r\n");
+      break;
+
+    default:
+      break;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *events = NULL;
+  uint8_t echo = 0;
+  struct timespec t0, t1;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "e:u")) != -1)
+    {
+      if (opt == 'e')
+        events = optarg;
+      else if (opt == 'u')
+        echo = 1;
+      else
+        optind = argc + 1;
+    }
+
+  if (optind != argc - 1)
+    {
+      fprintf (stderr, "usage: replay [-e <events>] [-u] <recording>\n");
+      return EXIT_FAILURE;
+    }
+
+  if (!replay_load (argv[optind])
+      || (events != NULL && !replay_load_events (events)))
+    return EXIT_FAILURE;
+
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+
+  /* The frame before the first one drawn is blank */
+  memset (replay_frame, ' ', sizeof (replay_frame));
+  if (echo)
+    sim_uart_echo (stderr);
+  sim_adc_feed (replay_scan);
+  sim_pins_watch (replay_pins);
+  sim_lcd_watch (replay_lcd);
+  sim_boot ();
+
+  size_t ev = 0;
+  while (replay_next < replay_count)
+    {
+      while (ev < replay_event_count && replay_events[ev].t <= sim_now ())
+        replay_apply (&replay_events[ev++]);
+
+      pressure_poll ();
+      sim_advance (SIM_POLL_US);
+    }
+
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+  fflush (stdout);
+
+  double sec = (t1.tv_sec - t0.tv_sec) + ((t1.tv_nsec - t0.tv_nsec) / 1e9);
+  double simulated = sim_now () / 1e6;
+  fprintf (stderr,
+           "replay: %zu scans, %.1f sec in %.2f sec, %.0f times real time\n",
+           replay_count, simulated, sec, simulated / sec);
+  if (ev < replay_event_count)
+    fprintf (stderr, "replay: %zu events after the end of the recording\n",
+             replay_event_count - ev);
+
+  return EXIT_SUCCESS;
+}
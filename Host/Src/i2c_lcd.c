@@ -0,0 +1,60 @@
+/**
+ * @file i2c_lcd.c
+ *
+ * @brief Simulated I2C_LCD driver program body
+ *
+ *        The panel is initialized and its custom characters are loaded
+ *        through blocking transfers the simulation doesn't need, everything
+ *        the firmware draws goes through lcd.c.
+ */
+
+#include "I2C_LCD.h"
+
+void
+I2C_LCD_Init (uint8_t lcd)
+{
+  (void)lcd;
+}
+
+void
+I2C_LCD_Clear (uint8_t lcd)
+{
+  (void)lcd;
+}
+
+void
+I2C_LCD_SetCursor (uint8_t lcd, uint8_t col, uint8_t row)
+{
+  (void)lcd;
+  (void)col;
+  (void)row;
+}
+
+void
+I2C_LCD_WriteString (uint8_t lcd, char *str)
+{
+  (void)lcd;
+  (void)str;
+}
+
+void
+I2C_LCD_WriteChar (uint8_t lcd, char ch)
+{
+  (void)lcd;
+  (void)ch;
+}
+
+void
+I2C_LCD_CreateCustomChar (uint8_t lcd, uint8_t loc, unsigned char *pattern)
+{
+  (void)lcd;
+  (void)loc;
+  (void)pattern;
+}
+
+void
+I2C_LCD_PrintCustomChar (uint8_t lcd, uint8_t loc)
+{
+  (void)lcd;
+  (void)loc;
+}
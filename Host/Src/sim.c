@@ -0,0 +1,1390 @@
+/**
+ * @file sim.c
+ *
+ * @brief Simulated board program body
+ *
+ *        Runs the unmodified firmware on the host. Time only moves when
+ *        sim_advance is called, either by a test between iterations of the
+ *        main loop, or by the firmware itself reading TIM5, so busy waits on
+ *        the timebase end. Time jumps from one peripheral event to the next:
+ *
+ *          TIM2    Compare matches switch the output levels, the pins drive
+ *                  the tank model
+ *          TIM4    Sample clock, the ADC scan it starts completes SIM_ADC_US
+ *                  later with codes from the tank model, or from whatever
+ *                  sim_adc_feed set, after the analog watchdog has been
+ *                  checked
+ *          TIM5    Wraps after 2^32 us
+ *          Others  Update interrupts of timers started by HAL_TIM_Base_Start_IT
+ *          UART    One received byte every SIM_UART_US
+ *          I2C     A DMA transfer completes SIM_I2C_US per byte later, and
+ *                  its bytes reach the HD44780 behind the PCF8574 backpack
+ *
+ *        Events only set their flags and mark their interrupt pending. The
+ *        handlers run one at a time, in priority order, while PRIMASK is
+ *        clear and no handler is already running. Flash erases and writes
+ *        stall the CPU: time passes and the timers keep switching pins, but
+ *        no handler runs until the flash is done.
+ *
+ *        Flash is mapped at its real address, so the records the firmware
+ *        reads through casts of their address are found. The firmware's
+ *        state is static, so a process boots the board once.
+ */
+
+#include "sim.h"
+#include "lcd.h"
+#include "pressure.h"
+#include "tank.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SIM_TIMERS 5  /*!< TIM1 to TIM5 */
+#define SIM_CHANNELS 4 /*!< Compare channels of TIM2 */
+#define SIM_RX_SIZE 4096
+#define SIM_DDRAM_SIZE 0x80 /*!< HD44780 display RAM */
+
+/* Interrupt lines, in the order they are served */
+enum sim_irq
+{
+  SIM_IRQ_TIM2,  /*!< Actuator compare matches */
+  SIM_IRQ_ADC,   /*!< Analog watchdog */
+  SIM_IRQ_TIM5,  /*!< Timebase wrap */
+  SIM_IRQ_EXTI,  /*!< Encoder button */
+  SIM_IRQ_TIM4,  /*!< Sample clock */
+  SIM_IRQ_DMA,   /*!< ADC scan complete */
+  SIM_IRQ_BASE,  /*!< Updates of every other timer */
+  SIM_IRQ_ENC,   /*!< Encoder capture */
+  SIM_IRQ_UART,  /*!< Byte received */
+  SIM_IRQ_I2C,   /*!< LCD transfer complete */
+  SIM_IRQS
+};
+
+/* Struct containing a timer counting with its update interrupt */
+struct SimTimer
+{
+  TIM_HandleTypeDef *htim; /*!< NULL if stopped */
+  uint64_t next;           /*!< Time of the next update */
+  uint64_t period;         /*!< Update period in us */
+};
+
+/* Struct containing the wiring of a TIM2 channel */
+struct SimPin
+{
+  GPIO_TypeDef *port;
+  uint16_t pin;
+};
+
+/* DDRAM address of the first cell of each row of the panel */
+static const uint8_t sim_lcd_row[LCD_ROWS] = { 0x00, 0x40, 0x14, 0x54 };
+
+static const struct SimPin sim_oc_pin[SIM_CHANNELS] = {
+  { GPIOA, GPIO_PIN_5 },
+  { GPIOB, GPIO_PIN_3 },
+  { GPIOA, GPIO_PIN_2 },
+  { GPIOA, GPIO_PIN_3 },
+};
+
+GPIO_TypeDef sim_gpio[3];
+TIM_TypeDef sim_tim[SIM_TIMERS];
+ADC_TypeDef sim_adc;
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+volatile uint32_t sim_primask;
+_Thread_local uint32_t sim_exclusive;
+uint32_t SystemCoreClock = 168000000;
+I2C_HandleTypeDef hi2c2;
+
+static uint64_t sim_t = 0;       /*!< Time in us */
+static uint8_t sim_isr = 0;      /*!< Set while a handler runs */
+static uint8_t sim_stalled = 0;  /*!< Set while the flash stalls the CPU */
+static uint32_t sim_pending = 0; /*!< enum sim_irq bits */
+static uint32_t sim_enabled = 0; /*!< enum sim_irq bits */
+static uint32_t sim_sr[SIM_TIMERS]; /*!< Status registers, see sim_sync */
+static uint8_t sim_level[SIM_CHANNELS]; /*!< OCxREF of TIM2 */
+static struct SimTimer sim_timers[SIM_TIMERS];
+static TIM_HandleTypeDef *sim_enc = NULL;
+
+static ADC_HandleTypeDef *sim_hadc = NULL;
+static uint32_t sim_adc_rank[16];  /*!< Channel of each rank */
+static uint16_t *sim_adc_buf;      /*!< DMA destination */
+static uint32_t sim_adc_len;       /*!< Conversions per scan */
+static uint64_t sim_adc_done = 0;  /*!< End of the scan, 0 if none */
+static void (*sim_adc_source) (uint16_t *codes, uint32_t len) = NULL;
+static uint8_t sim_awd_on = 0;     /*!< Analog watchdog enabled */
+static uint32_t sim_awd_channel;   /*!< Channel it watches */
+static uint32_t sim_awd_high;      /*!< Upper threshold */
+static uint8_t sim_awd_flag = 0;   /*!< Out of window */
+
+static UART_HandleTypeDef *sim_huart = NULL;
+static uint8_t *sim_rx_ptr = NULL; /*!< Armed receive buffer */
+static uint8_t sim_rx_byte;        /*!< Last byte received */
+static char sim_rx_fifo[SIM_RX_SIZE]; /*!< Bytes still to arrive */
+static uint32_t sim_rx_head = 0;
+static uint32_t sim_rx_tail = 0;
+static uint64_t sim_rx_next = 0; /*!< Arrival of the next byte, 0 if none */
+static char *sim_tx = NULL;      /*!< Everything transmitted */
+static size_t sim_tx_len = 0;
+static size_t sim_tx_cap = 0;
+static FILE *sim_echo = NULL;
+
+static I2C_HandleTypeDef *sim_hi2c = NULL;
+static uint64_t sim_i2c_done = 0; /*!< End of the transfer, 0 if none */
+static uint8_t sim_i2c_buf[LCD_QUEUE_SIZE]; /*!< Bytes of the transfer */
+static uint16_t sim_i2c_len = 0;
+
+static uint8_t sim_ddram[SIM_DDRAM_SIZE]; /*!< Characters of the panel */
+static uint8_t sim_lcd_ac = 0;   /*!< Address counter */
+static uint8_t sim_lcd_port = 0; /*!< Last byte on the PCF8574 */
+static uint8_t sim_lcd_high = 0; /*!< High nibble of the byte coming in */
+static uint8_t sim_lcd_half = 0; /*!< Set once the high nibble is in */
+static void (*sim_lcd_watcher) (void) = NULL;
+
+static uint8_t sim_oc_pins = 0; /*!< Levels last seen by sim_sync */
+static void (*sim_pins_watcher) (uint8_t pins) = NULL;
+
+static uint8_t sim_button = 0;   /*!< Level of the encoder button */
+static uint64_t sim_release = 0; /*!< Release of the button, 0 if up */
+
+static uint8_t sim_flash_unlocked = 0;
+
+static UART_HandleTypeDef sim_huart2;
+static ADC_HandleTypeDef sim_hadc1 = { .Instance = ADC1 };
+static TIM_HandleTypeDef sim_htim_enc = { .Instance = TIM3 };
+static TIM_HandleTypeDef sim_htim_upd = {
+  .Instance = TIM1,
+  .Init = { .Prescaler = (SIM_TIMER_CLOCK / 10000) - 1, .Period = 999 },
+};
+
+static void sim_dispatch (void);
+
+/**
+ * @brief Returns the output compare mode of a TIM2 channel
+ *
+ * @param c Channel, 0 for CH1
+ *
+ * @retval uint32_t TIM_OCMODE_*
+ */
+static uint32_t
+sim_oc_mode (uint8_t c)
+{
+  uint32_t ccmr = (c < 2) ? sim_tim[1].CCMR1 : sim_tim[1].CCMR2;
+
+  return (ccmr >> ((c & 1) * 8)) & 0x70;
+}
+
+/**
+ * @brief Brings the registers up to date with the time and with what the
+ *        firmware wrote since the last call
+ *
+ *        Status flags are cleared by writing 0, writing 1 has no effect, so
+ *        a flag only stays set if both the last value set by the simulation
+ *        and the register have it. Forced output modes act at once. A change
+ *        of the TIM2 pins is reported to the watcher set by sim_pins_watch.
+ *
+ * @retval None
+ */
+static void
+sim_sync (void)
+{
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    {
+      sim_sr[i] &= sim_tim[i].SR;
+      sim_tim[i].SR = sim_sr[i];
+    }
+
+  for (uint8_t c = 0; c < SIM_CHANNELS; c++)
+    {
+      uint32_t mode = sim_oc_mode (c);
+      if (mode == TIM_OCMODE_FORCED_ACTIVE)
+        sim_level[c] = 1;
+      else if (mode == TIM_OCMODE_FORCED_INACTIVE)
+        sim_level[c] = 0;
+    }
+
+  sim_tim[1].CNT = (uint32_t)sim_t;
+  sim_tim[4].CNT = (uint32_t)sim_t;
+  sim_dwt.CYCCNT = (uint32_t)(sim_t * (SystemCoreClock / 1000000));
+
+  /* Pins read back what drives them */
+  for (uint8_t p = 0; p < 3; p++)
+    {
+      GPIO_TypeDef *port = &sim_gpio[p];
+      uint32_t idr = 0;
+
+      for (uint8_t pin = 0; pin < 16; pin++)
+        if (((port->MODER >> (2 * pin)) & 3) == GPIO_MODE_OUTPUT_PP)
+          idr |= port->ODR & (1U << pin);
+
+      for (uint8_t c = 0; c < SIM_CHANNELS; c++)
+        if (sim_oc_pin[c].port == port)
+          {
+            uint8_t pin = __builtin_ctz (sim_oc_pin[c].pin);
+            if (((port->MODER >> (2 * pin)) & 3) == GPIO_MODE_AF_PP
+                && sim_level[c])
+              idr |= sim_oc_pin[c].pin;
+          }
+
+      if (port == GPIOA && sim_button)
+        idr |= GPIO_PIN_8;
+
+      port->IDR = idr;
+    }
+
+  uint8_t pins = 0;
+  for (uint8_t c = 0; c < SIM_CHANNELS; c++)
+    if (sim_oc_pin[c].port->IDR & sim_oc_pin[c].pin)
+      pins |= 1 << c;
+
+  if (pins != sim_oc_pins)
+    {
+      sim_oc_pins = pins;
+      if (sim_pins_watcher != NULL)
+        sim_pins_watcher (pins);
+    }
+}
+
+/**
+ * @brief TIM2 as seen by the firmware, whose mode writes act at once
+ *
+ * @retval TIM_TypeDef* Registers
+ */
+TIM_TypeDef *
+sim_tim2 (void)
+{
+  sim_sync ();
+  return &sim_tim[1];
+}
+
+/**
+ * @brief TIM5 as seen by the firmware
+ *
+ *        Reading it from the main loop takes a microsecond, so a busy wait
+ *        on the timebase lets the interrupts it waits for happen.
+ *
+ * @retval TIM_TypeDef* Registers
+ */
+TIM_TypeDef *
+sim_tim5 (void)
+{
+  if (!sim_isr && !sim_primask && !sim_stalled)
+    sim_advance (1);
+  else
+    sim_sync ();
+
+  return &sim_tim[4];
+}
+
+/**
+ * @brief Returns the levels of the TIM2 pins
+ *
+ *        Includes forced modes the firmware has just written.
+ *
+ * @retval uint8_t One bit per channel, bit 0 for CH1
+ */
+uint8_t
+sim_pins (void)
+{
+  sim_sync ();
+  return sim_oc_pins;
+}
+
+/**
+ * @brief Returns the time of the next TIM2 compare match of a channel
+ *
+ * @param c Channel, 0 for CH1
+ *
+ * @retval uint64_t Time in us, UINT64_MAX if the channel is off
+ */
+static uint64_t
+sim_oc_next (uint8_t c)
+{
+  if (!(sim_tim[1].CCER & (1U << (4 * c))))
+    return UINT64_MAX;
+
+  uint32_t delta = *(&sim_tim[1].CCR1 + c) - (uint32_t)sim_t;
+  if (delta == 0)
+    return sim_t + (1ULL << 32);
+
+  return sim_t + delta;
+}
+
+/**
+ * @brief Returns the time of the next event of any peripheral
+ *
+ * @retval uint64_t Time in us
+ */
+static uint64_t
+sim_next_event (void)
+{
+  uint64_t next = (sim_t | 0xFFFFFFFFULL) + 1; /* TIM5 wrap */
+
+  for (uint8_t c = 0; c < SIM_CHANNELS; c++)
+    {
+      uint64_t t = sim_oc_next (c);
+      if (t < next)
+        next = t;
+    }
+
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    if (sim_timers[i].htim != NULL && sim_timers[i].next < next)
+      next = sim_timers[i].next;
+
+  uint64_t events[] = { sim_adc_done, sim_rx_next, sim_i2c_done,
+                        sim_release };
+  for (uint8_t i = 0; i < sizeof (events) / sizeof (events[0]); i++)
+    if (events[i] != 0 && events[i] < next)
+      next = events[i];
+
+  return next;
+}
+
+/**
+ * @brief Completes an ADC scan
+ *
+ * @retval None
+ */
+static void
+sim_adc_scan (void)
+{
+  sim_adc_done = 0;
+
+  for (uint32_t i = 0; i < sim_adc_len; i++)
+    sim_adc_buf[i] = tank_code (sim_adc_rank[i]);
+  if (sim_adc_source != NULL)
+    sim_adc_source (sim_adc_buf, sim_adc_len);
+
+  for (uint32_t i = 0; i < sim_adc_len; i++)
+    {
+      uint16_t code = sim_adc_buf[i];
+
+      if (sim_awd_on && sim_adc_rank[i] == sim_awd_channel
+          && code > sim_awd_high)
+        {
+          sim_awd_flag = 1;
+          sim_pending |= 1U << SIM_IRQ_ADC;
+        }
+    }
+
+  sim_pending |= 1U << SIM_IRQ_DMA;
+}
+
+/**
+ * @brief Runs an instruction or a character through the HD44780
+ *
+ *        Only what lcd.c sends is decoded: DDRAM addresses, clear, home and
+ *        characters.
+ *
+ * @param b Byte
+ * @param rs Register select, 1 for a character
+ *
+ * @retval None
+ */
+static void
+sim_lcd_byte (uint8_t b, uint8_t rs)
+{
+  if (rs)
+    {
+      sim_ddram[sim_lcd_ac] = b;
+      sim_lcd_ac = (sim_lcd_ac + 1) & (SIM_DDRAM_SIZE - 1);
+    }
+  else if (b & 0x80)
+    sim_lcd_ac = b & (SIM_DDRAM_SIZE - 1);
+  else if (b == 0x01)
+    {
+      memset (sim_ddram, ' ', sizeof (sim_ddram));
+      sim_lcd_ac = 0;
+    }
+  else if ((b & 0xFE) == 0x02)
+    sim_lcd_ac = 0;
+}
+
+/**
+ * @brief Takes a byte written to the PCF8574 backpack
+ *
+ *        The panel is in 4 bit mode and latches a nibble, the high one
+ *        first, on the falling edge of EN.
+ *
+ * @param port Levels of P0 to P7
+ *
+ * @retval None
+ */
+static void
+sim_lcd_port_write (uint8_t port)
+{
+  uint8_t fall = (sim_lcd_port & LCD_EN) && !(port & LCD_EN);
+  uint8_t nibble = sim_lcd_port & 0xF0;
+
+  sim_lcd_port = port;
+  if (!fall)
+    return;
+
+  if (!sim_lcd_half)
+    sim_lcd_high = nibble;
+  else
+    sim_lcd_byte (sim_lcd_high | (nibble >> 4), port & LCD_RS);
+  sim_lcd_half = !sim_lcd_half;
+}
+
+/**
+ * @brief Applies the events due now
+ *
+ * @retval None
+ */
+static void
+sim_fire (void)
+{
+  /* TIM2 compare matches */
+  for (uint8_t c = 0; c < SIM_CHANNELS; c++)
+    {
+      if (!(sim_tim[1].CCER & (1U << (4 * c)))
+          || *(&sim_tim[1].CCR1 + c) != (uint32_t)sim_t)
+        continue;
+
+      uint32_t mode = sim_oc_mode (c);
+      if (mode == TIM_OCMODE_ACTIVE)
+        sim_level[c] = 1;
+      else if (mode == TIM_OCMODE_INACTIVE)
+        sim_level[c] = 0;
+
+      sim_sr[1] |= TIM_IT_CC1 << c;
+      if (sim_tim[1].DIER & (TIM_IT_CC1 << c))
+        sim_pending |= 1U << SIM_IRQ_TIM2;
+    }
+
+  /* TIM5 wrap */
+  if ((uint32_t)sim_t == 0 && sim_t != 0)
+    {
+      sim_sr[4] |= TIM_SR_UIF;
+      if (sim_tim[4].DIER & TIM_IT_UPDATE)
+        sim_pending |= 1U << SIM_IRQ_TIM5;
+    }
+
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    {
+      struct SimTimer *timer = &sim_timers[i];
+      if (timer->htim == NULL || timer->next != sim_t)
+        continue;
+
+      timer->next += timer->period;
+      sim_sr[i] |= TIM_SR_UIF;
+      if (sim_tim[i].DIER & TIM_IT_UPDATE)
+        sim_pending |= 1U << ((i == 3) ? SIM_IRQ_TIM4 : SIM_IRQ_BASE);
+    }
+
+  for (uint8_t i = 0; i < SIM_TIMERS; i++)
+    sim_tim[i].SR = sim_sr[i];
+
+  if (sim_adc_done == sim_t)
+    sim_adc_scan ();
+
+  if (sim_rx_next == sim_t)
+    {
+      sim_rx_byte = sim_rx_fifo[sim_rx_tail++ % SIM_RX_SIZE];
+      sim_pending |= 1U << SIM_IRQ_UART;
+      sim_rx_next = (sim_rx_tail != sim_rx_head) ? sim_t + SIM_UART_US : 0;
+    }
+
+  if (sim_i2c_done == sim_t)
+    {
+      sim_i2c_done = 0;
+      for (uint16_t i = 0; i < sim_i2c_len; i++)
+        sim_lcd_port_write (sim_i2c_buf[i]);
+      sim_pending |= 1U << SIM_IRQ_I2C;
+    }
+
+  if (sim_release == sim_t)
+    {
+      sim_release = 0;
+      sim_button = 0;
+    }
+}
+
+/**
+ * @brief Runs one interrupt handler
+ *
+ * @param irq enum sim_irq
+ *
+ * @retval None
+ */
+static void
+sim_serve (uint8_t irq)
+{
+  switch (irq)
+    {
+    case SIM_IRQ_TIM2:
+      TIM2_IRQHandler ();
+      break;
+
+    case SIM_IRQ_ADC:
+      ADC_IRQHandler ();
+      break;
+
+    case SIM_IRQ_TIM5:
+      TIM5_IRQHandler ();
+      break;
+
+    case SIM_IRQ_EXTI:
+      HAL_GPIO_EXTI_Callback (GPIO_PIN_8);
+      break;
+
+    case SIM_IRQ_TIM4:
+      TIM4_IRQHandler ();
+      break;
+
+    case SIM_IRQ_DMA:
+      HAL_ADC_ConvCpltCallback (sim_hadc);
+      break;
+
+    case SIM_IRQ_BASE:
+      /* What CubeMX generates for the other timers */
+      for (uint8_t i = 0; i < SIM_TIMERS; i++)
+        if (i != 3 && sim_timers[i].htim != NULL)
+          HAL_TIM_IRQHandler (sim_timers[i].htim);
+      break;
+
+    case SIM_IRQ_ENC:
+      if (sim_enc != NULL)
+        HAL_TIM_IC_CaptureCallback (sim_enc);
+      break;
+
+    case SIM_IRQ_UART:
+      if (sim_rx_ptr == NULL)
+        HAL_UART_ErrorCallback (sim_huart);
+      else
+        {
+          *sim_rx_ptr = sim_rx_byte;
+          sim_rx_ptr = NULL;
+          HAL_UART_RxCpltCallback (sim_huart);
+        }
+      break;
+
+    case SIM_IRQ_I2C:
+      HAL_I2C_MasterTxCpltCallback (sim_hi2c);
+
+      /* A frame can take more than one transfer */
+      if (sim_i2c_done == 0 && sim_lcd_watcher != NULL)
+        sim_lcd_watcher ();
+      break;
+
+    default:
+      break;
+    }
+}
+
+/**
+ * @brief Runs the pending handlers the CPU can take now
+ *
+ * @retval None
+ */
+static void
+sim_dispatch (void)
+{
+  if (sim_isr || sim_primask || sim_stalled)
+    return;
+
+  uint32_t ready;
+  while ((ready = sim_pending & sim_enabled) != 0)
+    {
+      uint8_t irq = __builtin_ctz (ready);
+      sim_pending &= ~(1U << irq);
+
+      sim_isr = 1;
+      sim_sync ();
+      sim_serve (irq);
+      sim_isr = 0;
+      sim_sync ();
+    }
+}
+
+/**
+ * @brief Advances the simulated time
+ *
+ * @param us Time to advance in us
+ *
+ * @retval None
+ */
+void
+sim_advance (uint64_t us)
+{
+  uint64_t end = sim_t + us;
+
+  if (us == 0)
+    {
+      sim_sync ();
+      sim_dispatch ();
+      return;
+    }
+
+  for (;;)
+    {
+      sim_sync ();
+
+      uint64_t next = sim_next_event ();
+      if (next > end)
+        next = end;
+
+      tank_step ((next - sim_t) / 1000000.0f, sim_pins ());
+      sim_t = next;
+
+      sim_sync ();
+      sim_fire ();
+      sim_sync ();
+      sim_dispatch ();
+
+      if (sim_t >= end)
+        break;
+    }
+}
+
+/**
+ * @brief Lets time pass with the CPU stalled
+ *
+ * @param us Time to advance in us
+ *
+ * @retval None
+ */
+static void
+sim_stall (uint64_t us)
+{
+  uint8_t stalled = sim_stalled;
+
+  sim_stalled = 1;
+  sim_advance (us);
+  sim_stalled = stalled;
+
+  sim_dispatch ();
+}
+
+/**
+ * @brief Returns the simulated time
+ *
+ * @retval uint64_t Time since sim_init in us
+ */
+uint64_t
+sim_now (void)
+{
+  return sim_t;
+}
+
+/**
+ * @brief Powers the board up with every peripheral reset
+ *
+ *        Maps the flash, erased, at its real address.
+ *
+ * @retval None
+ */
+void
+sim_init (void)
+{
+  static uint8_t mapped = 0;
+
+  if (!mapped)
+    {
+      void *flash
+          = mmap ((void *)SIM_FLASH_BASE, SIM_FLASH_SIZE,
+                  PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+      if (flash != (void *)SIM_FLASH_BASE)
+        {
+          perror ("sim: can't map flash");
+          exit (EXIT_FAILURE);
+        }
+      mapped = 1;
+    }
+  memset ((void *)SIM_FLASH_BASE, 0xFF, SIM_FLASH_SIZE);
+
+  memset (sim_gpio, 0, sizeof (sim_gpio));
+  memset (sim_tim, 0, sizeof (sim_tim));
+  memset (sim_sr, 0, sizeof (sim_sr));
+  memset (sim_level, 0, sizeof (sim_level));
+  memset (sim_timers, 0, sizeof (sim_timers));
+
+  sim_t = 0;
+  sim_primask = 0;
+  sim_pending = 0;
+  sim_enabled = (1U << SIM_IRQ_DMA) | (1U << SIM_IRQ_BASE)
+                | (1U << SIM_IRQ_ENC) | (1U << SIM_IRQ_UART)
+                | (1U << SIM_IRQ_I2C);
+  sim_adc_done = 0;
+  sim_rx_head = sim_rx_tail = 0;
+  sim_rx_next = 0;
+  sim_i2c_done = 0;
+  memset (sim_ddram, ' ', sizeof (sim_ddram));
+  sim_lcd_ac = 0;
+  sim_lcd_port = 0;
+  sim_lcd_half = 0;
+  sim_oc_pins = 0;
+  sim_button = 0;
+  sim_release = 0;
+  sim_tx_len = 0;
+
+  tank_init ();
+}
+
+/**
+ * @brief Powers the board up and runs the firmware's setup
+ *
+ *        The handles are the ones CubeMX would have initialized, with a
+ *        100ms update timer.
+ *
+ * @retval None
+ */
+void
+sim_boot (void)
+{
+  sim_init ();
+
+  HAL_TIM_Base_Init (&sim_htim_upd);
+  pressure_setup (&sim_huart2, &sim_hadc1, &sim_htim_enc, &sim_htim_upd);
+}
+
+/**
+ * @brief Runs the main loop
+ *
+ * @param sec Simulated time to run for
+ *
+ * @retval None
+ */
+void
+sim_run (float sec)
+{
+  uint64_t end = sim_t + (uint64_t)(sec * 1000000.0f);
+
+  while (sim_t < end)
+    {
+      pressure_poll ();
+      sim_advance (SIM_POLL_US);
+    }
+}
+
+/**
+ * @brief Sends bytes to the board's UART
+ *
+ * @param str Bytes to send, one every SIM_UART_US
+ *
+ * @retval None
+ */
+void
+sim_uart_rx (const char *str)
+{
+  for (; *str != '\0'; str++)
+    {
+      if (sim_rx_head - sim_rx_tail >= SIM_RX_SIZE)
+        break;
+      sim_rx_fifo[sim_rx_head++ % SIM_RX_SIZE] = *str;
+    }
+
+  if (sim_rx_next == 0 && sim_rx_head != sim_rx_tail)
+    sim_rx_next = sim_t + SIM_UART_US;
+}
+
+/**
+ * @brief Returns a mark in what the board has transmitted
+ *
+ * @retval size_t Bytes transmitted so far
+ */
+size_t
+sim_uart_mark (void)
+{
+  return sim_tx_len;
+}
+
+/**
+ * @brief Returns what the board has transmitted since a mark
+ *
+ * @param mark Value returned by sim_uart_mark
+ *
+ * @retval const char* Null terminated text
+ */
+const char *
+sim_uart_since (size_t mark)
+{
+  if (sim_tx == NULL)
+    return "";
+
+  return sim_tx + ((mark < sim_tx_len) ? mark : sim_tx_len);
+}
+
+/**
+ * @brief Finds the first line transmitted since a mark that starts with a
+ *        prefix
+ *
+ * @param mark Value returned by sim_uart_mark
+ * @param prefix Start of the line
+ *
+ * @retval const char* Start of the line, NULL if none
+ */
+const char *
+sim_uart_line (size_t mark, const char *prefix)
+{
+  const char *line = sim_uart_since (mark);
+  size_t len = strlen (prefix);
+
+  while (*line != '\0')
+    {
+      if (strncmp (line, prefix, len) == 0)
+        return line;
+
+      line = strchr (line, '\n');
+      if (line == NULL)
+        break;
+      line++;
+    }
+
+  return NULL;
+}
+
+/**
+ * @brief Copies everything the board transmits to a file
+ *
+ * @param file Destination, NULL to stop
+ *
+ * @retval None
+ */
+void
+sim_uart_echo (FILE *file)
+{
+  sim_echo = file;
+}
+
+/**
+ * @brief Turns the encoder by one detent
+ *
+ * @param dir 1 : Clockwise, -1 : Counter clockwise
+ *
+ * @retval None
+ */
+void
+sim_rotary_turn (int8_t dir)
+{
+  if (sim_enc == NULL)
+    return;
+
+  sim_enc->Instance->CNT = (uint32_t)(int32_t)dir;
+  sim_pending |= 1U << SIM_IRQ_ENC;
+  sim_dispatch ();
+}
+
+/**
+ * @brief Presses the encoder button, released SIM_PRESS_US later
+ *
+ * @retval None
+ */
+void
+sim_rotary_press (void)
+{
+  sim_button = 1;
+  sim_release = sim_t + SIM_PRESS_US;
+  sim_sync ();
+
+  if (sim_enabled & (1U << SIM_IRQ_EXTI))
+    sim_pending |= 1U << SIM_IRQ_EXTI;
+  sim_dispatch ();
+}
+
+/**
+ * @brief Takes the ADC scans from somewhere else than the tank model
+ *
+ * @param source Called as every scan completes, with the codes of the tank
+ *               model to overwrite, one per rank. NULL for the tank model
+ *               alone
+ *
+ * @retval None
+ */
+void
+sim_adc_feed (void (*source) (uint16_t *codes, uint32_t len))
+{
+  sim_adc_source = source;
+}
+
+/**
+ * @brief Watches the TIM2 pins
+ *
+ * @param watcher Called with the levels, as sim_pins returns them, every
+ *                time they change. Must not run the simulation. NULL to
+ *                stop
+ *
+ * @retval None
+ */
+void
+sim_pins_watch (void (*watcher) (uint8_t pins))
+{
+  sim_pins_watcher = watcher;
+}
+
+/**
+ * @brief Watches the panel
+ *
+ * @param watcher Called every time the bus goes idle after a transfer to
+ *                the panel. Must not run the simulation. NULL to stop
+ *
+ * @retval None
+ */
+void
+sim_lcd_watch (void (*watcher) (void))
+{
+  sim_lcd_watcher = watcher;
+}
+
+/**
+ * @brief Returns what the panel shows
+ *
+ * @param frame Filled with the character of every cell
+ *
+ * @retval None
+ */
+void
+sim_lcd_frame (uint8_t frame[LCD_ROWS][LCD_COLS])
+{
+  for (uint8_t y = 0; y < LCD_ROWS; y++)
+    memcpy (frame[y], &sim_ddram[sim_lcd_row[y]], LCD_COLS);
+}
+
+/* Timers */
+
+/**
+ * @brief Returns the index of a timer in sim_tim
+ *
+ * @param htim HAL timer handle
+ *
+ * @retval uint8_t 0 for TIM1
+ */
+static uint8_t
+sim_tim_index (TIM_HandleTypeDef *htim)
+{
+  return htim->Instance - sim_tim;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_Base_Init (TIM_HandleTypeDef *htim)
+{
+  uint8_t i = sim_tim_index (htim);
+
+  htim->Instance->PSC = htim->Init.Prescaler;
+  htim->Instance->ARR = htim->Init.Period;
+
+  /* Loading the prescaler generates an update */
+  sim_sync ();
+  sim_sr[i] |= TIM_SR_UIF;
+  sim_tim[i].SR = sim_sr[i];
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_Base_DeInit (TIM_HandleTypeDef *htim)
+{
+  return HAL_TIM_Base_Stop_IT (htim);
+}
+
+HAL_StatusTypeDef
+HAL_TIM_Base_Start (TIM_HandleTypeDef *htim)
+{
+  htim->Instance->CR1 |= 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_Base_Start_IT (TIM_HandleTypeDef *htim)
+{
+  uint8_t i = sim_tim_index (htim);
+
+  htim->Instance->CR1 |= 1;
+  htim->Instance->DIER |= TIM_IT_UPDATE;
+
+  /* TIM2 and TIM5 count the time itself */
+  if (i == 1 || i == 4)
+    return HAL_OK;
+
+  uint64_t ticks = (uint64_t)(htim->Instance->PSC + 1)
+                   * ((uint64_t)htim->Instance->ARR + 1);
+  sim_timers[i].period = ticks / (SIM_TIMER_CLOCK / 1000000);
+  sim_timers[i].next = sim_t + sim_timers[i].period;
+  sim_timers[i].htim = htim;
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_Base_Stop_IT (TIM_HandleTypeDef *htim)
+{
+  uint8_t i = sim_tim_index (htim);
+
+  htim->Instance->CR1 &= ~1U;
+  htim->Instance->DIER &= ~TIM_IT_UPDATE;
+  sim_timers[i].htim = NULL;
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_Encoder_Start_IT (TIM_HandleTypeDef *htim, uint32_t channel)
+{
+  (void)channel;
+  sim_enc = htim;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_OC_Init (TIM_HandleTypeDef *htim)
+{
+  htim->Instance->PSC = htim->Init.Prescaler;
+  htim->Instance->ARR = htim->Init.Period;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_OC_ConfigChannel (TIM_HandleTypeDef *htim, TIM_OC_InitTypeDef *conf,
+                          uint32_t channel)
+{
+  uint8_t c = channel / 4;
+  volatile uint32_t *ccmr
+      = (c < 2) ? &htim->Instance->CCMR1 : &htim->Instance->CCMR2;
+  uint32_t shift = (c & 1) * 8;
+
+  *ccmr = (*ccmr & ~(TIM_CCMR1_OC1M << shift)) | (conf->OCMode << shift);
+  __HAL_TIM_SET_COMPARE (htim, channel, conf->Pulse);
+  sim_sync ();
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_OC_Start (TIM_HandleTypeDef *htim, uint32_t channel)
+{
+  htim->Instance->CCER |= 1U << channel;
+  htim->Instance->CR1 |= 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_TIM_OC_Start_IT (TIM_HandleTypeDef *htim, uint32_t channel)
+{
+  htim->Instance->DIER |= TIM_IT_CC1 << (channel / 4);
+  return HAL_TIM_OC_Start (htim, channel);
+}
+
+/**
+ * @brief Timer interrupt handler, as the HAL's
+ *
+ *        Clears each flag whose interrupt is enabled and runs its callback,
+ *        compare matches first.
+ *
+ * @param htim HAL timer handle
+ *
+ * @retval None
+ */
+void
+HAL_TIM_IRQHandler (TIM_HandleTypeDef *htim)
+{
+  uint8_t i = sim_tim_index (htim);
+
+  sim_sync ();
+
+  for (uint8_t c = 0; c < SIM_CHANNELS; c++)
+    {
+      uint32_t flag = TIM_IT_CC1 << c;
+      if (!(sim_sr[i] & flag) || !(sim_tim[i].DIER & flag))
+        continue;
+
+      sim_sr[i] &= ~flag;
+      sim_tim[i].SR = sim_sr[i];
+      htim->Channel = 1U << c;
+      HAL_TIM_OC_DelayElapsedCallback (htim);
+      htim->Channel = 0;
+      sim_sync ();
+    }
+
+  if ((sim_sr[i] & TIM_SR_UIF) && (sim_tim[i].DIER & TIM_IT_UPDATE))
+    {
+      sim_sr[i] &= ~TIM_SR_UIF;
+      sim_tim[i].SR = sim_sr[i];
+      HAL_TIM_PeriodElapsedCallback (htim);
+    }
+}
+
+/* ADC */
+
+HAL_StatusTypeDef
+HAL_ADC_Init (ADC_HandleTypeDef *hadc)
+{
+  sim_hadc = hadc;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_ADC_ConfigChannel (ADC_HandleTypeDef *hadc, ADC_ChannelConfTypeDef *conf)
+{
+  (void)hadc;
+
+  if (conf->Rank < 1 || conf->Rank > 16)
+    return HAL_ERROR;
+
+  sim_adc_rank[conf->Rank - 1] = conf->Channel;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_ADC_AnalogWDGConfig (ADC_HandleTypeDef *hadc,
+                         ADC_AnalogWDGConfTypeDef *conf)
+{
+  (void)hadc;
+
+  sim_awd_on = conf->ITMode == ENABLE;
+  sim_awd_channel = conf->Channel;
+  sim_awd_high = conf->HighThreshold;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_ADC_Start_DMA (ADC_HandleTypeDef *hadc, uint32_t *buf, uint32_t len)
+{
+  if (sim_adc_done != 0)
+    return HAL_BUSY;
+
+  sim_hadc = hadc;
+  sim_adc_buf = (uint16_t *)buf;
+  sim_adc_len = (len > 16) ? 16 : len;
+  sim_adc_done = sim_t + SIM_ADC_US;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_ADC_Stop_DMA (ADC_HandleTypeDef *hadc)
+{
+  (void)hadc;
+  sim_adc_done = 0;
+  return HAL_OK;
+}
+
+void
+HAL_ADC_IRQHandler (ADC_HandleTypeDef *hadc)
+{
+  if (sim_awd_flag)
+    {
+      sim_awd_flag = 0;
+      HAL_ADC_LevelOutOfWindowCallback (hadc);
+    }
+}
+
+/* UART */
+
+HAL_StatusTypeDef
+HAL_UART_Transmit (UART_HandleTypeDef *huart, const uint8_t *data,
+                   uint16_t len, uint32_t timeout)
+{
+  (void)huart;
+  (void)timeout;
+
+  if (sim_tx_len + len + 1 > sim_tx_cap)
+    {
+      size_t cap = (sim_tx_cap > 0) ? sim_tx_cap : 65536;
+      while (sim_tx_len + len + 1 > cap)
+        cap *= 2;
+
+      char *tx = realloc (sim_tx, cap);
+      if (tx == NULL)
+        return HAL_ERROR;
+      sim_tx = tx;
+      sim_tx_cap = cap;
+    }
+
+  memcpy (sim_tx + sim_tx_len, data, len);
+  sim_tx_len += len;
+  sim_tx[sim_tx_len] = '\0';
+
+  if (sim_echo != NULL)
+    fwrite (data, 1, len, sim_echo);
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_UART_Receive_IT (UART_HandleTypeDef *huart, uint8_t *data, uint16_t len)
+{
+  (void)len;
+
+  sim_huart = huart;
+  sim_rx_ptr = data;
+  return HAL_OK;
+}
+
+/* I2C */
+
+HAL_StatusTypeDef
+HAL_I2C_Master_Transmit_DMA (I2C_HandleTypeDef *hi2c, uint16_t addr,
+                             uint8_t *data, uint16_t len)
+{
+  if (sim_i2c_done != 0)
+    return HAL_BUSY;
+  if (len > sizeof (sim_i2c_buf))
+    return HAL_ERROR;
+
+  /* Nothing but the backpack on the bus */
+  sim_i2c_len = (addr == LCD_ADDR) ? len : 0;
+  memcpy (sim_i2c_buf, data, sim_i2c_len);
+  sim_hi2c = hi2c;
+  sim_i2c_done = sim_t + ((uint64_t)len * SIM_I2C_US) + 1;
+  return HAL_OK;
+}
+
+/* GPIO */
+
+void
+HAL_GPIO_Init (GPIO_TypeDef *port, GPIO_InitTypeDef *init)
+{
+  for (uint8_t pin = 0; pin < 16; pin++)
+    if (init->Pin & (1U << pin))
+      port->MODER = (port->MODER & ~(3U << (2 * pin)))
+                    | ((init->Mode & 3) << (2 * pin));
+  sim_sync ();
+}
+
+void
+HAL_GPIO_WritePin (GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+  if (state == GPIO_PIN_SET)
+    port->ODR |= pin;
+  else
+    port->ODR &= ~(uint32_t)pin;
+  sim_sync ();
+}
+
+GPIO_PinState
+HAL_GPIO_ReadPin (GPIO_TypeDef *port, uint16_t pin)
+{
+  sim_sync ();
+  return (port->IDR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+/* NVIC, clocks */
+
+/**
+ * @brief Returns the simulated line of an interrupt
+ *
+ * @param irq IRQn_Type
+ *
+ * @retval int enum sim_irq, -1 if not simulated
+ */
+static int
+sim_irq_line (IRQn_Type irq)
+{
+  switch (irq)
+    {
+    case TIM2_IRQn:
+      return SIM_IRQ_TIM2;
+    case ADC_IRQn:
+      return SIM_IRQ_ADC;
+    case TIM5_IRQn:
+      return SIM_IRQ_TIM5;
+    case EXTI9_5_IRQn:
+      return SIM_IRQ_EXTI;
+    case TIM4_IRQn:
+      return SIM_IRQ_TIM4;
+    default:
+      return -1;
+    }
+}
+
+void
+HAL_NVIC_EnableIRQ (IRQn_Type irq)
+{
+  int line = sim_irq_line (irq);
+  if (line >= 0)
+    sim_enabled |= 1U << line;
+}
+
+void
+HAL_NVIC_DisableIRQ (IRQn_Type irq)
+{
+  int line = sim_irq_line (irq);
+  if (line >= 0)
+    sim_enabled &= ~(1U << line);
+}
+
+void
+HAL_NVIC_SetPriority (IRQn_Type irq, uint32_t pre, uint32_t sub)
+{
+  (void)irq;
+  (void)pre;
+  (void)sub;
+}
+
+void
+HAL_Delay (uint32_t ms)
+{
+  sim_advance ((uint64_t)ms * 1000);
+}
+
+uint32_t
+HAL_GetTick (void)
+{
+  return sim_t / 1000;
+}
+
+uint32_t
+HAL_RCC_GetPCLK1Freq (void)
+{
+  return SIM_TIMER_CLOCK / 2;
+}
+
+uint32_t
+HAL_RCC_GetHCLKFreq (void)
+{
+  return SystemCoreClock;
+}
+
+/* Flash */
+
+HAL_StatusTypeDef
+HAL_FLASH_Unlock (void)
+{
+  sim_flash_unlocked = 1;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_FLASH_Lock (void)
+{
+  sim_flash_unlocked = 0;
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_FLASHEx_Erase (FLASH_EraseInitTypeDef *erase, uint32_t *error)
+{
+  /* Sectors 0 to 3 are 16K, 4 is 64K, the others 128K */
+  static const uint32_t start[] = { 0x00000, 0x04000, 0x08000, 0x0C000,
+                                    0x10000, 0x20000, 0x40000, 0x60000,
+                                    0x80000 };
+
+  *error = 0xFFFFFFFFU;
+  if (!sim_flash_unlocked || erase->Sector + erase->NbSectors > 8)
+    return HAL_ERROR;
+
+  for (uint32_t s = erase->Sector; s < erase->Sector + erase->NbSectors; s++)
+    {
+      memset ((void *)(SIM_FLASH_BASE + start[s]), 0xFF,
+              start[s + 1] - start[s]);
+      sim_stall (SIM_ERASE_US);
+    }
+
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef
+HAL_FLASH_Program (uint32_t type, uint32_t addr, uint64_t data)
+{
+  if (!sim_flash_unlocked || type != FLASH_TYPEPROGRAM_WORD
+      || addr < SIM_FLASH_BASE || addr + 4 > SIM_FLASH_BASE + SIM_FLASH_SIZE
+      || (addr & 3) != 0)
+    return HAL_ERROR;
+
+  /* Programming only clears bits */
+  *(volatile uint32_t *)(uintptr_t)addr &= (uint32_t)data;
+  sim_stall (SIM_PROGRAM_US);
+
+  return HAL_OK;
+}
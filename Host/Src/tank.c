@@ -0,0 +1,214 @@
+/**
+ * @file tank.c
+ *
+ * @brief Simulated pneumatics program body
+ *
+ *        Every station is one tank. The compressor pushes it towards the
+ *        supply pressure, the exhaust and the leak pull it towards ambient,
+ *        each through a linear conductance:
+ *
+ *          dp/dt = fill * (supply - p) - (vent + leak) * p
+ *
+ *        The pins only change between two calls to tank_step, so each step
+ *        is solved exactly instead of being integrated.
+ *
+ *        The reference sensor reads the tank, the DUTs read the first tank
+ *        through their own gain and offset. Noise comes from a fixed seed,
+ *        so every run sees the same samples.
+ */
+
+#include "tank.h"
+#include "acquisition.h"
+#include "stm32f4xx_hal.h"
+
+#include <math.h>
+
+static const struct TankModel tank_default = {
+  .supply = 180.0f,
+  .fill = 0.15f,
+  .vent = 0.5f,
+  .leak = 0.002f,
+  .noise = 0.0f,
+  .dut_gain = { 1.0f, 1.0f, 1.0f },
+  .dut_offset = { 0.0f, 0.0f, 0.0f },
+};
+
+static struct TankModel tank_model[PRESSURE_STATIONS]; /*!< Parameters */
+static double tank_p[PRESSURE_STATIONS];               /*!< Pressures */
+static uint32_t tank_seed;                             /*!< Noise state */
+
+/**
+ * @brief Empties every tank and loads the default model
+ *
+ * @retval None
+ */
+void
+tank_init (void)
+{
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      tank_model[i] = tank_default;
+      tank_p[i] = 0.0;
+    }
+
+  tank_seed = 1;
+}
+
+/**
+ * @brief Returns the model of a station's tank, to be changed by a test
+ *
+ * @param station Index of the station
+ *
+ * @retval struct TankModel* Model, NULL for a bad station
+ */
+struct TankModel *
+tank_get_model (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return NULL;
+
+  return &tank_model[station];
+}
+
+/**
+ * @brief Returns the pressure of a tank
+ *
+ * @param station Index of the station
+ *
+ * @retval float Pressure in psi
+ */
+float
+tank_get (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return 0.0f;
+
+  return tank_p[station];
+}
+
+/**
+ * @brief Sets the pressure of a tank
+ *
+ * @param station Index of the station
+ * @param p Pressure in psi
+ *
+ * @retval None
+ */
+void
+tank_set (uint8_t station, float p)
+{
+  if (station < PRESSURE_STATIONS)
+    tank_p[station] = p;
+}
+
+/**
+ * @brief Advances every tank with the actuators held
+ *
+ * @param dt Time step in sec
+ * @param pins One bit per actuator, compressor then exhaust of each station
+ *
+ * @retval None
+ */
+void
+tank_step (float dt, uint8_t pins)
+{
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      const struct TankModel *m = &tank_model[i];
+      double c = 0.0;
+      double k = m->leak;
+
+      if (pins & (1 << (2 * i)))
+        {
+          c += m->fill * m->supply;
+          k += m->fill;
+        }
+      if (pins & (2 << (2 * i)))
+        k += m->vent;
+
+      if (k <= 0.0)
+        continue;
+
+      /* p approaches c / k with time constant 1 / k */
+      double end = c / k;
+      tank_p[i] = end + (tank_p[i] - end) * exp (-k * dt);
+    }
+}
+
+/**
+ * @brief Returns a normally distributed sample
+ *
+ * @retval float Zero mean, unit variance
+ */
+static float
+tank_gauss (void)
+{
+  float sum = 0.0f;
+
+  /* Irwin-Hall, twelve uniforms have a variance of one */
+  for (uint8_t i = 0; i < 12; i++)
+    {
+      tank_seed = (tank_seed * 1664525u) + 1013904223u;
+      sum += (tank_seed >> 8) / 16777216.0f;
+    }
+
+  return sum - 6.0f;
+}
+
+/**
+ * @brief Converts what a sensor reads to an ADC code
+ *
+ * @param station Index of the station whose noise applies
+ * @param p Pressure in psi
+ *
+ * @retval uint16_t 12 bit code
+ */
+static uint16_t
+tank_to_code (uint8_t station, float p)
+{
+  p += tank_model[station].noise * tank_gauss ();
+
+  float code = roundf ((p * ADC_RESOLUTION) / PRESSURE_SENSOR_SPAN);
+  if (code < 0.0f)
+    return 0;
+  if (code > ADC_RESOLUTION - 1)
+    return ADC_RESOLUTION - 1;
+
+  return code;
+}
+
+/**
+ * @brief Returns the code an ADC channel converts
+ *
+ * @param channel ADC_CHANNEL_n
+ *
+ * @retval uint16_t 12 bit code, 0 for an unwired channel
+ */
+uint16_t
+tank_code (uint32_t channel)
+{
+  const struct TankModel *m = &tank_model[0];
+
+  switch (channel)
+    {
+    case ADC_CHANNEL_0:
+      return tank_to_code (0, tank_p[0]);
+
+    case ADC_CHANNEL_1:
+      return tank_to_code (0, tank_p[0] * m->dut_gain[0] + m->dut_offset[0]);
+
+    case ADC_CHANNEL_4:
+      return tank_to_code (0, tank_p[0] * m->dut_gain[1] + m->dut_offset[1]);
+
+    case ADC_CHANNEL_8:
+      return tank_to_code (0, tank_p[0] * m->dut_gain[2] + m->dut_offset[2]);
+
+#ifdef PRESSURE_BOARD_DUAL
+    case ADC_CHANNEL_9:
+      return tank_to_code (1, tank_p[1]);
+#endif
+
+    default:
+      return 0;
+    }
+}
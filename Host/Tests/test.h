@@ -0,0 +1,76 @@
+/**
+ * @file test.h
+ *
+ * @brief Host test checks
+ *
+ *        A failed check is reported and counted, the test goes on. main
+ *        returns test_result, so make test stops at the first failing test.
+ */
+
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <math.h>
+#include <stdio.h>
+
+static int test_failures = 0; /*!< Failed checks */
+
+#define CHECK(cond)                                                           \
+  do                                                                          \
+    {                                                                         \
+      if (!(cond))                                                            \
+        {                                                                     \
+          fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,  \
+                   #cond);                                                    \
+          test_failures++;                                                    \
+        }                                                                     \
+    }                                                                         \
+  while (0)
+
+#define CHECK_NEAR(a, b, tol)                                                 \
+  do                                                                          \
+    {                                                                         \
+      double a_ = (a), b_ = (b);                                              \
+      if (!(fabs (a_ - b_) <= (tol)))                                         \
+        {                                                                     \
+          fprintf (stderr, "%s:%d: check failed: %s = %g, expected %g +- %g\n",\
+                   __FILE__, __LINE__, #a, a_, b_, (double)(tol));            \
+          test_failures++;                                                    \
+        }                                                                     \
+    }                                                                         \
+  while (0)
+
+#define CHECK_STR(a, b)                                                       \
+  do                                                                          \
+    {                                                                         \
+      const char *a_ = (a), *b_ = (b);                                        \
+      if (strcmp (a_, b_) != 0)                                               \
+        {                                                                     \
+          fprintf (stderr, "%s:%d: check failed: %s = \"%s\", expected "      \
+                   "\"%s\"\n", __FILE__, __LINE__, #a, a_, b_);               \
+          test_failures++;                                                    \
+        }                                                                     \
+    }                                                                         \
+  while (0)
+
+/**
+ * @brief Reports the outcome of a test
+ *
+ * @param name Name of the test
+ *
+ * @retval int Exit status
+ */
+static inline int
+test_result (const char *name)
+{
+  if (test_failures > 0)
+    {
+      fprintf (stderr, "%s: %d check(s) failed\n", name, test_failures);
+      return 1;
+    }
+
+  printf ("%s: ok\n", name);
+  return 0;
+}
+
+#endif // TEST_H_
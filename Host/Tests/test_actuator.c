@@ -0,0 +1,171 @@
+/**
+ * @file test_actuator.c
+ *
+ * @brief Hardware-timed actuator driver tests
+ *
+ *        Drives the actuators of an otherwise idle board, and times the
+ *        edges the simulated TIM2 compare channels put on the pins to the
+ *        microsecond: the shortest pulse, the dead time between compressor
+ *        and exhaust, and a pulse held across control ticks.
+ */
+
+#include "actuator.h"
+#include "sim.h"
+#include "test.h"
+
+#define TEST_COMPRESSOR (1 << ACTUATOR_COMPRESSOR) /*!< Pin of sim_pins */
+#define TEST_EXHAUST (1 << ACTUATOR_EXHAUST)       /*!< Pin of sim_pins */
+
+/**
+ * @brief Runs until some pins reach a level
+ *
+ * @param mask Pins to watch
+ * @param level Levels they must all have
+ * @param limit Longest wait in us
+ *
+ * @retval uint64_t Time waited in us, UINT64_MAX if they never did
+ */
+static uint64_t
+wait_pins (uint8_t mask, uint8_t level, uint64_t limit)
+{
+  for (uint64_t t = 0; t <= limit; t++)
+    {
+      if ((sim_pins () & mask) == level)
+        return t;
+      sim_advance (1);
+    }
+
+  return UINT64_MAX;
+}
+
+/**
+ * @brief Runs until every actuator has been off for longer than the dead
+ *        time
+ *
+ * @retval None
+ */
+static void
+settle (void)
+{
+  CHECK (wait_pins (TEST_COMPRESSOR | TEST_EXHAUST, 0, 1000000) != UINT64_MAX);
+  sim_advance (2 * ACTUATOR_DEAD_TIME);
+  CHECK (actuator_idle ());
+}
+
+static void
+test_min_on (void)
+{
+  settle ();
+
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_MIN_ON - 1) == 0);
+  CHECK (actuator_idle ());
+  CHECK (wait_pins (TEST_COMPRESSOR, TEST_COMPRESSOR, 1000) == UINT64_MAX);
+
+  /* Starts at once, the exhaust has been off long enough */
+  uint32_t edges = actuator_switches (ACTUATOR_COMPRESSOR);
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_MIN_ON) == 1);
+  CHECK (wait_pins (TEST_COMPRESSOR, TEST_COMPRESSOR, 0) == 0);
+  CHECK (wait_pins (TEST_COMPRESSOR, 0, ACTUATOR_MIN_ON) == ACTUATOR_MIN_ON);
+  CHECK (actuator_switches (ACTUATOR_COMPRESSOR) == edges + 1);
+  CHECK (!actuator_active (ACTUATOR_COMPRESSOR));
+
+  CHECK (actuator_pulse (ACTUATORS, ACTUATOR_MIN_ON) == 0);
+}
+
+static void
+test_dead_time (void)
+{
+  settle ();
+
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, 10000) == 1);
+  CHECK (actuator_pulse (ACTUATOR_EXHAUST, 10000) == 1);
+  CHECK (actuator_active (ACTUATOR_EXHAUST));
+
+  /* Nothing else goes in while the exhaust waits */
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, 50000) == 0);
+
+  CHECK (wait_pins (TEST_COMPRESSOR, 0, 10000) == 10000);
+  CHECK (sim_pins () == 0);
+  CHECK (wait_pins (TEST_EXHAUST, TEST_EXHAUST, ACTUATOR_DEAD_TIME)
+         == ACTUATOR_DEAD_TIME);
+  CHECK (wait_pins (TEST_EXHAUST, 0, 10000) == 10000);
+
+  /* Both ways round */
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, 10000) == 1);
+  CHECK (wait_pins (TEST_COMPRESSOR, TEST_COMPRESSOR, ACTUATOR_DEAD_TIME)
+         == ACTUATOR_DEAD_TIME);
+  CHECK (wait_pins (TEST_COMPRESSOR, 0, 10000) == 10000);
+
+  /* A pulse stopped before it started leaves no dead time behind */
+  settle ();
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, 10000) == 1);
+  CHECK (actuator_pulse (ACTUATOR_EXHAUST, 10000) == 1);
+  actuator_stop (ACTUATOR_EXHAUST);
+  CHECK (wait_pins (TEST_COMPRESSOR, 0, 10000) == 10000);
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, 10000) == 1);
+  CHECK (wait_pins (TEST_COMPRESSOR, TEST_COMPRESSOR, 0) == 0);
+  actuator_stop (ACTUATOR_COMPRESSOR);
+  CHECK (sim_pins () == 0);
+}
+
+static void
+test_hold (void)
+{
+  settle ();
+
+  /* Asked again on every tick, as the control code does */
+  uint32_t edges = actuator_switches (ACTUATOR_COMPRESSOR);
+  for (uint8_t tick = 0; tick < 10; tick++)
+    {
+      CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_HOLD) == 1);
+      CHECK (wait_pins (TEST_COMPRESSOR, 0, ACTUATOR_TICK - 1) == UINT64_MAX);
+    }
+  CHECK (actuator_switches (ACTUATOR_COMPRESSOR) == edges + 1);
+
+  /* Off by itself once no longer asked */
+  CHECK (wait_pins (TEST_COMPRESSOR, 0, ACTUATOR_HOLD)
+         == ACTUATOR_HOLD - ACTUATOR_TICK);
+
+  /* A shorter request shortens the pulse */
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_HOLD) == 1);
+  sim_advance (1000);
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_MIN_ON) == 1);
+  CHECK (wait_pins (TEST_COMPRESSOR, 0, ACTUATOR_HOLD) == ACTUATOR_MIN_ON);
+}
+
+static void
+test_trip (void)
+{
+  settle ();
+
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_HOLD) == 1);
+  sim_advance (1000);
+  actuator_trip ();
+  CHECK ((sim_pins () & (TEST_COMPRESSOR | TEST_EXHAUST)) == TEST_EXHAUST);
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_HOLD) == 0);
+  actuator_stop (ACTUATOR_EXHAUST);
+
+  /* Holds past the end of the pulse it cut */
+  CHECK (wait_pins (TEST_COMPRESSOR | TEST_EXHAUST, 0, ACTUATOR_HOLD)
+         == UINT64_MAX);
+
+  actuator_release ();
+  CHECK (sim_pins () == 0);
+  CHECK (actuator_pulse (ACTUATOR_COMPRESSOR, ACTUATOR_MIN_ON) == 1);
+  CHECK (wait_pins (TEST_COMPRESSOR, TEST_COMPRESSOR, ACTUATOR_DEAD_TIME)
+         == ACTUATOR_DEAD_TIME);
+}
+
+int
+main (void)
+{
+  sim_init ();
+  actuator_init ();
+
+  test_min_on ();
+  test_dead_time ();
+  test_hold ();
+  test_trip ();
+
+  return test_result ("test_actuator");
+}
@@ -0,0 +1,166 @@
+/**
+ * @file test_command.c
+ *
+ * @brief Serial command protocol tests
+ *
+ *        Types commands into the simulated UART of a booted board and checks
+ *        the replies, and that periods shorter than PRESSURE_SWITCH_TIME are
+ *        refused everywhere a period is set, the menu included.
+ */
+
+#include "command.h"
+#include "pressure.h"
+#include "sim.h"
+#include "test.h"
+
+#include <string.h>
+
+/**
+ * @brief Sends a command line and returns its reply
+ *
+ *        Runs the board long enough for the command to arrive and be
+ *        handled on the next control tick.
+ *
+ * @param line Command without line ending
+ *
+ * @retval const char* First line starting with '#' that isn't a telemetry
+ *                     marker, without line ending, empty if none
+ */
+static const char *
+command (const char *line)
+{
+  static char reply[128];
+  size_t mark = sim_uart_mark ();
+
+  sim_uart_rx (line);
+  sim_uart_rx ("\r\n");
+  sim_run (0.3f);
+
+  reply[0] = '\0';
+  for (const char *p = sim_uart_since (mark); *p != '\0'; p++)
+    {
+      if ((p == sim_uart_since (mark) || p[-1] == '\n') && *p == '#'
+          && strncmp (p, "#RATE", 5) != 0)
+        {
+          size_t len = strcspn (p, "\r\n");
+          if (len >= sizeof (reply))
+            len = sizeof (reply) - 1;
+          memcpy (reply, p, len);
+          reply[len] = '\0';
+          break;
+        }
+    }
+
+  return reply;
+}
+
+/**
+ * @brief Turns or presses the encoder, then lets the menu read it
+ *
+ * @param input -1 : Counter clockwise, 1 : Clockwise, 2 : Press
+ *
+ * @retval None
+ */
+static void
+rotary (int8_t input)
+{
+  if (input == 2)
+    sim_rotary_press ();
+  else
+    sim_rotary_turn (input);
+
+  sim_run (0.3f);
+}
+
+static void
+test_get_set (void)
+{
+  CHECK_STR (command ("GET PER"), "#PER=20.000");
+  CHECK_STR (command ("set offs 12.5"), "#OK");
+  CHECK_STR (command ("get OFFS"), "#OFFS=12.500");
+  CHECK_STR (command ("SET OFFS 151"), "#ERR RANGE");
+  CHECK_STR (command ("SET OFFS 1x"), "#ERR VALUE");
+  CHECK_STR (command ("SET VAL 1"), "#ERR PARAM");
+  CHECK_STR (command ("SET NOPE 1"), "#ERR PARAM");
+  CHECK_STR (command ("SET PER"), "#ERR ARG");
+  CHECK_STR (command ("GET"), "#ERR ARG");
+  CHECK_STR (command ("FROB"), "#ERR CMD");
+  CHECK_STR (command ("ABORT"), "#ERR IDLE");
+
+  char line[COMMAND_LINE_SIZE + 8];
+  memset (line, 'A', sizeof (line) - 1);
+  line[sizeof (line) - 1] = '\0';
+  CHECK_STR (command (line), "#ERR LENGTH");
+  CHECK_STR (command ("GET OFFS"), "#OFFS=12.500");
+}
+
+static void
+test_switch_time (void)
+{
+  CHECK_STR (command ("SET PER 0.5"), "#ERR RANGE");
+  CHECK_STR (command ("SET PER 0.8"), "#OK");
+  CHECK_STR (command ("GET PER"), "#PER=0.800");
+
+  CHECK_STR (command ("SCRIPT 2:0.5:10:15:1:3"), "#ERR VALUE");
+  CHECK_STR (command ("SCRIPT 2:1:10:15:1:3"), "#OK");
+  CHECK_STR (command ("SCRIPT CLEAR"), "#OK");
+
+  CHECK_STR (command ("SWEEP PER 0.5:20:3"), "#ERR VALUE");
+  CHECK_STR (command ("SWEEP PER 20:0.5:3"), "#ERR VALUE");
+  CHECK_STR (command ("SWEEP PER 1:20:3"), "#OK");
+  CHECK_STR (command ("SWEEP AMPL 0.5:20:3"), "#OK");
+}
+
+static void
+test_menu_period (void)
+{
+  struct Pressure *pressure = pressure_get_station (0);
+
+  CHECK_STR (command ("SET PER 1.5"), "#OK");
+  CHECK (pressure->menu.waveform != 0);
+
+  /* Wave, then Peri, edited */
+  rotary (1);
+  rotary (2);
+  rotary (-1);
+  CHECK_NEAR (pressure->menu.prev_val, 1.5, 1e-6);
+  rotary (1);
+  rotary (-1);
+  rotary (-1);
+  rotary (2);
+  CHECK_NEAR (pressure->per, 1.5, 1e-6);
+
+  rotary (2);
+  rotary (1);
+  rotary (2);
+  CHECK_STR (command ("GET PER"), "#PER=2.500");
+}
+
+static void
+test_busy (void)
+{
+  CHECK_STR (command ("SET PER 20"), "#OK");
+  CHECK_STR (command ("START"), "#OK");
+  CHECK_STR (command ("START"), "#ERR BUSY");
+  CHECK_STR (command ("SET PER 5"), "#ERR BUSY");
+  CHECK_STR (command ("SCRIPT CLEAR"), "#ERR BUSY");
+  CHECK_STR (command ("ABORT"), "#OK");
+
+  sim_run (30.0f);
+  CHECK (pressure_get_station (0)->menu.output == 0);
+  CHECK_STR (command ("SET PER 5"), "#OK");
+}
+
+int
+main (void)
+{
+  sim_boot ();
+  sim_run (1.0f);
+
+  test_get_set ();
+  test_switch_time ();
+  test_menu_period ();
+  test_busy ();
+
+  return test_result ("test_command");
+}
@@ -0,0 +1,144 @@
+/**
+ * @file test_estimator.c
+ *
+ * @brief Pressure and rate estimator tests
+ *
+ *        Feeds ramps with reference sensor noise through the filter, one
+ *        sample per scan, and checks that the estimate settles on the ramp,
+ *        follows a change of slope when the actuators switch, and is quieter
+ *        than the samples.
+ */
+
+#include "acquisition.h"
+#include "estimator.h"
+#include "pressure.h"
+#include "test.h"
+
+#include <math.h>
+
+#define TEST_NOISE 0.1f /*!< Sensor noise in psi rms, sqrt (ESTIMATOR_R) */
+
+static uint32_t test_seed = 1; /*!< Noise generator state */
+
+/**
+ * @brief Returns a sample of sensor noise
+ *
+ *        Sum of 12 uniform samples, close enough to normal.
+ *
+ * @retval float Noise in psi
+ */
+static float
+noise (void)
+{
+  float sum = 0.0f;
+
+  for (uint8_t i = 0; i < 12; i++)
+    {
+      test_seed = (test_seed * 1664525U) + 1013904223U;
+      sum += (test_seed >> 8) / 16777216.0f;
+    }
+
+  return (sum - 6.0f) * TEST_NOISE;
+}
+
+/**
+ * @brief Feeds a noisy ramp
+ *
+ * @param station Index of the station
+ * @param p Pressure at the start, advanced to the end
+ * @param rate Slope in psi/sec
+ * @param sec Length in sec
+ * @param pins Actuator pins throughout
+ * @param rms Filled with the rms error of the pressure estimate over the
+ *            second half, NULL if unused
+ *
+ * @retval None
+ */
+static void
+feed_ramp (uint8_t station, float *p, float rate, float sec, uint8_t pins,
+           float *rms)
+{
+  uint32_t n = sec * ACQUISITION_RATE;
+  float sum = 0.0f;
+
+  for (uint32_t i = 0; i < n; i++)
+    {
+      *p += rate / ACQUISITION_RATE;
+      estimator_update (station, *p + noise (), pins);
+
+      if (i >= n / 2)
+        {
+          struct Estimate est;
+          estimator_get (station, &est);
+          sum += (est.p - *p) * (est.p - *p);
+        }
+    }
+
+  if (rms != NULL)
+    *rms = sqrtf (sum / (n - (n / 2)));
+}
+
+static void
+test_ramp (void)
+{
+  struct Estimate est;
+  float p = 10.0f;
+  float rms;
+
+  feed_ramp (0, &p, 20.0f, 2.0f, 1, &rms);
+  estimator_get (0, &est);
+  CHECK_NEAR (est.p, p, 0.1);
+  CHECK_NEAR (est.rate, 20.0, 2.0);
+  CHECK (rms < TEST_NOISE / 2);
+
+  /* The exhaust opens, on the new slope within 50 scans. Without the
+   * switch to go by, the filter takes twice as long */
+  feed_ramp (0, &p, -30.0f, 0.05f, 2, NULL);
+  estimator_get (0, &est);
+  CHECK_NEAR (est.p, p, 0.1);
+  CHECK_NEAR (est.rate, -30.0, 3.0);
+
+  feed_ramp (0, &p, -30.0f, 1.0f, 2, &rms);
+  estimator_get (0, &est);
+  CHECK_NEAR (est.p, p, 0.1);
+  CHECK_NEAR (est.rate, -30.0, 2.0);
+  CHECK (rms < TEST_NOISE / 2);
+
+  /* Holding still */
+  feed_ramp (0, &p, 0.0f, 2.0f, 0, &rms);
+  estimator_get (0, &est);
+  CHECK_NEAR (est.p, p, 0.1);
+  CHECK_NEAR (est.rate, 0.0, 2.0);
+}
+
+static void
+test_stations (void)
+{
+  struct Estimate est;
+
+#if PRESSURE_STATIONS > 1
+  /* The other station starts from its own first sample */
+  float p = 100.0f;
+  feed_ramp (1, &p, -10.0f, 2.0f, 0, NULL);
+  estimator_get (1, &est);
+  CHECK_NEAR (est.p, p, 0.1);
+  CHECK_NEAR (est.rate, -10.0, 2.0);
+
+  estimator_get (0, &est);
+  CHECK_NEAR (est.rate, 0.0, 2.0);
+#endif
+
+  estimator_update (PRESSURE_STATIONS, 1.0f, 0);
+  est.p = 1.0f;
+  estimator_get (PRESSURE_STATIONS, &est);
+  CHECK (est.p == 0.0f && est.rate == 0.0f);
+}
+
+int
+main (void)
+{
+  test_ramp ();
+  test_stations ();
+
+  return test_result ("test_estimator");
+}
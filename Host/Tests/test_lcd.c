@@ -0,0 +1,113 @@
+/**
+ * @file test_lcd.c
+ *
+ * @brief Asynchronous LCD driver tests
+ *
+ *        Draws into the frame, flushes it, and reads back what the simulated
+ *        HD44780 latched from the PCF8574 writes: text where it was drawn,
+ *        only changed cells sent again, and whole frames that wrap around
+ *        the I2C queue.
+ */
+
+#include "lcd.h"
+#include "sim.h"
+#include "test.h"
+
+#include <string.h>
+
+static uint32_t test_idle = 0; /*!< Times the bus went idle */
+
+static void
+count_idle (void)
+{
+  test_idle++;
+}
+
+/**
+ * @brief Checks a row of the panel
+ *
+ * @param y Row
+ * @param text What it must show, LCD_COLS characters
+ *
+ * @retval None
+ */
+static void
+check_row (uint8_t y, const char *text)
+{
+  uint8_t frame[LCD_ROWS][LCD_COLS];
+  char row[LCD_COLS + 1];
+
+  sim_lcd_frame (frame);
+  memcpy (row, frame[y], LCD_COLS);
+  row[LCD_COLS] = '\0';
+  CHECK_STR (row, text);
+}
+
+static void
+test_draw (void)
+{
+  lcd_set_cursor (0, 0);
+  lcd_write_string ("Cur: 12.5 psi");
+  lcd_set_cursor (15, 3);
+  lcd_write_string ("past the end");
+  lcd_flush ();
+  sim_advance (100000);
+
+  check_row (0, "Cur: 12.5 psi       ");
+  check_row (1, "                    ");
+  check_row (3, "               past ");
+  CHECK (test_idle == 1);
+
+  /* Only the changed cells go out */
+  uint32_t idle = test_idle;
+  lcd_flush ();
+  sim_advance (100000);
+  CHECK (test_idle == idle);
+
+  lcd_set_cursor (5, 0);
+  lcd_write_string ("13.0");
+  lcd_flush ();
+  sim_advance (100000);
+  check_row (0, "Cur: 13.0 psi       ");
+  check_row (3, "               past ");
+  CHECK (test_idle == idle + 1);
+}
+
+static void
+test_wrap (void)
+{
+  char text[LCD_COLS + 1];
+
+  /* A whole frame is over half the queue, so every other one wraps */
+  for (uint8_t i = 0; i < 5; i++)
+    {
+      memset (text, 'A' + i, LCD_COLS);
+      text[LCD_COLS] = '\0';
+      for (uint8_t y = 0; y < LCD_ROWS; y++)
+        {
+          lcd_set_cursor (0, y);
+          lcd_write_string (text);
+        }
+
+      uint32_t idle = test_idle;
+      lcd_flush ();
+      sim_advance (100000);
+
+      for (uint8_t y = 0; y < LCD_ROWS; y++)
+        check_row (y, text);
+      CHECK (test_idle == idle + 1);
+    }
+}
+
+int
+main (void)
+{
+  sim_init ();
+  sim_lcd_watch (count_idle);
+  lcd_init (&hi2c2);
+
+  test_draw ();
+  test_wrap ();
+
+  return test_result ("test_lcd");
+}
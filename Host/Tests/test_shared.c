@@ -0,0 +1,202 @@
+/**
+ * @file test_shared.c
+ *
+ * @brief Interrupt-safe shared state tests
+ *
+ *        Runs each side of the flags, snapshots and queues on its own
+ *        thread, so they race for real instead of in the turns the
+ *        simulated interrupts take. A store-exclusive that doesn't fail
+ *        when it should, or a missing barrier, shows up as a lost event, a
+ *        torn copy or a slot out of order. Races are most likely with a core
+ *        per thread.
+ */
+
+#include "shared.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define TEST_ROUNDS 1000000 /*!< Updates made by each writer */
+#define TEST_WORDS 16       /*!< Size of the snapshot */
+#define TEST_SLOTS 64       /*!< Size of the queue */
+
+/* Struct containing one side of the flags test */
+struct TestFlagger
+{
+  uint32_t mask;   /*!< Bits it owns */
+  uint32_t events; /*!< Times it set a bit that was clear */
+};
+
+static struct SharedFlags test_flags;
+static volatile int test_done;
+
+static struct SharedSeq test_seq;
+static uint32_t test_snapshot[TEST_WORDS];
+
+static struct SharedQueue test_queue;
+static uint32_t test_slots[TEST_SLOTS];
+
+static void *
+flags_setter (void *arg)
+{
+  struct TestFlagger *side = arg;
+
+  for (uint32_t i = 0; i < TEST_ROUNDS; i++)
+    {
+      /* One bit at a time, so every bit sees sets and takes */
+      uint32_t bit = 1U << (i % 16);
+      if (side->mask & 0xFFFF0000U)
+        bit <<= 16;
+
+      if (!shared_flags_set (&test_flags, bit))
+        side->events++;
+    }
+
+  return NULL;
+}
+
+static void
+test_flags_race (void)
+{
+  struct TestFlagger low = { .mask = 0x0000FFFFU };
+  struct TestFlagger high = { .mask = 0xFFFF0000U };
+  uint32_t taken[2] = { 0 };
+  pthread_t threads[2];
+
+  test_flags.bits = 0;
+  pthread_create (&threads[0], NULL, flags_setter, &low);
+  pthread_create (&threads[1], NULL, flags_setter, &high);
+
+  /* Every event set is taken exactly once */
+  for (uint32_t i = 0; i < TEST_ROUNDS; i++)
+    {
+      uint32_t bits = shared_flags_take (&test_flags, 0xFFFFFFFFU);
+      taken[0] += __builtin_popcount (bits & low.mask);
+      taken[1] += __builtin_popcount (bits & high.mask);
+    }
+
+  pthread_join (threads[0], NULL);
+  pthread_join (threads[1], NULL);
+
+  uint32_t bits = shared_flags_take (&test_flags, 0xFFFFFFFFU);
+  taken[0] += __builtin_popcount (bits & low.mask);
+  taken[1] += __builtin_popcount (bits & high.mask);
+
+  CHECK (taken[0] == low.events);
+  CHECK (taken[1] == high.events);
+  CHECK (low.events > 0 && high.events > 0);
+  CHECK (shared_flags_test (&test_flags, 0xFFFFFFFFU) == 0);
+}
+
+static void *
+seq_writer (void *arg)
+{
+  uint32_t words[TEST_WORDS];
+
+  (void)arg;
+  for (uint32_t i = 1; i <= TEST_ROUNDS; i++)
+    {
+      for (uint8_t w = 0; w < TEST_WORDS; w++)
+        words[w] = i;
+      shared_seq_write (&test_seq, test_snapshot, words, sizeof (words));
+    }
+
+  test_done = 1;
+  return NULL;
+}
+
+static void
+test_seq_race (void)
+{
+  uint32_t words[TEST_WORDS];
+  uint32_t last = 0;
+  uint32_t torn = 0;
+  uint32_t reads = 0;
+  pthread_t thread;
+
+  test_done = 0;
+  pthread_create (&thread, NULL, seq_writer, NULL);
+
+  /* A copy is never a mix of two writes, and never goes back */
+  while (!test_done)
+    {
+      shared_seq_read (&test_seq, words, test_snapshot, sizeof (words));
+      for (uint8_t w = 1; w < TEST_WORDS; w++)
+        if (words[w] != words[0])
+          torn++;
+      if (words[0] < last)
+        torn++;
+      last = words[0];
+      reads++;
+    }
+
+  pthread_join (thread, NULL);
+
+  shared_seq_read (&test_seq, words, test_snapshot, sizeof (words));
+  CHECK (torn == 0);
+  CHECK (reads > 0);
+  CHECK (words[0] == TEST_ROUNDS);
+  CHECK (test_seq.seq == 2 * TEST_ROUNDS);
+}
+
+static void *
+queue_producer (void *arg)
+{
+  (void)arg;
+  for (uint32_t i = 0; i < TEST_ROUNDS;)
+    {
+      /* Lets the consumer run if both share a core */
+      int32_t slot = shared_queue_reserve (&test_queue);
+      if (slot < 0)
+        {
+          sched_yield ();
+          continue;
+        }
+
+      test_slots[slot] = i++;
+      shared_queue_commit (&test_queue);
+    }
+
+  return NULL;
+}
+
+static void
+test_queue_race (void)
+{
+  uint32_t next = 0;
+  uint32_t wrong = 0;
+  pthread_t thread;
+
+  shared_queue_init (&test_queue, TEST_SLOTS);
+  pthread_create (&thread, NULL, queue_producer, NULL);
+
+  /* Everything pushed comes out once, in order */
+  while (next < TEST_ROUNDS)
+    {
+      uint16_t count = shared_queue_count (&test_queue);
+      CHECK (count <= TEST_SLOTS);
+      if (count == 0)
+        sched_yield ();
+
+      for (uint16_t i = 0; i < count; i++)
+        if (test_slots[shared_queue_peek (&test_queue, i)] != next++)
+          wrong++;
+      shared_queue_release (&test_queue, count);
+    }
+
+  pthread_join (thread, NULL);
+
+  CHECK (wrong == 0);
+  CHECK (shared_queue_count (&test_queue) == 0);
+}
+
+int
+main (void)
+{
+  test_flags_race ();
+  test_seq_race ();
+  test_queue_race ();
+
+  return test_result ("test_shared");
+}
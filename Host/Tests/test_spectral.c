@@ -0,0 +1,157 @@
+/**
+ * @file test_spectral.c
+ *
+ * @brief Streaming spectral analyzer tests
+ *
+ *        Feeds synthetic sines with a known gain, phase and harmonic content
+ *        through the analyzer, one cycle at a time, the way a sine test does
+ *        on every control tick.
+ */
+
+#include "pressure.h"
+#include "spectral.h"
+#include "test.h"
+
+#include <math.h>
+#include <stddef.h>
+
+#define TEST_OFFSET 15.0f /*!< Offset of both signals in psi */
+#define TEST_AMPL 10.0f   /*!< Amplitude of the target in psi */
+
+/* Struct describing the pressure that follows a sinusoidal target */
+struct TestSignal
+{
+  float gain;            /*!< Fundamental of the pressure over the target's */
+  float phase;           /*!< Phase of the pressure in deg */
+  float harm[SPECTRAL_BINS]; /*!< Amplitude of harmonic k + 1 over the
+                                  fundamental's, harm[0] unused */
+};
+
+/**
+ * @brief Feeds one cycle and ends it
+ *
+ * @param sig Pressure to synthesize
+ * @param n Samples per cycle
+ *
+ * @retval uint8_t Return value of spectral_cycle
+ */
+static uint8_t
+feed_cycle (const struct TestSignal *sig, uint16_t n)
+{
+  for (uint16_t i = 0; i < n; i++)
+    {
+      float w = (2 * M_PI * i) / n;
+      float phi = sig->phase * M_PI / 180.0f;
+      float fund = sig->gain * TEST_AMPL;
+      float val = TEST_OFFSET + fund * sinf (w + phi);
+
+      for (uint8_t k = 1; k < SPECTRAL_BINS; k++)
+        val += sig->harm[k] * fund * sinf ((k + 1) * w);
+
+      spectral_update (0, val, TEST_OFFSET + TEST_AMPL * sinf (w));
+    }
+
+  return spectral_cycle (0);
+}
+
+static void
+test_gain_phase (void)
+{
+  const struct TestSignal sig = { .gain = 0.8f, .phase = -30.0f };
+
+  spectral_start (0);
+  CHECK (feed_cycle (&sig, 100) == 0);
+  CHECK (feed_cycle (&sig, 100) == 1);
+
+  const struct SpectralResult *res = spectral_get_result (0);
+  CHECK (res->cycle == 1);
+  CHECK (res->n == 100);
+  CHECK_NEAR (res->gain, 0.8, 1e-3);
+  CHECK_NEAR (res->phase, -30.0, 0.1);
+  CHECK_NEAR (res->thd, 0.0, 1e-3);
+
+  /* Leading, across the wrap of the phase */
+  const struct TestSignal lead = { .gain = 1.2f, .phase = 170.0f };
+  CHECK (feed_cycle (&lead, 100) == 1);
+  CHECK (res->cycle == 2);
+  CHECK_NEAR (res->gain, 1.2, 1e-3);
+  CHECK_NEAR (res->phase, 170.0, 0.1);
+
+  const struct TestSignal lag = { .gain = 1.0f, .phase = -170.0f };
+  CHECK (feed_cycle (&lag, 100) == 1);
+  CHECK_NEAR (res->phase, -170.0, 0.1);
+}
+
+static void
+test_thd (void)
+{
+  struct TestSignal sig = { .gain = 0.9f, .phase = -45.0f };
+  sig.harm[1] = 0.10f;
+  sig.harm[2] = 0.05f;
+  sig.harm[SPECTRAL_BINS - 1] = 0.02f;
+
+  float thd = 0.0f;
+  for (uint8_t k = 1; k < SPECTRAL_BINS; k++)
+    thd += sig.harm[k] * sig.harm[k];
+  thd = sqrtf (thd);
+
+  spectral_start (0);
+  feed_cycle (&sig, 250);
+  CHECK (feed_cycle (&sig, 250) == 1);
+
+  const struct SpectralResult *res = spectral_get_result (0);
+  CHECK_NEAR (res->gain, 0.9, 1e-3);
+  CHECK_NEAR (res->phase, -45.0, 0.1);
+  CHECK_NEAR (res->thd, thd, 1e-3);
+}
+
+static void
+test_retune (void)
+{
+  const struct TestSignal sig = { .gain = 0.5f, .phase = -90.0f };
+
+  spectral_start (0);
+  CHECK (feed_cycle (&sig, 100) == 0);
+  CHECK (feed_cycle (&sig, 100) == 1);
+
+  /* A cycle of another length only re-tunes the filters */
+  CHECK (feed_cycle (&sig, 80) == 0);
+  CHECK (spectral_get_result (0)->cycle == 1);
+  CHECK (feed_cycle (&sig, 80) == 1);
+  CHECK (spectral_get_result (0)->n == 80);
+  CHECK_NEAR (spectral_get_result (0)->phase, -90.0, 0.1);
+
+  /* Too short to tell the harmonics apart */
+  CHECK (feed_cycle (&sig, 2 * SPECTRAL_BINS) == 0);
+  CHECK (feed_cycle (&sig, 2 * SPECTRAL_BINS) == 0);
+}
+
+static void
+test_stop (void)
+{
+  const struct TestSignal sig = { .gain = 1.0f };
+
+  spectral_start (0);
+  feed_cycle (&sig, 100);
+  feed_cycle (&sig, 100);
+  spectral_stop (0);
+  CHECK (feed_cycle (&sig, 100) == 0);
+  CHECK (spectral_get_result (0)->cycle == 1);
+
+  /* A new start drops the previous result */
+  spectral_start (0);
+  CHECK (spectral_get_result (0)->cycle == 0);
+  CHECK (spectral_get_result (PRESSURE_STATIONS) == NULL);
+  CHECK (spectral_cycle (PRESSURE_STATIONS) == 0);
+}
+
+int
+main (void)
+{
+  test_gain_phase ();
+  test_thd ();
+  test_retune ();
+  test_stop ();
+
+  return test_result ("test_spectral");
+}
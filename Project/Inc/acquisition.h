@@ -0,0 +1,47 @@
+/**
+ * @file acquisition.h
+ *
+ * @brief Multi-channel acquisition header
+ *
+ *        Contains the scan channel map, per-channel error statistics and
+ *        function prototypes for sampling the reference sensor together with
+ *        the devices under test (DUTs).
+ */
+
+#ifndef ACQUISITION_H_
+#define ACQUISITION_H_
+
+#include "pressure.h"
+#include <stdint.h>
+
+/* Scan layout: the reference, the DUTs, then the reference of every other
+ * station */
+#define ACQUISITION_DUT_CHANNELS 3 /*!< Number of DUTs sampled per scan */
+#define ACQUISITION_REF 0          /*!< Scan index of the reference sensor */
+#define ACQUISITION_DUT_FIRST 1    /*!< Scan index of the first DUT */
+#define ACQUISITION_DUT_END (ACQUISITION_DUT_FIRST + ACQUISITION_DUT_CHANNELS)
+#define ACQUISITION_CHANNELS (ACQUISITION_DUT_END + PRESSURE_STATIONS - 1)
+#define ACQUISITION_TIMEOUT 20     /*!< Scan timeout in ms */
+#define ACQUISITION_RATE 1000      /*!< Background scans per second */
+
+/* Struct containing the error statistics of one DUT against the reference */
+struct AcquisitionStats
+{
+  uint32_t n; /*!< Number of samples */
+  float mean; /*!< Mean error against the reference in psi */
+  float m2;   /*!< Sum of squared deviations from the mean error */
+  float max;  /*!< Largest absolute error against the reference in psi */
+};
+
+void acquisition_init (ADC_HandleTypeDef *hadc);
+void acquisition_tick (void);
+uint8_t acquisition_read (ADC_HandleTypeDef *hadc);
+uint8_t acquisition_wait (ADC_HandleTypeDef *hadc);
+uint16_t acquisition_get_code (uint8_t ch);
+float acquisition_get_psi (uint8_t ch);
+float acquisition_code_to_psi (uint16_t code);
+void acquisition_stats_reset (void);
+const struct AcquisitionStats *acquisition_get_stats (uint8_t ch);
+void acquisition_uart_tx_stats (UART_HandleTypeDef *huart);
+
+#endif // ACQUISITION_H_
@@ -0,0 +1,49 @@
+/**
+ * @file actuator.h
+ *
+ * @brief Hardware-timed actuator driver header
+ *
+ *        Contains the actuator list, timing limits and function prototypes for
+ *        switching the compressor and exhaust valve through timer
+ *        output-compare channels.
+ */
+
+#ifndef ACTUATOR_H_
+#define ACTUATOR_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/* Timing limits in us */
+#define ACTUATOR_MIN_ON 5000     /*!< Shortest pulse an actuator responds to */
+#define ACTUATOR_DEAD_TIME 20000 /*!< Both off between compressor and exhaust */
+#define ACTUATOR_LEAD 5          /*!< Edges closer than this are forced now */
+#define ACTUATOR_LAG 20000       /*!< Pressure keeps moving this long after
+                                      an off edge */
+#define ACTUATOR_TICK 100000     /*!< Control tick period */
+#define ACTUATOR_HOLD (2 * ACTUATOR_TICK) /*!< Keeps an actuator on across a
+                                               control tick */
+
+/* Actuators, compressor then exhaust of each station, see actuator_map */
+enum actuator
+{
+  ACTUATOR_COMPRESSOR, /*!< D13, TIM2_CH1 */
+  ACTUATOR_EXHAUST,    /*!< D3,  TIM2_CH2 */
+#ifdef PRESSURE_BOARD_DUAL
+  ACTUATOR_COMPRESSOR2, /*!< PA2, TIM2_CH3 */
+  ACTUATOR_EXHAUST2,    /*!< PA3, TIM2_CH4 */
+#endif
+  ACTUATORS
+};
+
+void actuator_init (void);
+uint8_t actuator_pulse (uint8_t dev, uint32_t width);
+void actuator_stop (uint8_t dev);
+uint8_t actuator_active (uint8_t dev);
+uint8_t actuator_idle (void);
+uint32_t actuator_switches (uint8_t dev);
+uint8_t actuator_pins (void);
+void actuator_trip (void);
+void actuator_release (void);
+
+#endif // ACTUATOR_H_
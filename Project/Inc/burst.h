@@ -0,0 +1,40 @@
+/**
+ * @file burst.h
+ *
+ * @brief Compressed burst telemetry header
+ *
+ *        Contains the block layout, encoder statistics and function
+ *        prototypes for streaming every scan in compressed blocks.
+ */
+
+#ifndef BURST_H_
+#define BURST_H_
+
+#include "acquisition.h"
+#include <stdint.h>
+
+#define BURST_SCANS 256 /*!< Scans buffered, power of two */
+#define BURST_BLOCK 100 /*!< Scans per block */
+
+/* Largest payload: a keyframe, then deltas of at most two bytes */
+#define BURST_PAYLOAD_MAX                                                     \
+  ((ACQUISITION_CHANNELS * 2) * BURST_BLOCK)
+
+/* Struct containing the encoder statistics since burst mode was enabled */
+struct BurstStats
+{
+  uint32_t blocks;  /*!< Blocks sent */
+  uint32_t scans;   /*!< Scans sent */
+  uint32_t bytes;   /*!< Payload bytes sent, headers excluded */
+  uint32_t cycles;  /*!< Core cycles spent encoding */
+  uint32_t dropped; /*!< Scans lost to a full buffer */
+};
+
+void burst_enable (uint8_t on);
+uint8_t burst_enabled (void);
+void burst_record (const uint16_t *scan);
+void burst_uart_tx (UART_HandleTypeDef *huart);
+const struct BurstStats *burst_get_stats (void);
+void burst_uart_tx_stats (UART_HandleTypeDef *huart);
+
+#endif // BURST_H_
@@ -0,0 +1,63 @@
+/**
+ * @file calibration.h
+ *
+ * @brief Sensor linearization header
+ *
+ *        Contains the multi-point calibration tables, the precomputed
+ *        correction grid and function prototypes for the calibration curve
+ *        subsystem.
+ */
+
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include "acquisition.h"
+#include <stdint.h>
+
+/* Table and grid sizes */
+#define CALIBRATION_MAX_POINTS 8       /*!< Points per calibration table */
+#define CALIBRATION_GRID_SHIFT 6       /*!< log2 of ADC codes per grid cell */
+#define CALIBRATION_GRID_CELLS (4096 >> CALIBRATION_GRID_SHIFT)
+#define CALIBRATION_CAPTURE_SAMPLES 32 /*!< Scans averaged per captured point */
+
+/* Tables storage, the sector before the tuned gains on a 512K part, reserved
+ * in the linker script */
+#define CALIBRATION_FLASH_SECTOR FLASH_SECTOR_6
+#define CALIBRATION_FLASH_ADDR 0x08040000UL
+#define CALIBRATION_MAGIC 0x43414C42UL /*!< "CALB" */
+
+/* Interpolation between table points */
+enum calibration_method
+{
+  CALIBRATION_LINEAR, /*!< Piecewise-linear */
+  CALIBRATION_CUBIC   /*!< Monotone cubic (Fritsch-Carlson) */
+};
+
+/* Struct containing the measured points of one sensor */
+struct CalibrationTable
+{
+  uint8_t n;                             /*!< Number of points */
+  uint8_t method;                        /*!< enum calibration_method */
+  uint16_t code[CALIBRATION_MAX_POINTS]; /*!< Raw ADC codes, ascending */
+  float psi[CALIBRATION_MAX_POINTS];     /*!< True pressure at each code */
+};
+
+/* Struct containing the uniform correction grid of one sensor */
+struct CalibrationCurve
+{
+  float base[CALIBRATION_GRID_CELLS];  /*!< Pressure at the start of a cell */
+  float slope[CALIBRATION_GRID_CELLS]; /*!< Pressure per code in a cell */
+};
+
+void calibration_init (void);
+void calibration_build (uint8_t ch);
+float calibration_apply (uint8_t ch, uint16_t code);
+struct CalibrationTable *calibration_get_table (uint8_t ch);
+void calibration_capture_begin (uint8_t ch, uint8_t method);
+uint8_t calibration_capture_point (ADC_HandleTypeDef *hadc, uint8_t ch,
+                                   float psi);
+uint8_t calibration_capture_duts (ADC_HandleTypeDef *hadc);
+void calibration_capture_end (uint8_t ch);
+void calibration_save (void);
+
+#endif // CALIBRATION_H_
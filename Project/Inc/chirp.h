@@ -0,0 +1,31 @@
+/**
+ * @file chirp.h
+ *
+ * @brief Swept-sine waveform header
+ *
+ *        Contains the sweep settings and function prototypes for generating
+ *        linear and logarithmic chirps.
+ */
+
+#ifndef CHIRP_H_
+#define CHIRP_H_
+
+#include <stdint.h>
+
+/* Struct containing the swept-sine settings */
+struct Chirp
+{
+  float f_start;    /*!< Frequency at the start of the sweep in Hz */
+  float f_end;      /*!< Frequency at the end of the sweep in Hz */
+  float duration;   /*!< Length of the sweep in sec */
+  uint8_t log;      /*!< 0 : linear sweep, 1 : logarithmic sweep */
+  float ampl_end;   /*!< Amplitude at the end of the sweep, 0 keeps .ampl */
+  uint8_t segments; /*!< Number of segments marked in telemetry */
+};
+
+float chirp_phase (const struct Chirp *chirp, float t);
+float chirp_freq (const struct Chirp *chirp, float t);
+float chirp_ampl (const struct Chirp *chirp, float ampl, float t);
+uint8_t chirp_segment (const struct Chirp *chirp, float t);
+
+#endif // CHIRP_H_
@@ -0,0 +1,23 @@
+/**
+ * @file command.h
+ *
+ * @brief Serial command protocol header
+ *
+ *        Contains buffer sizes and function prototypes for the line based
+ *        command parser fed by the UART receive interrupt.
+ */
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include "pressure.h"
+#include <stdint.h>
+
+#define COMMAND_RX_SIZE 128   /*!< RX ring buffer size, power of two */
+#define COMMAND_LINE_SIZE 48  /*!< Longest accepted command line */
+#define COMMAND_POLL_BYTES 32 /*!< Bytes consumed per call to command_poll */
+
+void command_init (UART_HandleTypeDef *huart);
+void command_poll (struct Pressure *pressure);
+
+#endif // COMMAND_H_
@@ -0,0 +1,36 @@
+/**
+ * @file ensemble.h
+ *
+ * @brief Cycle-averaged response header
+ *
+ *        Contains the phase bin statistics and function prototypes for the
+ *        ensemble averager that folds every completed cycle of a periodic
+ *        test onto one averaged cycle.
+ */
+
+#ifndef ENSEMBLE_H_
+#define ENSEMBLE_H_
+
+#include "main.h"
+#include <stdint.h>
+
+#define ENSEMBLE_BINS 40     /*!< Phase bins per cycle */
+#define ENSEMBLE_SAMPLES 256 /*!< Samples of the current cycle kept, even */
+
+/* Struct containing the statistics of one phase bin across cycles */
+struct EnsembleBin
+{
+  uint32_t n; /*!< Cycles folded into the bin */
+  float mean; /*!< Average pressure in psi */
+  float m2;   /*!< Sum of squared deviations from the mean */
+};
+
+void ensemble_start (uint8_t station);
+void ensemble_stop (uint8_t station);
+void ensemble_update (uint8_t station, float val);
+void ensemble_cycle (uint8_t station);
+uint32_t ensemble_cycles (uint8_t station);
+const struct EnsembleBin *ensemble_get_bin (uint8_t station, uint8_t bin);
+void ensemble_uart_tx (uint8_t station, UART_HandleTypeDef *huart);
+
+#endif // ENSEMBLE_H_
@@ -0,0 +1,31 @@
+/**
+ * @file estimator.h
+ *
+ * @brief Pressure and rate estimator header
+ *
+ *        Contains the filter tuning, the estimate and function prototypes for
+ *        the two-state Kalman filter run on every background scan.
+ */
+
+#ifndef ESTIMATOR_H_
+#define ESTIMATOR_H_
+
+#include <stdint.h>
+
+/* Filter tuning */
+#define ESTIMATOR_R 0.01f /*!< Reference sensor noise variance in psi^2 */
+#define ESTIMATOR_Q 50.0f /*!< Rate random walk in (psi/s)^2 per sec */
+#define ESTIMATOR_SWITCH_VAR 25.0f /*!< Rate variance added whenever an
+                                        actuator switches, in (psi/s)^2 */
+
+/* Struct containing the estimated state of the tank */
+struct Estimate
+{
+  float p;    /*!< Pressure in psi */
+  float rate; /*!< Rate of change in psi/sec */
+};
+
+void estimator_update (uint8_t station, float z, uint8_t pins);
+void estimator_get (uint8_t station, struct Estimate *est);
+
+#endif // ESTIMATOR_H_
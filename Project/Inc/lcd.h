@@ -0,0 +1,35 @@
+/**
+ * @file lcd.h
+ *
+ * @brief Asynchronous LCD driver header
+ *
+ *        Contains the panel geometry, PCF8574 backpack wiring and function
+ *        prototypes for drawing on the LCD without blocking on I2C.
+ */
+
+#ifndef LCD_H_
+#define LCD_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/* Panel geometry */
+#define LCD_COLS 20
+#define LCD_ROWS 4
+
+/* PCF8574 backpack, address must match the one in I2C_LCD_cfg.c */
+#define LCD_ADDR (0x27 << 1)
+#define LCD_RS 0x01 /*!< P0 */
+#define LCD_EN 0x04 /*!< P2 */
+#define LCD_BL 0x08 /*!< P3, backlight */
+
+#define LCD_QUEUE_SIZE 512 /*!< I2C bytes queued, power of two */
+
+void lcd_init (I2C_HandleTypeDef *hi2c);
+void lcd_clear (void);
+void lcd_set_cursor (uint8_t x, uint8_t y);
+void lcd_write_string (const char *str);
+void lcd_print_custom_char (uint8_t idx);
+void lcd_flush (void);
+
+#endif // LCD_H_
@@ -0,0 +1,55 @@
+/**
+ * @file leak.h
+ *
+ * @brief Leak-rate test header
+ *
+ *        Contains the leak test settings, the fit result and function
+ *        prototypes for estimating the decay of an isolated tank.
+ */
+
+#ifndef LEAK_H_
+#define LEAK_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/* Fit */
+#define LEAK_SETTLE 5.0f     /*!< Ignored after isolating, in sec */
+#define LEAK_MIN_TIME 10.0f  /*!< Shortest fit before it may end, in sec */
+#define LEAK_MIN_SAMPLES 20  /*!< Fewest samples before it may end */
+#define LEAK_Z 1.96f         /*!< Confidence interval half-width in std errs */
+#define LEAK_PRECISION 0.1f  /*!< Interval considered tight, rel. to .max */
+
+/* Struct containing the leak test settings */
+struct LeakConfig
+{
+  float max;     /*!< Largest leak rate that passes in psi/min */
+  float timeout; /*!< Longest hold in sec */
+};
+
+/* Outcomes of a leak test */
+enum leak_verdict
+{
+  LEAK_PENDING, /*!< Not enough data to decide */
+  LEAK_PASS,
+  LEAK_FAIL
+};
+
+/* Struct containing the current estimate */
+struct LeakResult
+{
+  uint32_t n;        /*!< Samples fitted */
+  float t;           /*!< Length of the fit in sec */
+  float p;           /*!< Fitted pressure at the end of the fit in psi */
+  float rate;        /*!< Leak rate in psi/min, positive when decaying */
+  float conf;        /*!< Half-width of the confidence interval in psi/min */
+  uint8_t verdict;   /*!< enum leak_verdict */
+  uint8_t converged; /*!< Set once the fit may end */
+};
+
+void leak_begin (uint8_t station, float max);
+uint8_t leak_step (uint8_t station, float t, float p);
+const struct LeakResult *leak_get (uint8_t station);
+void leak_uart_tx (uint8_t station, UART_HandleTypeDef *huart);
+
+#endif // LEAK_H_
@@ -101,11 +101,11 @@ static unsigned char lcd_char_scr_qt_4_4[8] = {
   0b00011  //
 };
 
-/* Waveform strings that are iterated through like values */
-static const char *const waveforms[] = { "Const", "Step", "Ramp", "Sine" };
-
 void menu_sm_init (void);
 void menu_sm (struct Pressure *pressure);
 void menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt);
+uint8_t menu_get_waveform (struct Pressure *pressure);
+void menu_set_waveform (struct Pressure *pressure, uint8_t idx);
+void menu_sm_output (struct Pressure *pressure);
 
 #endif // MENU_H_
@@ -9,7 +9,12 @@
 #ifndef PRESSURE_H_
 #define PRESSURE_H_
 
+#include "chirp.h"
+#include "leak.h"
 #include "main.h"
+#include "shared.h"
+#include "trace.h"
+#include "waveform.h"
 #include <stdint.h>
 
 /* Compressor, valve, sensor pinout */
@@ -17,6 +22,17 @@
 #define PRESSURE_COMPRESSOR_PIN GPIO_PIN_5 /*!< D13 */
 #define PRESSURE_EXHAUST_PIN GPIO_PIN_3    /*!< D3  */
 
+/* Second station, only wired on the dual-station board. PA2 and PA3 carry the
+ * Nucleo's ST-LINK UART, so that board plots through another USART */
+#define PRESSURE_REF2_SENSOR_PIN GPIO_PIN_1 /*!< PB1, ADC_IN9  */
+#define PRESSURE_COMPRESSOR2_PIN GPIO_PIN_2 /*!< PA2, TIM2_CH3 */
+#define PRESSURE_EXHAUST2_PIN GPIO_PIN_3    /*!< PA3, TIM2_CH4 */
+
+/* Device under test sensor pinout */
+#define PRESSURE_DUT1_SENSOR_PIN GPIO_PIN_1 /*!< A1 (PA1) */
+#define PRESSURE_DUT2_SENSOR_PIN GPIO_PIN_4 /*!< A2 (PA4) */
+#define PRESSURE_DUT3_SENSOR_PIN GPIO_PIN_0 /*!< A3 (PB0) */
+
 /* Rotary encoder pinout */
 #define ROTARY_DT_PIN GPIO_PIN_10 /*!< D2 */
 #define ROTARY_CLK_PIN GPIO_PIN_9 /*!< D8 */
@@ -30,11 +46,148 @@
 #define PRESSURE_SENSOR_RANGE 3.3f /*!< Input voltage in Vdc      */
 #define ADC_READ_TIME 100          /*!< ADC conversion time in us */
 #define ADC_RESOLUTION 4096.0f     /*!< 12 bit ADC resolution     */
+#define PRESSURE_SENSOR_SPAN 200.0f /*!< Sensor reading at full scale in psi */
+#define PRESSURE_MAX 150.0f         /*!< Highest allowed tank pressure in psi */
+#define PRESSURE_SWITCH_TIME 0.8f   /*!< Shortest period of a test in sec, one
+                                         compressor and exhaust switching */
+
+/* Test stations wired to the board */
+#ifdef PRESSURE_BOARD_DUAL
+#define PRESSURE_STATIONS 2
+#else
+#define PRESSURE_STATIONS 1
+#endif
 
 /* Struct containing menu information */
 struct Menu
 {
-  int8_t output; /* Flag for determining if a test is currently running */
+  int8_t output;    /* Flag for determining if a test is currently running */
+  float prev_val;   /* Value being edited while in a SETVAL state */
+  uint8_t state;    /* State of the LCD state machine, see menu.c */
+  uint8_t waveform; /* Selected waveform, enum waveform in waveform.h */
+};
+
+/* Conditions that end a test */
+enum test_end
+{
+  TEST_END_ABORT,    /*!< Runs until the user interrupts */
+  TEST_END_CYCLES,   /*!< Runs for a number of waveform cycles */
+  TEST_END_DURATION  /*!< Runs for a number of seconds */
+};
+
+/* Struct containing the end condition and progress of the running test */
+struct Test
+{
+  uint8_t end;     /*!< enum test_end */
+  float limit;     /*!< Cycles or seconds, depending on end */
+  uint32_t cycles; /*!< Number of completed waveform cycles */
+  uint8_t aborted; /*!< Set if the user interrupted the test */
+};
+
+/* Struct containing the venting stage settings */
+struct Vent
+{
+  float threshold; /*!< Pressure considered ambient in psi */
+  float settle;    /*!< Time the tank must stay at ambient in sec */
+  float timeout;   /*!< Longest time the exhaust stays open in sec */
+  float alpha;     /*!< Pressure filter coefficient, between 0.0 and 1.0 */
+};
+
+/* Struct containing the hardware a station is wired to */
+struct StationMap
+{
+  uint8_t compressor; /*!< enum actuator of the compressor */
+  uint8_t exhaust;    /*!< enum actuator of the exhaust valve */
+  uint8_t ref;        /*!< Scan index of the reference sensor */
+  uint8_t duts;       /*!< Set if the DUTs are plumbed into this tank */
+};
+
+/* Flags set by the interrupt callbacks */
+enum control_flag
+{
+  CONTROL_ABORT = 0x01,     /*!< User interrupt flag */
+  CONTROL_ABORT_LCK = 0x02, /*!< User interrupt lock var */
+  CONTROL_TICK = 0x04       /*!< Set by the 100ms timer */
+};
+
+/* Struct containing the interrupt and pacing flags of a station */
+struct Control
+{
+  struct SharedFlags flags; /*!< enum control_flag */
+  uint8_t ticks;            /*!< Number of 100ms intervals */
+  uint64_t start;           /*!< Timebase at the start of the test */
+};
+
+/* Stages a station goes through, see pressure_poll */
+enum station_stage
+{
+  STAGE_IDLE,  /*!< Waiting for a test */
+  STAGE_TEST,  /*!< Runner stepped on every tick */
+  STAGE_TRACE, /*!< Waiting for a triggered capture to complete */
+  STAGE_VENT,  /*!< Depressurizing */
+  STAGE_SAVE   /*!< Waiting for every actuator to be off to write flash */
+};
+
+/* Records a runner leaves to be stored once the tank has been vented */
+enum run_save
+{
+  RUN_SAVE_NONE,
+  RUN_SAVE_TUNE, /*!< Tuned gains, tune_save */
+  RUN_SAVE_CAL   /*!< Calibration tables, calibration_save */
+};
+
+/* Ramps a runner can have in progress, see pressure_ramp_tick */
+enum ramp_kind
+{
+  RAMP_NONE,        /*!< Nothing in progress */
+  RAMP_NOCONSTRAIN, /*!< Started by pressure_ramp_noconstrain */
+  RAMP_V4,          /*!< Started by pressure_ramp_v4 */
+  RAMP_V3           /*!< Started by pressure_ramp_v3 */
+};
+
+/* Struct containing the ramp in progress */
+struct Ramp
+{
+  uint8_t kind;   /*!< enum ramp_kind */
+  uint8_t dev;    /*!< 1 : Compressor, 2 : Exhaust valve, 0 : Wait */
+  float target;   /*!< Target pressure */
+  float b_mx;     /*!< Upper bound of the allowed error band */
+  float b_mn;     /*!< Lower bound of the allowed error band */
+  uint32_t width; /*!< Pulse width in us */
+  float rate;     /*!< Rate seen while the actuator was on */
+};
+
+/* Struct containing the ramp settings of the point to point tests, step,
+ * ramp, sine, chirp and profile. 0 keeps the test's own */
+struct RampConfig
+{
+  float perr; /*!< Allowed error of a point, fraction of the target */
+  float sw;   /*!< Switching time of the components in sec, spaces the
+                   points of step, ramp, sine and chirp */
+};
+
+/* Struct containing the progress of a test and of the vent that follows it.
+ * Everything a runner keeps between two ticks lives here */
+struct Run
+{
+  uint8_t stage;    /*!< enum station_stage */
+  uint8_t waveform; /*!< enum waveform of the test */
+  uint8_t batch;    /*!< Set while the sequencer runs a batch */
+  uint8_t phase;    /*!< Runner specific step */
+  uint8_t save;     /*!< enum run_save */
+  uint16_t i;       /*!< Point of the cycle, or level */
+  uint16_t n;       /*!< Points per cycle */
+  int16_t seg;      /*!< Chirp segment of the last marker */
+  float t0;         /*!< Test time the runner's main phase started at */
+  float per;        /*!< Period of the profile generator in sec */
+  float integ;      /*!< Integral of the hold controller */
+  float filt;       /*!< Vent: filtered pressure */
+  float tau;        /*!< Vent: estimated time constant in sec */
+  float settled;    /*!< Vent: time spent near ambient in sec */
+  uint8_t ambient;  /*!< Vent: set once the tank is at ambient */
+  uint64_t since;   /*!< Timebase when the stage was entered */
+  struct Ramp ramp;
+  struct WaveformState wave; /*!< State of the profile generator */
 };
 
 /* Struct containing signal parameters, component handles and menu variables */
@@ -45,15 +198,55 @@ struct Pressure
   float ampl;                  /*!< Signal parameter: amplitude */
   float offset;                /*!< Signal parameter: offset */
   float target;                /*!< Current pressure target */
-  float tim3_elapsed;          /*!< Amount of time elapsed */
+  float elapsed;               /*!< Time elapsed during the test in sec */
   UART_HandleTypeDef *huart;   /*!< HAL UART handle */
   ADC_HandleTypeDef *hadc;     /*!< HAL ADC handle */
   TIM_HandleTypeDef *htim_enc; /*!< HAL TIM handle for rotary encoder */
   TIM_HandleTypeDef *htim_upd; /*!< HAL TIM handle for a 100ms timer */
+  uint8_t station;             /*!< Index of the station */
+  const struct StationMap *map;
+  struct Control ctl;
   struct Menu menu;
+  struct Test test;
+  struct Vent vent;
+  struct Chirp chirp;
+  struct Profile profile;
+  struct LeakConfig leak;
+  struct TraceConfig trace;
+  struct RampConfig ramps;
+  struct Run run;
 };
 
 void pressure_main (UART_HandleTypeDef *huart, ADC_HandleTypeDef *hadc,
                     TIM_HandleTypeDef *htim_enc, TIM_HandleTypeDef *htim_upd);
+void pressure_setup (UART_HandleTypeDef *huart, ADC_HandleTypeDef *hadc,
+                     TIM_HandleTypeDef *htim_enc, TIM_HandleTypeDef *htim_upd);
+void pressure_poll (void);
+void pressure_vent (struct Pressure *pressure);
+uint8_t pressure_vent_tick (struct Pressure *pressure);
+uint8_t pressure_test_done (struct Pressure *pressure);
+uint8_t pressure_testing (void);
+void pressure_request_abort (void);
+struct Pressure *pressure_get_station (uint8_t station);
+const struct StationMap *pressure_get_map (uint8_t station);
+uint8_t pressure_get_display (void);
+void pressure_set_display (uint8_t station);
+uint32_t pressure_timer_clock (void);
+void pressure_calib_static (struct Pressure *pressure);
+uint8_t pressure_calib_static_tick (struct Pressure *pressure);
+void pressure_calib_dynam_step (struct Pressure *pressure);
+uint8_t pressure_calib_dynam_step_tick (struct Pressure *pressure);
+void pressure_calib_dynam_ramp (struct Pressure *pressure);
+uint8_t pressure_calib_dynam_ramp_tick (struct Pressure *pressure);
+void pressure_calib_dynam_sine (struct Pressure *pressure);
+uint8_t pressure_calib_dynam_sine_tick (struct Pressure *pressure);
+void pressure_calib_dynam_chirp (struct Pressure *pressure);
+uint8_t pressure_calib_dynam_chirp_tick (struct Pressure *pressure);
+void pressure_calib_curve (struct Pressure *pressure);
+uint8_t pressure_calib_curve_tick (struct Pressure *pressure);
+void pressure_leak_test (struct Pressure *pressure);
+uint8_t pressure_leak_test_tick (struct Pressure *pressure);
+void pressure_autotune (struct Pressure *pressure);
+uint8_t pressure_autotune_tick (struct Pressure *pressure);
 
 #endif // PRESSURE_H_
@@ -0,0 +1,77 @@
+/**
+ * @file quality.h
+ *
+ * @brief Tracking quality header
+ *
+ *        Contains the tracking metrics, their baselines and function
+ *        prototypes for checking how well a test followed its waveform.
+ */
+
+#ifndef QUALITY_H_
+#define QUALITY_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/* Allowed regression against a baseline */
+#define QUALITY_TOLERANCE 0.2f  /*!< Relative, on every metric */
+#define QUALITY_SLACK_PSI 0.2f  /*!< Absolute, on RMS error and overshoot */
+#define QUALITY_SLACK_DEG 5.0f  /*!< Absolute, on phase lag */
+#define QUALITY_SLACK_SWITCH 2  /*!< Absolute, on actuator switches */
+
+#define QUALITY_MAX_BASELINES 32 /*!< Settings with a baseline */
+#define QUALITY_MATCH 0.005f     /*!< Settings closer than this, in sec or
+                                      psi, share a baseline */
+
+/* Baselines storage, the sector before the calibration tables on a 512K
+ * part */
+#define QUALITY_FLASH_SECTOR FLASH_SECTOR_5
+#define QUALITY_FLASH_ADDR 0x08020000UL
+#define QUALITY_MAGIC 0x51554C54UL /*!< "QULT" */
+
+/* Struct containing how well one test tracked its target */
+struct QualityMetrics
+{
+  uint32_t n;        /*!< Samples with a target */
+  float rms;         /*!< RMS tracking error in psi */
+  float overshoot;   /*!< Largest excursion above the target in psi */
+  float lag;         /*!< Phase lag of the fundamental in deg, sine only */
+  uint32_t switches; /*!< Compressor and exhaust on edges */
+};
+
+/* Struct containing the metrics of a known-good run
+ *
+ * Only compared against tests run with the same waveform and settings. */
+struct QualityBaseline
+{
+  uint8_t waveform;              /*!< enum waveform */
+  float per;                     /*!< Period in sec */
+  float ampl;                    /*!< Amplitude in psi */
+  float offset;                  /*!< Offset in psi */
+  struct QualityMetrics metrics; /*!< Metrics to stay within */
+};
+
+/* Outcomes of a comparison */
+enum quality_verdict
+{
+  QUALITY_NOBASE, /*!< No baseline for these settings */
+  QUALITY_PASS,
+  QUALITY_FAIL
+};
+
+void quality_init (void);
+void quality_start (uint8_t station, uint8_t waveform, float per, float ampl,
+                    float offset);
+void quality_update (uint8_t station, float val, float target);
+const struct QualityMetrics *quality_finish (uint8_t station,
+                                             uint8_t waveform);
+const struct QualityMetrics *quality_get (uint8_t station);
+uint8_t quality_check (uint8_t station, uint8_t waveform, float per,
+                       float ampl, float offset);
+void quality_uart_tx (uint8_t station, UART_HandleTypeDef *huart,
+                      uint8_t waveform, float per, float ampl, float offset);
+uint8_t quality_keep (uint8_t station);
+uint8_t quality_clear (void);
+void quality_uart_tx_baselines (UART_HandleTypeDef *huart);
+
+#endif // QUALITY_H_
@@ -0,0 +1,42 @@
+/**
+ * @file safety.h
+ *
+ * @brief Interrupt-level safety supervisor header
+ *
+ *        Contains trip causes, counters and function prototypes for the
+ *        supervisor that shuts the compressor off independently of the main
+ *        loop.
+ */
+
+#ifndef SAFETY_H_
+#define SAFETY_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/* Causes of a trip */
+enum safety_cause
+{
+  SAFETY_OVERPRESSURE, /*!< Analog watchdog saw the reference above max */
+  SAFETY_ABORT,        /*!< Test interrupted */
+  SAFETY_CAUSES
+};
+
+/* Struct containing the supervisor's counters */
+struct SafetyStats
+{
+  uint32_t trips[SAFETY_CAUSES]; /*!< Trips per cause */
+  uint32_t latency;     /*!< Cycles from the last event to the cut */
+  uint32_t latency_max; /*!< Largest latency seen in cycles */
+};
+
+void safety_init (ADC_HandleTypeDef *hadc, float max);
+void safety_check (uint16_t code);
+uint32_t safety_stamp (void);
+void safety_trip (uint8_t cause, uint32_t since);
+uint8_t safety_tripped (void);
+void safety_clear (void);
+void safety_get_stats (struct SafetyStats *stats);
+void safety_uart_tx (UART_HandleTypeDef *huart);
+
+#endif // SAFETY_H_
@@ -0,0 +1,71 @@
+/**
+ * @file sequencer.h
+ *
+ * @brief Batch test sequencer header
+ *
+ *        Contains the scripted test description, the parameter sweep and
+ *        function prototypes for running several tests back to back without
+ *        operator input.
+ */
+
+#ifndef SEQUENCER_H_
+#define SEQUENCER_H_
+
+#include "pressure.h"
+#include "quality.h"
+#include <stdint.h>
+
+#define SEQUENCER_MAX_TESTS 16   /*!< Largest script that can be appended */
+#define SEQUENCER_MAX_RESULTS 64 /*!< Tests kept in the results table */
+
+/* Struct containing one entry of a test script */
+struct SequencerTest
+{
+  uint8_t waveform; /*!< enum waveform in waveform.h */
+  float per;        /*!< Signal parameter: period */
+  float ampl;       /*!< Signal parameter: amplitude */
+  float offset;     /*!< Signal parameter: offset */
+  uint8_t end;      /*!< enum test_end, TEST_END_ABORT is not allowed */
+  float limit;      /*!< Cycles or seconds, depending on end */
+};
+
+/* Struct containing the values one signal parameter is swept over */
+struct SequencerAxis
+{
+  float start;   /*!< First value */
+  float stop;    /*!< Last value */
+  uint8_t count; /*!< Evenly spaced values from start to stop */
+};
+
+/* Struct containing a parameter sweep, every combination is one test */
+struct SequencerSweep
+{
+  uint8_t waveform;            /*!< enum waveform in waveform.h */
+  struct SequencerAxis per;    /*!< Period, slowest varying */
+  struct SequencerAxis ampl;   /*!< Amplitude */
+  struct SequencerAxis offset; /*!< Offset, fastest varying */
+  uint8_t end;                 /*!< enum test_end, not TEST_END_ABORT */
+  float limit;                 /*!< Cycles or seconds, depending on end */
+};
+
+/* Struct containing the outcome of one test of a batch */
+struct SequencerResult
+{
+  struct SequencerTest test;     /*!< Test that ran */
+  uint32_t cycles;               /*!< Cycles completed */
+  uint8_t aborted;               /*!< Set if interrupted */
+  uint8_t verdict;               /*!< enum quality_verdict */
+  struct QualityMetrics quality; /*!< Tracking metrics */
+};
+
+uint8_t sequencer_begin (struct Pressure *pressure);
+uint8_t sequencer_next (struct Pressure *pressure, uint8_t *waveform);
+void sequencer_record (struct Pressure *pressure);
+uint8_t sequencer_running (void);
+uint8_t sequencer_append (const struct SequencerTest *test);
+void sequencer_clear (void);
+void sequencer_uart_tx_script (UART_HandleTypeDef *huart);
+struct SequencerSweep *sequencer_get_sweep (void);
+uint8_t sequencer_use_sweep (void);
+
+#endif // SEQUENCER_H_
@@ -0,0 +1,56 @@
+/**
+ * @file shared.h
+ *
+ * @brief Interrupt-safe shared state header
+ *
+ *        Contains the structs and function prototypes for state shared
+ *        between interrupt callbacks and the main loop: event flags,
+ *        seqlock-protected snapshots and single producer, single consumer
+ *        queues. None of them disable interrupts.
+ */
+
+#ifndef SHARED_H_
+#define SHARED_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Struct containing a word of event flags */
+struct SharedFlags
+{
+  volatile uint32_t bits; /*!< One bit per flag */
+};
+
+/* Struct containing the sequence count of a snapshot */
+struct SharedSeq
+{
+  volatile uint32_t seq; /*!< Odd while the snapshot is being written */
+};
+
+/* Struct containing the indices of a ring of slots, storage is the caller's */
+struct SharedQueue
+{
+  volatile uint16_t head; /*!< Slots pushed, written by the producer */
+  volatile uint16_t tail; /*!< Slots popped, written by the consumer */
+  uint16_t size;          /*!< Number of slots, power of two */
+};
+
+uint32_t shared_flags_set (struct SharedFlags *flags, uint32_t mask);
+void shared_flags_clear (struct SharedFlags *flags, uint32_t mask);
+uint32_t shared_flags_take (struct SharedFlags *flags, uint32_t mask);
+uint32_t shared_flags_test (const struct SharedFlags *flags, uint32_t mask);
+
+void shared_seq_write (struct SharedSeq *seq, void *dst, const void *src,
+                       size_t len);
+void shared_seq_read (const struct SharedSeq *seq, void *dst, const void *src,
+                      size_t len);
+
+void shared_queue_init (struct SharedQueue *queue, uint16_t size);
+int32_t shared_queue_reserve (const struct SharedQueue *queue);
+void shared_queue_commit (struct SharedQueue *queue);
+uint16_t shared_queue_count (const struct SharedQueue *queue);
+uint16_t shared_queue_peek (const struct SharedQueue *queue, uint16_t i);
+void shared_queue_release (struct SharedQueue *queue, uint16_t n);
+void shared_queue_flush (struct SharedQueue *queue);
+
+#endif // SHARED_H_
@@ -0,0 +1,37 @@
+/**
+ * @file spectral.h
+ *
+ * @brief Streaming spectral analyzer header
+ *
+ *        Contains the per-cycle results and function prototypes for the
+ *        Goertzel analyzer that compares the measured pressure with the
+ *        target during periodic tests.
+ */
+
+#ifndef SPECTRAL_H_
+#define SPECTRAL_H_
+
+#include "main.h"
+#include <stdint.h>
+
+#define SPECTRAL_HARMONICS 4 /*!< Harmonics analyzed above the fundamental */
+#define SPECTRAL_BINS (1 + SPECTRAL_HARMONICS)
+
+/* Struct containing the analysis of one completed cycle */
+struct SpectralResult
+{
+  uint32_t cycle; /*!< Cycle number, starting from 1 */
+  uint16_t n;     /*!< Samples in the cycle */
+  float gain;     /*!< Fundamental of the pressure over that of the target */
+  float phase;    /*!< Phase of the pressure relative to the target in deg */
+  float thd;      /*!< Total harmonic distortion of the pressure */
+};
+
+void spectral_start (uint8_t station);
+void spectral_stop (uint8_t station);
+void spectral_update (uint8_t station, float val, float target);
+uint8_t spectral_cycle (uint8_t station);
+const struct SpectralResult *spectral_get_result (uint8_t station);
+void spectral_uart_tx (uint8_t station, UART_HandleTypeDef *huart);
+
+#endif // SPECTRAL_H_
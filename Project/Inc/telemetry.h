@@ -0,0 +1,51 @@
+/**
+ * @file telemetry.h
+ *
+ * @brief Adaptive telemetry header
+ *
+ *        Contains the telemetry rates, the policy thresholds and function
+ *        prototypes for streaming sensor frames at a rate that follows the
+ *        signal.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "acquisition.h"
+#include <stdint.h>
+
+#define TELEMETRY_FRAMES 64 /*!< Frames buffered, power of two */
+
+/* Policy thresholds */
+#define TELEMETRY_FAST_SLOPE 5.0f  /*!< psi/sec, above it goes fast */
+#define TELEMETRY_FAST_ERROR 2.0f  /*!< psi, above it goes fast */
+#define TELEMETRY_QUIET_SLOPE 0.2f /*!< psi/sec, below it counts as quiet */
+#define TELEMETRY_QUIET_ERROR 0.5f /*!< psi, below it counts as quiet */
+#define TELEMETRY_QUIET_TICKS 20   /*!< Quiet ticks before slowing down */
+
+/* Telemetry rates */
+enum telemetry_rate
+{
+  TELEMETRY_SLOW,   /*!< 1Hz */
+  TELEMETRY_NORMAL, /*!< 10Hz */
+  TELEMETRY_FAST,   /*!< 100Hz */
+  TELEMETRY_RATES
+};
+
+/* Struct containing one buffered frame */
+struct TelemetryFrame
+{
+  uint64_t t;                           /*!< Timebase when taken in us */
+  uint32_t n;                           /*!< Scan index */
+  uint16_t code[ACQUISITION_CHANNELS];  /*!< Raw codes, reference first */
+  uint16_t decim;                       /*!< Scans per frame when taken */
+  uint8_t pins;                         /*!< Actuator outputs when taken */
+  float target[PRESSURE_STATIONS];      /*!< Targets when taken */
+};
+
+void telemetry_record (const uint16_t *scan);
+void telemetry_policy (uint8_t station, float slope, float err);
+void telemetry_set_target (uint8_t station, float target);
+void telemetry_uart_tx (UART_HandleTypeDef *huart);
+
+#endif // TELEMETRY_H_
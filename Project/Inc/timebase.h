@@ -0,0 +1,19 @@
+/**
+ * @file timebase.h
+ *
+ * @brief Microsecond timebase header
+ *
+ *        Contains function prototypes for the monotonic 64 bit microsecond
+ *        clock shared by every module.
+ */
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <stdint.h>
+
+void timebase_init (void);
+uint64_t timebase_us (void);
+float timebase_elapsed (uint64_t since);
+
+#endif // TIMEBASE_H_
@@ -0,0 +1,62 @@
+/**
+ * @file trace.h
+ *
+ * @brief Raw trace capture header
+ *
+ *        Contains the record layout, trigger settings and function prototypes
+ *        for capturing raw samples around a fault at the full acquisition
+ *        rate.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "main.h"
+#include <stdint.h>
+
+#define TRACE_SIZE 2048 /*!< Records in the ring buffer, power of two */
+
+/* Causes that can trigger a capture, used as bits */
+enum trace_cause
+{
+  TRACE_OVERPRESSURE = 0x01, /*!< Reference above .overpressure */
+  TRACE_ABORT = 0x02,        /*!< Test interrupted */
+  TRACE_ERROR = 0x04         /*!< Tracking error above .error */
+};
+
+/* Struct containing one raw sample, as transmitted by trace_uart_tx */
+struct TraceRecord
+{
+  uint32_t t;    /*!< Timebase at the end of the scan in us, low 32 bits */
+  uint16_t code; /*!< Raw reference sensor code */
+  uint8_t pins;  /*!< Bit 0 : compressor, bit 1 : exhaust */
+  uint8_t flags; /*!< Trigger cause, on the record that triggered */
+};
+
+/* Struct containing the capture window and triggers */
+struct TraceConfig
+{
+  uint16_t pre;       /*!< Records kept from before the trigger */
+  uint16_t post;      /*!< Records taken after the trigger */
+  uint8_t triggers;   /*!< enum trace_cause bits allowed to trigger */
+  float overpressure; /*!< Reference pressure that triggers in psi */
+  float error;        /*!< Tracking error that triggers in psi */
+};
+
+/* Outcomes of trace_poll */
+enum trace_poll
+{
+  TRACE_WAITING, /*!< Triggered, still taking records */
+  TRACE_NONE,    /*!< Nothing triggered */
+  TRACE_CAPTURED /*!< Capture complete */
+};
+
+uint8_t trace_arm (uint8_t station, const struct TraceConfig *config);
+void trace_disarm (uint8_t station);
+void trace_record (uint8_t station, uint16_t code, uint8_t pins);
+void trace_trigger (uint8_t station, uint8_t cause);
+void trace_check_error (uint8_t station, float val, float target);
+uint8_t trace_poll (uint8_t station, uint64_t since);
+void trace_uart_tx (uint8_t station, UART_HandleTypeDef *huart);
+
+#endif // TRACE_H_
@@ -0,0 +1,49 @@
+/**
+ * @file tune.h
+ *
+ * @brief Relay auto-tuning header
+ *
+ *        Contains the relay experiment settings, the stored controller gains
+ *        and function prototypes for auto-tuning the pressure hold.
+ */
+
+#ifndef TUNE_H_
+#define TUNE_H_
+
+#include "main.h"
+#include <stdint.h>
+
+/* Relay experiment */
+#define TUNE_HYSTERESIS 0.5f /*!< Relay switches this far past the setpoint */
+#define TUNE_SKIP 2          /*!< Settling periods ignored */
+#define TUNE_PERIODS 4       /*!< Periods averaged for Ku and Tu */
+#define TUNE_TIMEOUT 300.0f  /*!< Experiment abandoned after this in sec */
+
+/* Gains storage, the last 128K sector of a 512K part, reserved in the
+ * linker script */
+#define TUNE_FLASH_SECTOR FLASH_SECTOR_7
+#define TUNE_FLASH_ADDR 0x08060000UL
+#define TUNE_MAGIC 0x54554E45UL /*!< "TUNE" */
+
+/* Struct containing the result of a relay experiment
+ *
+ * The controller output is a duty cycle from -1 (exhaust open for the whole
+ * tick) to 1 (compressor on for the whole tick). */
+struct TuneGains
+{
+  float ku; /*!< Ultimate gain in duty per psi */
+  float tu; /*!< Ultimate period in sec */
+  float kp; /*!< Proportional gain in duty per psi */
+  float ki; /*!< Integral gain in duty per psi-sec */
+};
+
+void tune_init (void);
+const struct TuneGains *tune_get_gains (uint8_t station);
+void tune_relay_begin (uint8_t station, float setpoint);
+int8_t tune_relay_step (uint8_t station, float p, float t);
+uint8_t tune_relay_done (uint8_t station);
+uint8_t tune_finish (uint8_t station);
+void tune_save (void);
+void tune_uart_tx (uint8_t station, UART_HandleTypeDef *huart);
+
+#endif // TUNE_H_
@@ -0,0 +1,77 @@
+/**
+ * @file waveform.h
+ *
+ * @brief Waveform registry header
+ *
+ *        Contains the list of waveforms, the settings of the profile
+ *        generators and function prototypes for looking waveforms up.
+ */
+
+#ifndef WAVEFORM_H_
+#define WAVEFORM_H_
+
+#include <stdint.h>
+
+#define WAVEFORM_MAX_POINTS 8 /*!< Points of a piecewise-linear profile */
+
+/* Waveforms, in the same order as the registry in waveform.c */
+enum waveform
+{
+  WAVEFORM_CONST,
+  WAVEFORM_STEP,
+  WAVEFORM_RAMP,
+  WAVEFORM_SINE,
+  WAVEFORM_TRAPEZOID,
+  WAVEFORM_STAIRS,
+  WAVEFORM_SEGMENTS,
+  WAVEFORM_CHIRP,
+  WAVEFORM_CURVE,
+  WAVEFORM_LEAK,
+  WAVEFORM_TUNE,
+  WAVEFORM_BATCH,
+  WAVEFORMS
+};
+
+/* Struct containing the settings of the profile generators */
+struct Profile
+{
+  float edge;     /*!< Trapezoid: rise and fall time in sec */
+  uint8_t steps;  /*!< Stairs: number of levels, including both ends */
+  uint8_t points; /*!< Segments: number of points in use */
+  float t[WAVEFORM_MAX_POINTS]; /*!< Segments: time of each point in sec */
+  float p[WAVEFORM_MAX_POINTS]; /*!< Segments: pressure at each point in psi */
+};
+
+/* Struct containing whatever a generator precomputes in its init */
+struct WaveformState
+{
+  float per;  /*!< Period in sec, 0 if the profile doesn't repeat */
+  float low;  /*!< Lowest setpoint in psi */
+  float high; /*!< Highest setpoint in psi */
+  float a;    /*!< Trapezoid: edge time, stairs: dwell time, in sec */
+  uint8_t top; /*!< Stairs: index of the highest level */
+  const struct Profile *profile; /*!< Settings the state was built from */
+};
+
+struct Pressure;
+
+/* Struct describing one entry of the registry. A waveform either steps its own
+ * runner, set up by .start and advanced by .tick once per control tick until
+ * it returns 1, or is a generator the common runner samples through .next.
+ * .init returns 0 if the settings don't make a profile */
+struct Waveform
+{
+  const char *name; /*!< Name shown on the LCD and through UART */
+  void (*start) (struct Pressure *pressure);
+  uint8_t (*tick) (struct Pressure *pressure);
+  uint8_t (*init) (struct WaveformState *state,
+                   const struct Pressure *pressure);
+  float (*next) (const struct WaveformState *state, float t);
+  float (*period) (const struct WaveformState *state);
+};
+
+const struct Waveform *waveform_get (uint8_t waveform);
+const char *waveform_name (uint8_t waveform);
+uint8_t waveform_add_point (struct Profile *profile, float t, float p);
+
+#endif // WAVEFORM_H_
@@ -0,0 +1,373 @@
+/**
+ * @file acquisition.c
+ *
+ * @brief Multi-channel acquisition program body
+ *
+ *        Samples the reference sensor and every DUT in a single ADC scan
+ *        sequence. The whole sequence is moved into one DMA buffer, so all
+ *        channels of a scan are taken within a few microseconds of each
+ *        other.
+ *
+ *        Scans are started in the background by TIM4 at ACQUISITION_RATE,
+ *        which sets the rate of the raw trace capture. The control code picks
+ *        up the most recent scan whenever it reads the sensors, through a
+ *        seqlock snapshot so it never sees half of two scans.
+ *
+ *        On the dual-station board the second station's reference is scanned
+ *        after the DUTs. The DUTs are only plumbed into the first station's
+ *        tank, so their statistics are always taken against its reference.
+ *
+ *        The ADC's DMA stream must be linked to the handle (CubeMX, half-word
+ *        transfers, normal mode). The scan sequence and TIM4 are configured
+ *        here, so TIM4 must be left disabled in CubeMX.
+ */
+
+#include "acquisition.h"
+#include "actuator.h"
+#include "calibration.h"
+#include "estimator.h"
+#include "safety.h"
+#include "shared.h"
+#include "stm32f4xx_hal.h"
+#include "telemetry.h"
+#include "timebase.h"
+#include "trace.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ACQUISITION_CPLT 0x01 /*!< Set once a scan has finished */
+
+/* ADC channel of each scan rank, reference first */
+static const uint32_t acquisition_channels[ACQUISITION_CHANNELS] = {
+  ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_4, ADC_CHANNEL_8,
+#ifdef PRESSURE_BOARD_DUAL
+  ADC_CHANNEL_9,
+#endif
+};
+
+static TIM_HandleTypeDef acquisition_htim; /*!< Sample clock */
+static ADC_HandleTypeDef *acquisition_hadc; /*!< ADC that samples the sensors */
+static uint16_t acquisition_buf[ACQUISITION_CHANNELS];  /*!< DMA buffer */
+static uint16_t acquisition_scan[ACQUISITION_CHANNELS]; /*!< Last scan done */
+static struct SharedSeq acquisition_seq; /*!< Guards acquisition_scan */
+static uint16_t acquisition_code[ACQUISITION_CHANNELS]; /*!< Last scan read */
+static float acquisition_psi[ACQUISITION_CHANNELS]; /*!< Last scan in psi */
+static struct AcquisitionStats
+    acquisition_stats[ACQUISITION_CHANNELS]; /*!< Errors against the ref */
+
+static struct SharedFlags acquisition_flags; /*!< ACQUISITION_CPLT */
+
+/**
+ * @brief ADC conversion complete callback
+ *
+ *        Called by the DMA once every rank of the scan sequence has been
+ *        transferred into acquisition_buf. Publishes the scan and hands the
+ *        reference of every station to its estimator and trace capture, and
+ *        the whole scan to the telemetry. References the analog watchdog
+ *        doesn't cover are checked for overpressure here.
+ *
+ * @retval None
+ */
+void
+HAL_ADC_ConvCpltCallback (ADC_HandleTypeDef *hadc)
+{
+  shared_seq_write (&acquisition_seq, acquisition_scan, acquisition_buf,
+                    sizeof (acquisition_scan));
+  shared_flags_set (&acquisition_flags, ACQUISITION_CPLT);
+
+  uint8_t pins = actuator_pins ();
+
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      const struct StationMap *map = pressure_get_map (i);
+      uint16_t code = acquisition_buf[map->ref];
+      uint8_t pair = (pins >> map->compressor) & 0x03;
+
+      if (i > 0)
+        safety_check (code);
+
+      estimator_update (i, calibration_apply (map->ref, code), pair);
+      trace_record (i, code, pair);
+    }
+  telemetry_record (acquisition_buf);
+}
+
+/**
+ * @brief TIM4 interrupt handler
+ *
+ * @retval None
+ */
+void
+TIM4_IRQHandler (void)
+{
+  HAL_TIM_IRQHandler (&acquisition_htim);
+}
+
+/**
+ * @brief Sample clock callback
+ *
+ *        Called from HAL_TIM_PeriodElapsedCallback on every TIM4 update.
+ *        Starts the next scan.
+ *
+ * @retval None
+ */
+void
+acquisition_tick (void)
+{
+  HAL_ADC_Start_DMA (acquisition_hadc, (uint32_t *)acquisition_buf,
+                     ACQUISITION_CHANNELS);
+}
+
+/**
+ * @brief Configures the ADC for scan-mode acquisition of every channel
+ *
+ *        Sets the DUT pins and any second reference to analog mode, programs one rank per channel
+ *        listed in acquisition_channels and starts the sample clock.
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ *
+ * @retval None
+ */
+void
+acquisition_init (ADC_HandleTypeDef *hadc)
+{
+  GPIO_InitTypeDef gpio = { 0 };
+  ADC_ChannelConfTypeDef conf = { 0 };
+
+  /* DUT inputs */
+  gpio.Mode = GPIO_MODE_ANALOG;
+  gpio.Pull = GPIO_NOPULL;
+
+  gpio.Pin = PRESSURE_DUT1_SENSOR_PIN | PRESSURE_DUT2_SENSOR_PIN;
+  HAL_GPIO_Init (GPIOA, &gpio);
+
+  gpio.Pin = PRESSURE_DUT3_SENSOR_PIN;
+#ifdef PRESSURE_BOARD_DUAL
+  gpio.Pin |= PRESSURE_REF2_SENSOR_PIN;
+#endif
+  HAL_GPIO_Init (GPIOB, &gpio);
+
+  /* One scan converts every channel once, then stops */
+  hadc->Init.ScanConvMode = ENABLE;
+  hadc->Init.ContinuousConvMode = DISABLE;
+  hadc->Init.DiscontinuousConvMode = DISABLE;
+  hadc->Init.NbrOfConversion = ACQUISITION_CHANNELS;
+  hadc->Init.EOCSelection = ADC_EOC_SEQ_CONV;
+  hadc->Init.DMAContinuousRequests = DISABLE;
+  HAL_ADC_Init (hadc);
+
+  for (uint8_t i = 0; i < ACQUISITION_CHANNELS; i++)
+    {
+      conf.Channel = acquisition_channels[i];
+      conf.Rank = i + 1;
+      conf.SamplingTime = ADC_SAMPLETIME_84CYCLES;
+      HAL_ADC_ConfigChannel (hadc, &conf);
+    }
+
+  acquisition_stats_reset ();
+  acquisition_hadc = hadc;
+
+  /* Sample clock, counting at 1MHz */
+  __HAL_RCC_TIM4_CLK_ENABLE ();
+  acquisition_htim.Instance = TIM4;
+  acquisition_htim.Init.Prescaler = (pressure_timer_clock () / 1000000) - 1;
+  acquisition_htim.Init.CounterMode = TIM_COUNTERMODE_UP;
+  acquisition_htim.Init.Period = (1000000 / ACQUISITION_RATE) - 1;
+  acquisition_htim.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  acquisition_htim.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  HAL_TIM_Base_Init (&acquisition_htim);
+
+  HAL_NVIC_SetPriority (TIM4_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ (TIM4_IRQn);
+  HAL_TIM_Base_Start_IT (&acquisition_htim);
+}
+
+/**
+ * @brief Converts a raw ADC code to pressure using the nominal sensor span
+ *
+ * @param code 12 bit ADC code
+ *
+ * @retval float Pressure in psi
+ */
+float
+acquisition_code_to_psi (uint16_t code)
+{
+  return (code * PRESSURE_SENSOR_SPAN) / ADC_RESOLUTION;
+}
+
+/**
+ * @brief Adds one sample to a DUT's error statistics
+ *
+ *        Uses Welford's method so the mean and variance stay accurate over
+ *        long runs.
+ *
+ * @param stats Statistics to update
+ * @param err Error of the DUT against the reference in psi
+ *
+ * @retval None
+ */
+static void
+acquisition_stats_add (struct AcquisitionStats *stats, float err)
+{
+  stats->n++;
+
+  float delta = err - stats->mean;
+  stats->mean += delta / stats->n;
+  stats->m2 += delta * (err - stats->mean);
+
+  if (fabsf (err) > stats->max)
+    stats->max = fabsf (err);
+}
+
+/**
+ * @brief Reads the most recent scan over every channel
+ *
+ *        Doesn't wait: picks up the last scan the sample clock completed,
+ *        converts each channel to psi through its calibration curve and
+ *        updates the DUT error statistics. The previous scan is kept if no
+ *        scan has completed since the last read.
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ *
+ * @retval uint8_t 1 : New scan available
+ *                 0 : No scan since the last read
+ */
+uint8_t
+acquisition_read (ADC_HandleTypeDef *hadc)
+{
+  if (!shared_flags_take (&acquisition_flags, ACQUISITION_CPLT))
+    return 0;
+
+  shared_seq_read (&acquisition_seq, acquisition_code, acquisition_scan,
+                   sizeof (acquisition_code));
+
+  for (uint8_t i = 0; i < ACQUISITION_CHANNELS; i++)
+    acquisition_psi[i] = calibration_apply (i, acquisition_code[i]);
+
+  for (uint8_t i = ACQUISITION_DUT_FIRST; i < ACQUISITION_DUT_END; i++)
+    acquisition_stats_add (&acquisition_stats[i],
+                           acquisition_psi[i]
+                               - acquisition_psi[ACQUISITION_REF]);
+
+  return 1;
+}
+
+/**
+ * @brief Waits for the next scan and reads it
+ *
+ *        Discards the scan already completed, then waits for the sample
+ *        clock to complete another one. The previous scan is kept if the ADC
+ *        doesn't finish in time.
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ *
+ * @retval uint8_t 1 : New scan available
+ *                 0 : Timed out
+ */
+uint8_t
+acquisition_wait (ADC_HandleTypeDef *hadc)
+{
+  uint64_t start = timebase_us ();
+
+  shared_flags_clear (&acquisition_flags, ACQUISITION_CPLT);
+  while (!acquisition_read (hadc))
+    {
+      if (timebase_us () - start > ACQUISITION_TIMEOUT * 1000ULL)
+        return 0;
+    }
+
+  return 1;
+}
+
+/**
+ * @brief Returns the raw ADC code of a channel from the last scan
+ *
+ * @param ch Scan index, ACQUISITION_REF for the reference sensor
+ *
+ * @retval uint16_t 12 bit ADC code
+ */
+uint16_t
+acquisition_get_code (uint8_t ch)
+{
+  if (ch >= ACQUISITION_CHANNELS)
+    return 0;
+
+  return acquisition_code[ch];
+}
+
+/**
+ * @brief Returns the pressure of a channel from the last scan
+ *
+ * @param ch Scan index, ACQUISITION_REF for the reference sensor
+ *
+ * @retval float Pressure in psi
+ */
+float
+acquisition_get_psi (uint8_t ch)
+{
+  if (ch >= ACQUISITION_CHANNELS)
+    return 0.0f;
+
+  return acquisition_psi[ch];
+}
+
+/**
+ * @brief Clears the error statistics of every DUT
+ *
+ * @retval None
+ */
+void
+acquisition_stats_reset (void)
+{
+  memset (acquisition_stats, 0, sizeof (acquisition_stats));
+}
+
+/**
+ * @brief Returns the error statistics of a DUT
+ *
+ * @param ch Scan index of the DUT, starting from ACQUISITION_DUT_FIRST
+ *
+ * @retval const struct AcquisitionStats* Statistics, NULL for a reference
+ */
+const struct AcquisitionStats *
+acquisition_get_stats (uint8_t ch)
+{
+  if (ch < ACQUISITION_DUT_FIRST || ch >= ACQUISITION_DUT_END)
+    return NULL;
+
+  return &acquisition_stats[ch];
+}
+
+/**
+ * @brief Transmits the error statistics of every DUT through UART
+ *
+ *        One line per DUT: sample count, mean error, RMS error and largest
+ *        absolute error, all in psi.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+acquisition_uart_tx_stats (UART_HandleTypeDef *huart)
+{
+  char str[80];
+
+  for (uint8_t i = ACQUISITION_DUT_FIRST; i < ACQUISITION_DUT_END; i++)
+    {
+      const struct AcquisitionStats *stats = &acquisition_stats[i];
+
+      float rms = 0.0f;
+      if (stats->n > 0)
+        rms = sqrtf ((stats->mean * stats->mean) + (stats->m2 / stats->n));
+
+      int len = snprintf (str, sizeof (str),
+                          "#DUT%u n=%lu mean=%.3f rms=%.3f max=%.3f\r\n", i,
+                          (unsigned long)stats->n, stats->mean, rms,
+                          stats->max);
+
+      HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+    }
+}
@@ -0,0 +1,469 @@
+/**
+ * @file actuator.c
+ *
+ * @brief Hardware-timed actuator driver program body
+ *
+ *        The compressor and exhaust pins are driven by TIM2's output-compare
+ *        channels, counting at 1MHz. The control code requests pulses; their
+ *        on and off edges are set by compare matches, so pulse widths have
+ *        microsecond resolution instead of being rounded to the control tick.
+ *
+ *        Pulses shorter than ACTUATOR_MIN_ON are refused, and one actuator is
+ *        only switched on ACTUATOR_DEAD_TIME after the other has switched
+ *        off. Requesting a pulse on an actuator that is already on extends
+ *        the pulse, so an actuator stays on for as long as the control code
+ *        keeps asking, and switches off by itself if it stops.
+ *
+ *        Channels come in pairs, compressor then exhaust of one station, and
+ *        the interlock only applies within a pair. actuator_map wires every
+ *        channel to its pin and TIM2 channel. The dual-station board wires a
+ *        second pair to TIM2_CH3 and TIM2_CH4.
+ *
+ *        The pins are set to their TIM2 alternate function here, so TIM2
+ *        must be left disabled in CubeMX.
+ *
+ *        Unlike the rest of the shared state, the channels are updated with
+ *        interrupts disabled. A channel is its state together with the
+ *        compare and mode registers of its pin, and the main loop, TIM2 and
+ *        the trips all change both; the seqlock only has one writer, and
+ *        handing requests to TIM2 through a queue would delay them and lose
+ *        the answer the control code needs. Each section is a few register
+ *        writes long.
+ */
+
+#include "actuator.h"
+#include "pressure.h"
+#include "stm32f4xx_hal.h"
+
+/* Channel states */
+enum actuator_state
+{
+  ACTUATOR_IDLE,    /*!< Off */
+  ACTUATOR_PENDING, /*!< On edge scheduled */
+  ACTUATOR_ON       /*!< On, off edge scheduled */
+};
+
+/* Struct containing the timing of one channel */
+struct ActuatorChannel
+{
+  volatile uint8_t state; /*!< enum actuator_state */
+  volatile uint32_t on;   /*!< Time of the on edge */
+  volatile uint32_t off;  /*!< Time of the off edge */
+};
+
+/* Struct containing the wiring of one channel */
+struct ActuatorPin
+{
+  GPIO_TypeDef *port; /*!< GPIO port of the pin */
+  uint16_t pin;       /*!< GPIO pin, TIM2 alternate function */
+  uint32_t channel;   /*!< TIM_CHANNEL_n of TIM2 */
+  uint32_t it;        /*!< TIM_IT_CCn of the same channel */
+};
+
+/* Pin map, in the order of enum actuator */
+static const struct ActuatorPin actuator_map[ACTUATORS] = {
+  { GPIOA, PRESSURE_COMPRESSOR_PIN, TIM_CHANNEL_1, TIM_IT_CC1 },
+  { GPIOB, PRESSURE_EXHAUST_PIN, TIM_CHANNEL_2, TIM_IT_CC2 },
+#ifdef PRESSURE_BOARD_DUAL
+  { GPIOA, PRESSURE_COMPRESSOR2_PIN, TIM_CHANNEL_3, TIM_IT_CC3 },
+  { GPIOA, PRESSURE_EXHAUST2_PIN, TIM_CHANNEL_4, TIM_IT_CC4 },
+#endif
+};
+
+static TIM_HandleTypeDef actuator_htim;                /*!< Edge timer */
+static struct ActuatorChannel actuator_ch[ACTUATORS]; /*!< Channel timing */
+static volatile uint8_t actuator_forced = 0; /*!< Set while tripped */
+static volatile uint32_t actuator_edges[ACTUATORS]; /*!< On edges taken */
+
+/**
+ * @brief TIM2 interrupt handler
+ *
+ * @retval None
+ */
+void
+TIM2_IRQHandler (void)
+{
+  HAL_TIM_IRQHandler (&actuator_htim);
+}
+
+/**
+ * @brief Sets the output compare mode of a channel
+ *
+ * @param dev enum actuator
+ * @param mode TIM_OCMODE_*
+ *
+ * @retval None
+ */
+static void
+actuator_set_mode (uint8_t dev, uint32_t mode)
+{
+  /* TIM_CHANNEL_n is 4 * (n - 1) */
+  uint32_t index = actuator_map[dev].channel / 4;
+  volatile uint32_t *ccmr = (index < 2) ? &TIM2->CCMR1 : &TIM2->CCMR2;
+  uint32_t shift = (index & 1) ? 8 : 0;
+
+  *ccmr = (*ccmr & ~(TIM_CCMR1_OC1M << shift)) | (mode << shift);
+}
+
+/**
+ * @brief Schedules the next edge of a channel
+ *
+ *        Edges that are too close to be caught by the compare are applied
+ *        immediately.
+ *
+ * @param dev enum actuator
+ * @param t Time of the edge
+ * @param active 1 for an on edge
+ *
+ * @retval uint8_t 1 : Edge scheduled
+ *                 0 : Edge applied now
+ */
+static uint8_t
+actuator_schedule (uint8_t dev, uint32_t t, uint8_t active)
+{
+  if ((int32_t)(t - TIM2->CNT) <= ACTUATOR_LEAD)
+    {
+      __HAL_TIM_DISABLE_IT (&actuator_htim, actuator_map[dev].it);
+      actuator_set_mode (dev, active ? TIM_OCMODE_FORCED_ACTIVE
+                                     : TIM_OCMODE_FORCED_INACTIVE);
+      return 0;
+    }
+
+  __HAL_TIM_SET_COMPARE (&actuator_htim, actuator_map[dev].channel, t);
+  actuator_set_mode (dev, active ? TIM_OCMODE_ACTIVE : TIM_OCMODE_INACTIVE);
+  __HAL_TIM_CLEAR_FLAG (&actuator_htim, actuator_map[dev].it);
+  __HAL_TIM_ENABLE_IT (&actuator_htim, actuator_map[dev].it);
+
+  return 1;
+}
+
+/**
+ * @brief Moves a channel to the state its pin has just reached
+ *
+ *        Must not be interrupted by anything else updating the channels.
+ *
+ * @param dev enum actuator
+ *
+ * @retval None
+ */
+static void
+actuator_advance (uint8_t dev)
+{
+  struct ActuatorChannel *ch = &actuator_ch[dev];
+
+  if (ch->state == ACTUATOR_PENDING)
+    {
+      ch->state = ACTUATOR_ON;
+      actuator_edges[dev]++;
+      if (!actuator_schedule (dev, ch->off, 0))
+        ch->state = ACTUATOR_IDLE;
+    }
+  else if (ch->state == ACTUATOR_ON)
+    {
+      __HAL_TIM_DISABLE_IT (&actuator_htim, actuator_map[dev].it);
+      actuator_set_mode (dev, TIM_OCMODE_FORCED_INACTIVE);
+      ch->state = ACTUATOR_IDLE;
+    }
+}
+
+/**
+ * @brief Output compare callback
+ *
+ *        Called once the hardware has switched a pin. Schedules the off edge
+ *        after an on edge.
+ *
+ * @param htim HAL timer handle whose compare matched
+ *
+ * @retval None
+ */
+void
+HAL_TIM_OC_DelayElapsedCallback (TIM_HandleTypeDef *htim)
+{
+  if (htim->Instance != TIM2)
+    return;
+
+  for (uint8_t dev = 0; dev < ACTUATORS; dev++)
+    {
+      /* HAL_TIM_ACTIVE_CHANNEL_n has bit n - 1 set */
+      if (htim->Channel != (1U << (actuator_map[dev].channel / 4)))
+        continue;
+
+      /* No need to disable interrupts, nothing preempts TIM2: the safety
+       * supervisor shares its priority, and every other context updating
+       * the channels does so with interrupts disabled */
+      if (!actuator_forced)
+        actuator_advance (dev);
+    }
+}
+
+/**
+ * @brief Starts the edge timer with both actuators off
+ *
+ * @retval None
+ */
+void
+actuator_init (void)
+{
+  GPIO_InitTypeDef gpio = { 0 };
+  TIM_OC_InitTypeDef oc = { 0 };
+
+  /* Free running 32 bit counter at 1MHz */
+  __HAL_RCC_TIM2_CLK_ENABLE ();
+  actuator_htim.Instance = TIM2;
+  actuator_htim.Init.Prescaler = (pressure_timer_clock () / 1000000) - 1;
+  actuator_htim.Init.CounterMode = TIM_COUNTERMODE_UP;
+  actuator_htim.Init.Period = 0xFFFFFFFF;
+  actuator_htim.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  actuator_htim.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  HAL_TIM_OC_Init (&actuator_htim);
+
+  oc.OCMode = TIM_OCMODE_FORCED_INACTIVE;
+  oc.Pulse = 0;
+  oc.OCPolarity = TIM_OCPOLARITY_HIGH;
+  oc.OCFastMode = TIM_OCFAST_DISABLE;
+  for (uint8_t i = 0; i < ACTUATORS; i++)
+    {
+      HAL_TIM_OC_ConfigChannel (&actuator_htim, &oc, actuator_map[i].channel);
+      HAL_TIM_OC_Start (&actuator_htim, actuator_map[i].channel);
+      actuator_ch[i].state = ACTUATOR_IDLE;
+      actuator_ch[i].off = 0;
+    }
+
+  /* Hands the pins over to the timer once it drives them low */
+  gpio.Mode = GPIO_MODE_AF_PP;
+  gpio.Pull = GPIO_NOPULL;
+  gpio.Speed = GPIO_SPEED_FREQ_LOW;
+  gpio.Alternate = GPIO_AF1_TIM2;
+
+  for (uint8_t i = 0; i < ACTUATORS; i++)
+    {
+      gpio.Pin = actuator_map[i].pin;
+      HAL_GPIO_Init (actuator_map[i].port, &gpio);
+    }
+
+  /* Same priority as the safety supervisor, so neither can interrupt the
+   * other halfway through a mode change */
+  HAL_NVIC_SetPriority (TIM2_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ (TIM2_IRQn);
+}
+
+/**
+ * @brief Requests a pulse on an actuator
+ *
+ *        If the actuator is already on, its off edge is moved to width from
+ *        now, which may shorten the pulse. Otherwise the pulse starts as soon
+ *        as the dead time after the other actuator allows.
+ *
+ * @param dev enum actuator
+ * @param width Pulse width in us
+ *
+ * @retval uint8_t 1 : Pulse scheduled
+ *                 0 : Refused, too short, conflicting or tripped
+ */
+uint8_t
+actuator_pulse (uint8_t dev, uint32_t width)
+{
+  if (dev >= ACTUATORS || width < ACTUATOR_MIN_ON)
+    return 0;
+
+  struct ActuatorChannel *ch = &actuator_ch[dev];
+  struct ActuatorChannel *other = &actuator_ch[dev ^ 1];
+  uint8_t ok = 1;
+
+  /* The edge chosen must be the one scheduled: a compare match or a trip
+   * in between would leave the registers out of step with the state */
+  uint32_t primask = __get_PRIMASK ();
+  __disable_irq ();
+
+  uint32_t now = TIM2->CNT;
+
+  if (actuator_forced || other->state == ACTUATOR_PENDING)
+    ok = 0;
+  else if (ch->state == ACTUATOR_PENDING)
+    ch->off = ch->on + width;
+  else if (ch->state == ACTUATOR_ON)
+    {
+      /* Too late to move an off edge the hardware is about to take */
+      if ((int32_t)(ch->off - now) <= ACTUATOR_LEAD)
+        ok = 0;
+      else
+        {
+          ch->off = now + width;
+          __HAL_TIM_SET_COMPARE (&actuator_htim, actuator_map[dev].channel,
+                                 ch->off);
+        }
+    }
+  else
+    {
+      uint32_t start = other->off + ACTUATOR_DEAD_TIME;
+      if (other->state == ACTUATOR_IDLE
+          && (now - other->off) >= ACTUATOR_DEAD_TIME)
+        start = now;
+
+      ch->on = start;
+      ch->off = start + width;
+      ch->state = ACTUATOR_PENDING;
+      if (!actuator_schedule (dev, start, 1))
+        actuator_advance (dev);
+    }
+
+  __set_PRIMASK (primask);
+
+  return ok;
+}
+
+/**
+ * @brief Switches an actuator off now, cancelling its pulse
+ *
+ * @param dev enum actuator
+ *
+ * @retval None
+ */
+void
+actuator_stop (uint8_t dev)
+{
+  if (dev >= ACTUATORS)
+    return;
+
+  struct ActuatorChannel *ch = &actuator_ch[dev];
+
+  /* A compare match in between would schedule the off edge again after the
+   * pin is forced off */
+  uint32_t primask = __get_PRIMASK ();
+  __disable_irq ();
+  if (!actuator_forced && ch->state != ACTUATOR_IDLE)
+    {
+      __HAL_TIM_DISABLE_IT (&actuator_htim, actuator_map[dev].it);
+      actuator_set_mode (dev, TIM_OCMODE_FORCED_INACTIVE);
+
+      /* The dead time counts from now, unless the pulse never started */
+      ch->off = TIM2->CNT;
+      if (ch->state == ACTUATOR_PENDING)
+        ch->off -= ACTUATOR_DEAD_TIME;
+      ch->state = ACTUATOR_IDLE;
+    }
+  __set_PRIMASK (primask);
+}
+
+/**
+ * @brief Returns whether an actuator is on or about to be
+ *
+ * @param dev enum actuator
+ *
+ * @retval uint8_t 1 : Pulse scheduled or running
+ *                 0 : Off
+ */
+uint8_t
+actuator_active (uint8_t dev)
+{
+  if (dev >= ACTUATORS)
+    return 0;
+
+  return actuator_ch[dev].state != ACTUATOR_IDLE;
+}
+
+/**
+ * @brief Returns whether every actuator is off
+ *
+ *        Used before writing flash, which stalls the timer interrupt that
+ *        ends pulses.
+ *
+ * @retval uint8_t 1 : Every actuator off, nothing scheduled
+ *                 0 : A pulse is scheduled or running
+ */
+uint8_t
+actuator_idle (void)
+{
+  for (uint8_t i = 0; i < ACTUATORS; i++)
+    if (actuator_ch[i].state != ACTUATOR_IDLE)
+      return 0;
+
+  return 1;
+}
+
+/**
+ * @brief Returns the number of times an actuator has switched on
+ *
+ *        Extended pulses count once.
+ *
+ * @param dev enum actuator
+ *
+ * @retval uint32_t On edges since startup
+ */
+uint32_t
+actuator_switches (uint8_t dev)
+{
+  if (dev >= ACTUATORS)
+    return 0;
+
+  return actuator_edges[dev];
+}
+
+/**
+ * @brief Returns the levels of the actuator pins
+ *
+ *        Read back from the pins, so it reflects trips and pulses that
+ *        haven't started yet.
+ *
+ * @retval uint8_t One bit per enum actuator, bit 0 : compressor, bit 1 :
+ *                 exhaust, then the same for every other station
+ */
+uint8_t
+actuator_pins (void)
+{
+  uint8_t pins = 0;
+
+  for (uint8_t i = 0; i < ACTUATORS; i++)
+    if (actuator_map[i].port->IDR & actuator_map[i].pin)
+      pins |= 1 << i;
+
+  return pins;
+}
+
+/**
+ * @brief Forces every compressor off and every exhaust open
+ *
+ *        Takes effect at the pins immediately and holds until
+ *        actuator_release, pulse requests are refused meanwhile. Safe to
+ *        call from interrupts.
+ *
+ * @retval None
+ */
+void
+actuator_trip (void)
+{
+  /* Called from the main loop and from interrupts below TIM2, which could
+   * otherwise switch a pin back on halfway through */
+  uint32_t primask = __get_PRIMASK ();
+  __disable_irq ();
+
+  uint32_t now = TIM2->CNT;
+  for (uint8_t i = 0; i < ACTUATORS; i++)
+    {
+      uint8_t exhaust = (i & 1);
+
+      actuator_set_mode (i, exhaust ? TIM_OCMODE_FORCED_ACTIVE
+                                    : TIM_OCMODE_FORCED_INACTIVE);
+      __HAL_TIM_DISABLE_IT (&actuator_htim, actuator_map[i].it);
+
+      actuator_ch[i].state = exhaust ? ACTUATOR_ON : ACTUATOR_IDLE;
+      actuator_ch[i].off = now;
+    }
+
+  actuator_forced = 1;
+
+  __set_PRIMASK (primask);
+}
+
+/**
+ * @brief Ends a trip, closing every exhaust
+ *
+ * @retval None
+ */
+void
+actuator_release (void)
+{
+  actuator_forced = 0;
+  for (uint8_t i = ACTUATOR_EXHAUST; i < ACTUATORS; i += 2)
+    actuator_stop (i);
+}
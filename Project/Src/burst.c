@@ -0,0 +1,276 @@
+/**
+ * @file burst.c
+ *
+ * @brief Compressed burst telemetry program body
+ *
+ *        While enabled, every background scan is buffered instead of being
+ *        decimated by the telemetry. The main loop packs them into blocks of
+ *        up to BURST_BLOCK consecutive scans and sends each one as a header
+ *        line followed by its binary payload:
+ *
+ *          #BLK seq=<block> n=<scan index> t=<sec> scans=<count>
+ *               len=<bytes> crc=<CRC-16>
+ *          <len bytes>
+ *
+ *        (one line on the wire). The payload starts with a keyframe, every
+ *        channel's code as little endian 16 bit, reference first. Each
+ *        following scan is coded as the change of every channel since the
+ *        previous scan, zig-zag mapped and written as a base 128 varint. A
+ *        12 bit code changes by less than 64 between scans most of the time,
+ *        so a channel usually takes a single byte.
+ *
+ *        Every block starts from a keyframe, so one that is lost or fails its
+ *        CRC doesn't affect the next. The CRC is CRC-16/CCITT-FALSE of the
+ *        payload. Tools/burst_decode.py decodes a capture.
+ */
+
+#include "burst.h"
+#include "shared.h"
+#include "stm32f4xx_hal.h"
+#include "timebase.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Struct containing one buffered scan */
+struct BurstScan
+{
+  uint64_t t;                          /*!< Timebase when taken in us */
+  uint32_t n;                          /*!< Scan index */
+  uint16_t code[ACQUISITION_CHANNELS]; /*!< Raw codes, reference first */
+};
+
+static struct BurstScan burst_buf[BURST_SCANS]; /*!< Ring */
+static struct SharedQueue burst_queue
+    = { .size = BURST_SCANS };           /*!< Slots of burst_buf */
+static volatile uint8_t burst_on = 0;    /*!< Set while enabled */
+static uint32_t burst_n = 0;             /*!< Scans seen */
+static uint8_t burst_payload[BURST_PAYLOAD_MAX]; /*!< Block being sent */
+static struct BurstStats burst_stats;    /*!< Encoder statistics */
+
+/**
+ * @brief Enables or disables burst mode
+ *
+ *        Enabling discards anything buffered and clears the statistics.
+ *
+ * @param on 1 : Enable, 0 : Disable
+ *
+ * @retval None
+ */
+void
+burst_enable (uint8_t on)
+{
+  burst_on = 0;
+
+  if (on)
+    {
+      shared_queue_flush (&burst_queue);
+      memset (&burst_stats, 0, sizeof (burst_stats));
+      burst_on = 1;
+    }
+}
+
+/**
+ * @brief Returns whether burst mode is enabled
+ *
+ * @retval uint8_t 1 : Enabled
+ *                 0 : Disabled
+ */
+uint8_t
+burst_enabled (void)
+{
+  return burst_on;
+}
+
+/**
+ * @brief Buffers one scan
+ *
+ *        Called from the ADC conversion complete interrupt through the
+ *        telemetry. Scans are dropped while the ring is full.
+ *
+ * @param scan Raw codes of every channel, reference first
+ *
+ * @retval None
+ */
+void
+burst_record (const uint16_t *scan)
+{
+  uint32_t n = burst_n++;
+
+  if (!burst_on)
+    return;
+
+  int32_t slot = shared_queue_reserve (&burst_queue);
+  if (slot < 0)
+    {
+      burst_stats.dropped++;
+      return;
+    }
+
+  struct BurstScan *s = &burst_buf[slot];
+  s->t = timebase_us ();
+  s->n = n;
+  memcpy (s->code, scan, sizeof (s->code));
+
+  shared_queue_commit (&burst_queue);
+}
+
+/**
+ * @brief Returns the CRC-16/CCITT-FALSE of a buffer
+ *
+ * @param buf Data
+ * @param len Length of the data in bytes
+ *
+ * @retval uint16_t CRC
+ */
+static uint16_t
+burst_crc (const uint8_t *buf, uint16_t len)
+{
+  uint16_t crc = 0xFFFF;
+
+  for (uint16_t i = 0; i < len; i++)
+    {
+      crc ^= (uint16_t)buf[i] << 8;
+      for (uint8_t b = 0; b < 8; b++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+  return crc;
+}
+
+/**
+ * @brief Encodes buffered scans into burst_payload
+ *
+ *        Stops at BURST_BLOCK scans, at the end of the buffer, or at a gap
+ *        in the scan indices.
+ *
+ * @param scans Returns the number of scans encoded
+ *
+ * @retval uint16_t Payload length in bytes
+ */
+static uint16_t
+burst_encode (uint16_t *scans)
+{
+  uint16_t avail = shared_queue_count (&burst_queue);
+  const struct BurstScan *prev
+      = &burst_buf[shared_queue_peek (&burst_queue, 0)];
+  uint8_t *out = burst_payload;
+
+  /* Keyframe */
+  for (uint8_t ch = 0; ch < ACQUISITION_CHANNELS; ch++)
+    {
+      *out++ = prev->code[ch] & 0xFF;
+      *out++ = prev->code[ch] >> 8;
+    }
+
+  uint16_t k = 1;
+  for (; k < avail && k < BURST_BLOCK; k++)
+    {
+      const struct BurstScan *s
+          = &burst_buf[shared_queue_peek (&burst_queue, k)];
+      if (s->n != prev->n + 1)
+        break;
+
+      for (uint8_t ch = 0; ch < ACQUISITION_CHANNELS; ch++)
+        {
+          int16_t d = (int16_t)(s->code[ch] - prev->code[ch]);
+          uint16_t z = ((uint16_t)d << 1) ^ (uint16_t)(d >> 15);
+
+          while (z >= 0x80)
+            {
+              *out++ = (z & 0x7F) | 0x80;
+              z >>= 7;
+            }
+          *out++ = z;
+        }
+
+      prev = s;
+    }
+
+  *scans = k;
+  return out - burst_payload;
+}
+
+/**
+ * @brief Transmits every complete block through UART
+ *
+ *        A partial block is held back until it fills, unless it ends at a
+ *        gap.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+burst_uart_tx (UART_HandleTypeDef *huart)
+{
+  char str[112];
+
+  while (burst_on && shared_queue_count (&burst_queue) >= BURST_BLOCK)
+    {
+      const struct BurstScan *first
+          = &burst_buf[shared_queue_peek (&burst_queue, 0)];
+      uint16_t scans;
+
+      uint32_t start = DWT->CYCCNT;
+      uint16_t len = burst_encode (&scans);
+      uint16_t crc = burst_crc (burst_payload, len);
+      burst_stats.cycles += DWT->CYCCNT - start;
+
+      int hlen = snprintf (
+          str, sizeof (str),
+          "#BLK seq=%lu n=%lu t=%lu.%06lu scans=%u len=%u crc=%04X\r\n",
+          (unsigned long)burst_stats.blocks, (unsigned long)first->n,
+          (unsigned long)(first->t / 1000000),
+          (unsigned long)(first->t % 1000000), scans, len, crc);
+      HAL_UART_Transmit (huart, (uint8_t *)str, hlen, 100);
+      HAL_UART_Transmit (huart, burst_payload, len, 200);
+
+      shared_queue_release (&burst_queue, scans);
+
+      burst_stats.blocks++;
+      burst_stats.scans += scans;
+      burst_stats.bytes += len;
+    }
+}
+
+/**
+ * @brief Returns the encoder statistics
+ *
+ * @retval const struct BurstStats* Statistics
+ */
+const struct BurstStats *
+burst_get_stats (void)
+{
+  return &burst_stats;
+}
+
+/**
+ * @brief Transmits the encoder statistics through UART
+ *
+ *        The ratio compares the payload against two bytes per channel per
+ *        scan. The cost includes the CRC.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+burst_uart_tx_stats (UART_HandleTypeDef *huart)
+{
+  const struct BurstStats *st = &burst_stats;
+  uint32_t samples = st->scans * ACQUISITION_CHANNELS;
+
+  float ratio = (st->bytes > 0) ? (samples * 2.0f) / st->bytes : 0.0f;
+  float cycles = (samples > 0) ? (float)st->cycles / samples : 0.0f;
+
+  char str[112];
+  int len = snprintf (str, sizeof (str),
+                      "#BURST on=%u blocks=%lu scans=%lu bytes=%lu ratio=%.2f "
+                      "cyc=%.1f drop=%lu\r\n",
+                      burst_on, (unsigned long)st->blocks,
+                      (unsigned long)st->scans, (unsigned long)st->bytes, ratio,
+                      cycles, (unsigned long)st->dropped);
+
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
@@ -0,0 +1,465 @@
+/**
+ * @file calibration.c
+ *
+ * @brief Sensor linearization program body
+ *
+ *        Every sensor has a table of measured (ADC code, pressure) points.
+ *        The table is interpolated once into a uniform grid over the ADC
+ *        range, so correcting a sample is a shift, a mask and one
+ *        multiply-add regardless of how many points the table holds.
+ *
+ *        Captured tables are kept in flash, so calibration survives a reset.
+ */
+
+#include "calibration.h"
+#include "stm32f4xx_hal.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#define CALIBRATION_CELL_CODES (1 << CALIBRATION_GRID_SHIFT)
+
+/* Struct containing the tables as stored in flash */
+struct CalibrationRecord
+{
+  uint32_t magic; /*!< CALIBRATION_MAGIC */
+  struct CalibrationTable tables[ACQUISITION_CHANNELS]; /*!< Stored tables */
+  uint32_t sum;   /*!< Sum of the words above */
+};
+
+static struct CalibrationTable
+    calibration_tables[ACQUISITION_CHANNELS]; /*!< Measured points */
+static struct CalibrationCurve
+    calibration_curves[ACQUISITION_CHANNELS]; /*!< Correction grids */
+
+/**
+ * @brief Loads the nominal two-point table of a sensor
+ *
+ *        Matches the sensor datasheet: 0 psi at code 0 and
+ *        PRESSURE_SENSOR_SPAN at full scale.
+ *
+ * @param table Table to reset
+ *
+ * @retval None
+ */
+static void
+calibration_table_default (struct CalibrationTable *table)
+{
+  table->n = 2;
+  table->method = CALIBRATION_LINEAR;
+  table->code[0] = 0;
+  table->psi[0] = 0.0f;
+  table->code[1] = (uint16_t)ADC_RESOLUTION;
+  table->psi[1] = PRESSURE_SENSOR_SPAN;
+}
+
+/**
+ * @brief Computes monotone cubic tangents for a table
+ *
+ *        Fritsch-Carlson: starts from averaged secants and limits them so the
+ *        interpolant never overshoots between points.
+ *
+ * @param table Table with at least two points
+ * @param m Output tangents, one per point
+ *
+ * @retval None
+ */
+static void
+calibration_tangents (const struct CalibrationTable *table, float *m)
+{
+  float d[CALIBRATION_MAX_POINTS];
+  uint8_t n = table->n;
+
+  for (uint8_t i = 0; i < n - 1; i++)
+    d[i] = (table->psi[i + 1] - table->psi[i])
+           / (float)(table->code[i + 1] - table->code[i]);
+
+  m[0] = d[0];
+  m[n - 1] = d[n - 2];
+  for (uint8_t i = 1; i < n - 1; i++)
+    m[i] = (d[i - 1] * d[i] <= 0.0f) ? 0.0f : (d[i - 1] + d[i]) / 2;
+
+  for (uint8_t i = 0; i < n - 1; i++)
+    {
+      if (d[i] == 0.0f)
+        {
+          m[i] = 0.0f;
+          m[i + 1] = 0.0f;
+          continue;
+        }
+
+      float a = m[i] / d[i];
+      float b = m[i + 1] / d[i];
+      float h = (a * a) + (b * b);
+      if (h > 9.0f)
+        {
+          float t = 3.0f / sqrtf (h);
+          m[i] = t * a * d[i];
+          m[i + 1] = t * b * d[i];
+        }
+    }
+}
+
+/**
+ * @brief Evaluates a table's interpolant at an ADC code
+ *
+ *        Codes outside the table are extrapolated along the end segments.
+ *
+ * @param table Table with at least two points
+ * @param m Tangents from calibration_tangents, or NULL for linear
+ * @param code ADC code, may be outside the table
+ *
+ * @retval float Pressure in psi
+ */
+static float
+calibration_eval (const struct CalibrationTable *table, const float *m,
+                  float code)
+{
+  uint8_t i = 0;
+  while ((i < table->n - 2) && (code > table->code[i + 1]))
+    i++;
+
+  float x0 = table->code[i];
+  float h = table->code[i + 1] - x0;
+  float y0 = table->psi[i];
+  float y1 = table->psi[i + 1];
+  float t = (code - x0) / h;
+
+  if ((m == NULL) || (t < 0.0f) || (t > 1.0f))
+    return y0 + ((y1 - y0) * t);
+
+  /* Cubic Hermite basis */
+  float t2 = t * t;
+  float t3 = t2 * t;
+  return (((2 * t3) - (3 * t2) + 1) * y0) + ((t3 - (2 * t2) + t) * h * m[i])
+         + (((-2 * t3) + (3 * t2)) * y1) + ((t3 - t2) * h * m[i + 1]);
+}
+
+/**
+ * @brief Sums the words of a record, except the sum itself
+ *
+ * @param rec Record
+ *
+ * @retval uint32_t Sum
+ */
+static uint32_t
+calibration_sum (const struct CalibrationRecord *rec)
+{
+  const uint32_t *w = (const uint32_t *)rec;
+  uint32_t sum = 0;
+
+  for (uint32_t i = 0; i < offsetof (struct CalibrationRecord, sum) / 4; i++)
+    sum += w[i];
+
+  return sum;
+}
+
+/**
+ * @brief Loads the stored tables and builds every sensor's grid
+ *
+ *        Without a valid record in flash, every sensor gets the nominal
+ *        table.
+ *
+ * @retval None
+ */
+void
+calibration_init (void)
+{
+  const struct CalibrationRecord *rec
+      = (const struct CalibrationRecord *)CALIBRATION_FLASH_ADDR;
+
+  if (rec->magic == CALIBRATION_MAGIC && rec->sum == calibration_sum (rec))
+    memcpy (calibration_tables, rec->tables, sizeof (calibration_tables));
+  else
+    {
+      for (uint8_t i = 0; i < ACQUISITION_CHANNELS; i++)
+        calibration_table_default (&calibration_tables[i]);
+    }
+
+  for (uint8_t i = 0; i < ACQUISITION_CHANNELS; i++)
+    calibration_build (i);
+}
+
+/**
+ * @brief Interpolates a sensor's table into its correction grid
+ *
+ *        Must be called after the table changes. Falls back to the nominal
+ *        table if fewer than two points are stored.
+ *
+ * @param ch Scan index of the sensor
+ *
+ * @retval None
+ */
+void
+calibration_build (uint8_t ch)
+{
+  if (ch >= ACQUISITION_CHANNELS)
+    return;
+
+  struct CalibrationTable *table = &calibration_tables[ch];
+  struct CalibrationCurve *curve = &calibration_curves[ch];
+  float m[CALIBRATION_MAX_POINTS];
+
+  if (table->n < 2)
+    calibration_table_default (table);
+
+  if (table->method == CALIBRATION_CUBIC)
+    calibration_tangents (table, m);
+
+  const float *tangents = (table->method == CALIBRATION_CUBIC) ? m : NULL;
+
+  float y0 = calibration_eval (table, tangents, 0.0f);
+  for (uint16_t k = 0; k < CALIBRATION_GRID_CELLS; k++)
+    {
+      float y1 = calibration_eval (table, tangents,
+                                   (float)((k + 1) * CALIBRATION_CELL_CODES));
+      curve->base[k] = y0;
+      curve->slope[k] = (y1 - y0) / CALIBRATION_CELL_CODES;
+      y0 = y1;
+    }
+}
+
+/**
+ * @brief Converts a raw ADC code to corrected pressure
+ *
+ * @param ch Scan index of the sensor
+ * @param code 12 bit ADC code
+ *
+ * @retval float Pressure in psi, 0 if ch is out of range
+ */
+float
+calibration_apply (uint8_t ch, uint16_t code)
+{
+  if (ch >= ACQUISITION_CHANNELS)
+    return 0.0f;
+
+  const struct CalibrationCurve *curve = &calibration_curves[ch];
+  uint16_t k = (code >> CALIBRATION_GRID_SHIFT) & (CALIBRATION_GRID_CELLS - 1);
+
+  return curve->base[k]
+         + (curve->slope[k] * (code & (CALIBRATION_CELL_CODES - 1)));
+}
+
+/**
+ * @brief Returns the calibration table of a sensor
+ *
+ * @param ch Scan index of the sensor
+ *
+ * @retval struct CalibrationTable* Table, NULL if ch is out of range
+ */
+struct CalibrationTable *
+calibration_get_table (uint8_t ch)
+{
+  if (ch >= ACQUISITION_CHANNELS)
+    return NULL;
+
+  return &calibration_tables[ch];
+}
+
+/**
+ * @brief Clears a sensor's table before capturing new points
+ *
+ *        The grid keeps its previous correction until
+ *        calibration_capture_end is called.
+ *
+ * @param ch Scan index of the sensor
+ * @param method Interpolation to use once the capture ends
+ *
+ * @retval None
+ */
+void
+calibration_capture_begin (uint8_t ch, uint8_t method)
+{
+  if (ch >= ACQUISITION_CHANNELS)
+    return;
+
+  calibration_tables[ch].n = 0;
+  calibration_tables[ch].method = method;
+}
+
+/**
+ * @brief Inserts a point into a table, keeping codes ascending
+ *
+ * @param table Table to insert into
+ * @param code Averaged raw ADC code
+ * @param psi True pressure at the code
+ *
+ * @retval uint8_t 1 : Point stored
+ *                 0 : Table full or code already present
+ */
+static uint8_t
+calibration_insert (struct CalibrationTable *table, uint16_t code, float psi)
+{
+  if (table->n >= CALIBRATION_MAX_POINTS)
+    return 0;
+
+  uint8_t i = table->n;
+  while ((i > 0) && (table->code[i - 1] > code))
+    {
+      table->code[i] = table->code[i - 1];
+      table->psi[i] = table->psi[i - 1];
+      i--;
+    }
+
+  if ((i > 0) && (table->code[i - 1] == code))
+    {
+      /* Undo the shift */
+      for (; i < table->n; i++)
+        {
+          table->code[i] = table->code[i + 1];
+          table->psi[i] = table->psi[i + 1];
+        }
+      return 0;
+    }
+
+  table->code[i] = code;
+  table->psi[i] = psi;
+  table->n++;
+
+  return 1;
+}
+
+/**
+ * @brief Averages CALIBRATION_CAPTURE_SAMPLES scans
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ * @param codes Output averaged raw code of every channel
+ * @param ref Output averaged corrected reference pressure
+ *
+ * @retval uint8_t Number of scans that completed
+ */
+static uint8_t
+calibration_average (ADC_HandleTypeDef *hadc, uint16_t *codes, float *ref)
+{
+  uint32_t sums[ACQUISITION_CHANNELS] = { 0 };
+  float ref_sum = 0.0f;
+  uint8_t n = 0;
+
+  for (uint8_t s = 0; s < CALIBRATION_CAPTURE_SAMPLES; s++)
+    {
+      if (!acquisition_wait (hadc))
+        continue;
+
+      for (uint8_t i = 0; i < ACQUISITION_CHANNELS; i++)
+        sums[i] += acquisition_get_code (i);
+      ref_sum += acquisition_get_psi (ACQUISITION_REF);
+      n++;
+    }
+
+  if (n == 0)
+    return 0;
+
+  for (uint8_t i = 0; i < ACQUISITION_CHANNELS; i++)
+    codes[i] = (sums[i] + (n / 2)) / n;
+  *ref = ref_sum / n;
+
+  return n;
+}
+
+/**
+ * @brief Captures one point of a sensor against a known pressure
+ *
+ *        Used for the reference sensor itself, with the known pressure coming
+ *        from an external standard (deadweight tester, certified gauge).
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ * @param ch Scan index of the sensor
+ * @param psi Known pressure applied to the sensor
+ *
+ * @retval uint8_t 1 : Point stored
+ *                 0 : Scan failed, table full or duplicate code
+ */
+uint8_t
+calibration_capture_point (ADC_HandleTypeDef *hadc, uint8_t ch, float psi)
+{
+  uint16_t codes[ACQUISITION_CHANNELS];
+  float ref;
+
+  if (ch >= ACQUISITION_CHANNELS)
+    return 0;
+
+  if (!calibration_average (hadc, codes, &ref))
+    return 0;
+
+  return calibration_insert (&calibration_tables[ch], codes[ch], psi);
+}
+
+/**
+ * @brief Captures one point of every DUT against the first station's
+ *        reference sensor
+ *
+ *        All channels are averaged over the same scans, so a slowly drifting
+ *        tank pressure affects the DUTs and the reference equally.
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ *
+ * @retval uint8_t Number of DUT tables the point was stored in
+ */
+uint8_t
+calibration_capture_duts (ADC_HandleTypeDef *hadc)
+{
+  uint16_t codes[ACQUISITION_CHANNELS];
+  float ref;
+  uint8_t stored = 0;
+
+  if (!calibration_average (hadc, codes, &ref))
+    return 0;
+
+  for (uint8_t i = ACQUISITION_DUT_FIRST; i < ACQUISITION_DUT_END; i++)
+    stored += calibration_insert (&calibration_tables[i], codes[i], ref);
+
+  return stored;
+}
+
+/**
+ * @brief Finishes a capture and rebuilds the sensor's grid
+ *
+ * @param ch Scan index of the sensor
+ *
+ * @retval None
+ */
+void
+calibration_capture_end (uint8_t ch)
+{
+  calibration_build (ch);
+}
+
+/**
+ * @brief Stores the table of every sensor in flash
+ *
+ *        Erasing stalls the core for a second or so, the safety interrupt
+ *        included, so it must only be done with the tank vented and both
+ *        actuators off. Sector CALIBRATION_FLASH_SECTOR is kept out of the
+ *        application by the linker script.
+ *
+ * @retval None
+ */
+void
+calibration_save (void)
+{
+  struct CalibrationRecord rec;
+
+  memset (&rec, 0, sizeof (rec));
+  rec.magic = CALIBRATION_MAGIC;
+  memcpy (rec.tables, calibration_tables, sizeof (rec.tables));
+  rec.sum = calibration_sum (&rec);
+
+  FLASH_EraseInitTypeDef erase = { 0 };
+  uint32_t err;
+
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+  erase.Sector = CALIBRATION_FLASH_SECTOR;
+  erase.NbSectors = 1;
+  erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+  HAL_FLASH_Unlock ();
+  if (HAL_FLASHEx_Erase (&erase, &err) == HAL_OK)
+    {
+      const uint32_t *w = (const uint32_t *)&rec;
+      for (uint32_t i = 0; i < sizeof (rec) / 4; i++)
+        HAL_FLASH_Program (FLASH_TYPEPROGRAM_WORD,
+                           CALIBRATION_FLASH_ADDR + (i * 4), w[i]);
+    }
+  HAL_FLASH_Lock ();
+}
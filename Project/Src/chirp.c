@@ -0,0 +1,100 @@
+/**
+ * @file chirp.c
+ *
+ * @brief Swept-sine waveform program body
+ *
+ *        The phase is the closed-form integral of the instantaneous
+ *        frequency, so it stays continuous over the whole sweep no matter how
+ *        irregularly the waveform is sampled.
+ */
+
+#include "chirp.h"
+
+#include <math.h>
+
+/**
+ * @brief Returns the phase of the sweep
+ *
+ * @param chirp Sweep settings
+ * @param t Time since the start of the sweep in sec
+ *
+ * @retval float Phase in radians
+ */
+float
+chirp_phase (const struct Chirp *chirp, float t)
+{
+  float f0 = chirp->f_start;
+  float f1 = chirp->f_end;
+  float T = chirp->duration;
+
+  if (chirp->log && (f0 > 0.0f) && (f1 > 0.0f) && (f0 != f1))
+    {
+      /* f(t) = f0 * k^t, k = (f1 / f0)^(1 / T) */
+      float ln_k = logf (f1 / f0) / T;
+      return 2 * M_PI * f0 * (expf (ln_k * t) - 1) / ln_k;
+    }
+
+  /* f(t) = f0 + (f1 - f0) * t / T */
+  return 2 * M_PI * ((f0 * t) + ((f1 - f0) * t * t / (2 * T)));
+}
+
+/**
+ * @brief Returns the instantaneous frequency of the sweep
+ *
+ * @param chirp Sweep settings
+ * @param t Time since the start of the sweep in sec
+ *
+ * @retval float Frequency in Hz
+ */
+float
+chirp_freq (const struct Chirp *chirp, float t)
+{
+  float f0 = chirp->f_start;
+  float f1 = chirp->f_end;
+
+  if (chirp->log && (f0 > 0.0f) && (f1 > 0.0f))
+    return f0 * powf (f1 / f0, t / chirp->duration);
+
+  return f0 + ((f1 - f0) * t / chirp->duration);
+}
+
+/**
+ * @brief Returns the amplitude of the sweep
+ *
+ *        Constant if .ampl_end is 0, otherwise interpolated linearly from
+ *        ampl to .ampl_end over the sweep.
+ *
+ * @param chirp Sweep settings
+ * @param ampl Amplitude at the start of the sweep
+ * @param t Time since the start of the sweep in sec
+ *
+ * @retval float Amplitude
+ */
+float
+chirp_ampl (const struct Chirp *chirp, float ampl, float t)
+{
+  if (chirp->ampl_end <= 0.0f)
+    return ampl;
+
+  return ampl + ((chirp->ampl_end - ampl) * t / chirp->duration);
+}
+
+/**
+ * @brief Returns the telemetry segment a point of the sweep falls in
+ *
+ *        Segments split the sweep into equal lengths of time.
+ *
+ * @param chirp Sweep settings
+ * @param t Time since the start of the sweep in sec
+ *
+ * @retval uint8_t Segment index, from 0 to .segments - 1
+ */
+uint8_t
+chirp_segment (const struct Chirp *chirp, float t)
+{
+  if (chirp->segments == 0 || t <= 0.0f)
+    return 0;
+
+  uint8_t seg = (t * chirp->segments) / chirp->duration;
+  return (seg < chirp->segments) ? seg : chirp->segments - 1;
+}
@@ -0,0 +1,1016 @@
+/**
+ * @file command.c
+ *
+ * @brief Serial command protocol program body
+ *
+ *        Bytes arriving on the plotting UART are stored in a ring buffer by
+ *        the receive interrupt. command_poll drains a bounded number of them
+ *        per call and executes every complete line, so parsing never takes
+ *        more than a few microseconds of a control tick.
+ *
+ *        Commands are case insensitive, one per line:
+ *
+ *          GET <param>          Replies #<param>=<value>
+ *          SET <param> <value>  Only while no test is running
+ *          START                Starts the waveform selected in the menu
+ *          ABORT                Interrupts the running test, replies
+ *                               #ERR IDLE if none is running
+ *          STATUS               Replies with the test state
+ *          STATS                Replies with the DUT error statistics
+ *          PRESET <n>           Loads preset n, only while idle
+ *          TRACE                Transmits the station's last raw trace
+ *                               capture, only while no station runs a test
+ *          SAFETY               Replies with the safety supervisor counters
+ *          TUNE                 Replies with the auto-tuned gains
+ *          QUALITY              Replies with the tracking baselines, only
+ *                               while idle
+ *          QUALITY KEEP         Keeps the metrics of the last test as the
+ *                               baseline for its settings and stores the
+ *                               baselines in flash, only while every
+ *                               station is idle
+ *          QUALITY CLEAR        Removes every baseline, only while every
+ *                               station is idle
+ *          SWEEP <axis> <range> Sets a sweep axis, PER, AMPL or OFFS, to
+ *                               <start>:<stop>:<count>, only while idle
+ *          SWEEP <field> <n>    Sets the sweep's WAVE, END or LIMIT
+ *          SWEEP ON             Runs the sweep as the next batch
+ *          SCRIPT               Replies with the batch script, only while
+ *                               idle
+ *          SCRIPT <w>:<per>:<ampl>:<offs>:<end>:<limit>
+ *                               Appends a test to the script and runs the
+ *                               script as the next batch, only while idle
+ *          SCRIPT CLEAR         Empties the script, the default one runs
+ *                               until tests are appended, only while idle
+ *          PROFILE              Replies with the piecewise-linear profile,
+ *                               only while idle
+ *          PROFILE <t>:<p>      Appends a point at t sec and p psi to the
+ *                               profile, only while idle
+ *          PROFILE CLEAR        Removes every point, only while idle
+ *          BURST ON|OFF         Switches compressed burst telemetry
+ *          BURST                Replies with the burst encoder statistics
+ *          STATION <n>          Shows station n on the LCD and sends the
+ *                               next commands to it
+ *          STATION              Replies with the displayed station
+ *          ENSEMBLE             Replies with the averaged cycle of the last
+ *                               step, ramp or sine test, only while idle
+ *          CAL <ch>             Replies with the calibration table of sensor
+ *                               ch, 0 for the reference, only while idle
+ *          CAL <ch> LINEAR|CUBIC
+ *                               Clears the table of sensor ch to capture new
+ *                               points with that interpolation, only while
+ *                               idle
+ *          CAL <ch> <psi>       Captures a point of sensor ch at a known
+ *                               pressure, only while idle
+ *          CAL <ch> SAVE        Rebuilds the curve of sensor ch and stores
+ *                               every table in flash, only while idle and
+ *                               no actuator is on
+ *
+ *        "Idle" means no test on the station the commands go to. SWEEP and
+ *        SCRIPT also wait while any station runs a batch.
+ *
+ *        Periods given to SET, SWEEP and SCRIPT can't be shorter than
+ *        PRESSURE_SWITCH_TIME.
+ *
+ *        Every reply starts with '#' so it can't be mistaken for a frame of
+ *        sensor data. Replies that span more than a couple of lines are only
+ *        sent while idle, since commands are also handled between the ticks
+ *        of a running test and the UART transmits blocking.
+ */
+
+#include "command.h"
+#include "acquisition.h"
+#include "actuator.h"
+#include "burst.h"
+#include "calibration.h"
+#include "ensemble.h"
+#include "menu.h"
+#include "quality.h"
+#include "safety.h"
+#include "sequencer.h"
+#include "shared.h"
+#include "tune.h"
+#include "stm32f4xx_hal.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Types of parameters reachable through GET and SET */
+enum command_type
+{
+  COMMAND_FLOAT,
+  COMMAND_UINT8,
+  COMMAND_UINT16,
+  COMMAND_UINT32
+};
+
+/* Struct describing one member of struct Pressure */
+struct CommandParam
+{
+  const char *name; /*!< Name used on the command line */
+  size_t offset;    /*!< Offset of the member in struct Pressure */
+  uint8_t type;     /*!< enum command_type */
+  uint8_t writable; /*!< Set if SET is allowed */
+  float min;        /*!< Smallest value accepted by SET */
+  float max;        /*!< Largest value accepted by SET */
+};
+
+static const struct CommandParam command_params[] = {
+  { "VAL", offsetof (struct Pressure, val), COMMAND_FLOAT, 0, 0, 0 },
+  { "PER", offsetof (struct Pressure, per), COMMAND_FLOAT, 1,
+    PRESSURE_SWITCH_TIME, 150 },
+  { "AMPL", offsetof (struct Pressure, ampl), COMMAND_FLOAT, 1, 0, 150 },
+  { "OFFS", offsetof (struct Pressure, offset), COMMAND_FLOAT, 1, 0, 150 },
+  { "TARGET", offsetof (struct Pressure, target), COMMAND_FLOAT, 0, 0, 0 },
+  { "TIME", offsetof (struct Pressure, elapsed), COMMAND_FLOAT, 0, 0,
+    0 },
+  { "OUTPUT", offsetof (struct Pressure, menu.output), COMMAND_UINT8, 0, 0,
+    0 },
+  { "END", offsetof (struct Pressure, test.end), COMMAND_UINT8, 1,
+    TEST_END_ABORT, TEST_END_DURATION },
+  { "LIMIT", offsetof (struct Pressure, test.limit), COMMAND_FLOAT, 1, 0,
+    100000 },
+  { "CYCLES", offsetof (struct Pressure, test.cycles), COMMAND_UINT32, 0, 0,
+    0 },
+  { "VENTTHR", offsetof (struct Pressure, vent.threshold), COMMAND_FLOAT, 1,
+    0, 10 },
+  { "VENTSETTLE", offsetof (struct Pressure, vent.settle), COMMAND_FLOAT, 1,
+    0, 60 },
+  { "VENTTIMEOUT", offsetof (struct Pressure, vent.timeout), COMMAND_FLOAT, 1,
+    1, 600 },
+  { "CHIRPF0", offsetof (struct Pressure, chirp.f_start), COMMAND_FLOAT, 1, 0,
+    10 },
+  { "CHIRPF1", offsetof (struct Pressure, chirp.f_end), COMMAND_FLOAT, 1, 0,
+    10 },
+  { "CHIRPT", offsetof (struct Pressure, chirp.duration), COMMAND_FLOAT, 1, 1,
+    36000 },
+  { "CHIRPLOG", offsetof (struct Pressure, chirp.log), COMMAND_UINT8, 1, 0,
+    1 },
+  { "CHIRPAEND", offsetof (struct Pressure, chirp.ampl_end), COMMAND_FLOAT, 1,
+    0, 150 },
+  { "CHIRPSEG", offsetof (struct Pressure, chirp.segments), COMMAND_UINT8, 1,
+    0, 100 },
+  { "TRAPEDGE", offsetof (struct Pressure, profile.edge), COMMAND_FLOAT, 1,
+    0, 150 },
+  { "STEPS", offsetof (struct Pressure, profile.steps), COMMAND_UINT8, 1, 2,
+    20 },
+  { "LEAKMAX", offsetof (struct Pressure, leak.max), COMMAND_FLOAT, 1, 0,
+    100 },
+  { "LEAKTIME", offsetof (struct Pressure, leak.timeout), COMMAND_FLOAT, 1,
+    LEAK_MIN_TIME + LEAK_SETTLE, 36000 },
+  { "PERR", offsetof (struct Pressure, ramps.perr), COMMAND_FLOAT, 1, 0, 1 },
+  { "SWITCH", offsetof (struct Pressure, ramps.sw), COMMAND_FLOAT, 1, 0,
+    10 },
+  { "TRPRE", offsetof (struct Pressure, trace.pre), COMMAND_UINT16, 1, 0,
+    TRACE_SIZE },
+  { "TRPOST", offsetof (struct Pressure, trace.post), COMMAND_UINT16, 1, 0,
+    TRACE_SIZE },
+  { "TRMASK", offsetof (struct Pressure, trace.triggers), COMMAND_UINT8, 1, 0,
+    TRACE_OVERPRESSURE | TRACE_ABORT | TRACE_ERROR },
+  { "TROVER", offsetof (struct Pressure, trace.overpressure), COMMAND_FLOAT,
+    1, 0, PRESSURE_SENSOR_SPAN },
+  { "TRERR", offsetof (struct Pressure, trace.error), COMMAND_FLOAT, 1, 0,
+    PRESSURE_SENSOR_SPAN },
+};
+
+/* Parameter sets loaded by PRESET, end conditions are ignored */
+static const struct SequencerTest command_presets[] = {
+  { WAVEFORM_CONST, 20.0f, 10.0f, 10.0f, TEST_END_ABORT, 0 },
+  { WAVEFORM_STEP, 20.0f, 10.0f, 15.0f, TEST_END_ABORT, 0 },
+  { WAVEFORM_RAMP, 20.0f, 10.0f, 15.0f, TEST_END_ABORT, 0 },
+  { WAVEFORM_SINE, 20.0f, 10.0f, 15.0f, TEST_END_ABORT, 0 },
+};
+
+#define COMMAND_PARAMS (sizeof (command_params) / sizeof (command_params[0]))
+#define COMMAND_PRESETS (sizeof (command_presets) / sizeof (command_presets[0]))
+
+static UART_HandleTypeDef *command_huart; /*!< UART commands arrive on */
+static uint8_t command_rx_byte;           /*!< Byte being received */
+static uint8_t command_rx[COMMAND_RX_SIZE]; /*!< RX ring buffer */
+static struct SharedQueue command_rx_queue; /*!< Slots of command_rx */
+static char command_line[COMMAND_LINE_SIZE]; /*!< Line being assembled */
+static uint8_t command_line_len = 0;         /*!< Length of command_line */
+static uint8_t command_line_ovf = 0; /*!< Set if the line was too long */
+
+/**
+ * @brief UART receive complete callback
+ *
+ *        Stores the received byte and re-arms the receive interrupt. Bytes
+ *        are dropped while the ring buffer is full.
+ *
+ * @param huart HAL UART handle that received the byte
+ *
+ * @retval None
+ */
+void
+HAL_UART_RxCpltCallback (UART_HandleTypeDef *huart)
+{
+  if (huart != command_huart)
+    return;
+
+
+  int32_t slot = shared_queue_reserve (&command_rx_queue);
+  if (slot >= 0)
+    {
+      command_rx[slot] = command_rx_byte;
+      shared_queue_commit (&command_rx_queue);
+    }
+
+  HAL_UART_Receive_IT (huart, &command_rx_byte, 1);
+}
+
+/**
+ * @brief UART error callback
+ *
+ *        Re-arms the receive interrupt after an overrun or framing error.
+ *
+ * @param huart HAL UART handle that reported the error
+ *
+ * @retval None
+ */
+void
+HAL_UART_ErrorCallback (UART_HandleTypeDef *huart)
+{
+  if (huart == command_huart)
+    HAL_UART_Receive_IT (huart, &command_rx_byte, 1);
+}
+
+/**
+ * @brief Starts receiving commands
+ *
+ * @param huart HAL UART handle commands arrive on
+ *
+ * @retval None
+ */
+void
+command_init (UART_HandleTypeDef *huart)
+{
+  command_huart = huart;
+  shared_queue_init (&command_rx_queue, COMMAND_RX_SIZE);
+  command_line_len = 0;
+
+  HAL_UART_Receive_IT (huart, &command_rx_byte, 1);
+}
+
+/**
+ * @brief Transmits a reply through UART
+ *
+ * @param fmt printf style format of the reply, without line ending
+ *
+ * @retval None
+ */
+static void
+command_reply (const char *fmt, ...)
+{
+  char str[96];
+  va_list args;
+
+  va_start (args, fmt);
+  int len = vsnprintf (str, sizeof (str) - 2, fmt, args);
+  va_end (args);
+
+  if (len < 0)
+    return;
+  if (len > (int)sizeof (str) - 3)
+    len = sizeof (str) - 3;
+
+  str[len++] = '\r';
+  str[len++] = '\n';
+  HAL_UART_Transmit (command_huart, (uint8_t *)str, len, 100);
+}
+
+/**
+ * @brief Looks up a parameter by name
+ *
+ * @param name Upper case parameter name
+ *
+ * @retval const struct CommandParam* Parameter, NULL if unknown
+ */
+static const struct CommandParam *
+command_find_param (const char *name)
+{
+  for (uint8_t i = 0; i < COMMAND_PARAMS; i++)
+    if (strcmp (command_params[i].name, name) == 0)
+      return &command_params[i];
+
+  return NULL;
+}
+
+/**
+ * @brief Handles GET
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param name Parameter name
+ *
+ * @retval None
+ */
+static void
+command_get (struct Pressure *pressure, const char *name)
+{
+  if (name == NULL)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  if (strcmp (name, "WAVE") == 0)
+    {
+      command_reply ("#WAVE=%u %s", menu_get_waveform (pressure),
+                     waveform_name (menu_get_waveform (pressure)));
+      return;
+    }
+
+  const struct CommandParam *param = command_find_param (name);
+  if (param == NULL)
+    {
+      command_reply ("#ERR PARAM");
+      return;
+    }
+
+  uint8_t *field = (uint8_t *)pressure + param->offset;
+  switch (param->type)
+    {
+    case COMMAND_FLOAT:
+      command_reply ("#%s=%.3f", param->name, *(float *)field);
+      break;
+
+    case COMMAND_UINT8:
+      command_reply ("#%s=%u", param->name, *field);
+      break;
+
+    case COMMAND_UINT16:
+      command_reply ("#%s=%u", param->name, *(uint16_t *)field);
+      break;
+
+    case COMMAND_UINT32:
+      command_reply ("#%s=%lu", param->name,
+                     (unsigned long)*(uint32_t *)field);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/**
+ * @brief Handles SET
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param name Parameter name
+ * @param arg Value to set
+ *
+ * @retval None
+ */
+static void
+command_set (struct Pressure *pressure, const char *name, const char *arg)
+{
+  char *end;
+
+  if (name == NULL || arg == NULL)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  if (pressure->menu.output)
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  float val = strtof (arg, &end);
+  if (end == arg || *end != '\0')
+    {
+      command_reply ("#ERR VALUE");
+      return;
+    }
+
+  if (strcmp (name, "WAVE") == 0)
+    {
+      if (val < 0 || val >= WAVEFORMS)
+        command_reply ("#ERR RANGE");
+      else
+        {
+          menu_set_waveform (pressure, (uint8_t)val);
+          command_reply ("#OK");
+        }
+      return;
+    }
+
+  const struct CommandParam *param = command_find_param (name);
+  if (param == NULL || !param->writable)
+    {
+      command_reply ("#ERR PARAM");
+      return;
+    }
+
+  if (val < param->min || val > param->max)
+    {
+      command_reply ("#ERR RANGE");
+      return;
+    }
+
+  /* The capture window has to fit the ring */
+  if ((param->offset == offsetof (struct Pressure, trace.pre)
+       && val + pressure->trace.post > TRACE_SIZE)
+      || (param->offset == offsetof (struct Pressure, trace.post)
+          && val + pressure->trace.pre > TRACE_SIZE))
+    {
+      command_reply ("#ERR RANGE");
+      return;
+    }
+
+  uint8_t *field = (uint8_t *)pressure + param->offset;
+  switch (param->type)
+    {
+    case COMMAND_FLOAT:
+      *(float *)field = val;
+      break;
+
+    case COMMAND_UINT8:
+      *field = (uint8_t)val;
+      break;
+
+    case COMMAND_UINT16:
+      *(uint16_t *)field = (uint16_t)val;
+      break;
+
+    case COMMAND_UINT32:
+      *(uint32_t *)field = (uint32_t)val;
+      break;
+
+    default:
+      break;
+    }
+
+  command_reply ("#OK");
+}
+
+/**
+ * @brief Handles PRESET
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param arg Preset number
+ *
+ * @retval None
+ */
+static void
+command_preset (struct Pressure *pressure, const char *arg)
+{
+  if (arg == NULL)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  if (pressure->menu.output)
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  int idx = atoi (arg);
+  if (idx < 0 || idx >= (int)COMMAND_PRESETS)
+    {
+      command_reply ("#ERR RANGE");
+      return;
+    }
+
+  const struct SequencerTest *preset = &command_presets[idx];
+  menu_set_waveform (pressure, preset->waveform);
+  pressure->per = preset->per;
+  pressure->ampl = preset->ampl;
+  pressure->offset = preset->offset;
+
+  command_reply ("#OK");
+}
+
+/**
+ * @brief Handles QUALITY
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param arg KEEP, CLEAR, or NULL to list the baselines
+ *
+ * @retval None
+ */
+static void
+command_quality (struct Pressure *pressure, const char *arg)
+{
+  if (pressure->menu.output)
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  if (arg == NULL)
+    {
+      quality_uart_tx_baselines (command_huart);
+      return;
+    }
+
+  if (strcmp (arg, "KEEP") != 0 && strcmp (arg, "CLEAR") != 0)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  /* Erasing stalls the timer interrupts, so another station's actuators
+   * must not be switching */
+  if (!actuator_idle ())
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  if (strcmp (arg, "CLEAR") == 0)
+    {
+      quality_clear ();
+      command_reply ("#OK");
+    }
+  else if (quality_keep (pressure->station))
+    command_reply ("#OK");
+  else
+    command_reply ("#ERR STATE");
+}
+
+/**
+ * @brief Handles SWEEP
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param name Axis or field of the sweep, or ON
+ * @param arg New value
+ *
+ * @retval None
+ */
+static void
+command_sweep (struct Pressure *pressure, const char *name, const char *arg)
+{
+  struct SequencerSweep *sweep = sequencer_get_sweep ();
+  struct SequencerAxis *axis = NULL;
+
+  if (name == NULL)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  /* The batch another station runs reads the sweep between its tests */
+  if (pressure->menu.output || sequencer_running ())
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  if (strcmp (name, "ON") == 0)
+    {
+      if (sequencer_use_sweep ())
+        command_reply ("#OK");
+      else
+        command_reply ("#ERR RANGE");
+      return;
+    }
+
+  if (arg == NULL)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  if (strcmp (name, "PER") == 0)
+    axis = &sweep->per;
+  else if (strcmp (name, "AMPL") == 0)
+    axis = &sweep->ampl;
+  else if (strcmp (name, "OFFS") == 0)
+    axis = &sweep->offset;
+
+  if (axis != NULL)
+    {
+      float start, stop;
+      unsigned count;
+
+      if (sscanf (arg, "%f:%f:%u", &start, &stop, &count) != 3 || count == 0
+          || count > SEQUENCER_MAX_RESULTS || start < 0 || stop < 0
+          || start > PRESSURE_MAX || stop > PRESSURE_MAX
+          || (axis == &sweep->per
+              && (start < PRESSURE_SWITCH_TIME || stop < PRESSURE_SWITCH_TIME)))
+        {
+          command_reply ("#ERR VALUE");
+          return;
+        }
+
+      axis->start = start;
+      axis->stop = stop;
+      axis->count = count;
+    }
+  else if (strcmp (name, "WAVE") == 0 || strcmp (name, "END") == 0
+           || strcmp (name, "LIMIT") == 0)
+    {
+      char *end;
+      float val = strtof (arg, &end);
+
+      if (end == arg || *end != '\0')
+        {
+          command_reply ("#ERR VALUE");
+          return;
+        }
+
+      /* A batch test has to run something and end on its own */
+      uint8_t ok;
+      if (strcmp (name, "WAVE") == 0)
+        {
+          ok = val >= 0 && val < WAVEFORMS && val != WAVEFORM_BATCH;
+          if (ok)
+            sweep->waveform = (uint8_t)val;
+        }
+      else if (strcmp (name, "END") == 0)
+        {
+          ok = val >= TEST_END_CYCLES && val <= TEST_END_DURATION;
+          if (ok)
+            sweep->end = (uint8_t)val;
+        }
+      else
+        {
+          ok = val > 0 && val <= 100000;
+          if (ok)
+            sweep->limit = val;
+        }
+
+      if (!ok)
+        {
+          command_reply ("#ERR VALUE");
+          return;
+        }
+    }
+  else
+    {
+      command_reply ("#ERR PARAM");
+      return;
+    }
+
+  command_reply ("#OK");
+}
+
+/**
+ * @brief Handles SCRIPT
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param arg Test to append, CLEAR, or NULL to list the script
+ *
+ * @retval None
+ */
+static void
+command_script (struct Pressure *pressure, const char *arg)
+{
+  if (pressure->menu.output || sequencer_running ())
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  if (arg == NULL)
+    {
+      sequencer_uart_tx_script (command_huart);
+      return;
+    }
+
+  if (strcmp (arg, "CLEAR") == 0)
+    {
+      sequencer_clear ();
+      command_reply ("#OK");
+      return;
+    }
+
+  struct SequencerTest test;
+  unsigned waveform, end;
+  int len = 0;
+
+  if (sscanf (arg, "%u:%f:%f:%f:%u:%f%n", &waveform, &test.per, &test.ampl,
+              &test.offset, &end, &test.limit, &len)
+          != 6
+      || arg[len] != '\0' || waveform > UINT8_MAX || end > UINT8_MAX
+      || test.per < PRESSURE_SWITCH_TIME || test.ampl < 0 || test.offset < 0
+      || test.per > PRESSURE_MAX || test.ampl > PRESSURE_MAX
+      || test.offset > PRESSURE_MAX)
+    {
+      command_reply ("#ERR VALUE");
+      return;
+    }
+
+  test.waveform = waveform;
+  test.end = end;
+
+  if (sequencer_append (&test))
+    command_reply ("#OK");
+  else
+    command_reply ("#ERR RANGE");
+}
+
+/**
+ * @brief Handles PROFILE
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param arg Point to append, CLEAR, or NULL to list the points
+ *
+ * @retval None
+ */
+static void
+command_profile (struct Pressure *pressure, const char *arg)
+{
+  struct Profile *profile = &pressure->profile;
+
+  if (pressure->menu.output)
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  if (arg == NULL)
+    {
+      for (uint8_t i = 0; i < profile->points; i++)
+        command_reply ("#PROFILE %u t=%.2f p=%.2f", i, profile->t[i],
+                       profile->p[i]);
+      command_reply ("#PROFILE n=%u", profile->points);
+      return;
+    }
+
+  if (strcmp (arg, "CLEAR") == 0)
+    {
+      profile->points = 0;
+      command_reply ("#OK");
+      return;
+    }
+
+  float t, p;
+  if (sscanf (arg, "%f:%f", &t, &p) != 2 || p < 0 || p > PRESSURE_MAX)
+    {
+      command_reply ("#ERR VALUE");
+      return;
+    }
+
+  if (waveform_add_point (profile, t, p))
+    command_reply ("#OK");
+  else
+    command_reply ("#ERR RANGE");
+}
+
+/**
+ * @brief Handles CAL
+ *
+ *        The known pressure comes from an external standard (deadweight
+ *        tester, certified gauge) connected to the tank.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param name Scan index of the sensor
+ * @param arg LINEAR, CUBIC, SAVE, a pressure in psi, or NULL for the table
+ *
+ * @retval None
+ */
+static void
+command_cal (struct Pressure *pressure, const char *name, const char *arg)
+{
+  char *end;
+
+  if (name == NULL)
+    {
+      command_reply ("#ERR ARG");
+      return;
+    }
+
+  long ch = strtol (name, &end, 10);
+  struct CalibrationTable *table = NULL;
+  if (end != name && *end == '\0' && ch >= 0)
+    table = calibration_get_table (ch);
+
+  if (table == NULL)
+    {
+      command_reply ("#ERR RANGE");
+      return;
+    }
+
+  if (pressure->menu.output)
+    {
+      command_reply ("#ERR BUSY");
+      return;
+    }
+
+  if (arg == NULL)
+    {
+      for (uint8_t i = 0; i < table->n; i++)
+        command_reply ("#CAL %ld %u code=%u p=%.3f", ch, i, table->code[i],
+                       table->psi[i]);
+      command_reply ("#CAL %ld n=%u %s", ch, table->n,
+                     (table->method == CALIBRATION_CUBIC) ? "cubic"
+                                                          : "linear");
+      return;
+    }
+
+  if (strcmp (arg, "LINEAR") == 0 || strcmp (arg, "CUBIC") == 0)
+    {
+      calibration_capture_begin (ch, (strcmp (arg, "CUBIC") == 0)
+                                         ? CALIBRATION_CUBIC
+                                         : CALIBRATION_LINEAR);
+      command_reply ("#OK");
+      return;
+    }
+
+  if (strcmp (arg, "SAVE") == 0)
+    {
+      /* Erasing stalls the timer interrupts, so another station's actuators
+       * must not be switching */
+      if (!actuator_idle ())
+        {
+          command_reply ("#ERR BUSY");
+          return;
+        }
+
+      calibration_capture_end (ch);
+      calibration_save ();
+      command_reply ("#OK");
+      return;
+    }
+
+  float psi = strtof (arg, &end);
+  if (end == arg || *end != '\0' || psi < 0 || psi > PRESSURE_SENSOR_SPAN)
+    {
+      command_reply ("#ERR VALUE");
+      return;
+    }
+
+  if (calibration_capture_point (pressure->hadc, ch, psi))
+    command_reply ("#OK n=%u", table->n);
+  else
+    command_reply ("#ERR STATE");
+}
+
+/**
+ * @brief Parses and executes one command line
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param line Null terminated command line, modified in place
+ *
+ * @retval None
+ */
+static void
+command_exec (struct Pressure *pressure, char *line)
+{
+  char *argv[3] = { NULL, NULL, NULL };
+  uint8_t argc = 0;
+
+  /* Splits the line into at most three upper case words */
+  for (char *c = line; *c != '\0'; c++)
+    {
+      if (*c == ' ' || *c == '\t')
+        {
+          *c = '\0';
+          continue;
+        }
+
+      *c = toupper ((unsigned char)*c);
+      if ((c == line || c[-1] == '\0') && argc < 3)
+        argv[argc++] = c;
+    }
+
+  if (argc == 0)
+    return;
+
+  if (strcmp (argv[0], "GET") == 0)
+    command_get (pressure, argv[1]);
+  else if (strcmp (argv[0], "SET") == 0)
+    command_set (pressure, argv[1], argv[2]);
+  else if (strcmp (argv[0], "START") == 0)
+    {
+      if (pressure->menu.output)
+        command_reply ("#ERR BUSY");
+      else
+        {
+          menu_sm_output (pressure);
+          command_reply ("#OK");
+        }
+    }
+  else if (strcmp (argv[0], "ABORT") == 0)
+    {
+      /* A trip stays latched until a vent, which only follows a test */
+      if (pressure->menu.output)
+        {
+          safety_trip (SAFETY_ABORT, safety_stamp ());
+          command_reply ("#OK");
+        }
+      else
+        command_reply ("#ERR IDLE");
+    }
+  else if (strcmp (argv[0], "STATUS") == 0)
+    command_reply ("#STATUS station=%u output=%d wave=%s val=%.2f "
+                   "target=%.2f time=%.1f cycles=%lu",
+                   pressure->station, pressure->menu.output,
+                   waveform_name (menu_get_waveform (pressure)),
+                   pressure->val, pressure->target, pressure->elapsed,
+                   (unsigned long)pressure->test.cycles);
+  else if (strcmp (argv[0], "STATION") == 0)
+    {
+      if (argv[1] == NULL)
+        command_reply ("#STATION n=%u of=%u", pressure_get_display (),
+                       PRESSURE_STATIONS);
+      else if (pressure_get_station (atoi (argv[1])) == NULL)
+        command_reply ("#ERR ARG");
+      else
+        {
+          pressure_set_display (atoi (argv[1]));
+          command_reply ("#OK");
+        }
+    }
+  else if (strcmp (argv[0], "STATS") == 0)
+    acquisition_uart_tx_stats (command_huart);
+  else if (strcmp (argv[0], "PRESET") == 0)
+    command_preset (pressure, argv[1]);
+  else if (strcmp (argv[0], "TRACE") == 0)
+    {
+      /* A dump takes seconds, which would stall every running test */
+      if (pressure->menu.output || pressure_testing ())
+        command_reply ("#ERR BUSY");
+      else
+        trace_uart_tx (pressure->station, command_huart);
+    }
+  else if (strcmp (argv[0], "SAFETY") == 0)
+    safety_uart_tx (command_huart);
+  else if (strcmp (argv[0], "TUNE") == 0)
+    tune_uart_tx (pressure->station, command_huart);
+  else if (strcmp (argv[0], "ENSEMBLE") == 0)
+    {
+      if (pressure->menu.output)
+        command_reply ("#ERR BUSY");
+      else if (ensemble_cycles (pressure->station) == 0)
+        command_reply ("#ERR STATE");
+      else
+        ensemble_uart_tx (pressure->station, command_huart);
+    }
+  else if (strcmp (argv[0], "QUALITY") == 0)
+    command_quality (pressure, argv[1]);
+  else if (strcmp (argv[0], "SWEEP") == 0)
+    command_sweep (pressure, argv[1], argv[2]);
+  else if (strcmp (argv[0], "SCRIPT") == 0)
+    command_script (pressure, argv[1]);
+  else if (strcmp (argv[0], "PROFILE") == 0)
+    command_profile (pressure, argv[1]);
+  else if (strcmp (argv[0], "CAL") == 0)
+    command_cal (pressure, argv[1], argv[2]);
+  else if (strcmp (argv[0], "BURST") == 0)
+    {
+      if (argv[1] == NULL)
+        burst_uart_tx_stats (command_huart);
+      else if (strcmp (argv[1], "ON") == 0 || strcmp (argv[1], "OFF") == 0)
+        {
+          burst_enable (strcmp (argv[1], "ON") == 0);
+          command_reply ("#OK");
+        }
+      else
+        command_reply ("#ERR ARG");
+    }
+  else
+    command_reply ("#ERR CMD");
+}
+
+/**
+ * @brief Processes received bytes
+ *
+ *        Consumes at most COMMAND_POLL_BYTES bytes from the ring buffer and
+ *        executes each line they complete. Lines longer than
+ *        COMMAND_LINE_SIZE are discarded.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+command_poll (struct Pressure *pressure)
+{
+  for (uint8_t n = 0; n < COMMAND_POLL_BYTES; n++)
+    {
+      if (shared_queue_count (&command_rx_queue) == 0)
+        break;
+
+      char c = command_rx[shared_queue_peek (&command_rx_queue, 0)];
+      shared_queue_release (&command_rx_queue, 1);
+
+      if (c == '\r' || c == '\n')
+        {
+          if (command_line_ovf)
+            command_reply ("#ERR LENGTH");
+          else if (command_line_len > 0)
+            {
+              command_line[command_line_len] = '\0';
+              command_exec (pressure, command_line);
+            }
+
+          command_line_len = 0;
+          command_line_ovf = 0;
+        }
+      else if (command_line_len < COMMAND_LINE_SIZE - 1)
+        command_line[command_line_len++] = c;
+      else
+        command_line_ovf = 1;
+    }
+}
@@ -0,0 +1,295 @@
+/**
+ * @file ensemble.c
+ *
+ * @brief Cycle-averaged response program body
+ *
+ *        Step, ramp and sine tests repeat the same cycle until they end. The
+ *        pressure read on every tick is kept for the current cycle; when the
+ *        test completes the cycle, its samples are spread over
+ *        ENSEMBLE_BINS phase bins and the mean of each bin is folded into
+ *        that bin's running mean and variance with Welford's method. A cycle
+ *        that doesn't complete is dropped.
+ *
+ *        Phase is taken from the position of a sample within its own cycle,
+ *        so cycles that run longer or shorter than .per still line up. The
+ *        spread of a bin is the cycle-to-cycle scatter of the response; the
+ *        error of its mean falls as 1 / sqrt(cycles).
+ *
+ *        Memory doesn't depend on the length of the run. A cycle with more
+ *        than ENSEMBLE_SAMPLES ticks is kept at a lower resolution: whenever
+ *        the buffer fills, neighbouring samples are averaged in pairs and
+ *        every later slot covers twice as many ticks.
+ *
+ *        Every station averages its own cycle.
+ */
+
+#include "ensemble.h"
+#include "pressure.h"
+#include "stm32f4xx_hal.h"
+#include "timebase.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Struct containing the averaged cycle of one station */
+struct EnsembleState
+{
+  struct EnsembleBin bins[ENSEMBLE_BINS]; /*!< Across cycles */
+  float buf[ENSEMBLE_SAMPLES];            /*!< Current cycle */
+  uint16_t len;    /*!< Slots filled in buf */
+  uint16_t stride; /*!< Ticks per slot */
+  float acc;       /*!< Sum of the slot being filled */
+  uint16_t acc_n;  /*!< Ticks in the slot being filled */
+  uint32_t n;      /*!< Cycles folded */
+  uint64_t t0;     /*!< Timebase at the cycle start */
+  float dur;       /*!< Total length of folded cycles */
+  uint8_t active;  /*!< Set while a test is averaged */
+};
+
+static struct EnsembleState
+    ensemble_stations[PRESSURE_STATIONS]; /*!< Average of each station */
+
+/**
+ * @brief Empties the current cycle
+ *
+ * @param en Average of the station
+ *
+ * @retval None
+ */
+static void
+ensemble_restart (struct EnsembleState *en)
+{
+  en->len = 0;
+  en->stride = 1;
+  en->acc = 0.0f;
+  en->acc_n = 0;
+  en->t0 = timebase_us ();
+}
+
+/**
+ * @brief Clears the averaged cycle of a station and starts collecting
+ *
+ *        Called by the test once it has reached its first cycle.
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+ensemble_start (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct EnsembleState *en = &ensemble_stations[station];
+
+  memset (en->bins, 0, sizeof (en->bins));
+  en->n = 0;
+  en->dur = 0.0f;
+  ensemble_restart (en);
+  en->active = 1;
+}
+
+/**
+ * @brief Stops collecting on a station, dropping the unfinished cycle
+ *
+ *        The averaged cycle is kept until the next ensemble_start.
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+ensemble_stop (uint8_t station)
+{
+  if (station < PRESSURE_STATIONS)
+    ensemble_stations[station].active = 0;
+}
+
+/**
+ * @brief Adds one tick of pressure to the current cycle of a station
+ *
+ *        Ignored unless a test is averaged.
+ *
+ * @param station Index of the station
+ * @param val Measured pressure
+ *
+ * @retval None
+ */
+void
+ensemble_update (uint8_t station, float val)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct EnsembleState *en = &ensemble_stations[station];
+
+  if (!en->active)
+    return;
+
+  en->acc += val;
+  if (++en->acc_n < en->stride)
+    return;
+
+  en->buf[en->len++] = en->acc / en->acc_n;
+  en->acc = 0.0f;
+  en->acc_n = 0;
+
+  /* Halves the resolution instead of growing */
+  if (en->len == ENSEMBLE_SAMPLES)
+    {
+      for (uint16_t i = 0; i < ENSEMBLE_SAMPLES / 2; i++)
+        en->buf[i] = (en->buf[2 * i] + en->buf[(2 * i) + 1]) / 2;
+
+      en->len = ENSEMBLE_SAMPLES / 2;
+      en->stride *= 2;
+    }
+}
+
+/**
+ * @brief Folds the cycle that has just completed into the average
+ *
+ *        Called by the test at the end of every cycle that ran to the end.
+ *        Bins that no sample of the cycle falls in, in cycles shorter than
+ *        ENSEMBLE_BINS ticks, are left out for that cycle.
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+ensemble_cycle (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct EnsembleState *en = &ensemble_stations[station];
+
+  if (!en->active)
+    return;
+
+  /* The partial slot is shorter but still one slot */
+  uint16_t len = en->len;
+  if (en->acc_n > 0)
+    en->buf[len++] = en->acc / en->acc_n;
+
+  if (len > 0)
+    {
+      float sum[ENSEMBLE_BINS] = { 0 };
+      uint16_t cnt[ENSEMBLE_BINS] = { 0 };
+
+      /* Slots spread evenly over one period, the first at phase 0 */
+      for (uint16_t i = 0; i < len; i++)
+        {
+          uint16_t k = (i * ENSEMBLE_BINS) / len;
+          sum[k] += en->buf[i];
+          cnt[k]++;
+        }
+
+      for (uint8_t k = 0; k < ENSEMBLE_BINS; k++)
+        {
+          if (cnt[k] == 0)
+            continue;
+
+          struct EnsembleBin *bin = &en->bins[k];
+          float x = sum[k] / cnt[k];
+
+          bin->n++;
+          float delta = x - bin->mean;
+          bin->mean += delta / bin->n;
+          bin->m2 += delta * (x - bin->mean);
+        }
+
+      en->n++;
+      en->dur += timebase_elapsed (en->t0);
+    }
+
+  ensemble_restart (en);
+}
+
+/**
+ * @brief Returns the number of cycles folded into the average of a station
+ *
+ * @param station Index of the station
+ *
+ * @retval uint32_t Completed cycles since ensemble_start
+ */
+uint32_t
+ensemble_cycles (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return 0;
+
+  return ensemble_stations[station].n;
+}
+
+/**
+ * @brief Returns the statistics of a phase bin of a station
+ *
+ * @param station Index of the station
+ * @param bin Bin index, 0 at the start of the cycle
+ *
+ * @retval const struct EnsembleBin* Statistics, NULL if out of range
+ */
+const struct EnsembleBin *
+ensemble_get_bin (uint8_t station, uint8_t bin)
+{
+  if (station >= PRESSURE_STATIONS || bin >= ENSEMBLE_BINS)
+    return NULL;
+
+  return &ensemble_stations[station].bins[bin];
+}
+
+/**
+ * @brief Transmits the averaged cycle of a station through UART
+ *
+ *        A header with the number of cycles and their average length, then
+ *        one line per bin: phase at the bin centre as a fraction of the
+ *        cycle, mean pressure, spread between cycles and standard error of
+ *        the mean, all in psi. Nothing is sent before a cycle has completed.
+ *
+ * @param station Index of the station
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+ensemble_uart_tx (uint8_t station, UART_HandleTypeDef *huart)
+{
+  char str[80];
+
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  const struct EnsembleState *en = &ensemble_stations[station];
+
+  if (en->n == 0)
+    return;
+
+  int len = snprintf (str, sizeof (str),
+                      "#ENSEMBLE cycles=%lu bins=%u per=%.2f\r\n",
+                      (unsigned long)en->n, ENSEMBLE_BINS,
+                      en->dur / en->n);
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+
+  for (uint8_t k = 0; k < ENSEMBLE_BINS; k++)
+    {
+      const struct EnsembleBin *bin = &en->bins[k];
+
+      float sd = 0.0f;
+      if (bin->n > 1)
+        sd = sqrtf (bin->m2 / (bin->n - 1));
+
+      float se = 0.0f;
+      if (bin->n > 0)
+        se = sd / sqrtf (bin->n);
+
+      len = snprintf (str, sizeof (str),
+                      "#BIN k=%u phase=%.3f mean=%.3f sd=%.3f se=%.3f "
+                      "n=%lu\r\n",
+                      k, (k + 0.5f) / ENSEMBLE_BINS, bin->mean, sd, se,
+                      (unsigned long)bin->n);
+      HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+    }
+}
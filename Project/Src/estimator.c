@@ -0,0 +1,137 @@
+/**
+ * @file estimator.c
+ *
+ * @brief Pressure and rate estimator program body
+ *
+ *        A Kalman filter over the reference sensor with a constant-rate
+ *        model: the pressure integrates the rate, and the rate drifts as a
+ *        random walk. Whenever an actuator switches the rate is expected to
+ *        jump, so its uncertainty is raised and the filter follows the new
+ *        slope within a few scans instead of averaging over it.
+ *
+ *        Every update is a fixed number of operations on 2x2 matrices, so it
+ *        runs from the scan complete interrupt at the full acquisition rate.
+ *        The estimate is published to the main loop as a seqlock snapshot.
+ *
+ *        Every station has its own filter over its own reference sensor.
+ */
+
+#include "estimator.h"
+#include "acquisition.h"
+#include "shared.h"
+
+/* Struct containing the filter of one station */
+struct EstimatorState
+{
+  float x[2];          /*!< Pressure and rate */
+  float p00;           /*!< Pressure variance */
+  float p01;           /*!< Pressure-rate covariance */
+  float p11;           /*!< Rate variance */
+  uint8_t pins;        /*!< Actuator pins at the last update */
+  uint8_t ready;       /*!< Set after the first sample */
+  struct Estimate out; /*!< Last published estimate */
+  struct SharedSeq seq; /*!< Guards out */
+};
+
+static struct EstimatorState
+    estimator_stations[PRESSURE_STATIONS]; /*!< Filter of each station */
+
+/**
+ * @brief Publishes the state as the latest estimate
+ *
+ * @param st Filter of the station
+ *
+ * @retval None
+ */
+static void
+estimator_publish (struct EstimatorState *st)
+{
+  struct Estimate est = { .p = st->x[0], .rate = st->x[1] };
+
+  shared_seq_write (&st->seq, &st->out, &est, sizeof (est));
+}
+
+/**
+ * @brief Adds one reference sample to the estimate
+ *
+ *        Called from the ADC conversion complete interrupt.
+ *
+ * @param station Index of the station
+ * @param z Reference pressure in psi
+ * @param pins Actuator pin levels of the station, bit 0 : compressor, bit 1 :
+ *             exhaust
+ *
+ * @retval None
+ */
+void
+estimator_update (uint8_t station, float z, uint8_t pins)
+{
+  const float dt = 1.0f / ACQUISITION_RATE;
+
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct EstimatorState *st = &estimator_stations[station];
+
+  if (!st->ready)
+    {
+      st->x[0] = z;
+      st->x[1] = 0.0f;
+      st->p00 = ESTIMATOR_R;
+      st->p01 = 0.0f;
+      st->p11 = ESTIMATOR_SWITCH_VAR;
+      st->pins = pins;
+      st->ready = 1;
+      estimator_publish (st);
+      return;
+    }
+
+  /* Predict */
+  st->x[0] += st->x[1] * dt;
+  st->p00 += dt * ((2.0f * st->p01) + (dt * st->p11));
+  st->p01 += dt * st->p11;
+  st->p11 += ESTIMATOR_Q * dt;
+
+  if (pins != st->pins)
+    {
+      st->p11 += ESTIMATOR_SWITCH_VAR;
+      st->pins = pins;
+    }
+
+  /* Correct */
+  float s = st->p00 + ESTIMATOR_R;
+  float k0 = st->p00 / s;
+  float k1 = st->p01 / s;
+  float y = z - st->x[0];
+
+  st->x[0] += k0 * y;
+  st->x[1] += k1 * y;
+
+  st->p11 -= k1 * st->p01;
+  st->p01 -= k1 * st->p00;
+  st->p00 -= k0 * st->p00;
+
+  estimator_publish (st);
+}
+
+/**
+ * @brief Returns the latest estimate of a station
+ *
+ * @param station Index of the station
+ * @param est Filled with the pressure and rate
+ *
+ * @retval None
+ */
+void
+estimator_get (uint8_t station, struct Estimate *est)
+{
+  if (station >= PRESSURE_STATIONS)
+    {
+      *est = (struct Estimate){ 0 };
+      return;
+    }
+
+  struct EstimatorState *st = &estimator_stations[station];
+
+  shared_seq_read (&st->seq, est, &st->out, sizeof (*est));
+}
@@ -0,0 +1,287 @@
+/**
+ * @file lcd.c
+ *
+ * @brief Asynchronous LCD driver program body
+ *
+ *        Drawing only writes into a frame buffer in RAM. lcd_flush compares
+ *        the frame with a shadow of what the panel shows and queues the
+ *        changed cells, as runs of characters behind a single address
+ *        command. Each HD44780 byte is encoded as the four PCF8574 writes
+ *        that clock out its two nibbles, and the queue is drained by I2C DMA
+ *        transfers chained from the completion interrupt. Submitting a frame
+ *        takes microseconds, and since the panel is cleared by overwriting
+ *        cells with spaces, the slow clear command is never sent.
+ *
+ *        If the queue is full, the cells that didn't fit stay different from
+ *        the shadow and are sent by a later flush with whatever they hold by
+ *        then, so a slow bus drops intermediate frames instead of stalling.
+ *
+ *        The I2C_LCD driver still initializes the panel and its custom
+ *        characters. The I2C TX DMA stream must be linked to the handle in
+ *        CubeMX.
+ */
+
+#include "lcd.h"
+#include "stm32f4xx_hal.h"
+
+#include <string.h>
+
+/* DDRAM address of the first cell of each row */
+static const uint8_t lcd_row_addr[LCD_ROWS] = { 0x00, 0x40, 0x14, 0x54 };
+
+static I2C_HandleTypeDef *lcd_hi2c; /*!< I2C bus of the backpack */
+static uint8_t lcd_frame[LCD_ROWS][LCD_COLS];  /*!< Frame being drawn */
+static uint8_t lcd_shadow[LCD_ROWS][LCD_COLS]; /*!< Frame on the panel */
+static uint8_t lcd_x = 0; /*!< Cursor column */
+static uint8_t lcd_y = 0; /*!< Cursor row */
+
+static uint8_t lcd_queue[LCD_QUEUE_SIZE]; /*!< Encoded I2C bytes */
+static volatile uint16_t lcd_head = 0;    /*!< Written by lcd_flush */
+static volatile uint16_t lcd_tail = 0;    /*!< Written by the ISR */
+static volatile uint16_t lcd_len = 0;     /*!< Bytes in the DMA transfer */
+
+/**
+ * @brief Starts a DMA transfer of the queued bytes
+ *
+ *        Sends at most up to the end of the ring. Must be called with
+ *        interrupts disabled, or from the completion interrupt.
+ *
+ * @retval None
+ */
+static void
+lcd_start (void)
+{
+  uint16_t head = lcd_head;
+
+  if (lcd_len != 0 || head == lcd_tail)
+    return;
+
+  uint16_t idx = lcd_tail & (LCD_QUEUE_SIZE - 1);
+  uint16_t len = head - lcd_tail;
+  if (len > LCD_QUEUE_SIZE - idx)
+    len = LCD_QUEUE_SIZE - idx;
+
+  lcd_len = len;
+  if (HAL_I2C_Master_Transmit_DMA (lcd_hi2c, LCD_ADDR, &lcd_queue[idx], len)
+      != HAL_OK)
+    lcd_len = 0;
+}
+
+/**
+ * @brief I2C transmit complete callback
+ *
+ *        Releases the bytes just sent and chains the next transfer.
+ *
+ * @param hi2c HAL I2C handle that finished
+ *
+ * @retval None
+ */
+void
+HAL_I2C_MasterTxCpltCallback (I2C_HandleTypeDef *hi2c)
+{
+  if (hi2c != lcd_hi2c)
+    return;
+
+  lcd_tail += lcd_len;
+  lcd_len = 0;
+  lcd_start ();
+}
+
+/**
+ * @brief I2C error callback
+ *
+ *        Drops the transfer, the cells it held are redrawn by the next flush.
+ *
+ * @param hi2c HAL I2C handle that failed
+ *
+ * @retval None
+ */
+void
+HAL_I2C_ErrorCallback (I2C_HandleTypeDef *hi2c)
+{
+  if (hi2c != lcd_hi2c)
+    return;
+
+  lcd_tail = lcd_head;
+  lcd_len = 0;
+  memset (lcd_shadow, 0xFF, sizeof (lcd_shadow));
+}
+
+/**
+ * @brief Takes over an initialized panel
+ *
+ * @param hi2c HAL I2C handle of the backpack
+ *
+ * @retval None
+ */
+void
+lcd_init (I2C_HandleTypeDef *hi2c)
+{
+  lcd_hi2c = hi2c;
+
+  /* Unknown contents, every cell is redrawn by the first flush */
+  memset (lcd_shadow, 0xFF, sizeof (lcd_shadow));
+  lcd_clear ();
+}
+
+/**
+ * @brief Blanks the frame and homes the cursor
+ *
+ * @retval None
+ */
+void
+lcd_clear (void)
+{
+  memset (lcd_frame, ' ', sizeof (lcd_frame));
+  lcd_x = 0;
+  lcd_y = 0;
+}
+
+/**
+ * @brief Moves the cursor
+ *
+ *        (0, 0) is the top left of the LCD.
+ *
+ * @param x Column
+ * @param y Row
+ *
+ * @retval None
+ */
+void
+lcd_set_cursor (uint8_t x, uint8_t y)
+{
+  lcd_x = x;
+  lcd_y = y;
+}
+
+/**
+ * @brief Writes one character code at the cursor and advances it
+ *
+ *        Characters past the end of the row are dropped.
+ *
+ * @param c Character code, 0 to 7 for custom characters
+ *
+ * @retval None
+ */
+static void
+lcd_put (uint8_t c)
+{
+  if (lcd_x < LCD_COLS && lcd_y < LCD_ROWS)
+    lcd_frame[lcd_y][lcd_x++] = c;
+}
+
+/**
+ * @brief Writes a string at the cursor
+ *
+ * @param str Null terminated string
+ *
+ * @retval None
+ */
+void
+lcd_write_string (const char *str)
+{
+  while (*str != '\0')
+    lcd_put (*str++);
+}
+
+/**
+ * @brief Writes a custom character at the cursor
+ *
+ * @param idx Custom character slot, 0 to 7
+ *
+ * @retval None
+ */
+void
+lcd_print_custom_char (uint8_t idx)
+{
+  lcd_put (idx & 0x07);
+}
+
+/**
+ * @brief Encodes one HD44780 byte into the queue
+ *
+ *        Four PCF8574 writes: each nibble is presented with EN high, then
+ *        latched by EN going low.
+ *
+ * @param b Byte
+ * @param rs LCD_RS for data, 0 for a command
+ *
+ * @retval None
+ */
+static void
+lcd_queue_byte (uint8_t b, uint8_t rs)
+{
+  uint8_t hi = (b & 0xF0) | LCD_BL | rs;
+  uint8_t lo = ((b << 4) & 0xF0) | LCD_BL | rs;
+  uint16_t head = lcd_head;
+
+  lcd_queue[head++ & (LCD_QUEUE_SIZE - 1)] = hi | LCD_EN;
+  lcd_queue[head++ & (LCD_QUEUE_SIZE - 1)] = hi;
+  lcd_queue[head++ & (LCD_QUEUE_SIZE - 1)] = lo | LCD_EN;
+  lcd_queue[head++ & (LCD_QUEUE_SIZE - 1)] = lo;
+
+  lcd_head = head;
+}
+
+/**
+ * @brief Queues the cells of one row that differ from the panel
+ *
+ *        One address command per run of changed cells.
+ *
+ * @param y Row
+ *
+ * @retval uint8_t 1 : Row queued
+ *                 0 : Queue full, the rest of the row stays dirty
+ */
+static uint8_t
+lcd_flush_row (uint8_t y)
+{
+  uint8_t x = 0;
+
+  while (x < LCD_COLS)
+    {
+      if (lcd_frame[y][x] == lcd_shadow[y][x])
+        {
+          x++;
+          continue;
+        }
+
+      uint8_t end = x;
+      while (end < LCD_COLS && lcd_frame[y][end] != lcd_shadow[y][end])
+        end++;
+
+      /* Address command plus the run, 4 I2C bytes each */
+      uint16_t need = (1 + (end - x)) * 4;
+      if ((uint16_t)(LCD_QUEUE_SIZE - (lcd_head - lcd_tail)) < need)
+        return 0;
+
+      lcd_queue_byte (0x80 | (lcd_row_addr[y] + x), 0);
+      for (; x < end; x++)
+        {
+          lcd_queue_byte (lcd_frame[y][x], LCD_RS);
+          lcd_shadow[y][x] = lcd_frame[y][x];
+        }
+    }
+
+  return 1;
+}
+
+/**
+ * @brief Sends the cells that differ from the panel
+ *
+ *        Starts the transfer if the bus is idle and returns without waiting.
+ *
+ * @retval None
+ */
+void
+lcd_flush (void)
+{
+  for (uint8_t y = 0; y < LCD_ROWS; y++)
+    if (!lcd_flush_row (y))
+      break;
+
+  uint32_t primask = __get_PRIMASK ();
+  __disable_irq ();
+  lcd_start ();
+  __set_PRIMASK (primask);
+}
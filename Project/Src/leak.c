@@ -0,0 +1,169 @@
+/**
+ * @file leak.c
+ *
+ * @brief Leak-rate test program body
+ *
+ *        Fits a straight line to the pressure of the isolated tank against
+ *        time, by least squares. The means and co-moments are updated in
+ *        place for every sample (Welford), so the fit takes constant memory
+ *        and stays accurate however long the hold runs.
+ *
+ *        The slope's standard error comes from the residuals of the fit. The
+ *        test has converged once its confidence interval no longer contains
+ *        the pass limit, or is already tighter than LEAK_PRECISION of it.
+ *
+ *        Every station has its own fit.
+ */
+
+#include "leak.h"
+#include "pressure.h"
+#include "stm32f4xx_hal.h"
+
+#include <math.h>
+#include <stdio.h>
+
+/* Struct containing the fit of one station */
+struct LeakState
+{
+  float max;             /*!< Pass limit in psi/min */
+  uint32_t n;            /*!< Samples fitted */
+  float mean_t;          /*!< Mean time */
+  float mean_p;          /*!< Mean pressure */
+  float stt;             /*!< Sum of squared time deviations */
+  float stp;             /*!< Sum of time-pressure co-deviations */
+  float spp;             /*!< Sum of squared pressure deviations */
+  float t0;              /*!< Time of the first sample */
+  struct LeakResult res; /*!< Estimate after the last sample */
+};
+
+static struct LeakState leak_stations[PRESSURE_STATIONS]; /*!< Each station */
+
+/**
+ * @brief Starts a new fit on a station
+ *
+ * @param station Index of the station
+ * @param max Largest leak rate that passes in psi/min
+ *
+ * @retval None
+ */
+void
+leak_begin (uint8_t station, float max)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  leak_stations[station] = (struct LeakState){ .max = max };
+}
+
+/**
+ * @brief Adds one sample to the fit of a station
+ *
+ * @param station Index of the station
+ * @param t Time in sec
+ * @param p Pressure in psi
+ *
+ * @retval uint8_t 1 : Converged, the test can end
+ *                 0 : Keep sampling
+ */
+uint8_t
+leak_step (uint8_t station, float t, float p)
+{
+  if (station >= PRESSURE_STATIONS)
+    return 0;
+
+  struct LeakState *lk = &leak_stations[station];
+  struct LeakResult *res = &lk->res;
+
+  if (lk->n == 0)
+    lk->t0 = t;
+
+  /* Relative to the first sample, so the time terms stay small */
+  t -= lk->t0;
+  lk->n++;
+
+  float dt = t - lk->mean_t;
+  float dp = p - lk->mean_p;
+  lk->mean_t += dt / lk->n;
+  lk->mean_p += dp / lk->n;
+  lk->stt += dt * (t - lk->mean_t);
+  lk->stp += dt * (p - lk->mean_p);
+  lk->spp += dp * (p - lk->mean_p);
+
+  res->n = lk->n;
+  res->t = t;
+
+  if (lk->n < 3 || lk->stt <= 0.0f)
+    return 0;
+
+  float slope = lk->stp / lk->stt;
+  float sse = lk->spp - (slope * lk->stp);
+  if (sse < 0.0f)
+    sse = 0.0f;
+  float se = sqrtf (sse / ((lk->n - 2) * lk->stt));
+
+  res->p = lk->mean_p + (slope * (t - lk->mean_t));
+  res->rate = -slope * 60.0f;
+  res->conf = LEAK_Z * se * 60.0f;
+
+  if (res->rate - res->conf > lk->max)
+    res->verdict = LEAK_FAIL;
+  else if (res->rate + res->conf <= lk->max)
+    res->verdict = LEAK_PASS;
+  else
+    res->verdict = LEAK_PENDING;
+
+  res->converged = (lk->n >= LEAK_MIN_SAMPLES) && (t >= LEAK_MIN_TIME)
+                   && ((res->verdict != LEAK_PENDING)
+                       || (res->conf <= LEAK_PRECISION * lk->max));
+
+  return res->converged;
+}
+
+/**
+ * @brief Returns the estimate of a station after the last sample
+ *
+ * @param station Index of the station
+ *
+ * @retval const struct LeakResult* Estimate, NULL for a bad station
+ */
+const struct LeakResult *
+leak_get (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return NULL;
+
+  return &leak_stations[station].res;
+}
+
+/**
+ * @brief Transmits the estimate of a station through UART
+ *
+ *        A test that ends without a decision is judged on the fitted rate
+ *        alone, and marked as not converged.
+ *
+ * @param station Index of the station
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+leak_uart_tx (uint8_t station, UART_HandleTypeDef *huart)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  const struct LeakState *lk = &leak_stations[station];
+  const struct LeakResult *res = &lk->res;
+  uint8_t pass = (res->verdict == LEAK_PENDING) ? (res->rate <= lk->max)
+                                                : (res->verdict == LEAK_PASS);
+
+  char str[112];
+  int len = snprintf (str, sizeof (str),
+                      "#LEAK n=%lu t=%.1f p=%.2f rate=%.4f conf=%.4f max=%.4f "
+                      "%s%s\r\n",
+                      (unsigned long)res->n, res->t, res->p, res->rate,
+                      res->conf, lk->max, pass ? "PASS" : "FAIL",
+                      res->converged ? "" : " unconverged");
+
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
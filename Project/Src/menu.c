@@ -6,6 +6,7 @@
 
 #include "menu.h"
 #include "I2C_LCD.h"
+#include "lcd.h"
 #include "pressure.h"
 
 #include <math.h>
@@ -28,9 +29,7 @@ enum lcd_state
   STATE_OUTPUT_SETVAL
 };
 
-static enum lcd_state pressure_lcd_state
-    = 0;                  /* Holds the state of the LCD state machine */
-uint8_t waveform_idx = 2; /* Indexes waveform strings located in menu.h */
+extern I2C_HandleTypeDef LCD_MODULE_HANDLE;
 
 void menu_sm_printinfo (struct Pressure *pressure);
 void menu_sm_println (const char *str, float val, uint8_t cursor_x,
@@ -41,7 +40,8 @@ void menu_sm_printstr (const char *str, const char *str_val, uint8_t cursor_x,
 /**
  * @brief Initializes the menu driver
  *
- *        Adds custom chars listed under menu.h to I2C_LCD_1.
+ *        Adds custom chars listed under menu.h to I2C_LCD_1, then hands the
+ *        panel over to the asynchronous driver.
  *
  * @retval None
  */
@@ -56,6 +56,54 @@ menu_sm_init (void)
   I2C_LCD_CreateCustomChar (I2C_LCD_1, 5, lcd_char_scr_qt_2_4);
   I2C_LCD_CreateCustomChar (I2C_LCD_1, 6, lcd_char_scr_qt_3_4);
   I2C_LCD_CreateCustomChar (I2C_LCD_1, 7, lcd_char_scr_qt_4_4);
+
+  /* Drawing is asynchronous from here on */
+  lcd_init (&LCD_MODULE_HANDLE);
+}
+
+/**
+ * @brief Returns the waveform selected in the menu of a station
+ *
+ * @param pressure Pointer to a pressure struct
+ *
+ * @retval uint8_t enum waveform in waveform.h
+ */
+uint8_t
+menu_get_waveform (struct Pressure *pressure)
+{
+  return pressure->menu.waveform;
+}
+
+/**
+ * @brief Selects a waveform without going through the menu
+ *
+ * @param pressure Pointer to a pressure struct
+ * @param idx enum waveform in waveform.h
+ *
+ * @retval None
+ */
+void
+menu_set_waveform (struct Pressure *pressure, uint8_t idx)
+{
+  if (idx < WAVEFORMS)
+    pressure->menu.waveform = idx;
+}
+
+/**
+ * @brief Starts a test without going through the menu
+ *
+ *        Leaves the LCD in the same state as pressing the encoder on
+ *        "Press to begin", so the next press aborts the test.
+ *
+ * @param pressure Pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+menu_sm_output (struct Pressure *pressure)
+{
+  pressure->menu.state = STATE_OUTPUT;
+  menu_sm_setstate (pressure, 2);
 }
 
 /**
@@ -80,13 +128,13 @@ menu_sm_printinfo (struct Pressure *pressure)
   if (isnan (devi))
     devi = 0.0f;
 
-  if (pressure_lcd_state == STATE_OUTPUT_SETVAL)
+  if (pressure->menu.state == STATE_OUTPUT_SETVAL)
     {
       if (!isinf (devi))
         menu_sm_println ("Dev:  %.1f%%", devi, 0, 1);
 
       /* Time */
-      menu_sm_println ("Time: %.1f sec", pressure->tim3_elapsed, 0, 2);
+      menu_sm_println ("Time: %.1f sec", pressure->elapsed, 0, 2);
     }
 }
 
@@ -106,12 +154,12 @@ void
 menu_sm_printstr (const char *str, const char *str_val, uint8_t cursor_x,
                   uint8_t cursor_y)
 {
-  I2C_LCD_SetCursor (I2C_LCD_1, cursor_x, cursor_y);
+  lcd_set_cursor (cursor_x, cursor_y);
 
   char buf[20] = { '\0' };
   snprintf (buf, 20, str, str_val);
 
-  I2C_LCD_WriteString (I2C_LCD_1, buf);
+  lcd_write_string (buf);
 }
 
 /**
@@ -130,12 +178,12 @@ void
 menu_sm_println (const char *str, float val, uint8_t cursor_x,
                  uint8_t cursor_y)
 {
-  I2C_LCD_SetCursor (I2C_LCD_1, cursor_x, cursor_y);
+  lcd_set_cursor (cursor_x, cursor_y);
 
   char buf[20] = { '\0' };
   snprintf (buf, 20, str, val);
 
-  I2C_LCD_WriteString (I2C_LCD_1, buf);
+  lcd_write_string (buf);
 }
 
 /**
@@ -153,25 +201,25 @@ menu_sm_println (const char *str, float val, uint8_t cursor_x,
 void
 menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
 {
-  switch (pressure_lcd_state)
+  switch (pressure->menu.state)
     {
     case STATE_WAVE:
       switch (rotary_inpt)
         {
         case -1:
-          pressure_lcd_state = STATE_OUTPUT;
+          pressure->menu.state = STATE_OUTPUT;
           break;
 
         case 1:
-          if (waveform_idx != 0)
-            pressure_lcd_state = STATE_PER;
+          if (pressure->menu.waveform != 0)
+            pressure->menu.state = STATE_PER;
           else
-            pressure_lcd_state = STATE_OFFS;
+            pressure->menu.state = STATE_OFFS;
           break;
 
         case 2:
-          pressure_lcd_state = STATE_WAVE_SETVAL;
-          pressure->menu.prev_val = waveform_idx;
+          pressure->menu.state = STATE_WAVE_SETVAL;
+          pressure->menu.prev_val = pressure->menu.waveform;
           break;
 
         default:
@@ -191,33 +239,33 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
           break;
 
         case 2:
-          pressure_lcd_state = STATE_WAVE;
-          waveform_idx = pressure->menu.prev_val;
+          pressure->menu.state = STATE_WAVE;
+          pressure->menu.waveform = pressure->menu.prev_val;
           break;
 
         default:
           break;
         }
 
-      if (pressure->menu.prev_val > 3)
+      if (pressure->menu.prev_val > WAVEFORMS - 1)
         pressure->menu.prev_val = 0;
       else if (pressure->menu.prev_val < 0)
-        pressure->menu.prev_val = 3;
+        pressure->menu.prev_val = WAVEFORMS - 1;
       break;
 
     case STATE_PER:
       switch (rotary_inpt)
         {
         case -1:
-          pressure_lcd_state = STATE_WAVE;
+          pressure->menu.state = STATE_WAVE;
           break;
 
         case 1:
-          pressure_lcd_state = STATE_AMPL;
+          pressure->menu.state = STATE_AMPL;
           break;
 
         case 2:
-          pressure_lcd_state = STATE_PER_SETVAL;
+          pressure->menu.state = STATE_PER_SETVAL;
           pressure->menu.prev_val = pressure->per;
           break;
 
@@ -230,7 +278,8 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
       switch (rotary_inpt)
         {
         case -1:
-          if (pressure->menu.prev_val > 0.0f)
+          /* Shorter periods leave no time to switch the components */
+          if (pressure->menu.prev_val - 1.0f >= PRESSURE_SWITCH_TIME)
             pressure->menu.prev_val -= 1.0f;
           break;
 
@@ -240,7 +289,7 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
           break;
 
         case 2:
-          pressure_lcd_state = STATE_PER;
+          pressure->menu.state = STATE_PER;
           pressure->per = pressure->menu.prev_val;
           break;
 
@@ -253,15 +302,15 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
       switch (rotary_inpt)
         {
         case -1:
-          pressure_lcd_state = STATE_PER;
+          pressure->menu.state = STATE_PER;
           break;
 
         case 1:
-          pressure_lcd_state = STATE_OFFS;
+          pressure->menu.state = STATE_OFFS;
           break;
 
         case 2:
-          pressure_lcd_state = STATE_AMPL_SETVAL;
+          pressure->menu.state = STATE_AMPL_SETVAL;
           pressure->menu.prev_val = pressure->ampl;
           break;
 
@@ -284,7 +333,7 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
           break;
 
         case 2:
-          pressure_lcd_state = STATE_AMPL;
+          pressure->menu.state = STATE_AMPL;
           pressure->ampl = pressure->menu.prev_val;
           break;
 
@@ -297,18 +346,18 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
       switch (rotary_inpt)
         {
         case -1:
-          if (waveform_idx != 0)
-            pressure_lcd_state = STATE_AMPL;
+          if (pressure->menu.waveform != 0)
+            pressure->menu.state = STATE_AMPL;
           else
-            pressure_lcd_state = STATE_WAVE;
+            pressure->menu.state = STATE_WAVE;
           break;
 
         case 1:
-          pressure_lcd_state = STATE_OUTPUT;
+          pressure->menu.state = STATE_OUTPUT;
           break;
 
         case 2:
-          pressure_lcd_state = STATE_OFFS_SETVAL;
+          pressure->menu.state = STATE_OFFS_SETVAL;
           pressure->menu.prev_val = pressure->offset;
           break;
 
@@ -331,7 +380,7 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
           break;
 
         case 2:
-          pressure_lcd_state = STATE_OFFS;
+          pressure->menu.state = STATE_OFFS;
           pressure->offset = pressure->menu.prev_val;
           break;
 
@@ -344,18 +393,18 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
       switch (rotary_inpt)
         {
         case -1:
-          pressure_lcd_state = STATE_OFFS;
+          pressure->menu.state = STATE_OFFS;
           break;
 
         case 1:
-          pressure_lcd_state = STATE_WAVE;
+          pressure->menu.state = STATE_WAVE;
           break;
 
         case 2: /* Change in output */
           if (pressure->menu.output <= 0)
             pressure->menu.output = 1;
 
-          pressure_lcd_state = STATE_OUTPUT_SETVAL;
+          pressure->menu.state = STATE_OUTPUT_SETVAL;
           break;
 
         default:
@@ -370,7 +419,7 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
           if (pressure->menu.output >= 1)
             pressure->menu.output = 0;
 
-          pressure_lcd_state = STATE_OUTPUT;
+          pressure->menu.state = STATE_OUTPUT;
           break;
 
         default:
@@ -386,6 +435,9 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
 /**
  * @brief State machine that controls the UI displayed on the LCD
  *
+ *        Redraws the whole frame, which costs no I2C traffic for the cells
+ *        that didn't change.
+ *
  * @param pressure Pointer to a pressure struct
  *
  * @retval None
@@ -393,162 +445,166 @@ menu_sm_setstate (struct Pressure *pressure, int8_t rotary_inpt)
 void
 menu_sm (struct Pressure *pressure)
 {
-  I2C_LCD_Clear (I2C_LCD_1);
+  lcd_clear ();
 
-  switch (pressure_lcd_state)
+  switch (pressure->menu.state)
     {
     case STATE_WAVE:
       menu_sm_printinfo (pressure); /* Info */
-      menu_sm_printstr (" Wave: %s", waveforms[waveform_idx], 0,
+      menu_sm_printstr (" Wave: %s", waveform_name (pressure->menu.waveform), 0,
                         3); /* Option */
 
-      if (waveform_idx == 0)
+      if (pressure->menu.waveform == 0)
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 1);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (1);
         }
       else
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 4);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (4);
         }
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (0, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_WAVE_SETVAL:
       menu_sm_printinfo (pressure);
       menu_sm_printstr ("Wave: %s",
-                        waveforms[(uint8_t)pressure->menu.prev_val], 0, 3);
+                        waveform_name ((uint8_t)pressure->menu.prev_val), 0,
+                        3);
 
-      if (waveform_idx == 0)
+      if (pressure->menu.waveform == 0)
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 1);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (1);
         }
       else
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 4);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (4);
         }
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 5, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (5, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_PER:
       menu_sm_printinfo (pressure);
       menu_sm_println (" Peri: %.2f sec", pressure->per, 0, 3);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 5);
+      lcd_set_cursor (19, 3);
+      lcd_print_custom_char (5);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (0, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_PER_SETVAL:
       menu_sm_printinfo (pressure);
       menu_sm_println ("Peri: %.2f sec", pressure->menu.prev_val, 0, 3);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 5);
+      lcd_set_cursor (19, 3);
+      lcd_print_custom_char (5);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 5, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (5, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_AMPL:
       menu_sm_printinfo (pressure);
       menu_sm_println (" Ampl: %.2f pp", pressure->ampl, 0, 3);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 6);
+      lcd_set_cursor (19, 3);
+      lcd_print_custom_char (6);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (0, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_AMPL_SETVAL:
       menu_sm_printinfo (pressure);
       menu_sm_println ("Ampl: %.2f pp", pressure->menu.prev_val, 0, 3);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 6);
+      lcd_set_cursor (19, 3);
+      lcd_print_custom_char (6);
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 5, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (5, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_OFFS:
       menu_sm_printinfo (pressure);
       menu_sm_println (" Offs: %.2f psi", pressure->offset, 0, 3);
 
-      if (waveform_idx == 0)
+      if (pressure->menu.waveform == 0)
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 1);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (1);
         }
       else
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 6);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (6);
         }
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (0, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_OFFS_SETVAL:
       menu_sm_printinfo (pressure);
       menu_sm_println ("Offs: %.2f psi", pressure->menu.prev_val, 0, 3);
-      I2C_LCD_SetCursor (I2C_LCD_1, 5, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (5, 3);
+      lcd_print_custom_char (0);
       break;
 
     case STATE_OUTPUT:
       menu_sm_printinfo (pressure);
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_WriteString (I2C_LCD_1, " Press to begin ");
+      lcd_set_cursor (0, 3);
+      lcd_write_string (" Press to begin ");
 
-      if (waveform_idx == 0)
+      if (pressure->menu.waveform == 0)
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 3);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (3);
         }
       else
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 7);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (7);
         }
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (0, 3);
+      lcd_print_custom_char (0);
 
       break;
 
     case STATE_OUTPUT_SETVAL:
       menu_sm_printinfo (pressure);
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_WriteString (I2C_LCD_1, " Press to abort");
+      lcd_set_cursor (0, 3);
+      lcd_write_string (" Press to abort");
 
-      if (waveform_idx == 0)
+      if (pressure->menu.waveform == 0)
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 3);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (3);
         }
       else
         {
-          I2C_LCD_SetCursor (I2C_LCD_1, 19, 3);
-          I2C_LCD_PrintCustomChar (I2C_LCD_1, 7);
+          lcd_set_cursor (19, 3);
+          lcd_print_custom_char (7);
         }
 
-      I2C_LCD_SetCursor (I2C_LCD_1, 0, 3);
-      I2C_LCD_PrintCustomChar (I2C_LCD_1, 0);
+      lcd_set_cursor (0, 3);
+      lcd_print_custom_char (0);
       break;
 
     default:
       break;
     }
+
+  /* Only the cells that changed are sent, in the background */
+  lcd_flush ();
 }
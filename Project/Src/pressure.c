@@ -2,65 +2,147 @@
  * @file pressure.c
  *
  * @brief Pressure system main program body
+ *
+ *        Every station steps through its test once per 100ms control tick,
+ *        see pressure_poll. A runner never waits: its start function sets up
+ *        the test and begins the first ramp, and its tick function advances
+ *        the ramp in progress and begins the next one, returning 1 once the
+ *        test is over. Everything a runner keeps between two ticks lives in
+ *        the station's struct Run, so the stations run side by side.
  */
 
 #include "pressure.h"
 #include "I2C_LCD.h"
+#include "acquisition.h"
+#include "actuator.h"
+#include "calibration.h"
+#include "command.h"
+#include "ensemble.h"
+#include "estimator.h"
 #include "menu.h"
+#include "quality.h"
 #include "rotary.h"
+#include "safety.h"
+#include "sequencer.h"
+#include "spectral.h"
+#include "telemetry.h"
+#include "timebase.h"
+#include "trace.h"
+#include "tune.h"
 #include "stm32f4xx_hal.h"
 
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
-
-uint8_t userint_flg = 0;     /*!< User interrupt flag */
-uint8_t userint_flg_lck = 0; /*!< User interrupt lock var */
-uint8_t tim3_flg = 0;        /*!< Flag that indicates 100ms */
-uint8_t tim3_wraps = 0;      /*!< Number of 100ms intervals */
-float tim3_elapsed = 0.0f;   /*!< Amount of time elapsed during test */
+#include <string.h>
+
+/* Hardware of each station, see struct StationMap. The second station's
+ * reference is scanned after the DUTs */
+static const struct StationMap pressure_station_map[PRESSURE_STATIONS] = {
+  { ACTUATOR_COMPRESSOR, ACTUATOR_EXHAUST, ACQUISITION_REF, 1 },
+#ifdef PRESSURE_BOARD_DUAL
+  { ACTUATOR_COMPRESSOR2, ACTUATOR_EXHAUST2, ACQUISITION_DUT_END, 0 },
+#endif
+};
+
+static struct Pressure pressure_ctx[PRESSURE_STATIONS]; /*!< Station state */
+static struct Pressure
+    *pressure_stations[PRESSURE_STATIONS]; /*!< Contexts of each station */
+static uint8_t pressure_display = 0; /*!< Station shown on the LCD */
 
 void pressure_init (struct Pressure *pressure);
 void pressure_cleanup (struct Pressure *pressure);
 void pressure_uart_tx (struct Pressure *pressure);
 void pressure_sensor_read (struct Pressure *pressure);
+void pressure_ramp_noconstrain (struct Pressure *pressure, uint8_t dev,
+                                float target);
+void pressure_ramp_v4 (struct Pressure *pressure, uint8_t dev, float target,
+                       float perr);
 void pressure_ramp_v3 (struct Pressure *pressure, uint8_t dev, float target,
                        float perr);
-void pressure_calib_static (struct Pressure *pressure);
-void pressure_calib_dynam_step (struct Pressure *pressure);
-void pressure_calib_dynam_ramp (struct Pressure *pressure);
-void pressure_calib_dynam_sine (struct Pressure *pressure);
+void pressure_calib_profile (struct Pressure *pressure,
+                             const struct Waveform *wave);
+uint8_t pressure_calib_profile_tick (struct Pressure *pressure);
+static void pressure_step (struct Pressure *pressure);
 
 /**
  * @brief User interrupt callback
  *
- *        Sets the user interrupt flags once the encoder is pressed.
+ *        Trips the safety supervisor once the encoder is pressed, which sets
+ *        the user interrupt flags. The actuators are shared by one timer, so
+ *        every station is interrupted.
  *
  * @retval None
  */
 void
 HAL_GPIO_EXTI_Callback (uint16_t GPIO_Pin)
 {
-  if (GPIO_Pin == GPIO_PIN_8 && !userint_flg_lck)
+  uint32_t since = safety_stamp ();
+
+  if (GPIO_Pin != GPIO_PIN_8)
+    return;
+
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
     {
-      userint_flg = 1;
-      userint_flg_lck = 1;
+      if (pressure_stations[i] != NULL
+          && !shared_flags_test (&pressure_stations[i]->ctl.flags,
+                                 CONTROL_ABORT_LCK))
+        {
+          safety_trip (SAFETY_ABORT, since);
+          return;
+        }
     }
 }
 
 /**
  * @brief 100ms timer callback
  *
- *        Sets the 100ms timer flags and increments the total time elapsed
- *        by 100ms.
+ *        Sets the 100ms timer flag that paces the control loops of every
+ *        station. Updates of the acquisition sample clock are passed on.
  *
  * @retval None
  */
 void
 HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef *htim)
 {
-  tim3_flg = 1;
-  tim3_elapsed += 0.1f;
+  if (htim->Instance == TIM4)
+    {
+      acquisition_tick ();
+      return;
+    }
+
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      if (pressure_stations[i] != NULL)
+        shared_flags_set (&pressure_stations[i]->ctl.flags, CONTROL_TICK);
+    }
+}
+
+/**
+ * @brief Returns the time elapsed since the test was started
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval float Time in sec
+ */
+static float
+pressure_elapsed (struct Pressure *pressure)
+{
+  return timebase_elapsed (pressure->ctl.start);
+}
+
+/**
+ * @brief Returns whether the user has interrupted the station
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Interrupted
+ *                 0 : Running
+ */
+static uint8_t
+pressure_aborted (struct Pressure *pressure)
+{
+  return shared_flags_test (&pressure->ctl.flags, CONTROL_ABORT) != 0;
 }
 
 /**
@@ -75,723 +157,1935 @@ HAL_TIM_PeriodElapsedCallback (TIM_HandleTypeDef *htim)
  */
 void
 pressure_main (UART_HandleTypeDef *huart, ADC_HandleTypeDef *hadc,
-               TIM_HandleTypeDef *htim_enc, _HandleTypeDef *htim_upd)
-{
-  /* Initializes struct containing handles to components, menu variables and
-   * test parameters */
-  struct Pressure pressure = { .val = 0.0f,
-                               .target = 0.0f,
-                               .per = 20.00f,
-                               .ampl = 10.0f,
-                               .offset = 10.0f,
-                               .huart = huart,
-                               .hadc = hadc,
-                               .htim_enc = htim_enc,
-                               .htim_upd = htim_upd,
-                               .menu.output = 0};
-
-  /* Initialization functions */
-  pressure_init (&pressure);
-  menu_sm_init ();
-  menu_sm (&pressure);
-
-  int8_t rotary_inpt; /* Holds rotary encoder directional/button status */
+               TIM_HandleTypeDef *htim_enc, TIM_HandleTypeDef *htim_upd)
+{
+  pressure_setup (huart, hadc, htim_enc, htim_upd);
 
   /* Pressure main loop */
   while (1)
-    {
-      /* Reads and displays pressure data every 100ms */
-      HAL_Delay (100);
-      pressure_sensor_read (&pressure);
+    pressure_poll ();
 
-      /* Poll for rotary encoder and update LCD if there's any input */
-      rotary_inpt = rotary_get_input ();
-      if (rotary_inpt != 0)
-        {
-          menu_sm_setstate (&pressure, rotary_inpt);
-          menu_sm (&pressure);
-        }
+  pressure_cleanup (&pressure_ctx[0]);
+}
 
-      /* Begins the test if the menu state is set to output */
-      if (pressure.menu.output)
-        {
-          /* Enable encoder interrupt */
-          HAL_NVIC_EnableIRQ (EXTI9_5_IRQn);
-
-          /* Reset test timer */
-          tim3_elapsed = 0;
-          pressure.tim3_elapsed = 0;
-
-          /* Begins the specified test */
-          switch (menu_get_waveform ())
-            {
-            case 0:
-              pressure_calib_static (&pressure);
-              break;
-
-            case 1:
-              pressure_calib_dynam_step (&pressure);
-              break;
-
-            case 2:
-              pressure_calib_dynam_ramp (&pressure);
-              break;
-
-            case 3:
-              pressure_calib_dynam_sine (&pressure);
-              break;
-
-            default:
-              break;
-            }
-
-          /* Disables encoder interrupt and resets interrupt flag so tank can
-           * depressurize */
-          HAL_NVIC_DisableIRQ (EXTI9_5_IRQn);
-          userint_flg = 0;
-          tim3_elapsed = 0;
-
-          /* Depressurizes the tank and updates the sensor data + LCD every
-           * 100ms */
-          while (pressure.val >= 0.0000005f)
-            {
-              HAL_Delay (100);
-              pressure_sensor_read (&pressure);
-              HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_SET);
-            }
-          HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_RESET);
-
-          /* Disables output and updates LCD */
-          pressure.menu.output = 0;
-          menu_sm_setstate (&pressure, 2);
-          menu_sm (&pressure);
-        }
+/**
+ * @brief Sets up every station and starts the control tick
+ *
+ * @param huart Pointer to a HAL UART handle for data plotting
+ * @param hadc Pointer to a HAL ADC handle for incoming reference sensor data
+ * @param htim_enc Pointer to a HAL timer handle for rotary encoder
+ * @param htim_upd Pointer to a HAL timer handle set for 100ms
+ *
+ * @retval None
+ */
+void
+pressure_setup (UART_HandleTypeDef *huart, ADC_HandleTypeDef *hadc,
+                TIM_HandleTypeDef *htim_enc, TIM_HandleTypeDef *htim_upd)
+{
+  /* Initializes one struct per station containing handles to components,
+   * menu variables and test parameters */
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      pressure_ctx[i] = (struct Pressure){
+        .val = 0.0f,
+        .target = 0.0f,
+        .per = 20.00f,
+        .ampl = 10.0f,
+        .offset = 10.0f,
+        .huart = huart,
+        .hadc = hadc,
+        .htim_enc = htim_enc,
+        .htim_upd = htim_upd,
+        .station = i,
+        .map = &pressure_station_map[i],
+        .menu = { .output = 0, .state = 0, .waveform = WAVEFORM_RAMP },
+        .test.end = TEST_END_ABORT,
+        .vent = { .threshold = 0.5f,
+                  .settle = 1.0f,
+                  .timeout = 60.0f,
+                  .alpha = 0.3f },
+        .chirp = { .f_start = 0.02f,
+                   .f_end = 0.2f,
+                   .duration = 300.0f,
+                   .log = 1,
+                   .ampl_end = 0.0f,
+                   .segments = 10 },
+        .profile = { .edge = 2.0f,
+                     .steps = 5,
+                     .points = 4,
+                     .t = { 0.0f, 20.0f, 40.0f, 60.0f },
+                     .p = { 10.0f, 30.0f, 30.0f, 10.0f } },
+        .leak = { .max = 0.5f, .timeout = 600.0f },
+        .trace = { .pre = TRACE_SIZE / 2,
+                   .post = TRACE_SIZE / 2,
+                   .triggers = TRACE_OVERPRESSURE | TRACE_ABORT | TRACE_ERROR,
+                   .overpressure = PRESSURE_MAX,
+                   .error = 20.0f },
+        .run.stage = STAGE_IDLE
+      };
+      pressure_stations[i] = &pressure_ctx[i];
     }
 
-  pressure_cleanup (&pressure);
+  /* Initialization functions */
+  pressure_init (&pressure_ctx[0]);
+  menu_sm_init ();
+  menu_sm (&pressure_ctx[0]);
+
+  /* The control tick runs for good, idle stations only read their sensors */
+  HAL_TIM_Base_Start_IT (htim_upd);
 }
 
 /**
- * @brief Ramps system to a target pressure using no error bounds
+ * @brief Enables the encoder's user interrupt while the displayed station
+ *        runs a test
  *
- *        Mainly used to ramp to initial offsets
+ *        Otherwise a press belongs to the menu.
  *
- * @param pressure A pointer to a pressure struct
- * @param dev    The device to turn on to generate the ramp
- *                 1 : Compressor
- *                 2 : Exhaust valve
- * @param target Target pressure to ramp to
+ * @retval None
+ */
+static void
+pressure_update_exti (void)
+{
+  if (pressure_stations[pressure_display]->run.stage == STAGE_TEST)
+    HAL_NVIC_EnableIRQ (EXTI9_5_IRQn);
+  else
+    HAL_NVIC_DisableIRQ (EXTI9_5_IRQn);
+}
+
+/**
+ * @brief Steps every station whose control tick has come
+ *
+ *        Each station reads its sensors and advances its stage by one tick.
+ *        The telemetry, the remote commands and the encoder are then
+ *        serviced on behalf of the displayed station. Returns at once if no
+ *        tick has come, so it can be called as often as the caller likes.
  *
  * @retval None
  */
 void
-pressure_ramp_noconstrain (struct Pressure *pressure, uint8_t dev,
-                           float target)
+pressure_poll (void)
 {
-  switch (dev)
-    {
-    case 1: /* Turns on the compressor, starts 100ms timer */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-      HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
+  uint8_t ticked = 0;
 
-      while (pressure->val < target)
-        {
-          if (userint_flg)
-            break;
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      struct Pressure *pressure = pressure_stations[i];
 
-          while (!tim3_flg)
-            ;
+      if (!shared_flags_take (&pressure->ctl.flags, CONTROL_TICK))
+        continue;
 
-          if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-            pressure->val = 0;
+      /* One scan serves every station */
+      if (!ticked)
+        acquisition_read (pressure->hadc);
+      ticked = 1;
 
-          pressure_sensor_read (pressure);
+      pressure_sensor_read (pressure);
+      pressure_step (pressure);
+    }
 
-          tim3_flg = 0;
-        }
+  if (!ticked)
+    return;
 
-      HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
-      break;
+  /* The LCD and the encoder belong to the displayed station */
+  struct Pressure *shown = pressure_stations[pressure_display];
 
-    case 2: /* Turns on the valve, starts 100ms timer */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-      HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_SET);
+  pressure_uart_tx (shown);
+  command_poll (shown);
 
-      while (pressure->val > target)
-        {
-          if (userint_flg)
-            break;
+  /* Poll for rotary encoder and update LCD if there's any input. Turns
+   * during a test are discarded */
+  int8_t rotary_inpt = rotary_get_input ();
+  if (rotary_inpt != 0 && shown->run.stage == STAGE_IDLE)
+    {
+      menu_sm_setstate (shown, rotary_inpt);
+      menu_sm (shown);
+    }
 
-          while (!tim3_flg)
-            ;
+  pressure_update_exti ();
+}
 
-          if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-            pressure->val = 0;
+/**
+ * @brief Transmits why a record a runner left was not stored
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+static void
+pressure_save_skip (struct Pressure *pressure)
+{
+  if (pressure->run.save == RUN_SAVE_TUNE)
+    HAL_UART_Transmit (pressure->huart, (uint8_t *)"#TUNE not saved\r\n", 17,
+                       100);
+  else if (pressure->run.save == RUN_SAVE_CAL)
+    HAL_UART_Transmit (pressure->huart, (uint8_t *)"#CAL not saved\r\n", 16,
+                       100);
+
+  pressure->run.save = RUN_SAVE_NONE;
+}
 
-          pressure_sensor_read (pressure);
+/**
+ * @brief Starts a single test
+ *
+ *        Resets the test timer, cycle count and DUT statistics, then starts
+ *        the specified waveform. It runs on the following ticks until its end
+ *        condition under .test is met or the user interrupts.
+ *
+ *        Nothing runs while the safety supervisor is tripped, since the
+ *        compressor is locked out; the test counts as interrupted and the
+ *        vent that follows it releases the trip.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param waveform Waveform to run, see enum waveform in waveform.h
+ *
+ * @retval None
+ */
+static void
+pressure_start_test (struct Pressure *pressure, uint8_t waveform)
+{
+  struct Run *run = &pressure->run;
 
-          tim3_wraps++;
-          tim3_flg = 0;
-        }
+  run->waveform = waveform;
+  run->save = RUN_SAVE_NONE;
+  run->ramp.kind = RAMP_NONE;
 
-      HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_RESET);
-      break;
+  if (safety_tripped ())
+    {
+      pressure->test.cycles = 0;
+      pressure->test.aborted = 1;
+      safety_uart_tx (pressure->huart);
+      HAL_UART_Transmit (pressure->huart, (uint8_t *)"#ERR TRIPPED\r\n", 14,
+                         100);
+      if (run->batch)
+        sequencer_record (pressure);
+
+      pressure_vent (pressure);
+      run->stage = STAGE_VENT;
+      return;
     }
 
-  HAL_TIM_Base_Stop_IT (pressure->htim_upd);
+  /* Reset test timer, target and DUT statistics */
+  pressure->ctl.start = timebase_us ();
+  pressure->elapsed = 0.0f;
+  pressure->target = 0.0f;
+  pressure->test.cycles = 0;
+  if (pressure->map->duts)
+    acquisition_stats_reset ();
+
+  /* Records raw samples in case something goes wrong */
+  if (!trace_arm (pressure->station, &pressure->trace))
+    HAL_UART_Transmit (pressure->huart, (uint8_t *)"#ERR TRACE\r\n", 12,
+                       100);
+  quality_start (pressure->station, waveform, pressure->per, pressure->ampl,
+                 pressure->offset);
+
+  /* Begins the specified test */
+  const struct Waveform *wave = waveform_get (waveform);
+  run->stage = STAGE_TEST;
+  if (wave != NULL && wave->start != NULL)
+    wave->start (pressure);
+  else if (wave != NULL && wave->next != NULL)
+    pressure_calib_profile (pressure, wave);
 }
 
 /**
- * @brief Ramps system to a target pressure with error bounds
+ * @brief Advances the running test by one tick
  *
- *        Essentially the same function as pressure_ramp_v3, except this
- *        function turns off the device once the system pressurizes to the specified
- *        target; there's no waiting for any duration between points.
+ * @param pressure A pointer to a pressure struct
  *
- *        Ultimately, this function was used by pressure_calib_dynam_ramp to
- *        generate a clean triangle wave.
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+static uint8_t
+pressure_test_tick (struct Pressure *pressure)
+{
+  const struct Waveform *wave = waveform_get (pressure->run.waveform);
+
+  if (wave != NULL && wave->tick != NULL)
+    return wave->tick (pressure);
+  if (wave != NULL && wave->next != NULL)
+    return pressure_calib_profile_tick (pressure);
+
+  return 1;
+}
+
+/**
+ * @brief Reports the test that has just ended
  *
  * @param pressure A pointer to a pressure struct
- * @param dev    The device to turn on to generate the ramp
- *                 1 : Compressor
- *                 2 : Exhaust valve
- * @param target Target pressure to ramp to
- * @param perr   The amount of allowable error for the target. Values should be
- *               between 0.0 and 1.0.
  *
  * @retval None
  */
-void
-pressure_ramp_v4 (struct Pressure *pressure, uint8_t dev, float target,
-                  float perr)
+static void
+pressure_test_end (struct Pressure *pressure)
 {
-  if ((target < 0.0000005f) && (target > -0.0000005f))
-    target = 0;
+  uint8_t waveform = pressure->run.waveform;
 
-  /* Calculates max and min pressure targets based off target and error args */
-  float b_mx = target + (perr * target);
-  float b_mn = target - (perr * target);
+  pressure->test.aborted = pressure_aborted (pressure);
+
+  /* Reports how every DUT tracked the reference during the test */
+  if (pressure->map->duts)
+    acquisition_uart_tx_stats (pressure->huart);
+
+  /* Reports how the reference tracked the waveform */
+  quality_finish (pressure->station, waveform);
+  quality_uart_tx (pressure->station, pressure->huart, waveform,
+                   pressure->per, pressure->ampl, pressure->offset);
 
-  if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-    pressure->val = 0;
+  if (safety_tripped ())
+    safety_uart_tx (pressure->huart);
 
-  tim3_wraps = 0;
+  if (pressure->run.batch)
+    sequencer_record (pressure);
+}
+
+/**
+ * @brief Starts the next test of the batch, or returns the station to idle
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+static void
+pressure_next (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
+  uint8_t waveform;
 
-  switch (dev)
+  if (run->batch && sequencer_next (pressure, &waveform))
     {
-    case 1: /* Turns on the compressor, starts 100ms timer */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-      HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
+      pressure_start_test (pressure, waveform);
+      return;
+    }
 
-      while (pressure->val <= target)
-        {
-          if (userint_flg)
-            break;
+  /* Disables output and updates LCD */
+  run->batch = 0;
+  run->stage = STAGE_IDLE;
+  pressure->menu.output = 0;
+  menu_sm_setstate (pressure, 2);
+  if (pressure->station == pressure_display)
+    menu_sm (pressure);
+}
 
-          while (!tim3_flg)
-            ;
+/**
+ * @brief Starts what the menu selected once its output is switched on
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+static void
+pressure_begin (struct Pressure *pressure)
+{
+  if (pressure->menu.waveform != WAVEFORM_BATCH)
+    {
+      /* Runs until the user interrupts */
+      pressure->test.end = TEST_END_ABORT;
+      pressure_start_test (pressure, pressure->menu.waveform);
+      return;
+    }
 
-          if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-            pressure->val = 0;
+  /* The sequencer keeps one results table, so one batch runs at a time */
+  pressure->run.batch = sequencer_begin (pressure);
+  if (!pressure->run.batch)
+    HAL_UART_Transmit (pressure->huart, (uint8_t *)"#ERR BUSY\r\n", 11, 100);
 
-          pressure->target = target;
-          pressure_sensor_read (pressure);
+  pressure_next (pressure);
+}
 
-          tim3_wraps++;
-          tim3_flg = 0;
-        }
+/**
+ * @brief Advances a station's stage by one tick
+ *
+ *        IDLE waits for the menu's output, TEST steps the runner, TRACE waits
+ *        for a triggered capture to complete, VENT depressurizes the tank and
+ *        SAVE writes the record the runner left once nothing is switching,
+ *        since erasing flash stalls every interrupt.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+static void
+pressure_step (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
 
-      HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
+  switch (run->stage)
+    {
+    case STAGE_IDLE:
+      if (pressure->menu.output)
+        pressure_begin (pressure);
       break;
 
-    case 2: /* Turns on the valve, starts 100ms timer */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-      HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_SET);
-
-      while (pressure->val >= target)
+    case STAGE_TEST:
+      if (pressure_test_tick (pressure))
         {
-          if (userint_flg)
-            break;
-
-          while (!tim3_flg)
-            ;
+          pressure_test_end (pressure);
+          run->since = timebase_us ();
+          run->stage = STAGE_TRACE;
+        }
+      break;
 
-          if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-            pressure->val = 0;
+    case STAGE_TRACE:
+      {
+        uint8_t trace = trace_poll (pressure->station, run->since);
+
+        if (trace == TRACE_WAITING)
+          break;
+
+        /* Dumps the raw trace if the test triggered it, the capture is kept
+         * until the next test. A dump takes seconds, so it waits for the
+         * TRACE command while another station runs */
+        if (trace == TRACE_NONE)
+          trace_disarm (pressure->station);
+        else if (pressure_testing ())
+          HAL_UART_Transmit (pressure->huart, (uint8_t *)"#TRACE held\r\n",
+                             13, 100);
+        else
+          trace_uart_tx (pressure->station, pressure->huart);
+
+        pressure_vent (pressure);
+        run->stage = STAGE_VENT;
+      }
+      break;
 
-          pressure->target = target;
-          pressure_sensor_read (pressure);
+    case STAGE_VENT:
+      if (!pressure_vent_tick (pressure))
+        break;
 
-          tim3_wraps++;
-          tim3_flg = 0;
+      /* A record is only stored once the tank is known to be empty */
+      if (run->save != RUN_SAVE_NONE && run->ambient)
+        run->stage = STAGE_SAVE;
+      else
+        {
+          pressure_save_skip (pressure);
+          pressure_next (pressure);
         }
-      HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_RESET);
       break;
 
-    default:
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-
-      while (tim3_wraps < 5)
+    case STAGE_SAVE:
+      if (pressure_aborted (pressure))
         {
-          while (!tim3_flg)
-            ;
-
-          pressure_sensor_read (pressure);
-
-          tim3_wraps++;
-          tim3_flg = 0;
+          pressure_save_skip (pressure);
+          pressure_next (pressure);
+        }
+      else if (actuator_idle ())
+        {
+          if (run->save == RUN_SAVE_TUNE)
+            tune_save ();
+          else
+            calibration_save ();
+          run->save = RUN_SAVE_NONE;
+          pressure_next (pressure);
         }
       break;
     }
-
-  HAL_TIM_Base_Stop_IT (pressure->htim_upd);
 }
 
 /**
- * @brief Ramps system to a target pressure with error bounds
+ * @brief Starts depressurizing the tank after a test
  *
- *        Turns off the compressor or valve when either the target pressure is
- *        met or 500ms has passed.
+ *        Opens the exhaust valve, pressure_vent_tick keeps it open every
+ *        100ms until the tank is at ambient pressure.
  *
  * @param pressure A pointer to a pressure struct
- * @param dev    The device to turn on to generate the ramp.
- *                 1 : Compressor
- *                 2 : Exhaust valve
- *                 default: wait for 500ms
- * @param target Target pressure to ramp to
- * @param perr   The amount of allowable error for the target. Values should be
- *               between 0.0 and 1.0.
  *
  * @retval None
  */
 void
-pressure_ramp_v3 (struct Pressure *pressure, uint8_t dev, float target,
-                  float perr)
+pressure_vent (struct Pressure *pressure)
 {
-  uint8_t status = 0;
+  struct Run *run = &pressure->run;
 
-  if ((target < 0.0000005f) && (target > -0.0000005f))
-    target = 0;
+  /* Resets interrupt flag so tank can depressurize */
+  shared_flags_clear (&pressure->ctl.flags, CONTROL_ABORT);
+  pressure->ctl.start = timebase_us ();
 
-  float b_mx = target + (perr * target);
-  float b_mn = target - (perr * target);
+  run->filt = pressure->val;
+  run->tau = 0.0f;
+  run->settled = 0.0f;
+  run->ambient = 0;
 
-  if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-    pressure->val = 0;
+  /* Keeps the valve open until the next reading */
+  actuator_pulse (pressure->map->exhaust, ACTUATOR_HOLD);
+}
 
-  if ((fabs (pressure->val) <= fabs (b_mx))
-      && (fabs (pressure->val) >= fabs (b_mn)))
-    {
-      dev = 0;
-      status = 1;
-    }
+/**
+ * @brief Advances the vent by one tick
+ *
+ *        The tank is modelled as a first order system venting towards 0 psi,
+ *        with its time constant estimated from the filtered pressure. Ambient
+ *        is reached once the filtered pressure stays below .vent.threshold, or
+ *        once it is near the threshold and the decay the model still expects
+ *        is below it (the remaining reading is sensor offset, not tank
+ *        pressure), for .vent.settle seconds. The valve is closed after
+ *        .vent.timeout seconds regardless.
+ *
+ *        The turnaround time is reported through UART once the vent is over,
+ *        and .run.ambient tells how it ended.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Vent over
+ *                 0 : Still venting
+ */
+uint8_t
+pressure_vent_tick (struct Pressure *pressure)
+{
+  const float dt = 0.1f; /* Sample interval in sec */
+  struct Run *run = &pressure->run;
+  float elapsed = pressure_elapsed (pressure);
 
-  tim3_wraps = 0;
+  /* Low-pass filtered pressure and its rate of change */
+  float prev = run->filt;
+  run->filt += pressure->vent.alpha * (pressure->val - run->filt);
+  float rate = (run->filt - prev) / dt;
 
-  switch (dev)
+  /* Time constant of the decay, only meaningful while well above ambient */
+  if ((rate < 0.0f) && (run->filt > pressure->vent.threshold))
     {
-    case 1: /* Turns on the compressor, starts 100ms timer */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-      HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_SET);
-
-      while (tim3_wraps < 5)
-        {
-          if (userint_flg)
-            break;
-
-          while (!tim3_flg)
-            ;
-
-          if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-            pressure->val = 0;
-
-          pressure->target = target;
-          pressure_sensor_read (pressure);
-
-          if ((fabs (pressure->val) <= fabs (b_mx))
-              && (fabs (pressure->val) >= fabs (b_mn)))
-            HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
-
-          tim3_wraps++;
-          tim3_flg = 0;
-        }
+      float tau_i = -run->filt / rate;
+      run->tau = (run->tau == 0.0f) ? tau_i
+                                    : run->tau + (0.2f * (tau_i - run->tau));
+    }
 
-      HAL_GPIO_WritePin (GPIOA, GPIO_PIN_5, GPIO_PIN_RESET);
-      break;
+  /* Decay the model still expects from here on. Only trusted close to
+   * ambient, so a blocked exhaust isn't mistaken for an empty tank */
+  float remaining = (run->tau > 0.0f) ? fabsf (rate) * run->tau : run->filt;
 
-    case 2: /* Turns on the valve, starts 100ms timer */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
-      HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_SET);
+  if ((run->filt <= pressure->vent.threshold)
+      || ((remaining <= pressure->vent.threshold)
+          && (run->filt <= 4 * pressure->vent.threshold)))
+    run->settled += dt;
+  else
+    run->settled = 0.0f;
 
-      while (tim3_wraps < 5)
-        {
-          if (userint_flg)
-            break;
+  if (run->settled >= pressure->vent.settle)
+    run->ambient = 1;
 
-          while (!tim3_flg)
-            ;
+  if (!run->ambient && elapsed < pressure->vent.timeout)
+    {
+      actuator_pulse (pressure->map->exhaust, ACTUATOR_HOLD);
+      return 0;
+    }
 
-          if ((pressure->val < 0.0000005f) && (pressure->val > -0.0000005f))
-            pressure->val = 0;
+  /* A trip is only released once the tank is known to be empty */
+  if (run->ambient)
+    safety_clear ();
 
-          pressure->target = target;
-          pressure_sensor_read (pressure);
+  actuator_stop (pressure->map->exhaust);
 
-          if ((fabs (pressure->val) <= fabs (b_mx))
-              && (fabs (pressure->val) >= fabs (b_mn)))
-            HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_RESET);
+  char str[64];
+  int len = snprintf (str, sizeof (str),
+                      "#VENT time=%.1f p=%.2f tau=%.2f %s\r\n", elapsed,
+                      run->filt, run->tau,
+                      run->ambient ? "ambient" : "timeout");
+  HAL_UART_Transmit (pressure->huart, (uint8_t *)str, len, 100);
 
-          tim3_wraps++;
-          tim3_flg = 0;
-        }
-      HAL_GPIO_WritePin (GPIOB, GPIO_PIN_3, GPIO_PIN_RESET);
-      break;
+  return 1;
+}
 
-    default: /* Waits and reads + displays pressure sensor data for 500ms */
-      HAL_TIM_Base_Start_IT (pressure->htim_upd);
+/**
+ * @brief Checks whether the running test should stop
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : User interrupted or end condition under .test met
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_test_done (struct Pressure *pressure)
+{
+  if (pressure_aborted (pressure))
+    return 1;
 
-      while (tim3_wraps < 5)
-        {
-          while (!tim3_flg)
-            ;
+  switch (pressure->test.end)
+    {
+    case TEST_END_CYCLES:
+      return pressure->test.cycles >= pressure->test.limit;
 
-          pressure_sensor_read (pressure);
+    case TEST_END_DURATION:
+      return pressure_elapsed (pressure) >= pressure->test.limit;
 
-          tim3_wraps++;
-          tim3_flg = 0;
-        }
-      break;
+    default:
+      return 0;
     }
-
-  HAL_TIM_Base_Stop_IT (pressure->htim_upd);
 }
 
 /**
- * @brief Initializes components for the pressure system
+ * @brief Returns whether any station is running a test
  *
- * @param pressure A pointer to a pressure struct
+ *        Vents and saves don't count.
  *
- * @retval None
+ * @retval uint8_t 1 : A runner is stepping
+ *                 0 : None
  */
-void
-pressure_init (struct Pressure *pressure)
+uint8_t
+pressure_testing (void)
 {
-  HAL_NVIC_DisableIRQ (EXTI9_5_IRQn);
-  I2C_LCD_Init (I2C_LCD_1);
-  HAL_TIM_Encoder_Start_IT (pressure->htim_enc, TIM_CHANNEL_ALL);
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      if (pressure_stations[i] != NULL
+          && pressure_stations[i]->run.stage == STAGE_TEST)
+        return 1;
+    }
+
+  return 0;
 }
 
 /**
- * @brief Deinitializes components for the pressure system
+ * @brief Interrupts the running test
  *
- * @param pressure A pointer to a pressure struct
+ *        Has the same effect as pressing the encoder during a test. Every
+ *        station is interrupted, since their actuators share a timer.
  *
  * @retval None
  */
 void
-pressure_cleanup (struct Pressure *pressure)
+pressure_request_abort (void)
 {
-  userint_flg = 0;
-
-  HAL_ADC_Stop (pressure->hadc);
-  HAL_TIM_Base_DeInit (pressure->htim_enc);
-  HAL_TIM_Base_DeInit (pressure->htim_upd);
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    {
+      if (pressure_stations[i] != NULL)
+        shared_flags_set (&pressure_stations[i]->ctl.flags,
+                          CONTROL_ABORT | CONTROL_ABORT_LCK);
+      trace_trigger (i, TRACE_ABORT);
+    }
 }
 
 /**
- * @brief Transmits the current pressure read by the sensor out through UART
+ * @brief Returns the context of a station
  *
- * @param pressure A pointer to a pressure struct
+ * @param station Index of the station
  *
- * @retval None
+ * @retval struct Pressure* Context, NULL before pressure_setup sets it up
  */
-void
-pressure_uart_tx (struct Pressure *pressure)
+struct Pressure *
+pressure_get_station (uint8_t station)
 {
-  uint8_t str[35] = { '\0' };
-  sprintf (str, "%.2f\r\n", pressure->val);
-  HAL_UART_Transmit (pressure->huart, str, sizeof (str), 100);
+  if (station >= PRESSURE_STATIONS)
+    return NULL;
+
+  return pressure_stations[station];
 }
 
 /**
- * @brief Reads in the current pressure from the sensor using the ADC
+ * @brief Returns the hardware a station is wired to
  *
- *        Displays sensor data to LCD and transmits through UART to PC.
- *
- * @param pressure A pointer to a pressure struct
+ * @param station Index of the station
  *
- * @retval None
+ * @retval const struct StationMap* Map, the first station's for a bad index
  */
-void
-pressure_sensor_read (struct Pressure *pressure)
+const struct StationMap *
+pressure_get_map (uint8_t station)
 {
-  /* Reads in sensor data */
-  HAL_ADC_Start (pressure->hadc);
-  HAL_ADC_PollForConversion (pressure->hadc, 20);
-  pressure->val = (HAL_ADC_GetValue (pressure->hadc) * 200) / 4096.0f;
+  if (station >= PRESSURE_STATIONS)
+    station = 0;
 
-  /* Transmits sensor data through UART, updates test duration and LCD */
-  pressure_uart_tx (pressure);
-  pressure->tim3_elapsed = tim3_elapsed;
-  menu_sm (pressure);
+  return &pressure_station_map[station];
 }
 
 /**
- * @brief Function that performs static calibration
+ * @brief Returns the station shown on the LCD
+ *
+ * @retval uint8_t Index of the station
+ */
+uint8_t
+pressure_get_display (void)
+{
+  return pressure_display;
+}
+
+/**
+ * @brief Switches the LCD and the encoder over to another station
+ *
+ *        The menu of each station keeps its own state, so it comes back
+ *        where it was left.
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+pressure_set_display (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS || pressure_stations[station] == NULL)
+    return;
+
+  pressure_display = station;
+  menu_sm (pressure_stations[station]);
+}
+
+/**
+ * @brief Returns the clock driving the APB1 timers
+ *
+ *        The timer clock runs at twice PCLK1 whenever APB1 is prescaled,
+ *        which is always the case at the F4's maximum core clock.
+ *
+ * @retval uint32_t Timer clock in Hz
+ */
+uint32_t
+pressure_timer_clock (void)
+{
+  return 2 * HAL_RCC_GetPCLK1Freq ();
+}
+
+/**
+ * @brief Returns the actuator a ramp drives
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t enum actuator
+ */
+static uint8_t
+pressure_ramp_actuator (struct Pressure *pressure)
+{
+  return (pressure->run.ramp.dev == 1) ? pressure->map->compressor
+                                       : pressure->map->exhaust;
+}
+
+/**
+ * @brief Keeps the actuator of an unbounded ramp on until the target is
+ *        crossed
+ *
+ *        pressure_ramp_noconstrain stops short of the target, pressure_ramp_v4
+ *        stops once past it.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Ramp complete
+ *                 0 : Actuator kept on until the next tick
+ */
+static uint8_t
+pressure_ramp_drive (struct Pressure *pressure)
+{
+  struct Ramp *ramp = &pressure->run.ramp;
+  uint8_t dev = pressure_ramp_actuator (pressure);
+  uint8_t go;
+
+  if (ramp->kind == RAMP_NOCONSTRAIN)
+    go = (ramp->dev == 1) ? (pressure->val < ramp->target)
+                          : (pressure->val > ramp->target);
+  else
+    go = (ramp->dev == 1) ? (pressure->val <= ramp->target)
+                          : (pressure->val >= ramp->target);
+
+  if (!go || pressure_aborted (pressure))
+    {
+      actuator_stop (dev);
+      ramp->kind = RAMP_NONE;
+      return 1;
+    }
+
+  /* Keeps the actuator on until the next tick */
+  actuator_pulse (dev, ACTUATOR_HOLD);
+  return 0;
+}
+
+/**
+ * @brief Ramps system to a target pressure using no error bounds
+ *
+ *        Mainly used to ramp to initial offsets. Advanced by
+ *        pressure_ramp_tick until the target is reached.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param dev    The device to turn on to generate the ramp
+ *                 1 : Compressor
+ *                 2 : Exhaust valve
+ * @param target Target pressure to ramp to
+ *
+ * @retval None
+ */
+void
+pressure_ramp_noconstrain (struct Pressure *pressure, uint8_t dev,
+                           float target)
+{
+  pressure->run.ramp = (struct Ramp){
+    .kind = RAMP_NOCONSTRAIN, .dev = dev, .target = target
+  };
+
+  if (dev != 1 && dev != 2)
+    {
+      pressure->run.ramp.kind = RAMP_NONE;
+      return;
+    }
+
+  pressure_ramp_drive (pressure);
+}
+
+/**
+ * @brief Ramps system to a target pressure with error bounds
+ *
+ *        Essentially the same function as pressure_ramp_v3, except this
+ *        function turns off the device once the system pressurizes to the specified
+ *        target; there's no waiting for any duration between points.
+ *
+ *        Ultimately, this function was used by pressure_calib_dynam_ramp to
+ *        generate a clean triangle wave.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param dev    The device to turn on to generate the ramp
+ *                 1 : Compressor
+ *                 2 : Exhaust valve
+ *                 default: wait for 500ms
+ * @param target Target pressure to ramp to
+ * @param perr   The amount of allowable error for the target. Values should be
+ *               between 0.0 and 1.0.
+ *
+ * @retval None
+ */
+void
+pressure_ramp_v4 (struct Pressure *pressure, uint8_t dev, float target,
+                  float perr)
+{
+  if ((target < 0.0000005f) && (target > -0.0000005f))
+    target = 0;
+
+  /* Calculates max and min pressure targets based off target and error args */
+  pressure->run.ramp = (struct Ramp){ .kind = RAMP_V4,
+                                      .dev = (dev == 1 || dev == 2) ? dev : 0,
+                                      .target = target,
+                                      .b_mx = target + (perr * target),
+                                      .b_mn = target - (perr * target) };
+  pressure->ctl.ticks = 0;
+
+  if (pressure->run.ramp.dev != 0)
+    {
+      pressure->target = target;
+      pressure_ramp_drive (pressure);
+    }
+}
+
+/**
+ * @brief Pulse width expected to bring the pressure to a target
+ *
+ *        Time until the estimated pressure crosses the target at the given
+ *        rate, less the time the pressure keeps moving after the actuator
+ *        switches off.
+ *
+ * @param err    Pressure left to go, in the direction of the actuator
+ * @param rate   Rate seen while the actuator was on, same direction
+ *
+ * @retval uint32_t Pulse width in us, 0 once the target is reached
+ */
+static uint32_t
+pressure_ramp_width (float err, float rate)
+{
+  /* No response seen yet, keeps going for another tick */
+  if (rate <= 0.0f)
+    return ACTUATOR_HOLD;
+
+  float w = ((err / rate) * 1000000.0f) - ACTUATOR_LAG;
+
+  if (w <= 0.0f)
+    return 0;
+  if (w > ACTUATOR_HOLD)
+    return ACTUATOR_HOLD;
+
+  return w;
+}
+
+/**
+ * @brief Returns whether the pressure is within a ramp's error band
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : In band
+ *                 0 : Outside
+ */
+static uint8_t
+pressure_ramp_in_band (struct Pressure *pressure)
+{
+  const struct Ramp *ramp = &pressure->run.ramp;
+
+  return (fabs (pressure->val) <= fabs (ramp->b_mx))
+         && (fabs (pressure->val) >= fabs (ramp->b_mn));
+}
+
+/**
+ * @brief Ramps system to a target pressure with error bounds
+ *
+ *        Turns off the compressor or valve when either the target pressure is
+ *        met or 500ms has passed. Each tick, pressure_ramp_tick resizes the
+ *        pulse from the Kalman estimate so the actuator switches off where
+ *        the target is predicted to be crossed, instead of overshooting until
+ *        the next tick once the reading is already in the band.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param dev    The device to turn on to generate the ramp.
+ *                 1 : Compressor
+ *                 2 : Exhaust valve
+ *                 default: wait for 500ms
+ * @param target Target pressure to ramp to
+ * @param perr   The amount of allowable error for the target. Values should be
+ *               between 0.0 and 1.0.
+ *
+ * @retval None
+ */
+void
+pressure_ramp_v3 (struct Pressure *pressure, uint8_t dev, float target,
+                  float perr)
+{
+  struct Ramp *ramp = &pressure->run.ramp;
+
+  if ((target < 0.0000005f) && (target > -0.0000005f))
+    target = 0;
+
+  *ramp = (struct Ramp){ .kind = RAMP_V3,
+                         .dev = (dev == 1 || dev == 2) ? dev : 0,
+                         .target = target,
+                         .b_mx = target + (perr * target),
+                         .b_mn = target - (perr * target),
+                         .width = ACTUATOR_HOLD,
+                         .rate = 0.0f };
+  pressure->ctl.ticks = 0;
+
+  /* Already there, waits instead */
+  if (pressure_ramp_in_band (pressure))
+    ramp->dev = 0;
+
+  if (ramp->dev == 0)
+    return;
+
+  if (pressure_aborted (pressure))
+    {
+      ramp->kind = RAMP_NONE;
+      return;
+    }
+
+  pressure->target = target;
+  actuator_pulse (pressure_ramp_actuator (pressure), ramp->width);
+}
+
+/**
+ * @brief Resizes the pulse of a bounded ramp for the next tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+static void
+pressure_ramp_track (struct Pressure *pressure)
+{
+  struct Ramp *ramp = &pressure->run.ramp;
+  uint8_t dev = pressure_ramp_actuator (pressure);
+  struct Estimate est;
+  float err;
+
+  estimator_get (pressure->station, &est);
+  if (ramp->dev == 1)
+    {
+      if (actuator_active (dev) && (est.rate > 0.0f))
+        ramp->rate = est.rate;
+      err = ramp->target - est.p;
+    }
+  else
+    {
+      if (actuator_active (dev) && (est.rate < 0.0f))
+        ramp->rate = -est.rate;
+      err = est.p - ramp->target;
+    }
+
+  if (pressure_ramp_in_band (pressure))
+    ramp->width = 0;
+  else if (ramp->width > 0)
+    ramp->width = pressure_ramp_width (err, ramp->rate);
+
+  if (ramp->width >= ACTUATOR_MIN_ON)
+    actuator_pulse (dev, ramp->width);
+  else
+    {
+      actuator_stop (dev);
+      ramp->width = 0;
+    }
+}
+
+/**
+ * @brief Advances the ramp in progress by one tick
+ *
+ *        Bounded ramps and waits last 5 ticks, unbounded ones until the
+ *        target is crossed. An interrupt ends every ramp that drives an
+ *        actuator.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : No ramp in progress
+ *                 0 : Ramp continues
+ */
+static uint8_t
+pressure_ramp_tick (struct Pressure *pressure)
+{
+  struct Ramp *ramp = &pressure->run.ramp;
+
+  switch (ramp->kind)
+    {
+    case RAMP_NONE:
+      return 1;
+
+    case RAMP_NOCONSTRAIN:
+      return pressure_ramp_drive (pressure);
+
+    case RAMP_V4:
+      if (ramp->dev != 0)
+        return pressure_ramp_drive (pressure);
+      break;
+
+    case RAMP_V3:
+      if (ramp->dev == 0)
+        break;
+
+      if (pressure_aborted (pressure))
+        pressure->ctl.ticks = 5;
+      else
+        pressure_ramp_track (pressure);
+      break;
+    }
+
+  if (++pressure->ctl.ticks < 5)
+    return 0;
+
+  if (ramp->dev != 0)
+    actuator_stop (pressure_ramp_actuator (pressure));
+  ramp->kind = RAMP_NONE;
+
+  return 1;
+}
+
+/**
+ * @brief Advances a runner made of ramps between points by one tick
+ *
+ *        Once the ramp in progress is complete, the runner's point function
+ *        is called to begin the next ramp. Ramps that complete at once are
+ *        skipped within the same tick, at most one cycle's worth so a tick
+ *        stays bounded.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param point Begins the next ramp, returns 1 once the test is over
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+static uint8_t
+pressure_run_points (struct Pressure *pressure,
+                     uint8_t (*point) (struct Pressure *pressure))
+{
+  if (!pressure_ramp_tick (pressure))
+    return 0;
+
+  for (uint16_t k = 0; k <= pressure->run.n; k++)
+    {
+      if (point (pressure))
+        return 1;
+
+      if (pressure->run.ramp.kind != RAMP_NONE)
+        return 0;
+    }
+
+  return 0;
+}
+
+/**
+ * @brief Returns the allowed error of a test's points
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param perr The test's own, kept unless set with SET PERR
+ *
+ * @retval float Allowed error, fraction of the target
+ */
+static float
+pressure_run_perr (const struct Pressure *pressure, float perr)
+{
+  return (pressure->ramps.perr > 0.0f) ? pressure->ramps.perr : perr;
+}
+
+/**
+ * @brief Returns the switching time a test spaces its points by
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param sw The test's own in sec, kept unless set with SET SWITCH
+ *
+ * @retval float Switching time in sec
+ */
+static float
+pressure_run_sw (const struct Pressure *pressure, float sw)
+{
+  return (pressure->ramps.sw > 0.0f) ? pressure->ramps.sw : sw;
+}
+
+/**
+ * @brief Sets up a runner that ramps to .offset first
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param sw Switching time of the components in sec, sets the points per
+ *           cycle
+ *
+ * @retval None
+ */
+static void
+pressure_run_begin (struct Pressure *pressure, float sw)
+{
+  struct Run *run = &pressure->run;
+
+  /* Reset user interrupt flag */
+  shared_flags_clear (&pressure->ctl.flags,
+                      CONTROL_ABORT | CONTROL_ABORT_LCK);
+
+  run->phase = 0;
+  run->i = 0;
+  run->n = pressure->per / sw;
+  if (run->n < 1)
+    run->n = 1;
+
+  /* Ramp to the offset */
+  pressure_ramp_noconstrain (pressure, 1, pressure->offset);
+}
+
+/**
+ * @brief Function that performs static calibration
  *
  *        Ramps to the specified offset under the .offset member of
  *        struct Pressure. Maintains pressure until user interrupt flag
- *        is set.
+ *        is set. Once auto-tuned, a PI controller holds the offset by
+ *        resizing compressor and exhaust pulses every tick.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_calib_static (struct Pressure *pressure)
+{
+  pressure_run_begin (pressure, 1.0f);
+  pressure->run.integ = 0.0f;
+}
+
+/**
+ * @brief Advances static calibration by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_static_tick (struct Pressure *pressure)
+{
+  if (!pressure_ramp_tick (pressure))
+    return 0;
+
+  if (pressure_test_done (pressure))
+    {
+      actuator_stop (pressure->map->compressor);
+      actuator_stop (pressure->map->exhaust);
+      return 1;
+    }
+
+  /* Holds the offset once the rig has been tuned */
+  const struct TuneGains *gains = tune_get_gains (pressure->station);
+  if (gains->kp <= 0.0f)
+    return 0;
+
+  struct Estimate est;
+  float *integ = &pressure->run.integ;
+
+  estimator_get (pressure->station, &est);
+  float err = pressure->offset - est.p;
+
+  /* Integrates only while the output isn't saturated */
+  float u = (gains->kp * err) + (gains->ki * *integ);
+  if (fabsf (u) < 1.0f)
+    {
+      *integ += err * 0.1f;
+      u = (gains->kp * err) + (gains->ki * *integ);
+    }
+  if (u > 1.0f)
+    u = 1.0f;
+  if (u < -1.0f)
+    u = -1.0f;
+
+  uint32_t width = fabsf (u) * ACTUATOR_TICK;
+  if (width < ACTUATOR_MIN_ON)
+    {
+      actuator_stop (pressure->map->compressor);
+      actuator_stop (pressure->map->exhaust);
+    }
+  else if (u > 0.0f)
+    {
+      actuator_stop (pressure->map->exhaust);
+      actuator_pulse (pressure->map->compressor, width);
+    }
+  else
+    {
+      actuator_stop (pressure->map->compressor);
+      actuator_pulse (pressure->map->exhaust, width);
+    }
+
+  return 0;
+}
+
+/**
+ * @brief Begins the ramp to the next point of a step cycle
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Ramp begun
+ */
+static uint8_t
+pressure_step_point (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
+
+  if (run->phase == 0)
+    {
+      /* Offset reached */
+      ensemble_start (pressure->station);
+      run->phase = 1;
+      run->i = 0;
+    }
+  else if (++run->i >= run->n)
+    {
+      /* Only count cycles that ran to the end */
+      pressure->test.cycles++;
+      ensemble_cycle (pressure->station);
+      run->i = 0;
+    }
+
+  if (pressure_test_done (pressure))
+    {
+      ensemble_stop (pressure->station);
+      ensemble_uart_tx (pressure->station, pressure->huart);
+      return 1;
+    }
+
+  /* Square wave sampled at linspaced times */
+  float target = pressure->offset
+                 + ((pressure->ampl / 2)
+                    * pow (-1.0f, floor ((2.0f * run->i) / run->n)));
+
+  pressure_ramp_v3 (pressure, (run->i < run->n / 2) ? 1 : 2, target,
+                    pressure_run_perr (pressure, 0.1f));
+  return 0;
+}
+
+/**
+ * @brief Function that performs dynamic step calibration
+ *
+ *        Forms a square wave by continuously ramping to the value in .ampl
+ *        from .offset, and waiting for a duration specified by .per found
+ *        under struct Pressure. Completed cycles are averaged into one,
+ *        transmitted through UART once the test ends.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_calib_dynam_step (struct Pressure *pressure)
+{
+  pressure_run_begin (pressure,
+                      pressure_run_sw (pressure, PRESSURE_SWITCH_TIME));
+}
+
+/**
+ * @brief Advances dynamic step calibration by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_dynam_step_tick (struct Pressure *pressure)
+{
+  return pressure_run_points (pressure, pressure_step_point);
+}
+
+/**
+ * @brief Begins the ramp to the next point of a triangle cycle
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Ramp begun
+ */
+static uint8_t
+pressure_ramp_point (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
+
+  if (run->phase == 0)
+    {
+      ensemble_start (pressure->station);
+      run->phase = 1;
+      run->i = 0;
+    }
+  else if (++run->i >= run->n)
+    {
+      pressure->test.cycles++;
+      ensemble_cycle (pressure->station);
+      run->i = 0;
+    }
+
+  if (pressure_test_done (pressure))
+    {
+      ensemble_stop (pressure->station);
+      ensemble_uart_tx (pressure->station, pressure->huart);
+      return 1;
+    }
+
+  float target = pressure->offset
+                 + ((pressure->ampl / 2) * sin ((2 * M_PI * run->i) / run->n));
+
+  /* Previous ramp function:
+   * yi[i] = ((((4 * half_ampl) / pressure->per)
+   *           * fabs (fmod ((fmod ((ti[i] - (pressure->per / 4)), pressure->per)
+   *           + pressure->per), pressure->per) - (pressure->per / 2))) - half_ampl)
+   *           + pressure->offset;
+   */
+
+  /* pressure_ramp_v3(pressure, dev, target, 0.1f); */
+  uint8_t dev = (run->i < run->n / 4) || (run->i >= 3 * (run->n / 4)) ? 1 : 2;
+  pressure_ramp_v4 (pressure, dev, target,
+                    pressure_run_perr (pressure, 0.1f));
+  return 0;
+}
+
+/**
+ * @brief Function that performs dynamic ramp calibration
+ *
+ *        Generates a triangle wave using the specified parameters
+ *        held by the .per, .ampl, .offset members in struct Pressure.
+ *
+ *        To generate a cleaner ramp function, the sine function along with
+ *        pressure_ramp_v4 are used instead of an actual ramp function with
+ *        pressure_ramp_v3. The previous method still works, except it would
+ *        take some work playing with parameters to generate a proper
+ *        triangle wave. The previous method has been left commented in the
+ *        code.
+ *
+ *        The averaged cycle is transmitted through UART at the end.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @bug Given the nature of pressure_ramp_v4, this function essentially ignores
+ *      the .per member, effectively making the period parameter useless.
+ *
+ * @retval None
+ */
+void
+pressure_calib_dynam_ramp (struct Pressure *pressure)
+{
+  pressure_run_begin (pressure, pressure_run_sw (pressure, 0.5f));
+}
+
+/**
+ * @brief Advances dynamic ramp calibration by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_dynam_ramp_tick (struct Pressure *pressure)
+{
+  return pressure_run_points (pressure, pressure_ramp_point);
+}
+
+/**
+ * @brief Begins the ramp to the next point of a sine cycle
+ *
+ *        A cycle runs through points 0 to N, both ends included.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Ramp begun
+ */
+static uint8_t
+pressure_sine_point (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
+
+  if (run->phase == 0)
+    {
+      spectral_start (pressure->station);
+      ensemble_start (pressure->station);
+      run->phase = 1;
+      run->i = 0;
+    }
+  else if (++run->i > run->n)
+    {
+      pressure->test.cycles++;
+      ensemble_cycle (pressure->station);
+
+      /* Reports gain, phase and THD of the cycle */
+      if (spectral_cycle (pressure->station))
+        spectral_uart_tx (pressure->station, pressure->huart);
+      run->i = 0;
+    }
+
+  if (pressure_test_done (pressure))
+    {
+      spectral_stop (pressure->station);
+      ensemble_stop (pressure->station);
+      ensemble_uart_tx (pressure->station, pressure->huart);
+      return 1;
+    }
+
+  float target = pressure->offset
+                 + ((pressure->ampl / 2) * sin ((2 * M_PI * run->i) / run->n));
+
+  uint8_t dev = (run->i <= run->n / 4) || (run->i > 3 * (run->n / 4)) ? 1 : 2;
+  pressure_ramp_v3 (pressure, dev, target,
+                    pressure_run_perr (pressure, 0.2f));
+  return 0;
+}
+
+/**
+ * @brief Function that performs dynamic sine calibration
+ *
+ *        Generates a sine wave using the specified parameters
+ *        held by the .per, .ampl, .offset members in struct
+ *        Pressure.
+ *
+ *        The gain, phase and THD of the pressure against the target are
+ *        transmitted through UART after every completed cycle, and the
+ *        average of all of them at the end, see ensemble.c.
  *
  * @param pressure A pointer to a pressure struct
  *
  * @retval None
  */
 void
-pressure_calib_static (struct Pressure *pressure)
+pressure_calib_dynam_sine (struct Pressure *pressure)
 {
-  /* Reset user interrupt flag */
-  userint_flg = 0;
-  userint_flg_lck = 0;
+  pressure_run_begin (pressure,
+                      pressure_run_sw (pressure, PRESSURE_SWITCH_TIME));
+}
 
-  /* Ramp to the offset */
-  pressure_ramp_noconstrain (pressure, 1, pressure->offset);
+/**
+ * @brief Advances dynamic sine calibration by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_dynam_sine_tick (struct Pressure *pressure)
+{
+  return pressure_run_points (pressure, pressure_sine_point);
+}
 
-  /* Display sensor data on LCD and UART every 100ms until user interrupts */
-  HAL_TIM_Base_Start_IT (pressure->htim_upd);
+/**
+ * @brief Begins the ramp to the chirp's value at the current test time
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Ramp begun
+ */
+static uint8_t
+pressure_chirp_point (struct Pressure *pressure)
+{
+  const struct Chirp *chirp = &pressure->chirp;
+  struct Run *run = &pressure->run;
 
-  while (!userint_flg)
+  /* The sweep starts once the offset is reached */
+  if (run->phase == 0)
     {
-      while (!tim3_flg)
-        ;
+      run->t0 = pressure_elapsed (pressure);
+      run->seg = -1;
+      run->phase = 1;
+    }
 
-      pressure_sensor_read (pressure);
-      tim3_flg = 0;
+  if (pressure_test_done (pressure))
+    return 1;
+
+  float t = pressure_elapsed (pressure) - run->t0;
+  if (t >= chirp->duration)
+    return 1;
+
+  /* Segment marker */
+  if (chirp_segment (chirp, t) != run->seg)
+    {
+      char str[48];
+      run->seg = chirp_segment (chirp, t);
+      int len = snprintf (str, sizeof (str), "#SEG %d t=%.1f f=%.4f\r\n",
+                          run->seg, t, chirp_freq (chirp, t));
+      HAL_UART_Transmit (pressure->huart, (uint8_t *)str, len, 100);
     }
 
-  HAL_TIM_Base_Stop_IT (pressure->htim_upd);
+  float phase = chirp_phase (chirp, t);
+  float target = pressure->offset
+                 + ((chirp_ampl (chirp, pressure->ampl, t) / 2)
+                    * sinf (phase));
+
+  pressure->test.cycles = phase / (2 * M_PI);
+
+  pressure_ramp_v3 (pressure, (target > pressure->val) ? 1 : 2, target,
+                    pressure_run_perr (pressure, 0.2f));
+  return 0;
 }
 
 /**
- * @brief Function that performs dynamic step calibration
+ * @brief Function that performs dynamic swept-sine calibration
  *
- *        Forms a square wave by continuously ramping to the value in .ampl
- *        from .offset, and waiting for a duration specified by .per found
- *        under struct Pressure.
+ *        Sweeps a sine around .offset from .chirp.f_start to .chirp.f_end
+ *        over .chirp.duration seconds, linearly or logarithmically. The target
+ *        is evaluated at the actual test time, so the phase stays continuous
+ *        however long each ramp takes. The amplitude starts at .ampl and
+ *        optionally moves towards .chirp.ampl_end.
+ *
+ *        A marker is transmitted through UART at the start of every segment
+ *        so the response can be split up later.
  *
  * @param pressure A pointer to a pressure struct
  *
  * @retval None
  */
 void
-pressure_calib_dynam_step (struct Pressure *pressure)
+pressure_calib_dynam_chirp (struct Pressure *pressure)
+{
+  pressure_run_begin (pressure, pressure_run_sw (pressure, 1.0f));
+
+  /* One ramp per tick, every point is sampled afresh */
+  pressure->run.n = 1;
+}
+
+/**
+ * @brief Advances dynamic swept-sine calibration by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_dynam_chirp_tick (struct Pressure *pressure)
 {
-  userint_flg = 0;
-  userint_flg_lck = 0;
+  return pressure_run_points (pressure, pressure_chirp_point);
+}
 
-  float sw = 0.8f; /* Switching time of the components in seconds */
+/**
+ * @brief Begins the ramp to the generator's value at the current test time
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Ramp begun
+ */
+static uint8_t
+pressure_profile_point (struct Pressure *pressure)
+{
+  const struct Waveform *wave = waveform_get (pressure->run.waveform);
+  struct Run *run = &pressure->run;
 
-  uint8_t N = pressure->per / sw;
+  if (run->phase == 0)
+    {
+      run->t0 = pressure_elapsed (pressure);
+      run->phase = 1;
+    }
 
-  /* Generate linspaced time array */
-  float ti[N];
-  for (uint8_t i = 0; i < N; i++)
-    ti[i] = (i * pressure->per) / N;
+  if (pressure_test_done (pressure))
+    return 1;
 
-  /* Generate targets using a square wave function */
-  float yi[N];
-  for (uint32_t i = 0; i < N; i++)
-    yi[i] = pressure->offset
-            + ((pressure->ampl / 2)
-               * pow (-1.0f, floor ((2 * ti[i]) / pressure->per)));
+  float t = pressure_elapsed (pressure) - run->t0;
+  float target = wave->next (&run->wave, t);
 
-  /* Ramp to the initial offset */
-  pressure_ramp_noconstrain (pressure, 1, pressure->offset);
+  pressure->test.cycles = t / run->per;
 
-  /* Loop through points until user interrupts test */
-  while (1)
-    {
-      if (userint_flg)
-        break;
+  pressure_ramp_v3 (pressure, (target > pressure->val) ? 1 : 2, target,
+                    pressure_run_perr (pressure, 0.2f));
+  return 0;
+}
 
-      uint32_t i = 0;
-      while (i < N / 2)
-        {
-          if (userint_flg)
-            break;
+/**
+ * @brief Function that follows a profile generator
+ *
+ *        Ramps to the generator's first setpoint, then samples it at the
+ *        actual test time before every ramp, the same way as the chirp. The
+ *        cycle count follows the generator's period. Settings the generator
+ *        rejects, such as a segment profile with fewer than two points,
+ *        interrupt the test before anything runs.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param wave Registry entry of the generator
+ *
+ * @retval None
+ */
+void
+pressure_calib_profile (struct Pressure *pressure, const struct Waveform *wave)
+{
+  struct Run *run = &pressure->run;
 
-          pressure_ramp_v3 (pressure, 1, yi[i], 0.1f);
-          i++;
-        }
+  shared_flags_clear (&pressure->ctl.flags,
+                      CONTROL_ABORT | CONTROL_ABORT_LCK);
 
-      while (i < N)
-        {
-          if (userint_flg)
-            break;
+  run->phase = 0;
+  run->n = 1;
 
-          pressure_ramp_v3 (pressure, 2, yi[i], 0.1f);
-          i++;
-        }
+  /* A profile without a period would never complete a cycle */
+  if (!wave->init (&run->wave, pressure))
+    {
+      shared_flags_set (&pressure->ctl.flags, CONTROL_ABORT);
+      HAL_UART_Transmit (pressure->huart, (uint8_t *)"#ERR PROFILE\r\n", 14,
+                         100);
+      return;
     }
+  run->per = wave->period (&run->wave);
+
+  /* Ramp to the start of the profile */
+  pressure_ramp_noconstrain (pressure, 1, wave->next (&run->wave, 0.0f));
 }
 
 /**
- * @brief Function that performs dynamic ramp calibration
+ * @brief Advances a profile generator by one tick
  *
- *        Generates a triangle wave using the specified parameters
- *        held by the .per, .ampl, .offset members in struct Pressure.
+ * @param pressure A pointer to a pressure struct
  *
- *        To generate a cleaner ramp function, the sine function along with
- *        pressure_ramp_v4 are used instead of an actual ramp function with
- *        pressure_ramp_v3. The previous method still works, except it would
- *        take some work playing with parameters to generate a proper
- *        triangle wave. The previous method has been left commented in the
- *        code below.
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_profile_tick (struct Pressure *pressure)
+{
+  return pressure_run_points (pressure, pressure_profile_point);
+}
+
+/**
+ * @brief Captures the level just settled at and begins the next one
+ *
+ *        Each level is reached with an unbounded ramp, then held for a
+ *        500ms wait before every DUT is captured.
  *
  * @param pressure A pointer to a pressure struct
  *
- * @bug Given the nature of pressure_ramp_v4, this function essentially ignores
- *      the .per member, effectively making the period parameter useless.
+ * @retval uint8_t 1 : Test over
+ *                 0 : Ramp begun
+ */
+static uint8_t
+pressure_curve_point (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
+
+  if (run->phase == 0)
+    {
+      /* Let the tank settle before capturing */
+      float level = (pressure->offset * run->i) / (CALIBRATION_MAX_POINTS - 1);
+      pressure->target = level;
+      pressure_ramp_v3 (pressure, 0, level, 0.0f);
+      run->phase = 1;
+      return 0;
+    }
+
+  calibration_capture_duts (pressure->hadc);
+  run->i++;
+  run->phase = 0;
+
+  if (pressure_aborted (pressure) || run->i >= CALIBRATION_MAX_POINTS)
+    {
+      for (uint8_t ch = ACQUISITION_DUT_FIRST; ch < ACQUISITION_DUT_END; ch++)
+        calibration_capture_end (ch);
+
+      /* Keeps the curves across resets, once the tank has been vented */
+      actuator_stop (pressure->map->compressor);
+      run->save = RUN_SAVE_CAL;
+      return 1;
+    }
+
+  pressure_ramp_noconstrain (
+      pressure, 1, (pressure->offset * run->i) / (CALIBRATION_MAX_POINTS - 1));
+  return 0;
+}
+
+/**
+ * @brief Function that captures the calibration curves of every DUT
+ *
+ *        Steps the tank up through CALIBRATION_MAX_POINTS evenly spaced
+ *        levels from ambient to the value in .offset. At each level the
+ *        pressure settles for 500ms, then every DUT's averaged reading is
+ *        paired with the averaged reference pressure. The curves are rebuilt
+ *        once the last level is captured or the user interrupts, and stored
+ *        in flash once the tank has been vented, since erasing stalls the
+ *        safety interrupt. Only runs on the station the DUTs are plumbed
+ *        into.
+ *
+ * @param pressure A pointer to a pressure struct
  *
  * @retval None
  */
 void
-pressure_calib_dynam_ramp (struct Pressure *pressure)
+pressure_calib_curve (struct Pressure *pressure)
 {
-  userint_flg = 0;
-  userint_flg_lck = 0;
+  struct Run *run = &pressure->run;
 
-  float sw = 0.5f;                /* Switching in sec */
-  uint8_t N = pressure->per / sw; /* Number of points that make up the wave */
+  shared_flags_clear (&pressure->ctl.flags,
+                      CONTROL_ABORT | CONTROL_ABORT_LCK);
 
-  /* Generate linspaced time array */
-  float ti[N];
-  for (uint8_t i = 0; i < N; i++)
-    ti[i] = (i * pressure->per) / N;
+  if (!pressure->map->duts)
+    {
+      shared_flags_set (&pressure->ctl.flags, CONTROL_ABORT);
+      HAL_UART_Transmit (pressure->huart, (uint8_t *)"#ERR CURVE\r\n", 12,
+                         100);
+      return;
+    }
 
-  /* Generate targets */
-  float yi[N];
-  for (uint32_t i = 0; i < N; i++)
-    yi[i] = pressure->offset
-            + ((pressure->ampl / 2)
-               * sin (2 * M_PI * (1 / pressure->per) * ti[i]));
+  for (uint8_t ch = ACQUISITION_DUT_FIRST; ch < ACQUISITION_DUT_END; ch++)
+    calibration_capture_begin (ch, CALIBRATION_CUBIC);
 
-  /* Previous ramp function:
-   * yi[i] = ((((4 * half_ampl) / pressure->per)
-   *           * fabs (fmod ((fmod ((ti[i] - (pressure->per / 4)), pressure->per)
-   *           + pressure->per), pressure->per) - (pressure->per / 2))) - half_ampl)
-   *           + pressure->offset;
-   */
+  run->phase = 0;
+  run->i = 0;
+  run->n = 1;
+  pressure_ramp_noconstrain (pressure, 1, 0.0f);
+}
 
-  /* Ramp to initial offset */
-  pressure_ramp_noconstrain (pressure, 1, pressure->offset);
+/**
+ * @brief Advances the curve capture by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_calib_curve_tick (struct Pressure *pressure)
+{
+  if (!pressure->map->duts)
+    return 1;
 
-  /* Loop through targets until user interrupts */
-  while (1)
-    {
-      if (userint_flg)
-        break;
+  return pressure_run_points (pressure, pressure_curve_point);
+}
 
-      uint32_t i = 0;
-      while (i < N / 4)
-        {
-          if (userint_flg)
-            break;
+/**
+ * @brief Function that measures the leak rate of the tank
+ *
+ *        Ramps to .offset, then closes both actuators and fits the decay of
+ *        the pressure every 100ms, after letting it settle for LEAK_SETTLE.
+ *        Ends once the fit has converged, after .leak.timeout seconds, or
+ *        when the user interrupts, and reports the leak rate through UART.
+ *        Ignores the end condition under .test.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_leak_test (struct Pressure *pressure)
+{
+  pressure_run_begin (pressure, 1.0f);
+}
 
-          /* pressure_ramp_v3(pressure, 1, yi[i], 0.1f); */
-          pressure_ramp_v4 (pressure, 1, yi[i], 0.1f);
-          i++;
-        }
+/**
+ * @brief Advances the leak test by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_leak_test_tick (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
 
-      while (i < 3 * (N / 4))
-        {
-          if (userint_flg)
-            break;
+  if (!pressure_ramp_tick (pressure))
+    return 0;
 
-          /* pressure_ramp_v3(pressure, 2, yi[i], 0.1f); */
-          pressure_ramp_v4 (pressure, 2, yi[i], 0.1f);
-          i++;
-        }
+  if (run->phase == 0)
+    {
+      /* Isolates the tank. Nothing is tracked during the hold */
+      actuator_stop (pressure->map->compressor);
+      actuator_stop (pressure->map->exhaust);
+      pressure->target = 0.0f;
+
+      leak_begin (pressure->station, pressure->leak.max);
+      run->t0 = pressure_elapsed (pressure);
+      run->phase = 1;
+      return 0;
+    }
 
-      while (i < N)
-        {
-          if (userint_flg)
-            break;
+  float t = pressure_elapsed (pressure) - run->t0;
 
-          /* pressure_ramp_v3(pressure, 1, yi[i], 0.1f); */
-          pressure_ramp_v4 (pressure, 1, yi[i], 0.1f);
-          i++;
-        }
+  if (pressure_aborted (pressure) || (t >= pressure->leak.timeout)
+      || ((t >= LEAK_SETTLE) && leak_step (pressure->station, t, pressure->val)))
+    {
+      leak_uart_tx (pressure->station, pressure->huart);
+      return 1;
     }
+
+  return 0;
 }
 
 /**
- * @brief Function that performs dynamic sine calibration
+ * @brief Function that auto-tunes the pressure hold
  *
- *        Generates a sine wave using the specified parameters
- *        held by the .per, .ampl, .offset members in struct
- *        Pressure.
+ *        Ramps to .offset, then runs a relay experiment around it until the
+ *        oscillation has been measured, the user interrupts, or
+ *        TUNE_TIMEOUT has passed. The resulting gains are reported through
+ *        UART, and stored in flash once the tank has been vented, since
+ *        erasing stalls the safety interrupt. Ignores the end condition under
+ *        .test.
  *
  * @param pressure A pointer to a pressure struct
  *
  * @retval None
  */
 void
-pressure_calib_dynam_sine (struct Pressure *pressure)
+pressure_autotune (struct Pressure *pressure)
 {
-  userint_flg = 0;
-  userint_flg_lck = 0;
-
-  float sw = 0.8f;                /* Switching in sec */
-  uint8_t N = pressure->per / sw; /* Number of points that make up the wave */
+  pressure_run_begin (pressure, 1.0f);
+}
 
-  /* Generate linspaced time array */
-  float ti[N];
-  for (uint8_t i = 0; i < N; i++)
-    ti[i] = (i * pressure->per) / N;
+/**
+ * @brief Advances auto-tuning by one tick
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Test over
+ *                 0 : Test continues
+ */
+uint8_t
+pressure_autotune_tick (struct Pressure *pressure)
+{
+  struct Run *run = &pressure->run;
 
-  /* Generate targets */
-  float yi[N];
-  for (uint32_t i = 0; i < N; i++)
-    yi[i] = pressure->offset
-            + ((pressure->ampl / 2)
-               * sin (2 * M_PI * (1 / pressure->per) * ti[i]));
+  if (!pressure_ramp_tick (pressure))
+    return 0;
 
-  /* Ramp to initial offset */
-  pressure_ramp_noconstrain (pressure, 1, pressure->offset);
+  if (run->phase == 0)
+    {
+      pressure->ctl.start = timebase_us ();
+      tune_relay_begin (pressure->station, pressure->offset);
+      pressure->target = pressure->offset;
+      run->phase = 1;
+      return 0;
+    }
 
-  /* Loop through targets until user interrupts */
-  while (1)
+  if (pressure_aborted (pressure) || tune_relay_done (pressure->station)
+      || (pressure_elapsed (pressure) >= TUNE_TIMEOUT))
     {
-      if (userint_flg)
-        break;
+      actuator_stop (pressure->map->compressor);
+      actuator_stop (pressure->map->exhaust);
 
-      uint32_t i = 0;
-      while (i <= N / 4)
+      if (tune_finish (pressure->station))
         {
-          if (userint_flg)
-            break;
-
-          pressure_ramp_v3 (pressure, 1, yi[i], 0.2f);
-          i++;
+          tune_uart_tx (pressure->station, pressure->huart);
+          run->save = RUN_SAVE_TUNE;
         }
+      else
+        HAL_UART_Transmit (pressure->huart, (uint8_t *)"#TUNE failed\r\n",
+                           14, 100);
+      return 1;
+    }
 
-      while (i <= 3 * (N / 4))
-        {
-          if (userint_flg)
-            break;
+  struct Estimate est;
+  estimator_get (pressure->station, &est);
+  if (tune_relay_step (pressure->station, est.p, pressure_elapsed (pressure))
+      > 0)
+    {
+      actuator_stop (pressure->map->exhaust);
+      actuator_pulse (pressure->map->compressor, ACTUATOR_HOLD);
+    }
+  else
+    {
+      actuator_stop (pressure->map->compressor);
+      actuator_pulse (pressure->map->exhaust, ACTUATOR_HOLD);
+    }
 
-          pressure_ramp_v3 (pressure, 2, yi[i], 0.2f);
-          i++;
-        }
+  return 0;
+}
 
-      while (i <= N)
-        {
-          if (userint_flg)
-            break;
+/**
+ * @brief Initializes components for the pressure system
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_init (struct Pressure *pressure)
+{
+  HAL_NVIC_DisableIRQ (EXTI9_5_IRQn);
+  timebase_init ();
+  acquisition_init (pressure->hadc);
+  actuator_init ();
+  safety_init (pressure->hadc, PRESSURE_MAX);
+  calibration_init ();
+  tune_init ();
+  quality_init ();
+  command_init (pressure->huart);
+  I2C_LCD_Init (I2C_LCD_1);
+  HAL_TIM_Encoder_Start_IT (pressure->htim_enc, TIM_CHANNEL_ALL);
+}
 
-          pressure_ramp_v3 (pressure, 1, yi[i], 0.2f);
-          i++;
-        }
-    }
+/**
+ * @brief Deinitializes components for the pressure system
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_cleanup (struct Pressure *pressure)
+{
+  shared_flags_clear (&pressure->ctl.flags, CONTROL_ABORT);
+
+  HAL_ADC_Stop_DMA (pressure->hadc);
+  HAL_TIM_Base_DeInit (pressure->htim_enc);
+  HAL_TIM_Base_DeInit (pressure->htim_upd);
+}
+
+/**
+ * @brief Transmits the sensor frames taken since the last tick through UART
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_uart_tx (struct Pressure *pressure)
+{
+  telemetry_uart_tx (pressure->huart);
+}
+
+/**
+ * @brief Takes a station's pressure from the last scan
+ *
+ *        Feeds the analyzers of the station and picks the telemetry rate it
+ *        asks for from the estimated slope and the tracking error, see
+ *        telemetry.c. Displays sensor data to LCD if the station is shown on
+ *        it.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+pressure_sensor_read (struct Pressure *pressure)
+{
+  uint8_t station = pressure->station;
+  struct Estimate est;
+
+  pressure->val = acquisition_get_psi (pressure->map->ref);
+
+  estimator_get (station, &est);
+
+  float err = 0.0f;
+  if (pressure->target > 0.0f)
+    err = fabsf (pressure->val - pressure->target);
+
+  telemetry_policy (station, fabsf (est.rate), err);
+  telemetry_set_target (station, pressure->target);
+
+  /* Updates the analyzers, test duration and LCD */
+  spectral_update (station, pressure->val, pressure->target);
+  ensemble_update (station, pressure->val);
+  quality_update (station, pressure->val, pressure->target);
+  trace_check_error (station, pressure->val, pressure->target);
+  pressure->elapsed = pressure_elapsed (pressure);
+  if (station == pressure_display)
+    menu_sm (pressure);
 }
@@ -0,0 +1,453 @@
+/**
+ * @file quality.c
+ *
+ * @brief Tracking quality program body
+ *
+ *        Scores every test on how closely the pressure followed the target:
+ *        RMS error, overshoot, phase lag of the fundamental for sine tests
+ *        and how often the actuators had to switch. The scores are compared
+ *        against baselines of known-good runs, so a controller change that
+ *        degrades tracking shows up as a FAIL on the rig.
+ *
+ *        A baseline is the metrics of a test run on the reference rig, kept
+ *        with quality_keep for the settings the test ran with. Baselines are
+ *        stored in flash, the same way as the tuned gains.
+ *
+ *        Every station scores its own tests against its own actuators. The
+ *        baselines are shared, the stations being copies of the same rig.
+ */
+
+#include "quality.h"
+#include "actuator.h"
+#include "menu.h"
+#include "pressure.h"
+#include "spectral.h"
+#include "stm32f4xx_hal.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Struct containing the baselines as stored in flash */
+struct QualityRecord
+{
+  uint32_t magic; /*!< QUALITY_MAGIC */
+  uint32_t n;     /*!< Baselines in use */
+  struct QualityBaseline baselines[QUALITY_MAX_BASELINES]; /*!< Baselines */
+  uint32_t sum;   /*!< Sum of the words above */
+};
+
+/* Struct containing the score of the last test of one station */
+struct QualityState
+{
+  struct QualityBaseline run; /*!< Settings of the last test */
+  struct QualityMetrics m;    /*!< Metrics of the current test */
+  float sum_sq;               /*!< Sum of squared errors */
+  uint32_t edges[2];          /*!< Compressor and exhaust switch counts at
+                                   the start */
+};
+
+static struct QualityRecord quality_rec; /*!< Baselines, loaded on start */
+static struct QualityState
+    quality_stations[PRESSURE_STATIONS]; /*!< Score of each station */
+
+/**
+ * @brief Sums the words of a record, except the sum itself
+ *
+ * @param rec Record
+ *
+ * @retval uint32_t Sum
+ */
+static uint32_t
+quality_sum (const struct QualityRecord *rec)
+{
+  const uint32_t *w = (const uint32_t *)rec;
+  uint32_t sum = 0;
+
+  for (uint32_t i = 0; i < offsetof (struct QualityRecord, sum) / 4; i++)
+    sum += w[i];
+
+  return sum;
+}
+
+/**
+ * @brief Loads the baselines from flash
+ *
+ *        Without a valid record, there are no baselines.
+ *
+ * @retval None
+ */
+void
+quality_init (void)
+{
+  const struct QualityRecord *rec
+      = (const struct QualityRecord *)QUALITY_FLASH_ADDR;
+
+  if (rec->magic == QUALITY_MAGIC && rec->n <= QUALITY_MAX_BASELINES
+      && rec->sum == quality_sum (rec))
+    quality_rec = *rec;
+  else
+    {
+      memset (&quality_rec, 0, sizeof (quality_rec));
+      quality_rec.magic = QUALITY_MAGIC;
+    }
+}
+
+/**
+ * @brief Stores the baselines in flash
+ *
+ *        Erasing stalls the core for a second or so, so it must only be done
+ *        with both actuators off.
+ *
+ * @retval None
+ */
+static void
+quality_save (void)
+{
+  quality_rec.sum = quality_sum (&quality_rec);
+
+  FLASH_EraseInitTypeDef erase = { 0 };
+  uint32_t err;
+
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+  erase.Sector = QUALITY_FLASH_SECTOR;
+  erase.NbSectors = 1;
+  erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+  HAL_FLASH_Unlock ();
+  if (HAL_FLASHEx_Erase (&erase, &err) == HAL_OK)
+    {
+      const uint32_t *w = (const uint32_t *)&quality_rec;
+      for (uint32_t i = 0; i < sizeof (quality_rec) / 4; i++)
+        HAL_FLASH_Program (FLASH_TYPEPROGRAM_WORD,
+                           QUALITY_FLASH_ADDR + (i * 4), w[i]);
+    }
+  HAL_FLASH_Lock ();
+}
+
+/**
+ * @brief Looks up the baseline of some settings
+ *
+ *        Settings only have to match within QUALITY_MATCH, those set
+ *        through the menu being sums of float steps.
+ *
+ * @param waveform enum waveform
+ * @param per Period in sec
+ * @param ampl Amplitude in psi
+ * @param offset Offset in psi
+ *
+ * @retval struct QualityBaseline* Baseline, NULL if there is none
+ */
+static struct QualityBaseline *
+quality_find (uint8_t waveform, float per, float ampl, float offset)
+{
+  for (uint32_t i = 0; i < quality_rec.n; i++)
+    {
+      struct QualityBaseline *b = &quality_rec.baselines[i];
+
+      if (b->waveform == waveform && fabsf (b->per - per) < QUALITY_MATCH
+          && fabsf (b->ampl - ampl) < QUALITY_MATCH
+          && fabsf (b->offset - offset) < QUALITY_MATCH)
+        return b;
+    }
+
+  return NULL;
+}
+
+/**
+ * @brief Clears the metrics of a station before a test
+ *
+ * @param station Index of the station
+ * @param waveform enum waveform about to run
+ * @param per Period in sec
+ * @param ampl Amplitude in psi
+ * @param offset Offset in psi
+ *
+ * @retval None
+ */
+void
+quality_start (uint8_t station, uint8_t waveform, float per, float ampl,
+               float offset)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct QualityState *q = &quality_stations[station];
+  const struct StationMap *map = pressure_get_map (station);
+
+  q->run.waveform = waveform;
+  q->run.per = per;
+  q->run.ampl = ampl;
+  q->run.offset = offset;
+
+  q->m.n = 0;
+  q->m.rms = 0.0f;
+  q->m.overshoot = 0.0f;
+  q->m.lag = 0.0f;
+  q->m.switches = 0;
+  q->sum_sq = 0.0f;
+
+  q->edges[0] = actuator_switches (map->compressor);
+  q->edges[1] = actuator_switches (map->exhaust);
+}
+
+/**
+ * @brief Adds one sample to the metrics of a station
+ *
+ *        Only counted once the test has set a target.
+ *
+ * @param station Index of the station
+ * @param val Measured pressure
+ * @param target Target pressure
+ *
+ * @retval None
+ */
+void
+quality_update (uint8_t station, float val, float target)
+{
+  if (station >= PRESSURE_STATIONS || target <= 0.0f)
+    return;
+
+  struct QualityState *q = &quality_stations[station];
+  float err = val - target;
+
+  q->m.n++;
+  q->sum_sq += err * err;
+  if (err > q->m.overshoot)
+    q->m.overshoot = err;
+}
+
+/**
+ * @brief Completes the metrics of a station after a test
+ *
+ * @param station Index of the station
+ * @param waveform enum waveform that ran
+ *
+ * @retval const struct QualityMetrics* Metrics of the test, NULL for a bad
+ *                                      station
+ */
+const struct QualityMetrics *
+quality_finish (uint8_t station, uint8_t waveform)
+{
+  if (station >= PRESSURE_STATIONS)
+    return NULL;
+
+  struct QualityState *q = &quality_stations[station];
+  const struct StationMap *map = pressure_get_map (station);
+
+  if (q->m.n > 0)
+    q->m.rms = sqrtf (q->sum_sq / q->m.n);
+
+  q->m.switches = (actuator_switches (map->compressor) - q->edges[0])
+                  + (actuator_switches (map->exhaust) - q->edges[1]);
+
+  /* Last complete cycle of the analyzer */
+  const struct SpectralResult *res = spectral_get_result (station);
+  if (waveform == WAVEFORM_SINE && res->cycle > 0)
+    q->m.lag = -res->phase;
+
+  return &q->m;
+}
+
+/**
+ * @brief Returns the metrics of the last test of a station
+ *
+ * @param station Index of the station
+ *
+ * @retval const struct QualityMetrics* Metrics, complete after quality_finish,
+ *                                      NULL for a bad station
+ */
+const struct QualityMetrics *
+quality_get (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return NULL;
+
+  return &quality_stations[station].m;
+}
+
+/**
+ * @brief Checks whether a metric has regressed
+ *
+ * @param val Measured value
+ * @param base Baseline value
+ * @param slack Absolute allowance
+ *
+ * @retval uint8_t 1 : Worse than allowed
+ *                 0 : Within tolerance
+ */
+static uint8_t
+quality_worse (float val, float base, float slack)
+{
+  return fabsf (val) > (fabsf (base) * (1.0f + QUALITY_TOLERANCE)) + slack;
+}
+
+/**
+ * @brief Compares the last test of a station against its baseline
+ *
+ * @param station Index of the station
+ * @param waveform enum waveform that ran
+ * @param per Period in sec
+ * @param ampl Amplitude in psi
+ * @param offset Offset in psi
+ *
+ * @retval uint8_t enum quality_verdict
+ */
+uint8_t
+quality_check (uint8_t station, uint8_t waveform, float per, float ampl,
+               float offset)
+{
+  const struct QualityBaseline *b
+      = quality_find (waveform, per, ampl, offset);
+
+  if (b == NULL || station >= PRESSURE_STATIONS)
+    return QUALITY_NOBASE;
+
+  const struct QualityMetrics *q = &quality_stations[station].m;
+  const struct QualityMetrics *m = &b->metrics;
+
+  if (quality_worse (q->rms, m->rms, QUALITY_SLACK_PSI)
+      || quality_worse (q->overshoot, m->overshoot, QUALITY_SLACK_PSI)
+      || quality_worse (q->lag, m->lag, QUALITY_SLACK_DEG)
+      || quality_worse (q->switches, m->switches, QUALITY_SLACK_SWITCH))
+    return QUALITY_FAIL;
+
+  return QUALITY_PASS;
+}
+
+/**
+ * @brief Transmits the metrics of the last test of a station and its verdict
+ *        through UART
+ *
+ * @param station Index of the station
+ * @param huart HAL UART handle for data plotting
+ * @param waveform enum waveform that ran
+ * @param per Period in sec
+ * @param ampl Amplitude in psi
+ * @param offset Offset in psi
+ *
+ * @retval None
+ */
+void
+quality_uart_tx (uint8_t station, UART_HandleTypeDef *huart, uint8_t waveform,
+                 float per, float ampl, float offset)
+{
+  static const char *const verdicts[] = { "NOBASE", "PASS", "FAIL" };
+  char str[128];
+
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  const struct QualityMetrics *q = &quality_stations[station].m;
+
+  int len = snprintf (
+      str, sizeof (str),
+      "#QUALITY %s per=%.2f ampl=%.2f offs=%.2f n=%lu rms=%.3f over=%.3f "
+      "lag=%.1f sw=%lu %s\r\n",
+      waveform_name (waveform), per, ampl, offset, (unsigned long)q->n,
+      q->rms, q->overshoot, q->lag, (unsigned long)q->switches,
+      verdicts[quality_check (station, waveform, per, ampl, offset)]);
+
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
+
+/**
+ * @brief Keeps the metrics of the last test of a station as the baseline of
+ *        its settings
+ *
+ *        Meant for a known-good run on the reference rig. Replaces an older
+ *        baseline of the same settings and stores every baseline in flash.
+ *        Refused while any actuator is switching, as the erase would stall
+ *        the interrupt that ends its pulse.
+ *
+ * @param station Index of the station
+ *
+ * @retval uint8_t 1 : Baseline stored
+ *                 0 : No test with a target has finished, table full or an
+ *                     actuator busy
+ */
+uint8_t
+quality_keep (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS || !actuator_idle ())
+    return 0;
+
+  const struct QualityState *q = &quality_stations[station];
+
+  if (q->m.n == 0)
+    return 0;
+
+  struct QualityBaseline *b = quality_find (q->run.waveform, q->run.per,
+                                            q->run.ampl, q->run.offset);
+
+  if (b == NULL)
+    {
+      if (quality_rec.n >= QUALITY_MAX_BASELINES)
+        return 0;
+
+      b = &quality_rec.baselines[quality_rec.n++];
+    }
+
+  *b = q->run;
+  b->metrics = q->m;
+  quality_save ();
+
+  return 1;
+}
+
+/**
+ * @brief Removes every baseline, in flash as well
+ *
+ *        Refused while any actuator is switching, like quality_keep.
+ *
+ * @retval uint8_t 1 : Baselines removed
+ *                 0 : An actuator busy
+ */
+uint8_t
+quality_clear (void)
+{
+  if (!actuator_idle ())
+    return 0;
+
+  quality_rec.n = 0;
+  memset (quality_rec.baselines, 0, sizeof (quality_rec.baselines));
+  quality_save ();
+
+  return 1;
+}
+
+/**
+ * @brief Transmits the baselines through UART
+ *
+ *        One line per baseline in the same format as the #QUALITY line, then
+ *        the number of baselines.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+quality_uart_tx_baselines (UART_HandleTypeDef *huart)
+{
+  char str[128];
+  int len;
+
+  for (uint32_t i = 0; i < quality_rec.n; i++)
+    {
+      const struct QualityBaseline *b = &quality_rec.baselines[i];
+
+      len = snprintf (str, sizeof (str),
+                      "#BASE %lu %s per=%.2f ampl=%.2f offs=%.2f n=%lu "
+                      "rms=%.3f over=%.3f lag=%.1f sw=%lu\r\n",
+                      (unsigned long)i, waveform_name (b->waveform), b->per,
+                      b->ampl, b->offset, (unsigned long)b->metrics.n,
+                      b->metrics.rms, b->metrics.overshoot, b->metrics.lag,
+                      (unsigned long)b->metrics.switches);
+      HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+    }
+
+  len = snprintf (str, sizeof (str), "#BASE n=%lu\r\n",
+                  (unsigned long)quality_rec.n);
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
@@ -5,6 +5,7 @@
  */
 
 #include "rotary.h"
+#include "shared.h"
 #include "stm32f4xx_hal_gpio.h"
 #include <stdint.h>
 
@@ -13,15 +14,17 @@ uint8_t btn_state
 uint8_t last_btn_state
     = GPIO_PIN_SET; /*!< Holds the button's last state, for debouncing */
 
-volatile int16_t rotary_count = 0; /*!< Current encoder count */
-volatile int16_t dir = 0;          /*!< Direction of last encoder turn */
+#define ROTARY_CW 0x01  /*!< Last turn was clockwise */
+#define ROTARY_CCW 0x02 /*!< Last turn was counter clockwise */
+
+/* The encoder is shared by every station, whichever is on the LCD reads it */
+static struct SharedFlags rotary_flags; /*!< Turns not read yet */
 
 /**
  * @brief Rotary encoder button's interrupt callback
  *
- *        Modifies dir once rotary_count is a high enough value.
- *        If dir = -1 : counter clockwise movement
- *               =  1 : clockwise movement
+ *        Records the direction of the turn once the encoder count is high
+ *        enough, replacing any turn not read yet.
  *
  * @param htim HAL timer handle for the rotary encoder
  *
@@ -30,15 +33,17 @@ volatile int16_t dir = 0;          /*!< Direction of last encoder turn */
 void
 HAL_TIM_IC_CaptureCallback (TIM_HandleTypeDef *htim)
 {
-  rotary_count = __HAL_TIM_GET_COUNTER (htim);
-  if (rotary_count >= 1)
+  int16_t count = __HAL_TIM_GET_COUNTER (htim);
+  if (count >= 1)
     {
-      dir = 1;
+      shared_flags_clear (&rotary_flags, ROTARY_CCW);
+      shared_flags_set (&rotary_flags, ROTARY_CW);
       __HAL_TIM_SET_COUNTER (htim, 0);
     }
-  else if (rotary_count <= -1)
+  else if (count <= -1)
     {
-      dir = -1;
+      shared_flags_clear (&rotary_flags, ROTARY_CW);
+      shared_flags_set (&rotary_flags, ROTARY_CCW);
       __HAL_TIM_SET_COUNTER (htim, 0);
     }
 }
@@ -59,8 +64,11 @@ rotary_get_input (void)
   int8_t status = 0;
 
   /* Checks for encoder movement */
-  status = dir;
-  dir = 0;
+  uint32_t turn = shared_flags_take (&rotary_flags, ROTARY_CW | ROTARY_CCW);
+  if (turn & ROTARY_CW)
+    status = 1;
+  else if (turn & ROTARY_CCW)
+    status = -1;
 
   /* Checks for a button press */
   btn_state = HAL_GPIO_ReadPin (GPIOA, ROTARY_SW_PIN);
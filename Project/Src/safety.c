@@ -0,0 +1,242 @@
+/**
+ * @file safety.c
+ *
+ * @brief Interrupt-level safety supervisor program body
+ *
+ *        The ADC's analog watchdog compares every conversion of the
+ *        reference sensor with a limit derived from the maximum pressure, in
+ *        hardware. When it fires, or when the test is interrupted, the
+ *        compressor is cut and the exhaust opened straight from the
+ *        interrupt, whatever the main loop is blocked on. The trip stays
+ *        latched until the tank has been vented.
+ *
+ *        Only the trip that sets the latch updates the counters, so they
+ *        have a single writer and reach the main loop as a seqlock
+ *        snapshot. The latency counted is the response time, from the
+ *        moment the event was noticed to the cut: entry into the ADC
+ *        interrupt for the watchdog, the encoder callback or the command
+ *        being executed for an abort.
+ *
+ *        The watchdog only covers one channel. The reference of every other
+ *        station is checked against the same limit in software, once per
+ *        scan, from the ADC conversion complete interrupt.
+ *
+ *        The ADC global interrupt must be left disabled in CubeMX, this
+ *        module provides ADC_IRQHandler.
+ */
+
+#include "safety.h"
+#include "actuator.h"
+#include "pressure.h"
+#include "shared.h"
+#include "stm32f4xx_hal.h"
+
+#include <stdio.h>
+
+static ADC_HandleTypeDef *safety_hadc;    /*!< ADC with the watchdog */
+static uint32_t safety_irq_stamp;         /*!< Cycle count at ADC IRQ entry */
+static uint16_t safety_limit = 0xFFFF;    /*!< Overpressure as an ADC code */
+#define SAFETY_LATCH 0x01 /*!< Set while tripped */
+
+static struct SharedFlags safety_flags;   /*!< SAFETY_LATCH */
+static struct SafetyStats safety_counts;  /*!< Counters, trip side */
+static struct SafetyStats safety_stats;   /*!< Last published counters */
+static struct SharedSeq safety_seq;       /*!< Guards safety_stats */
+
+/**
+ * @brief ADC interrupt handler
+ *
+ * @retval None
+ */
+void
+ADC_IRQHandler (void)
+{
+  safety_irq_stamp = safety_stamp ();
+  HAL_ADC_IRQHandler (safety_hadc);
+}
+
+/**
+ * @brief Analog watchdog callback
+ *
+ *        Called whenever a conversion of the reference sensor lands above
+ *        the limit.
+ *
+ * @param hadc HAL ADC handle whose watchdog fired
+ *
+ * @retval None
+ */
+void
+HAL_ADC_LevelOutOfWindowCallback (ADC_HandleTypeDef *hadc)
+{
+  safety_trip (SAFETY_OVERPRESSURE, safety_irq_stamp);
+}
+
+/**
+ * @brief Arms the analog watchdog on the reference sensor
+ *
+ *        The limit uses the nominal sensor span, so it doesn't depend on a
+ *        calibration curve that may be wrong.
+ *
+ * @param hadc HAL ADC handle that samples the sensors
+ * @param max Highest allowed tank pressure in psi
+ *
+ * @retval None
+ */
+void
+safety_init (ADC_HandleTypeDef *hadc, float max)
+{
+  ADC_AnalogWDGConfTypeDef awd = { 0 };
+
+  safety_hadc = hadc;
+
+  awd.WatchdogMode = ADC_ANALOGWATCHDOG_SINGLE_REG;
+  awd.Channel = ADC_CHANNEL_0;
+  safety_limit = (max * ADC_RESOLUTION) / PRESSURE_SENSOR_SPAN;
+  awd.HighThreshold = safety_limit;
+  awd.LowThreshold = 0;
+  awd.ITMode = ENABLE;
+  HAL_ADC_AnalogWDGConfig (hadc, &awd);
+
+  HAL_NVIC_SetPriority (ADC_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ (ADC_IRQn);
+
+  /* The response takes a few microseconds, too short for the timebase, so
+   * its latency is counted in core cycles */
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Checks a reference the analog watchdog doesn't cover
+ *
+ *        Called from the ADC conversion complete interrupt, once per scan,
+ *        so the response is a scan slower than the watchdog's.
+ *
+ * @param code Raw code of the reference sensor
+ *
+ * @retval None
+ */
+void
+safety_check (uint16_t code)
+{
+  if (code > safety_limit)
+    safety_trip (SAFETY_OVERPRESSURE, safety_stamp ());
+}
+
+/**
+ * @brief Returns a timestamp for the latency of a trip
+ *
+ *        Taken by the caller as soon as it notices the event.
+ *
+ * @retval uint32_t Core cycle count
+ */
+uint32_t
+safety_stamp (void)
+{
+  return DWT->CYCCNT;
+}
+
+/**
+ * @brief Cuts the compressor and opens the exhaust
+ *
+ *        Forces the actuator timer's outputs so the cut takes a handful of
+ *        cycles, then interrupts the running test. The latency recorded runs
+ *        from since to the end of the cut. Safe to call from interrupts.
+ *
+ * @param cause enum safety_cause
+ * @param since safety_stamp taken when the event was noticed
+ *
+ * @retval None
+ */
+void
+safety_trip (uint8_t cause, uint32_t since)
+{
+  actuator_trip ();
+
+  uint32_t latency = DWT->CYCCNT - since;
+
+  /* The watchdog keeps firing on every scan above the limit, only the first
+   * one counts */
+  if (!shared_flags_set (&safety_flags, SAFETY_LATCH))
+    {
+      if (cause < SAFETY_CAUSES)
+        safety_counts.trips[cause]++;
+      safety_counts.latency = latency;
+      if (latency > safety_counts.latency_max)
+        safety_counts.latency_max = latency;
+
+      shared_seq_write (&safety_seq, &safety_stats, &safety_counts,
+                        sizeof (safety_stats));
+    }
+
+  pressure_request_abort ();
+}
+
+/**
+ * @brief Returns whether the supervisor has tripped
+ *
+ *        While tripped, the compressor must stay off and the exhaust open.
+ *
+ * @retval uint8_t 1 : Tripped
+ *                 0 : Normal operation
+ */
+uint8_t
+safety_tripped (void)
+{
+  return shared_flags_test (&safety_flags, SAFETY_LATCH) != 0;
+}
+
+/**
+ * @brief Releases the trip once the tank has been vented
+ *
+ *        Closes the exhaust.
+ *
+ * @retval None
+ */
+void
+safety_clear (void)
+{
+  shared_flags_clear (&safety_flags, SAFETY_LATCH);
+  actuator_release ();
+}
+
+/**
+ * @brief Returns the supervisor's counters
+ *
+ * @param stats Filled with the counters
+ *
+ * @retval None
+ */
+void
+safety_get_stats (struct SafetyStats *stats)
+{
+  shared_seq_read (&safety_seq, stats, &safety_stats, sizeof (*stats));
+}
+
+/**
+ * @brief Transmits the supervisor's counters through UART
+ *
+ *        Latencies are converted to microseconds.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+safety_uart_tx (UART_HandleTypeDef *huart)
+{
+  char str[96];
+  float us = SystemCoreClock / 1000000.0f;
+  struct SafetyStats stats;
+
+  safety_get_stats (&stats);
+
+  int len = snprintf (str, sizeof (str),
+                      "#SAFETY over=%lu abort=%lu lat=%.2fus max=%.2fus%s\r\n",
+                      (unsigned long)stats.trips[SAFETY_OVERPRESSURE],
+                      (unsigned long)stats.trips[SAFETY_ABORT],
+                      stats.latency / us, stats.latency_max / us,
+                      safety_tripped () ? " tripped" : "");
+
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
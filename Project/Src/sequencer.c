@@ -0,0 +1,440 @@
+/**
+ * @file sequencer.c
+ *
+ * @brief Batch test sequencer program body
+ *
+ *        Runs every test of a script in order, venting the tank between
+ *        tests, and emits a summary line through UART as each test ends.
+ *        The station running the batch asks for one test at a time, so the
+ *        other stations keep running meanwhile.
+ *
+ *        Instead of a script, a parameter sweep can be run: every combination
+ *        of the swept period, amplitude and offset is generated as a test
+ *        when it's due, so sweeps aren't limited by the script size. Once the
+ *        batch is over, the results of every test are transmitted as one
+ *        table.
+ */
+
+#include "sequencer.h"
+#include "acquisition.h"
+#include "menu.h"
+#include "stm32f4xx_hal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Script used while no other one is loaded */
+static const struct SequencerTest sequencer_default[] = {
+  { WAVEFORM_SINE, 20.0f, 5.0f, 15.0f, TEST_END_CYCLES, 3 },
+  { WAVEFORM_SINE, 20.0f, 10.0f, 15.0f, TEST_END_CYCLES, 3 },
+  { WAVEFORM_SINE, 20.0f, 20.0f, 15.0f, TEST_END_CYCLES, 3 },
+  { WAVEFORM_STEP, 20.0f, 10.0f, 15.0f, TEST_END_CYCLES, 3 },
+};
+
+#define SEQUENCER_DEFAULTS (sizeof (sequencer_default) / sizeof (sequencer_default[0]))
+
+static struct SequencerTest sequencer_tests[SEQUENCER_MAX_TESTS]; /*!< Script */
+static uint8_t sequencer_n = 0; /*!< Number of tests in the script */
+/* Sweep run instead of the script once selected */
+static struct SequencerSweep sequencer_sweep
+    = { WAVEFORM_SINE,       { 20.0f, 20.0f, 1 }, { 5.0f, 20.0f, 4 },
+        { 15.0f, 15.0f, 1 }, TEST_END_CYCLES,     3 };
+static uint8_t sequencer_sweeping = 0; /*!< Set if the sweep is selected */
+static struct SequencerResult
+    sequencer_results[SEQUENCER_MAX_RESULTS]; /*!< Results table */
+static struct Pressure *sequencer_owner = NULL; /*!< Station running a batch */
+static struct SequencerTest sequencer_saved; /*!< Menu settings to restore */
+static uint8_t sequencer_total = 0; /*!< Tests in the running batch */
+static uint8_t sequencer_done = 0;  /*!< Tests of it that have ended */
+
+/**
+ * @brief Checks that a test can run as part of a batch
+ *
+ *        Every test has to end on its own, or the batch would wait forever.
+ *
+ * @param waveform enum waveform in waveform.h
+ * @param end enum test_end
+ * @param limit Cycles or seconds, depending on end
+ *
+ * @retval uint8_t 1 : Valid
+ *                 0 : No such waveform, or no end condition
+ */
+static uint8_t
+sequencer_valid (uint8_t waveform, uint8_t end, float limit)
+{
+  if (waveform >= WAVEFORMS || waveform == WAVEFORM_BATCH)
+    return 0;
+
+  if (end < TEST_END_CYCLES || end > TEST_END_DURATION || !(limit > 0.0f))
+    return 0;
+
+  return 1;
+}
+
+/**
+ * @brief Adds a test at the end of the script
+ *
+ *        Selects the script instead of the sweep.
+ *
+ * @param test Test to add
+ *
+ * @retval uint8_t 1 : Test added
+ *                 0 : Script full, or a test without an end condition
+ */
+uint8_t
+sequencer_append (const struct SequencerTest *test)
+{
+  if (sequencer_n >= SEQUENCER_MAX_TESTS
+      || !sequencer_valid (test->waveform, test->end, test->limit))
+    return 0;
+
+  sequencer_tests[sequencer_n++] = *test;
+  sequencer_sweeping = 0;
+
+  return 1;
+}
+
+/**
+ * @brief Empties the script
+ *
+ *        The default script runs until tests are added again.
+ *
+ * @retval None
+ */
+void
+sequencer_clear (void)
+{
+  sequencer_n = 0;
+  sequencer_sweeping = 0;
+}
+
+/**
+ * @brief Transmits the script through UART
+ *
+ *        One line per test, then the number of tests and whether the sweep
+ *        or the default script runs instead.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+sequencer_uart_tx_script (UART_HandleTypeDef *huart)
+{
+  char str[96];
+  int len;
+
+  for (uint8_t i = 0; i < sequencer_n; i++)
+    {
+      const struct SequencerTest *test = &sequencer_tests[i];
+
+      len = snprintf (str, sizeof (str),
+                      "#SCRIPT %u %s per=%.2f ampl=%.2f offs=%.2f end=%u "
+                      "limit=%.1f\r\n",
+                      i, waveform_name (test->waveform), test->per,
+                      test->ampl, test->offset, test->end, test->limit);
+      HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+    }
+
+  const char *runs = "";
+  if (sequencer_sweeping)
+    runs = " sweep";
+  else if (sequencer_n == 0)
+    runs = " default";
+
+  len = snprintf (str, sizeof (str), "#SCRIPT n=%u%s\r\n", sequencer_n,
+                  runs);
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
+
+/**
+ * @brief Returns the sweep, to be edited before sequencer_use_sweep
+ *
+ * @retval struct SequencerSweep* Sweep
+ */
+struct SequencerSweep *
+sequencer_get_sweep (void)
+{
+  return &sequencer_sweep;
+}
+
+/**
+ * @brief Number of tests a sweep generates
+ *
+ * @param sweep Sweep
+ *
+ * @retval uint32_t Product of the axis counts
+ */
+static uint32_t
+sequencer_sweep_count (const struct SequencerSweep *sweep)
+{
+  return (uint32_t)sweep->per.count * sweep->ampl.count * sweep->offset.count;
+}
+
+/**
+ * @brief Runs the sweep instead of the script from now on
+ *
+ *        Appending to the script switches back.
+ *
+ * @retval uint8_t 1 : Sweep selected
+ *                 0 : Empty, too many tests, or no end condition
+ */
+uint8_t
+sequencer_use_sweep (void)
+{
+  uint32_t n = sequencer_sweep_count (&sequencer_sweep);
+
+  if (n == 0 || n > SEQUENCER_MAX_RESULTS
+      || !sequencer_valid (sequencer_sweep.waveform, sequencer_sweep.end,
+                           sequencer_sweep.limit))
+    return 0;
+
+  sequencer_sweeping = 1;
+
+  return 1;
+}
+
+/**
+ * @brief Value of a swept parameter
+ *
+ * @param axis Swept parameter
+ * @param k Index of the value
+ *
+ * @retval float Value
+ */
+static float
+sequencer_axis_value (const struct SequencerAxis *axis, uint8_t k)
+{
+  if (axis->count < 2)
+    return axis->start;
+
+  return axis->start + (((axis->stop - axis->start) * k) / (axis->count - 1));
+}
+
+/**
+ * @brief Generates one test of the batch
+ *
+ * @param idx Index of the test
+ * @param test Filled with the test
+ *
+ * @retval None
+ */
+static void
+sequencer_get_test (uint8_t idx, struct SequencerTest *test)
+{
+  if (!sequencer_sweeping)
+    {
+      *test = (sequencer_n > 0) ? sequencer_tests[idx] : sequencer_default[idx];
+      return;
+    }
+
+  const struct SequencerSweep *sweep = &sequencer_sweep;
+
+  test->waveform = sweep->waveform;
+  test->offset = sequencer_axis_value (&sweep->offset,
+                                       idx % sweep->offset.count);
+  idx /= sweep->offset.count;
+  test->ampl = sequencer_axis_value (&sweep->ampl, idx % sweep->ampl.count);
+  idx /= sweep->ampl.count;
+  test->per = sequencer_axis_value (&sweep->per, idx);
+  test->end = sweep->end;
+  test->limit = sweep->limit;
+}
+
+/**
+ * @brief Transmits the summary of a finished test through UART
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param res Result of the test
+ * @param idx Index of the test in the batch
+ * @param n Number of tests in the batch
+ *
+ * @retval None
+ */
+static void
+sequencer_uart_tx_summary (struct Pressure *pressure,
+                           const struct SequencerResult *res, uint8_t idx,
+                           uint8_t n)
+{
+  char str[128];
+  const struct SequencerTest *test = &res->test;
+
+  int len = snprintf (
+      str, sizeof (str),
+      "#TEST %u/%u %s per=%.2f ampl=%.2f offs=%.2f cycles=%lu time=%.1f "
+      "aborted=%u\r\n",
+      idx + 1, n, waveform_name (test->waveform), test->per, test->ampl,
+      test->offset, (unsigned long)res->cycles, pressure->elapsed,
+      res->aborted);
+
+  HAL_UART_Transmit (pressure->huart, (uint8_t *)str, len, 100);
+}
+
+/**
+ * @brief Transmits the results of every test of the batch through UART
+ *
+ *        A header line, one row per test, then an end line:
+ *
+ *          #TABLE n=<tests> cols=idx,wave,per,ampl,offs,cycles,rms,over,lag,sw,verdict
+ *          #ROW <values>
+ *          #END
+ *
+ *        verdict is the enum quality_verdict.
+ *
+ * @param huart HAL UART handle for data plotting
+ * @param n Number of tests that ran
+ *
+ * @retval None
+ */
+static void
+sequencer_uart_tx_table (UART_HandleTypeDef *huart, uint8_t n)
+{
+  char str[128];
+
+  int len = snprintf (str, sizeof (str),
+                      "#TABLE n=%u cols=idx,wave,per,ampl,offs,cycles,rms,"
+                      "over,lag,sw,verdict\r\n",
+                      n);
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+
+  for (uint8_t i = 0; i < n; i++)
+    {
+      const struct SequencerResult *res = &sequencer_results[i];
+
+      len = snprintf (str, sizeof (str),
+                      "#ROW %u,%s,%.2f,%.2f,%.2f,%lu,%.3f,%.3f,%.1f,%lu,%u\r\n",
+                      i + 1, waveform_name (res->test.waveform),
+                      res->test.per, res->test.ampl, res->test.offset,
+                      (unsigned long)res->cycles, res->quality.rms,
+                      res->quality.overshoot, res->quality.lag,
+                      (unsigned long)res->quality.switches, res->verdict);
+      HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+    }
+
+  HAL_UART_Transmit (huart, (uint8_t *)"#END\r\n", 6, 100);
+}
+
+/**
+ * @brief Takes the sequencer for a batch on a station
+ *
+ *        Only one batch runs at a time, whichever station it runs on. The
+ *        station then calls sequencer_next for every test, and
+ *        sequencer_record once each test has ended.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Batch started
+ *                 0 : Another station is running a batch
+ */
+uint8_t
+sequencer_begin (struct Pressure *pressure)
+{
+  if (sequencer_owner != NULL)
+    return 0;
+
+  sequencer_owner = pressure;
+  sequencer_saved.per = pressure->per;
+  sequencer_saved.ampl = pressure->ampl;
+  sequencer_saved.offset = pressure->offset;
+
+  /* The sweep may have been edited since it was selected */
+  if (sequencer_sweeping && !sequencer_use_sweep ())
+    sequencer_sweeping = 0;
+
+  sequencer_total = sequencer_n;
+  if (sequencer_sweeping)
+    sequencer_total = sequencer_sweep_count (&sequencer_sweep);
+  else if (sequencer_total == 0)
+    sequencer_total = SEQUENCER_DEFAULTS;
+  sequencer_done = 0;
+
+  return 1;
+}
+
+/**
+ * @brief Loads the next test of the batch into the station
+ *
+ *        Interrupting a test aborts the rest of the batch. Once the batch is
+ *        over, the results table is transmitted, the signal parameters set
+ *        in the menu are restored and the sequencer is released.
+ *
+ * @param pressure A pointer to a pressure struct
+ * @param waveform Output enum waveform of the test
+ *
+ * @retval uint8_t 1 : Test loaded
+ *                 0 : Batch over
+ */
+uint8_t
+sequencer_next (struct Pressure *pressure, uint8_t *waveform)
+{
+  if (pressure != sequencer_owner)
+    return 0;
+
+  uint8_t done = sequencer_done;
+
+  if (done >= sequencer_total
+      || (done > 0 && sequencer_results[done - 1].aborted))
+    {
+      sequencer_uart_tx_table (pressure->huart, done);
+
+      pressure->per = sequencer_saved.per;
+      pressure->ampl = sequencer_saved.ampl;
+      pressure->offset = sequencer_saved.offset;
+      pressure->test.end = TEST_END_ABORT;
+      sequencer_owner = NULL;
+      return 0;
+    }
+
+  struct SequencerTest *test = &sequencer_results[done].test;
+  sequencer_get_test (done, test);
+
+  pressure->per = test->per;
+  pressure->ampl = test->ampl;
+  pressure->offset = test->offset;
+  pressure->test.end = test->end;
+  pressure->test.limit = test->limit;
+  *waveform = test->waveform;
+
+  return 1;
+}
+
+/**
+ * @brief Records the result of the test that has just ended
+ *
+ *        Transmits its summary line through UART.
+ *
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval None
+ */
+void
+sequencer_record (struct Pressure *pressure)
+{
+  if (pressure != sequencer_owner || sequencer_done >= sequencer_total)
+    return;
+
+  struct SequencerResult *res = &sequencer_results[sequencer_done];
+  const struct SequencerTest *test = &res->test;
+
+  res->cycles = pressure->test.cycles;
+  res->aborted = pressure->test.aborted;
+  res->quality = *quality_get (pressure->station);
+  res->verdict = quality_check (pressure->station, test->waveform, test->per,
+                                test->ampl, test->offset);
+  sequencer_uart_tx_summary (pressure, res, sequencer_done, sequencer_total);
+  sequencer_done++;
+}
+
+/**
+ * @brief Returns whether a batch is running
+ *
+ *        The script and the sweep can't be edited meanwhile.
+ *
+ * @retval uint8_t 1 : Running on some station
+ *                 0 : Free
+ */
+uint8_t
+sequencer_running (void)
+{
+  return sequencer_owner != NULL;
+}
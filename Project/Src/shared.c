@@ -0,0 +1,265 @@
+/**
+ * @file shared.c
+ *
+ * @brief Interrupt-safe shared state program body
+ *
+ *        Flags are read-modify-written with LDREX/STREX. Taking an exception
+ *        clears the exclusive monitor, so a main loop update interrupted by
+ *        a callback fails its store and is retried, and no flag is lost.
+ *
+ *        A snapshot is written by one context and read by others. The
+ *        writer makes the sequence count odd, copies, then makes it even
+ *        again. Readers retry until they copy with the same even count on
+ *        both sides. A reader that interrupts the writer would wait forever,
+ *        so the writer must run at a higher priority than every reader,
+ *        which is the case for callbacks publishing to the main loop.
+ *
+ *        Queues have one producer and one consumer. Each index is written by
+ *        one side only, and the barriers order the slot contents against
+ *        the index that publishes them. Indices run free and are masked on
+ *        use.
+ */
+
+#include "shared.h"
+#include "stm32f4xx_hal.h"
+
+#include <string.h>
+
+/**
+ * @brief Sets flags and returns which of them were already set
+ *
+ *        Setting a single flag is a test-and-set: only the caller that gets
+ *        0 back has set it.
+ *
+ * @param flags Flags to update
+ * @param mask Bits to set
+ *
+ * @retval uint32_t Bits of mask that were already set
+ */
+uint32_t
+shared_flags_set (struct SharedFlags *flags, uint32_t mask)
+{
+  uint32_t bits;
+
+  do
+    bits = __LDREXW (&flags->bits);
+  while (__STREXW (bits | mask, &flags->bits));
+
+  return bits & mask;
+}
+
+/**
+ * @brief Clears flags
+ *
+ * @param flags Flags to update
+ * @param mask Bits to clear
+ *
+ * @retval None
+ */
+void
+shared_flags_clear (struct SharedFlags *flags, uint32_t mask)
+{
+  uint32_t bits;
+
+  do
+    bits = __LDREXW (&flags->bits) & ~mask;
+  while (__STREXW (bits, &flags->bits));
+}
+
+/**
+ * @brief Clears flags and returns which of them were set
+ *
+ *        Consumes events: an event set after the read is kept for the next
+ *        call.
+ *
+ * @param flags Flags to update
+ * @param mask Bits to take
+ *
+ * @retval uint32_t Bits of mask that were set
+ */
+uint32_t
+shared_flags_take (struct SharedFlags *flags, uint32_t mask)
+{
+  uint32_t bits;
+
+  do
+    bits = __LDREXW (&flags->bits);
+  while (__STREXW (bits & ~mask, &flags->bits));
+
+  return bits & mask;
+}
+
+/**
+ * @brief Returns which flags are set, leaving them as they are
+ *
+ * @param flags Flags to read
+ * @param mask Bits to test
+ *
+ * @retval uint32_t Bits of mask that are set
+ */
+uint32_t
+shared_flags_test (const struct SharedFlags *flags, uint32_t mask)
+{
+  return flags->bits & mask;
+}
+
+/**
+ * @brief Publishes a snapshot
+ *
+ *        Only one context may write a given snapshot.
+ *
+ * @param seq Sequence count of the snapshot
+ * @param dst Snapshot
+ * @param src New contents
+ * @param len Size of the snapshot in bytes
+ *
+ * @retval None
+ */
+void
+shared_seq_write (struct SharedSeq *seq, void *dst, const void *src,
+                  size_t len)
+{
+  seq->seq++;
+  __DMB ();
+  memcpy (dst, src, len);
+  __DMB ();
+  seq->seq++;
+}
+
+/**
+ * @brief Copies a snapshot out, retrying if it was written meanwhile
+ *
+ * @param seq Sequence count of the snapshot
+ * @param dst Filled with a consistent copy
+ * @param src Snapshot
+ * @param len Size of the snapshot in bytes
+ *
+ * @retval None
+ */
+void
+shared_seq_read (const struct SharedSeq *seq, void *dst, const void *src,
+                 size_t len)
+{
+  uint32_t start;
+
+  do
+    {
+      start = seq->seq;
+      __DMB ();
+      memcpy (dst, src, len);
+      __DMB ();
+    }
+  while ((start & 1) || seq->seq != start);
+}
+
+/**
+ * @brief Empties a queue
+ *
+ *        Must be called before either side uses the queue.
+ *
+ * @param queue Queue to set up
+ * @param size Number of slots, power of two up to 32768
+ *
+ * @retval None
+ */
+void
+shared_queue_init (struct SharedQueue *queue, uint16_t size)
+{
+  queue->head = 0;
+  queue->tail = 0;
+  queue->size = size;
+}
+
+/**
+ * @brief Returns the slot the producer fills next
+ *
+ *        The slot only becomes visible to the consumer once committed.
+ *
+ * @param queue Queue to push to
+ *
+ * @retval int32_t Index of the slot, -1 if the queue is full
+ */
+int32_t
+shared_queue_reserve (const struct SharedQueue *queue)
+{
+  uint16_t head = queue->head;
+
+  if ((uint16_t)(head - queue->tail) >= queue->size)
+    return -1;
+
+  return head & (queue->size - 1);
+}
+
+/**
+ * @brief Hands the reserved slot over to the consumer
+ *
+ * @param queue Queue to push to
+ *
+ * @retval None
+ */
+void
+shared_queue_commit (struct SharedQueue *queue)
+{
+  __DMB ();
+  queue->head = queue->head + 1;
+}
+
+/**
+ * @brief Returns the number of slots waiting for the consumer
+ *
+ * @param queue Queue to pop from
+ *
+ * @retval uint16_t Committed slots not released yet
+ */
+uint16_t
+shared_queue_count (const struct SharedQueue *queue)
+{
+  uint16_t count = queue->head - queue->tail;
+
+  __DMB ();
+  return count;
+}
+
+/**
+ * @brief Returns the index of a waiting slot
+ *
+ * @param queue Queue to pop from
+ * @param i 0 for the oldest slot, below shared_queue_count
+ *
+ * @retval uint16_t Index of the slot
+ */
+uint16_t
+shared_queue_peek (const struct SharedQueue *queue, uint16_t i)
+{
+  return (uint16_t)(queue->tail + i) & (queue->size - 1);
+}
+
+/**
+ * @brief Hands the oldest slots back to the producer
+ *
+ * @param queue Queue to pop from
+ * @param n Number of slots, at most shared_queue_count
+ *
+ * @retval None
+ */
+void
+shared_queue_release (struct SharedQueue *queue, uint16_t n)
+{
+  __DMB ();
+  queue->tail = queue->tail + n;
+}
+
+/**
+ * @brief Drops every waiting slot
+ *
+ *        Called by the consumer.
+ *
+ * @param queue Queue to pop from
+ *
+ * @retval None
+ */
+void
+shared_queue_flush (struct SharedQueue *queue)
+{
+  queue->tail = queue->head;
+}
@@ -0,0 +1,284 @@
+/**
+ * @file spectral.c
+ *
+ * @brief Streaming spectral analyzer program body
+ *
+ *        Runs one Goertzel filter per bin over the measured pressure and the
+ *        target. Bin k is tuned to k times the fundamental, so after a whole
+ *        cycle it holds that harmonic's DFT coefficient. Memory is constant
+ *        and every sample costs the same 2 * SPECTRAL_BINS multiply-adds.
+ *
+ *        The test calls spectral_cycle at the end of each cycle. The first
+ *        cycle only measures how many samples a cycle holds; the filters are
+ *        tuned to that count and re-tuned whenever a cycle's length changes.
+ *
+ *        Every station has its own analyzer.
+ */
+
+#include "spectral.h"
+#include "pressure.h"
+#include "stm32f4xx_hal.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Struct containing the Goertzel state of one signal */
+struct SpectralSignal
+{
+  float s1[SPECTRAL_BINS]; /*!< Filter output one sample ago */
+  float s2[SPECTRAL_BINS]; /*!< Filter output two samples ago */
+};
+
+/* Struct containing the analyzer of one station */
+struct SpectralState
+{
+  float cos[SPECTRAL_BINS];     /*!< cos(w) of each bin */
+  float sin[SPECTRAL_BINS];     /*!< sin(w) of each bin */
+  struct SpectralSignal val;    /*!< Measured pressure */
+  struct SpectralSignal target; /*!< Target pressure */
+  struct SpectralResult result; /*!< Last completed cycle */
+  uint16_t len;                 /*!< Samples per cycle, 0 if untuned */
+  uint16_t n;                   /*!< Samples in the current cycle */
+  uint8_t active;               /*!< Set while a test is analyzed */
+};
+
+static struct SpectralState
+    spectral_stations[PRESSURE_STATIONS]; /*!< Analyzer of each station */
+
+/**
+ * @brief Tunes every bin to a cycle length
+ *
+ * @param sp Analyzer of the station
+ * @param len Samples per cycle
+ *
+ * @retval None
+ */
+static void
+spectral_tune (struct SpectralState *sp, uint16_t len)
+{
+  sp->len = len;
+
+  for (uint8_t k = 0; k < SPECTRAL_BINS; k++)
+    {
+      float w = (2 * M_PI * (k + 1)) / len;
+      sp->cos[k] = cosf (w);
+      sp->sin[k] = sinf (w);
+    }
+}
+
+/**
+ * @brief Feeds one sample into a signal's filters
+ *
+ * @param sp Analyzer of the station
+ * @param sig Signal to update
+ * @param x New sample
+ *
+ * @retval None
+ */
+static void
+spectral_step (const struct SpectralState *sp, struct SpectralSignal *sig,
+               float x)
+{
+  for (uint8_t k = 0; k < SPECTRAL_BINS; k++)
+    {
+      float s0 = x + (2 * sp->cos[k] * sig->s1[k]) - sig->s2[k];
+      sig->s2[k] = sig->s1[k];
+      sig->s1[k] = s0;
+    }
+}
+
+/**
+ * @brief Returns the DFT coefficient of one bin after a whole cycle
+ *
+ * @param sp Analyzer of the station
+ * @param sig Signal to evaluate
+ * @param k Bin, 0 for the fundamental
+ * @param re Output real part
+ * @param im Output imaginary part
+ *
+ * @retval None
+ */
+static void
+spectral_coeff (const struct SpectralState *sp,
+                const struct SpectralSignal *sig, uint8_t k, float *re,
+                float *im)
+{
+  *re = sig->s1[k] - (sig->s2[k] * sp->cos[k]);
+  *im = sig->s2[k] * sp->sin[k];
+}
+
+/**
+ * @brief Starts analyzing a test on a station
+ *
+ *        Results become available from the end of the second cycle on.
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+spectral_start (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct SpectralState *sp = &spectral_stations[station];
+
+  memset (&sp->val, 0, sizeof (sp->val));
+  memset (&sp->target, 0, sizeof (sp->target));
+  memset (&sp->result, 0, sizeof (sp->result));
+  sp->len = 0;
+  sp->n = 0;
+  sp->active = 1;
+}
+
+/**
+ * @brief Stops analyzing a station, samples are ignored until the next start
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+spectral_stop (uint8_t station)
+{
+  if (station < PRESSURE_STATIONS)
+    spectral_stations[station].active = 0;
+}
+
+/**
+ * @brief Feeds one sample of the pressure and target into the analyzer
+ *
+ * @param station Index of the station
+ * @param val Measured pressure
+ * @param target Target pressure
+ *
+ * @retval None
+ */
+void
+spectral_update (uint8_t station, float val, float target)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct SpectralState *sp = &spectral_stations[station];
+
+  if (!sp->active)
+    return;
+
+  if (sp->n < UINT16_MAX)
+    sp->n++;
+
+  if (sp->len > 0)
+    {
+      spectral_step (sp, &sp->val, val);
+      spectral_step (sp, &sp->target, target);
+    }
+}
+
+/**
+ * @brief Marks the end of a cycle
+ *
+ *        Computes the cycle's gain, phase and THD if the filters were tuned
+ *        to its length, otherwise re-tunes them for the next cycle.
+ *
+ * @param station Index of the station
+ *
+ * @retval uint8_t 1 : New result available
+ *                 0 : Cycle used for tuning
+ */
+uint8_t
+spectral_cycle (uint8_t station)
+{
+  uint8_t ready = 0;
+
+  if (station >= PRESSURE_STATIONS)
+    return 0;
+
+  struct SpectralState *sp = &spectral_stations[station];
+
+  if (!sp->active)
+    return 0;
+
+  if ((sp->len > 0) && (sp->n == sp->len))
+    {
+      float yr, yi, xr, xi;
+      float harm = 0.0f;
+
+      spectral_coeff (sp, &sp->val, 0, &yr, &yi);
+      spectral_coeff (sp, &sp->target, 0, &xr, &xi);
+
+      for (uint8_t k = 1; k < SPECTRAL_BINS; k++)
+        {
+          float hr, hi;
+          spectral_coeff (sp, &sp->val, k, &hr, &hi);
+          harm += (hr * hr) + (hi * hi);
+        }
+
+      float y = sqrtf ((yr * yr) + (yi * yi));
+      float x = sqrtf ((xr * xr) + (xi * xi));
+
+      float phase = (atan2f (yi, yr) - atan2f (xi, xr)) * 180.0f / M_PI;
+      if (phase > 180.0f)
+        phase -= 360.0f;
+      else if (phase < -180.0f)
+        phase += 360.0f;
+
+      sp->result.cycle++;
+      sp->result.n = sp->n;
+      sp->result.gain = (x > 0.0f) ? y / x : 0.0f;
+      sp->result.phase = phase;
+      sp->result.thd = (y > 0.0f) ? sqrtf (harm) / y : 0.0f;
+      ready = 1;
+    }
+  else if (sp->n > 2 * SPECTRAL_BINS)
+    spectral_tune (sp, sp->n);
+
+  memset (&sp->val, 0, sizeof (sp->val));
+  memset (&sp->target, 0, sizeof (sp->target));
+  sp->n = 0;
+
+  return ready;
+}
+
+/**
+ * @brief Returns the analysis of the last completed cycle of a station
+ *
+ * @param station Index of the station
+ *
+ * @retval const struct SpectralResult* Result, NULL for a bad station
+ */
+const struct SpectralResult *
+spectral_get_result (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return NULL;
+
+  return &spectral_stations[station].result;
+}
+
+/**
+ * @brief Transmits the analysis of the last completed cycle of a station
+ *        through UART
+ *
+ * @param station Index of the station
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+spectral_uart_tx (uint8_t station, UART_HandleTypeDef *huart)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  const struct SpectralResult *result = &spectral_stations[station].result;
+  char str[80];
+  int len = snprintf (str, sizeof (str),
+                      "#SPEC cycle=%lu n=%u gain=%.3f phase=%.1f thd=%.3f\r\n",
+                      (unsigned long)result->cycle, result->n, result->gain,
+                      result->phase, result->thd);
+
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
@@ -0,0 +1,229 @@
+/**
+ * @file telemetry.c
+ *
+ * @brief Adaptive telemetry program body
+ *
+ *        Every background scan is offered to the telemetry, which keeps one
+ *        in every few depending on the current rate. Once per control tick
+ *        the policy raises the rate while the pressure moves fast or tracks
+ *        badly, and lowers it after a quiet spell. The kept frames are sent
+ *        in the usual comma separated format, followed by the target of
+ *        every station and the actuator outputs at the time of the scan:
+ *
+ *          <ref>,<dut1>,<dut2>,<dut3>,<target>,<pins>
+ *
+ *        pins has bit 0 set while the compressor is on, bit 1 for the
+ *        exhaust. On the dual-station board the second reference follows the
+ *        DUTs, the second target follows the first, and bits 2 and 3 of pins
+ *        belong to the second station's actuators.
+ *
+ *        Every station runs the policy on its own tick, and frames are kept
+ *        at the fastest rate any station asks for.
+ *
+ *        Whenever the spacing of the frames changes, a marker line is sent
+ *        before the next frame:
+ *
+ *          #RATE hz=<frames per sec> n=<scan index> t=<sec>
+ *
+ *        n and t belong to the next frame. Scan indices count at
+ *        ACQUISITION_RATE, so the host can place every frame on a uniform time
+ *        axis, across rate changes and lost frames. t is read from the
+ *        timebase and ties that axis to the rest of the firmware's records.
+ *
+ *        In burst mode every scan is handed to burst.c instead, and the
+ *        comma separated frames stop.
+ */
+
+#include "telemetry.h"
+#include "actuator.h"
+#include "burst.h"
+#include "calibration.h"
+#include "shared.h"
+#include "stm32f4xx_hal.h"
+#include "timebase.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Scans per frame at each rate */
+static const uint16_t telemetry_decim[TELEMETRY_RATES]
+    = { ACQUISITION_RATE, ACQUISITION_RATE / 10, ACQUISITION_RATE / 100 };
+
+static struct TelemetryFrame telemetry_buf[TELEMETRY_FRAMES]; /*!< Ring */
+static struct SharedQueue telemetry_queue
+    = { .size = TELEMETRY_FRAMES }; /*!< Slots of telemetry_buf */
+static volatile uint16_t telemetry_cur = ACQUISITION_RATE / 10; /*!< Decim */
+static uint32_t telemetry_n = 0;       /*!< Scans seen */
+static uint8_t telemetry_rate[PRESSURE_STATIONS] = {
+  [0 ... PRESSURE_STATIONS - 1] = TELEMETRY_NORMAL
+}; /*!< enum telemetry_rate of each station */
+static uint8_t telemetry_quiet[PRESSURE_STATIONS]; /*!< Quiet ticks */
+static uint32_t telemetry_next = 0;    /*!< Scan index expected next */
+static uint16_t telemetry_sent = 0;    /*!< Decim of the last frame sent */
+static volatile float
+    telemetry_target[PRESSURE_STATIONS]; /*!< Target of each station */
+
+/**
+ * @brief Offers one scan to the telemetry
+ *
+ *        Called from the ADC conversion complete interrupt. Frames are
+ *        dropped while the ring is full.
+ *
+ * @param scan Raw codes of every channel, reference first
+ *
+ * @retval None
+ */
+void
+telemetry_record (const uint16_t *scan)
+{
+  uint32_t n = telemetry_n++;
+  uint16_t decim = telemetry_cur;
+
+  burst_record (scan);
+  if (burst_enabled ())
+    return;
+
+  if (n % decim != 0)
+    return;
+
+  int32_t slot = shared_queue_reserve (&telemetry_queue);
+  if (slot < 0)
+    return;
+
+  struct TelemetryFrame *frame = &telemetry_buf[slot];
+  frame->t = timebase_us ();
+  frame->n = n;
+  frame->decim = decim;
+  frame->pins = actuator_pins ();
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    frame->target[i] = telemetry_target[i];
+  memcpy (frame->code, scan, sizeof (frame->code));
+
+  shared_queue_commit (&telemetry_queue);
+}
+
+/**
+ * @brief Picks the telemetry rate a station asks for on the next tick
+ *
+ *        Goes fast as soon as either threshold is crossed, and slows down
+ *        one step at a time after TELEMETRY_QUIET_TICKS quiet ticks.
+ *
+ * @param station Index of the station
+ * @param slope Absolute rate of change of the pressure in psi/sec
+ * @param err Absolute tracking error in psi, 0 without a target
+ *
+ * @retval None
+ */
+void
+telemetry_policy (uint8_t station, float slope, float err)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  uint8_t *rate = &telemetry_rate[station];
+  uint8_t *quiet = &telemetry_quiet[station];
+
+  if (slope > TELEMETRY_FAST_SLOPE || err > TELEMETRY_FAST_ERROR)
+    {
+      *rate = TELEMETRY_FAST;
+      *quiet = 0;
+    }
+  else if (slope < TELEMETRY_QUIET_SLOPE && err < TELEMETRY_QUIET_ERROR)
+    {
+      if (++*quiet >= TELEMETRY_QUIET_TICKS)
+        {
+          if (*rate > TELEMETRY_SLOW)
+            (*rate)--;
+          *quiet = 0;
+        }
+    }
+  else
+    {
+      if (*rate < TELEMETRY_NORMAL)
+        *rate = TELEMETRY_NORMAL;
+      *quiet = 0;
+    }
+
+  /* Fastest rate asked for */
+  uint8_t fastest = TELEMETRY_SLOW;
+  for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+    if (telemetry_rate[i] > fastest)
+      fastest = telemetry_rate[i];
+
+  telemetry_cur = telemetry_decim[fastest];
+}
+
+/**
+ * @brief Sets the target of a station stamped on the following frames
+ *
+ * @param station Index of the station
+ * @param target Test target in psi, 0 without a target
+ *
+ * @retval None
+ */
+void
+telemetry_set_target (uint8_t station, float target)
+{
+  if (station < PRESSURE_STATIONS)
+    telemetry_target[station] = target;
+}
+
+/**
+ * @brief Transmits every buffered frame through UART
+ *
+ *        One line per frame: the pressure of every channel, the target of
+ *        every station and the actuator outputs, preceded by a #RATE marker
+ *        whenever the spacing changes. Sends the complete blocks instead in
+ *        burst mode.
+ *
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+telemetry_uart_tx (UART_HandleTypeDef *huart)
+{
+  char str[96];
+
+  if (burst_enabled ())
+    {
+      shared_queue_flush (&telemetry_queue);
+      burst_uart_tx (huart);
+      return;
+    }
+
+  while (shared_queue_count (&telemetry_queue) > 0)
+    {
+      const struct TelemetryFrame *frame
+          = &telemetry_buf[shared_queue_peek (&telemetry_queue, 0)];
+      int len;
+
+      if (frame->decim != telemetry_sent || frame->n != telemetry_next)
+        {
+          len = snprintf (str, sizeof (str),
+                          "#RATE hz=%u n=%lu t=%lu.%06lu\r\n",
+                          ACQUISITION_RATE / frame->decim,
+                          (unsigned long)frame->n,
+                          (unsigned long)(frame->t / 1000000),
+                          (unsigned long)(frame->t % 1000000));
+          HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+          telemetry_sent = frame->decim;
+        }
+      telemetry_next = frame->n + frame->decim;
+
+      len = snprintf (str, sizeof (str), "%.2f",
+                      calibration_apply (ACQUISITION_REF, frame->code[0]));
+      for (uint8_t i = 1; i < ACQUISITION_CHANNELS; i++)
+        len += snprintf (str + len, sizeof (str) - len, ",%.2f",
+                         calibration_apply (i, frame->code[i]));
+      for (uint8_t i = 0; i < PRESSURE_STATIONS; i++)
+        len += snprintf (str + len, sizeof (str) - len, ",%.2f",
+                         frame->target[i]);
+      len += snprintf (str + len, sizeof (str) - len, ",%u\r\n",
+                       frame->pins);
+
+      HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+
+      shared_queue_release (&telemetry_queue, 1);
+    }
+}
@@ -0,0 +1,109 @@
+/**
+ * @file timebase.c
+ *
+ * @brief Microsecond timebase program body
+ *
+ *        TIM5 counts at 1MHz over its full 32 bits and wraps every 71
+ *        minutes. Its update interrupt counts the wraps, which extends the
+ *        counter to 64 bits.
+ *
+ *        Reads take no lock: the wrap count is read on both sides of the
+ *        counter and the read is retried if it changed. A wrap whose
+ *        interrupt is still pending, because the reader runs with
+ *        interrupts disabled or at the same priority, is accounted for from
+ *        the update flag.
+ *
+ *        TIM5 is configured here, so it must be left disabled in CubeMX.
+ */
+
+#include "timebase.h"
+#include "pressure.h"
+#include "stm32f4xx_hal.h"
+
+static TIM_HandleTypeDef timebase_htim;       /*!< Free running counter */
+static volatile uint32_t timebase_wraps = 0; /*!< High 32 bits */
+
+/**
+ * @brief TIM5 interrupt handler
+ *
+ *        Runs at the highest priority, so no reader can observe the flag
+ *        cleared before the wrap is counted.
+ *
+ * @retval None
+ */
+void
+TIM5_IRQHandler (void)
+{
+  if (TIM5->SR & TIM_SR_UIF)
+    {
+      TIM5->SR = ~TIM_SR_UIF;
+      timebase_wraps++;
+    }
+}
+
+/**
+ * @brief Starts the timebase from zero
+ *
+ * @retval None
+ */
+void
+timebase_init (void)
+{
+  __HAL_RCC_TIM5_CLK_ENABLE ();
+  timebase_htim.Instance = TIM5;
+  timebase_htim.Init.Prescaler = (pressure_timer_clock () / 1000000) - 1;
+  timebase_htim.Init.CounterMode = TIM_COUNTERMODE_UP;
+  timebase_htim.Init.Period = 0xFFFFFFFF;
+  timebase_htim.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  timebase_htim.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  HAL_TIM_Base_Init (&timebase_htim);
+
+  /* Base_Init leaves the update flag set from loading the prescaler */
+  __HAL_TIM_CLEAR_FLAG (&timebase_htim, TIM_FLAG_UPDATE);
+  timebase_wraps = 0;
+
+  HAL_NVIC_SetPriority (TIM5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ (TIM5_IRQn);
+  HAL_TIM_Base_Start_IT (&timebase_htim);
+}
+
+/**
+ * @brief Returns the time since timebase_init
+ *
+ *        Safe to call from interrupts.
+ *
+ * @retval uint64_t Time in us
+ */
+uint64_t
+timebase_us (void)
+{
+  uint32_t hi, lo, pending;
+
+  do
+    {
+      hi = timebase_wraps;
+      lo = TIM5->CNT;
+      pending = TIM5->SR & TIM_SR_UIF;
+    }
+  while (hi != timebase_wraps);
+
+  /* The counter wrapped but the interrupt hasn't run yet. A counter read
+   * from just before the wrap belongs to the old count */
+  if (pending && lo < 0x80000000UL)
+    hi++;
+
+  return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief Returns the time elapsed since an earlier reading
+ *
+ * @param since Earlier return value of timebase_us
+ *
+ * @retval float Time in sec
+ */
+float
+timebase_elapsed (uint64_t since)
+{
+  return (timebase_us () - since) / 1000000.0f;
+}
@@ -0,0 +1,305 @@
+/**
+ * @file trace.c
+ *
+ * @brief Raw trace capture program body
+ *
+ *        While armed, every background scan appends one record to a
+ *        statically allocated ring buffer. A trigger freezes the ring once
+ *        .post more records have been taken, keeping up to .pre records from
+ *        before the trigger. The capture is transmitted straight out of the
+ *        ring buffer, without copying.
+ *
+ *        Every station has its own ring, recording its own reference sensor
+ *        and actuators, and is armed and triggered on its own.
+ */
+
+#include "trace.h"
+#include "acquisition.h"
+#include "stm32f4xx_hal.h"
+#include "timebase.h"
+
+#include <math.h>
+#include <stdio.h>
+
+/* Capture states */
+enum trace_state
+{
+  TRACE_IDLE,
+  TRACE_ARMED,
+  TRACE_TRIGGERED,
+  TRACE_DONE
+};
+
+/* Struct containing the capture of one station */
+struct TraceStation
+{
+  struct TraceRecord buf[TRACE_SIZE]; /*!< Ring buffer */
+  volatile uint8_t state;             /*!< enum trace_state */
+  volatile uint32_t head;      /*!< Records written since arming */
+  volatile uint32_t trig;      /*!< head at the trigger */
+  volatile uint16_t post_left; /*!< Records left to take */
+  volatile uint8_t cause;      /*!< What triggered */
+  struct TraceConfig config;   /*!< Settings of the capture */
+  uint16_t over_code;          /*!< Overpressure as an ADC code */
+};
+
+static struct TraceStation
+    trace_stations[PRESSURE_STATIONS]; /*!< Capture of each station */
+
+/**
+ * @brief Moves the capture to the triggered state
+ *
+ *        Must be called with the acquisition interrupt unable to preempt.
+ *
+ * @param tr Capture of the station
+ * @param cause enum trace_cause that triggered
+ *
+ * @retval None
+ */
+static void
+trace_fire (struct TraceStation *tr, uint8_t cause)
+{
+  tr->trig = tr->head;
+  tr->cause = cause;
+  tr->post_left = tr->config.post;
+  tr->state = (tr->config.post > 0) ? TRACE_TRIGGERED : TRACE_DONE;
+
+  if (tr->head > 0)
+    tr->buf[(tr->head - 1) & (TRACE_SIZE - 1)].flags = cause;
+}
+
+/**
+ * @brief Arms the capture of a station
+ *
+ *        The previous capture is discarded either way.
+ *
+ * @param station Index of the station
+ * @param config Capture window and triggers
+ *
+ * @retval uint8_t 1 : Armed
+ *                 0 : Window larger than TRACE_SIZE
+ */
+uint8_t
+trace_arm (uint8_t station, const struct TraceConfig *config)
+{
+  if (station >= PRESSURE_STATIONS)
+    return 0;
+
+  struct TraceStation *tr = &trace_stations[station];
+
+  tr->state = TRACE_IDLE;
+
+  if (config->pre + config->post > TRACE_SIZE)
+    return 0;
+
+  tr->config = *config;
+  tr->over_code
+      = (config->overpressure * ADC_RESOLUTION) / PRESSURE_SENSOR_SPAN;
+  tr->head = 0;
+  tr->cause = 0;
+
+  tr->state = TRACE_ARMED;
+
+  return 1;
+}
+
+/**
+ * @brief Stops recording and discards any capture of a station
+ *
+ * @param station Index of the station
+ *
+ * @retval None
+ */
+void
+trace_disarm (uint8_t station)
+{
+  if (station < PRESSURE_STATIONS)
+    trace_stations[station].state = TRACE_IDLE;
+}
+
+/**
+ * @brief Appends one record to the ring buffer of a station
+ *
+ *        Called from the ADC conversion complete interrupt. Checks the
+ *        overpressure trigger.
+ *
+ * @param station Index of the station
+ * @param code Raw code of the station's reference sensor
+ * @param pins Actuator pin levels of the station
+ *
+ * @retval None
+ */
+void
+trace_record (uint8_t station, uint16_t code, uint8_t pins)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct TraceStation *tr = &trace_stations[station];
+  uint8_t state = tr->state;
+
+  if (state != TRACE_ARMED && state != TRACE_TRIGGERED)
+    return;
+
+  struct TraceRecord *rec = &tr->buf[tr->head & (TRACE_SIZE - 1)];
+  rec->t = (uint32_t)timebase_us ();
+  rec->code = code;
+  rec->pins = pins;
+  rec->flags = 0;
+  tr->head++;
+
+  if (state == TRACE_ARMED)
+    {
+      if ((tr->config.triggers & TRACE_OVERPRESSURE)
+          && (code >= tr->over_code))
+        trace_fire (tr, TRACE_OVERPRESSURE);
+    }
+  else if (--tr->post_left == 0)
+    tr->state = TRACE_DONE;
+}
+
+/**
+ * @brief Triggers the capture of a station from outside the acquisition
+ *        interrupt
+ *
+ *        Ignored unless the capture is armed and the cause is enabled. Safe
+ *        to call from interrupts.
+ *
+ * @param station Index of the station
+ * @param cause enum trace_cause
+ *
+ * @retval None
+ */
+void
+trace_trigger (uint8_t station, uint8_t cause)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct TraceStation *tr = &trace_stations[station];
+
+  if (!(tr->config.triggers & cause))
+    return;
+
+  uint32_t primask = __get_PRIMASK ();
+  __disable_irq ();
+  if (tr->state == TRACE_ARMED)
+    trace_fire (tr, cause);
+  __set_PRIMASK (primask);
+}
+
+/**
+ * @brief Triggers the capture of a station if its tracking error is too
+ *        large
+ *
+ *        Only checked once the test has set a target.
+ *
+ * @param station Index of the station
+ * @param val Measured pressure
+ * @param target Target pressure
+ *
+ * @retval None
+ */
+void
+trace_check_error (uint8_t station, float val, float target)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  if ((target > 0.0f)
+      && (fabsf (val - target) > trace_stations[station].config.error))
+    trace_trigger (station, TRACE_ERROR);
+}
+
+/**
+ * @brief Checks whether the capture of a station has completed
+ *
+ *        Doesn't wait: called on every tick after the test has ended, until
+ *        it stops returning TRACE_WAITING. A capture still taking records
+ *        long after it should have completed is cut short.
+ *
+ * @param station Index of the station
+ * @param since Timebase when the test ended
+ *
+ * @retval uint8_t enum trace_poll
+ */
+uint8_t
+trace_poll (uint8_t station, uint64_t since)
+{
+  if (station >= PRESSURE_STATIONS)
+    return TRACE_NONE;
+
+  struct TraceStation *tr = &trace_stations[station];
+  uint64_t timeout = ((tr->config.post * 1000000ULL) / ACQUISITION_RATE)
+                     + (ACQUISITION_TIMEOUT * 1000ULL);
+
+  if (tr->state == TRACE_TRIGGERED)
+    {
+      if (timebase_us () - since <= timeout)
+        return TRACE_WAITING;
+
+      tr->state = TRACE_DONE;
+    }
+
+  return (tr->state == TRACE_DONE) ? TRACE_CAPTURED : TRACE_NONE;
+}
+
+/**
+ * @brief Transmits a completed capture of a station through UART
+ *
+ *        A header line, then the records as raw little endian struct
+ *        TraceRecord, oldest first, then an end line:
+ *
+ *          #TRACE n=<records> trig=<index> cause=<cause> clk=<Hz>
+ *          <n * 8 bytes>
+ *          #END
+ *
+ *        trig is the index of the first record taken after the trigger.
+ *
+ * @param station Index of the station
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+trace_uart_tx (uint8_t station, UART_HandleTypeDef *huart)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  struct TraceStation *tr = &trace_stations[station];
+
+  if (tr->state != TRACE_DONE)
+    return;
+
+  /* Records from before the trigger that haven't been overwritten */
+  uint32_t pre = tr->config.pre;
+  if (pre > tr->trig)
+    pre = tr->trig;
+  if (pre > TRACE_SIZE - (tr->head - tr->trig))
+    pre = TRACE_SIZE - (tr->head - tr->trig);
+
+  uint32_t first = tr->trig - pre;
+  uint32_t n = tr->head - first;
+
+  char str[80];
+  int len = snprintf (str, sizeof (str),
+                      "#TRACE n=%lu trig=%lu cause=%u clk=%lu\r\n",
+                      (unsigned long)n, (unsigned long)pre, tr->cause,
+                      1000000UL);
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+
+  /* At most two contiguous spans of the ring */
+  uint32_t idx = first & (TRACE_SIZE - 1);
+  uint32_t span = TRACE_SIZE - idx;
+  if (span > n)
+    span = n;
+
+  HAL_UART_Transmit (huart, (uint8_t *)&tr->buf[idx],
+                     span * sizeof (struct TraceRecord), 2000);
+  if (n > span)
+    HAL_UART_Transmit (huart, (uint8_t *)&tr->buf[0],
+                       (n - span) * sizeof (struct TraceRecord), 2000);
+
+  HAL_UART_Transmit (huart, (uint8_t *)"\r\n#END\r\n", 8, 100);
+}
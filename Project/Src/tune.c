@@ -0,0 +1,284 @@
+/**
+ * @file tune.c
+ *
+ * @brief Relay auto-tuning program body
+ *
+ *        Astrom-Hagglund relay experiment: the compressor and exhaust are
+ *        switched bang-bang around the setpoint with a little hysteresis,
+ *        which makes the tank settle into a limit cycle. Its amplitude a and
+ *        period give the ultimate gain and period of the rig,
+ *
+ *          Ku = 4d / (pi * sqrt (a^2 - h^2))
+ *
+ *        with d = 1 for full on / full open. Ziegler-Nichols PI gains follow
+ *        from those and are kept in flash, so tuning survives a reset.
+ *
+ *        Every station is tuned on its own, and the gains of all of them are
+ *        stored together in one record.
+ */
+
+#include "tune.h"
+#include "pressure.h"
+#include "stm32f4xx_hal.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Struct containing the gains as stored in flash */
+struct TuneRecord
+{
+  uint32_t magic;                            /*!< TUNE_MAGIC */
+  struct TuneGains gains[PRESSURE_STATIONS]; /*!< Stored gains */
+  uint32_t sum;                              /*!< Sum of the words above */
+};
+
+/* Struct containing the relay experiment of one station */
+struct TuneRelay
+{
+  float setpoint;  /*!< Pressure the relay switches around */
+  int8_t out;      /*!< Relay output, 1 : compressor, -1 : exhaust */
+  uint8_t periods; /*!< Full periods seen */
+  float t_rise;    /*!< Time of the last switch to the compressor */
+  float max;       /*!< Peak of the current period */
+  float min;       /*!< Trough of the current period */
+  float sum_tu;    /*!< Sum of the measured periods */
+  float sum_a;     /*!< Sum of the measured amplitudes */
+};
+
+static struct TuneGains
+    tune_gains[PRESSURE_STATIONS]; /*!< Gains in use, zero if untuned */
+static struct TuneRelay tune_relay[PRESSURE_STATIONS]; /*!< Experiments */
+
+/**
+ * @brief Sums the words of a record, except the sum itself
+ *
+ * @param rec Record
+ *
+ * @retval uint32_t Sum
+ */
+static uint32_t
+tune_sum (const struct TuneRecord *rec)
+{
+  const uint32_t *w = (const uint32_t *)rec;
+  uint32_t sum = 0;
+
+  for (uint32_t i = 0; i < offsetof (struct TuneRecord, sum) / 4; i++)
+    sum += w[i];
+
+  return sum;
+}
+
+/**
+ * @brief Loads the gains from flash
+ *
+ *        Without a valid record, the gains stay at zero, which leaves the
+ *        hold uncontrolled.
+ *
+ * @retval None
+ */
+void
+tune_init (void)
+{
+  const struct TuneRecord *rec = (const struct TuneRecord *)TUNE_FLASH_ADDR;
+
+  if (rec->magic == TUNE_MAGIC && rec->sum == tune_sum (rec))
+    memcpy (tune_gains, rec->gains, sizeof (tune_gains));
+  else
+    memset (tune_gains, 0, sizeof (tune_gains));
+}
+
+/**
+ * @brief Returns the gains in use on a station
+ *
+ * @param station Index of the station
+ *
+ * @retval const struct TuneGains* Gains, kp is zero if untuned
+ */
+const struct TuneGains *
+tune_get_gains (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    station = 0;
+
+  return &tune_gains[station];
+}
+
+/**
+ * @brief Starts a relay experiment on a station
+ *
+ * @param station Index of the station
+ * @param setpoint Pressure to oscillate around in psi
+ *
+ * @retval None
+ */
+void
+tune_relay_begin (uint8_t station, float setpoint)
+{
+  if (station >= PRESSURE_STATIONS)
+    return;
+
+  tune_relay[station] = (struct TuneRelay){ .setpoint = setpoint,
+                                            .out = 1,
+                                            .t_rise = -1.0f,
+                                            .max = -INFINITY,
+                                            .min = INFINITY };
+}
+
+/**
+ * @brief Runs the relay of a station for one sample
+ *
+ *        A period ends every time the relay switches back to the compressor.
+ *
+ * @param station Index of the station
+ * @param p Estimated pressure in psi
+ * @param t Time since the start of the experiment in sec
+ *
+ * @retval int8_t 1 : Compressor on, -1 : Exhaust open
+ */
+int8_t
+tune_relay_step (uint8_t station, float p, float t)
+{
+  if (station >= PRESSURE_STATIONS)
+    return -1;
+
+  struct TuneRelay *rl = &tune_relay[station];
+
+  if (p > rl->max)
+    rl->max = p;
+  if (p < rl->min)
+    rl->min = p;
+
+  if (rl->out > 0 && p > rl->setpoint + TUNE_HYSTERESIS)
+    rl->out = -1;
+  else if (rl->out < 0 && p < rl->setpoint - TUNE_HYSTERESIS)
+    {
+      rl->out = 1;
+
+      if (rl->t_rise >= 0.0f)
+        {
+          if (rl->periods >= TUNE_SKIP)
+            {
+              rl->sum_tu += t - rl->t_rise;
+              rl->sum_a += (rl->max - rl->min) / 2.0f;
+            }
+          rl->periods++;
+        }
+
+      rl->t_rise = t;
+      rl->max = p;
+      rl->min = p;
+    }
+
+  return rl->out;
+}
+
+/**
+ * @brief Returns whether enough periods have been measured on a station
+ *
+ * @param station Index of the station
+ *
+ * @retval uint8_t 1 : Done
+ *                 0 : Still oscillating
+ */
+uint8_t
+tune_relay_done (uint8_t station)
+{
+  if (station >= PRESSURE_STATIONS)
+    return 0;
+
+  return tune_relay[station].periods >= TUNE_SKIP + TUNE_PERIODS;
+}
+
+/**
+ * @brief Computes the gains of a station from its experiment and puts them
+ *        in use
+ *
+ *        The gains are only kept until reset, tune_save stores them.
+ *
+ * @param station Index of the station
+ *
+ * @retval uint8_t 1 : Gains updated
+ *                 0 : Experiment incomplete or oscillation too small
+ */
+uint8_t
+tune_finish (uint8_t station)
+{
+  if (!tune_relay_done (station))
+    return 0;
+
+  const struct TuneRelay *rl = &tune_relay[station];
+  struct TuneGains *gains = &tune_gains[station];
+
+  float a = rl->sum_a / TUNE_PERIODS;
+  if (a <= TUNE_HYSTERESIS)
+    return 0;
+
+  gains->tu = rl->sum_tu / TUNE_PERIODS;
+  gains->ku = 4.0f
+              / ((float)M_PI
+                 * sqrtf ((a * a) - (TUNE_HYSTERESIS * TUNE_HYSTERESIS)));
+  gains->kp = 0.45f * gains->ku;
+  gains->ki = gains->kp / (gains->tu / 1.2f);
+
+  return 1;
+}
+
+/**
+ * @brief Stores the gains in use on every station in flash
+ *
+ *        Erasing stalls the core for a second or so, the safety interrupt
+ *        included, so it must only be done with every tank vented and every
+ *        actuator off. Sector TUNE_FLASH_SECTOR is kept out of the
+ *        application by the linker script.
+ *
+ * @retval None
+ */
+void
+tune_save (void)
+{
+  struct TuneRecord rec;
+
+  rec.magic = TUNE_MAGIC;
+  memcpy (rec.gains, tune_gains, sizeof (rec.gains));
+  rec.sum = tune_sum (&rec);
+
+  FLASH_EraseInitTypeDef erase = { 0 };
+  uint32_t err;
+
+  erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+  erase.Sector = TUNE_FLASH_SECTOR;
+  erase.NbSectors = 1;
+  erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+  HAL_FLASH_Unlock ();
+  if (HAL_FLASHEx_Erase (&erase, &err) == HAL_OK)
+    {
+      const uint32_t *w = (const uint32_t *)&rec;
+      for (uint32_t i = 0; i < sizeof (rec) / 4; i++)
+        HAL_FLASH_Program (FLASH_TYPEPROGRAM_WORD, TUNE_FLASH_ADDR + (i * 4),
+                           w[i]);
+    }
+  HAL_FLASH_Lock ();
+}
+
+/**
+ * @brief Transmits the gains in use on a station through UART
+ *
+ * @param station Index of the station
+ * @param huart HAL UART handle for data plotting
+ *
+ * @retval None
+ */
+void
+tune_uart_tx (uint8_t station, UART_HandleTypeDef *huart)
+{
+  const struct TuneGains *gains = tune_get_gains (station);
+  char str[80];
+  int len = snprintf (str, sizeof (str),
+                      "#TUNE ku=%.4f tu=%.2f kp=%.4f ki=%.4f\r\n", gains->ku,
+                      gains->tu, gains->kp, gains->ki);
+
+  HAL_UART_Transmit (huart, (uint8_t *)str, len, 100);
+}
@@ -0,0 +1,333 @@
+/**
+ * @file waveform.c
+ *
+ * @brief Waveform registry program body
+ *
+ *        Every waveform the menu can select has one entry here. Tests with
+ *        their own control strategy provide a start and a tick function: the
+ *        station calls start once, then tick on every control tick until it
+ *        reports the test done. Profile generators instead provide init, next
+ *        and period: init precomputes a struct WaveformState once per test,
+ *        then the common runner calls next once per setpoint. Adding a generator only takes an entry in
+ *        the registry and the enum.
+ */
+
+#include "waveform.h"
+#include "pressure.h"
+
+#include <math.h>
+
+/**
+ * @brief Sets up the levels and period shared by the generators
+ *
+ * @param state State to fill
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Ready
+ *                 0 : No period, the profile would never complete a cycle
+ */
+static uint8_t
+waveform_init_levels (struct WaveformState *state,
+                      const struct Pressure *pressure)
+{
+  state->per = pressure->per;
+  state->low = pressure->offset - (pressure->ampl / 2);
+  state->high = pressure->offset + (pressure->ampl / 2);
+  state->profile = &pressure->profile;
+
+  if (state->low < 0.0f)
+    state->low = 0.0f;
+
+  return state->per > 0.0f;
+}
+
+/**
+ * @brief Returns the period of a generator
+ *
+ * @param state State built by the generator's init
+ *
+ * @retval float Period in sec
+ */
+static float
+waveform_period (const struct WaveformState *state)
+{
+  return state->per;
+}
+
+/**
+ * @brief Returns the time into the current period
+ *
+ * @param state State built by the generator's init
+ * @param t Time since the start of the profile in sec
+ *
+ * @retval float Time in sec
+ */
+static float
+waveform_phase (const struct WaveformState *state, float t)
+{
+  if (state->per <= 0.0f)
+    return 0.0f;
+
+  return fmodf (t, state->per);
+}
+
+/**
+ * @brief Trapezoid init
+ *
+ *        The edges are limited to half the period each.
+ *
+ * @param state State to fill
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Ready
+ *                 0 : No period
+ */
+static uint8_t
+waveform_trapezoid_init (struct WaveformState *state,
+                         const struct Pressure *pressure)
+{
+  uint8_t ok = waveform_init_levels (state, pressure);
+
+  state->a = pressure->profile.edge;
+  if (state->a > state->per / 2)
+    state->a = state->per / 2;
+
+  return ok;
+}
+
+/**
+ * @brief Trapezoid setpoint
+ *
+ *        Rises from the low to the high level, holds, falls back and holds,
+ *        starting at the low level. Each half of the period holds one level.
+ *
+ * @param state State built by waveform_trapezoid_init
+ * @param t Time since the start of the profile in sec
+ *
+ * @retval float Setpoint in psi
+ */
+static float
+waveform_trapezoid_next (const struct WaveformState *state, float t)
+{
+  float tm = waveform_phase (state, t);
+  float half = state->per / 2;
+  float span = state->high - state->low;
+
+  if (tm < state->a)
+    return state->low + (span * tm / state->a);
+  if (tm < half)
+    return state->high;
+  if (tm < half + state->a)
+    return state->high - (span * (tm - half) / state->a);
+
+  return state->low;
+}
+
+/**
+ * @brief Stairs init
+ *
+ *        One period climbs through every level and comes back down, dwelling
+ *        the same time on each step.
+ *
+ * @param state State to fill
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Ready
+ *                 0 : No period
+ */
+static uint8_t
+waveform_stairs_init (struct WaveformState *state,
+                      const struct Pressure *pressure)
+{
+  uint8_t ok = waveform_init_levels (state, pressure);
+
+  state->top = (pressure->profile.steps < 2) ? 1 : pressure->profile.steps - 1;
+  state->a = state->per / (2 * state->top);
+
+  return ok;
+}
+
+/**
+ * @brief Stairs setpoint
+ *
+ * @param state State built by waveform_stairs_init
+ * @param t Time since the start of the profile in sec
+ *
+ * @retval float Setpoint in psi
+ */
+static float
+waveform_stairs_next (const struct WaveformState *state, float t)
+{
+  if (state->a <= 0.0f)
+    return state->low;
+
+  uint16_t top = state->top;
+  uint16_t k = waveform_phase (state, t) / state->a;
+
+  /* Climbs for the first half of the dwells, then descends */
+  uint16_t level = (k <= top) ? k : (2 * top) - k;
+  if (level > top)
+    level = 0;
+
+  return state->low + ((state->high - state->low) * level / top);
+}
+
+/**
+ * @brief Segments init
+ *
+ *        The profile repeats once its last point is reached. It doesn't use
+ *        .per, .ampl or .offset. At least two points are needed, the first
+ *        one being at 0 sec.
+ *
+ * @param state State to fill
+ * @param pressure A pointer to a pressure struct
+ *
+ * @retval uint8_t 1 : Ready
+ *                 0 : Fewer than two points
+ */
+static uint8_t
+waveform_segments_init (struct WaveformState *state,
+                        const struct Pressure *pressure)
+{
+  const struct Profile *profile = &pressure->profile;
+
+  if (profile->points < 2)
+    return 0;
+
+  state->profile = profile;
+  state->per = profile->t[profile->points - 1];
+  state->low = profile->p[0];
+  state->high = profile->p[0];
+  state->a = 0.0f;
+
+  for (uint8_t i = 1; i < profile->points; i++)
+    {
+      if (profile->p[i] < state->low)
+        state->low = profile->p[i];
+      if (profile->p[i] > state->high)
+        state->high = profile->p[i];
+    }
+
+  return 1;
+}
+
+/**
+ * @brief Segments setpoint
+ *
+ *        Interpolates linearly between the two points around t.
+ *
+ * @param state State built by waveform_segments_init
+ * @param t Time since the start of the profile in sec
+ *
+ * @retval float Setpoint in psi
+ */
+static float
+waveform_segments_next (const struct WaveformState *state, float t)
+{
+  const struct Profile *profile = state->profile;
+  float tm = waveform_phase (state, t);
+
+  for (uint8_t i = 1; i < profile->points; i++)
+    {
+      if (tm < profile->t[i])
+        {
+          float dt = profile->t[i] - profile->t[i - 1];
+          if (dt <= 0.0f)
+            return profile->p[i];
+
+          return profile->p[i - 1]
+                 + ((profile->p[i] - profile->p[i - 1])
+                    * (tm - profile->t[i - 1]) / dt);
+        }
+    }
+
+  return profile->p[profile->points - 1];
+}
+
+/* Every waveform, indexed by enum waveform. Batch is run by the sequencer */
+static const struct Waveform waveform_registry[WAVEFORMS] = {
+  [WAVEFORM_CONST]
+  = { "Const", pressure_calib_static, pressure_calib_static_tick },
+  [WAVEFORM_STEP]
+  = { "Step", pressure_calib_dynam_step, pressure_calib_dynam_step_tick },
+  [WAVEFORM_RAMP]
+  = { "Ramp", pressure_calib_dynam_ramp, pressure_calib_dynam_ramp_tick },
+  [WAVEFORM_SINE]
+  = { "Sine", pressure_calib_dynam_sine, pressure_calib_dynam_sine_tick },
+  [WAVEFORM_TRAPEZOID] = { "Trapezoid", NULL, NULL, waveform_trapezoid_init,
+                           waveform_trapezoid_next, waveform_period },
+  [WAVEFORM_STAIRS] = { "Stairs", NULL, NULL, waveform_stairs_init,
+                        waveform_stairs_next, waveform_period },
+  [WAVEFORM_SEGMENTS] = { "Segments", NULL, NULL, waveform_segments_init,
+                          waveform_segments_next, waveform_period },
+  [WAVEFORM_CHIRP] = { "Chirp", pressure_calib_dynam_chirp,
+                       pressure_calib_dynam_chirp_tick },
+  [WAVEFORM_CURVE]
+  = { "Curve", pressure_calib_curve, pressure_calib_curve_tick },
+  [WAVEFORM_LEAK] = { "Leak", pressure_leak_test, pressure_leak_test_tick },
+  [WAVEFORM_TUNE] = { "Tune", pressure_autotune, pressure_autotune_tick },
+  [WAVEFORM_BATCH] = { "Batch" },
+};
+
+/**
+ * @brief Returns the registry entry of a waveform
+ *
+ * @param waveform enum waveform
+ *
+ * @retval const struct Waveform* Entry, NULL if out of range
+ */
+const struct Waveform *
+waveform_get (uint8_t waveform)
+{
+  if (waveform >= WAVEFORMS)
+    return NULL;
+
+  return &waveform_registry[waveform];
+}
+
+/**
+ * @brief Returns the name of a waveform
+ *
+ * @param waveform enum waveform
+ *
+ * @retval const char* Name, "?" if out of range
+ */
+const char *
+waveform_name (uint8_t waveform)
+{
+  if (waveform >= WAVEFORMS)
+    return "?";
+
+  return waveform_registry[waveform].name;
+}
+
+/**
+ * @brief Appends a point to the piecewise-linear profile
+ *
+ *        The first point sets where the profile starts, so its time is
+ *        forced to 0.
+ *
+ * @param profile Profile settings
+ * @param t Time of the point in sec
+ * @param p Pressure at the point in psi
+ *
+ * @retval uint8_t 1 : Added
+ *                 0 : Profile full, or t not after the previous point
+ */
+uint8_t
+waveform_add_point (struct Profile *profile, float t, float p)
+{
+  if (profile->points >= WAVEFORM_MAX_POINTS)
+    return 0;
+
+  if (profile->points == 0)
+    t = 0.0f;
+  else if (t <= profile->t[profile->points - 1])
+    return 0;
+
+  profile->t[profile->points] = t;
+  profile->p[profile->points] = p;
+  profile->points++;
+
+  return 1;
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""Decodes a capture of the firmware's compressed burst telemetry.
+
+The capture is the raw byte stream of the plotting UART, saved with any
+serial terminal while BURST ON was active. Every #BLK header is followed by
+its binary payload (see Project/Src/burst.c for the layout). The decoded
+scans are written as CSV, one line per scan:
+
+    n,t,ref,dut1,dut2,dut3
+
+with raw 12 bit ADC codes and t in seconds. A summary with the compression
+ratio goes to stderr.
+
+    python3 burst_decode.py capture.bin > scans.csv
+"""
+
+import argparse
+import re
+import sys
+
+CHANNELS = 4
+
+HEADER = re.compile(
+    rb"#BLK seq=(\d+) n=(\d+) t=(\d+\.\d+) scans=(\d+) len=(\d+) "
+    rb"crc=([0-9A-F]{4})\r\n"
+)
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, as computed by burst_crc."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def decode_block(payload, scans):
+    """Returns the scans of one block as lists of codes."""
+    prev = [payload[2 * ch] | (payload[2 * ch + 1] << 8)
+            for ch in range(CHANNELS)]
+    out = [prev]
+    pos = 2 * CHANNELS
+
+    for _ in range(scans - 1):
+        cur = []
+        for ch in range(CHANNELS):
+            z = 0
+            shift = 0
+            while True:
+                byte = payload[pos]
+                pos += 1
+                z |= (byte & 0x7F) << shift
+                shift += 7
+                if not byte & 0x80:
+                    break
+            delta = (z >> 1) ^ -(z & 1)
+            cur.append((prev[ch] + delta) & 0xFFFF)
+        out.append(cur)
+        prev = cur
+
+    if pos != len(payload):
+        raise ValueError("payload length mismatch")
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="raw UART capture")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        data = f.read()
+
+    blocks = bad = scans = payload_bytes = wire_bytes = 0
+    pos = 0
+    out = sys.stdout
+
+    while True:
+        m = HEADER.search(data, pos)
+        if m is None:
+            break
+
+        seq, n, t, count, length, crc = m.groups()
+        n, count, length = int(n), int(count), int(length)
+        start = m.end()
+        payload = data[start : start + length]
+        pos = start + length
+
+        if len(payload) < length or crc16(payload) != int(crc, 16):
+            bad += 1
+            print("block %s: bad CRC, skipped" % seq.decode(), file=sys.stderr)
+            continue
+
+        try:
+            rows = decode_block(payload, count)
+        except (IndexError, ValueError) as e:
+            bad += 1
+            print("block %s: %s, skipped" % (seq.decode(), e), file=sys.stderr)
+            continue
+
+        # Scans are taken every millisecond, see ACQUISITION_RATE
+        t0 = float(t)
+        for i, row in enumerate(rows):
+            out.write("%d,%.6f,%s\n" % (n + i, t0 + i / 1000.0,
+                                        ",".join(str(c) for c in row)))
+
+        blocks += 1
+        scans += count
+        payload_bytes += length
+        wire_bytes += (m.end() - m.start()) + length
+
+    raw = scans * CHANNELS * 2
+    print("blocks=%d bad=%d scans=%d" % (blocks, bad, scans), file=sys.stderr)
+    if payload_bytes:
+        print("ratio=%.2f payload, %.2f with headers (against 2 bytes/sample)"
+              % (raw / payload_bytes, raw / wire_bytes), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
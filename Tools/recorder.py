@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+"""Records the firmware's telemetry stream into a columnar capture.
+
+Reads the plotting UART from a tty or pty (or a saved raw stream) and appends
+every sensor frame as one row. Each column is a file of fixed-width little
+endian values written through mmap, so memory use doesn't grow with the
+length of the run. A capture is a directory:
+
+    meta.json    Columns, their struct types and the number of rows written
+    <name>.bin   One value per row, for each column below
+    index.bin    Time of the first row of every BLOCK rows, float64
+
+Columns: t (sec, from the #RATE markers), ref, dut1, dut2, dut3 (psi),
+target (psi, 0 without a target) and pins (bit 0 compressor, bit 1 exhaust).
+meta.json is rewritten every BLOCK rows, so a capture can be read while it
+is still being recorded.
+
+    python3 recorder.py /dev/ttyACM0 run1 --baud 115200
+    python3 recorder.py run1 --query 120 180 --max 2000 > window.csv
+
+From Python, Capture(path).window(t0, t1) returns zero-copy views of any
+time range without reading the rest of the file.
+"""
+
+import argparse
+import bisect
+import json
+import math
+import mmap
+import os
+import re
+import struct
+import sys
+import termios
+import tty
+
+COLUMNS = (
+    ("t", "d"),
+    ("ref", "f"),
+    ("dut1", "f"),
+    ("dut2", "f"),
+    ("dut3", "f"),
+    ("target", "f"),
+    ("pins", "B"),
+)
+
+BLOCK = 4096      # Rows per index entry
+GROW = 1 << 20    # Rows added to the files whenever they fill up
+LINE_MAX = 256    # Longer lines are garbage and dropped
+
+RATE = re.compile(rb"#RATE hz=(\d+) n=(\d+) t=(\d+\.\d+)")
+BLK = re.compile(rb"#BLK .* len=(\d+) ")
+
+
+class CaptureWriter:
+    """Appends rows to a capture directory."""
+
+    def __init__(self, path):
+        os.makedirs(path, exist_ok=True)
+        self.path = path
+        self.rows = 0
+        self.cap = 0
+        self.files = {}
+        self.maps = {}
+        for name, fmt in COLUMNS:
+            self.files[name] = open(os.path.join(path, name + ".bin"), "w+b")
+        self.index = open(os.path.join(path, "index.bin"), "wb")
+        self._grow()
+        self._write_meta()
+
+    def _grow(self):
+        for m in self.maps.values():
+            m.close()
+        self.cap += GROW
+        for name, fmt in COLUMNS:
+            f = self.files[name]
+            f.truncate(self.cap * struct.calcsize(fmt))
+            self.maps[name] = mmap.mmap(f.fileno(), 0)
+
+    def _write_meta(self):
+        meta = {"rows": self.rows, "block": BLOCK,
+                "columns": [list(c) for c in COLUMNS]}
+        tmp = os.path.join(self.path, "meta.json.tmp")
+        with open(tmp, "w") as f:
+            json.dump(meta, f)
+        os.replace(tmp, os.path.join(self.path, "meta.json"))
+
+    def append(self, row):
+        if self.rows == self.cap:
+            self._grow()
+        for (name, fmt), value in zip(COLUMNS, row):
+            struct.pack_into("<" + fmt, self.maps[name],
+                             self.rows * struct.calcsize(fmt), value)
+        if self.rows % BLOCK == 0:
+            self.index.write(struct.pack("<d", row[0]))
+            self.index.flush()
+        self.rows += 1
+        if self.rows % BLOCK == 0:
+            self._write_meta()
+
+    def close(self):
+        for name, fmt in COLUMNS:
+            self.maps[name].flush()
+            self.maps[name].close()
+            self.files[name].truncate(self.rows * struct.calcsize(fmt))
+            self.files[name].close()
+        self.index.close()
+        self._write_meta()
+
+
+class StreamParser:
+    """Turns the raw UART byte stream into rows."""
+
+    def __init__(self, writer):
+        self.writer = writer
+        self.buf = b""
+        self.skip = 0
+        self.t = None
+        self.step = 0.0
+
+    def feed(self, data):
+        self.buf += data
+        while True:
+            # Burst payloads are binary, see burst_decode.py
+            if self.skip:
+                n = min(self.skip, len(self.buf))
+                self.buf = self.buf[n:]
+                self.skip -= n
+                if self.skip:
+                    return
+
+            end = self.buf.find(b"\n")
+            if end < 0:
+                if len(self.buf) > LINE_MAX:
+                    self.buf = b""
+                return
+            line = self.buf[:end].strip()
+            self.buf = self.buf[end + 1:]
+            self._line(line)
+
+    def _line(self, line):
+        if line.startswith(b"#"):
+            m = RATE.match(line)
+            if m:
+                self.t = float(m.group(3))
+                self.step = 1.0 / int(m.group(1))
+            m = BLK.match(line)
+            if m:
+                self.skip = int(m.group(1))
+            return
+
+        # Frames before the first marker have no time
+        if self.t is None:
+            return
+
+        try:
+            fields = [float(v) for v in line.split(b",")]
+        except ValueError:
+            return
+        if len(fields) == 4:
+            fields += [math.nan, 255]
+        if len(fields) != 6:
+            return
+
+        self.writer.append([self.t] + fields[:5] + [int(fields[5])])
+        self.t += self.step
+
+
+class Capture:
+    """Read-only view of a capture directory."""
+
+    def __init__(self, path):
+        with open(os.path.join(path, "meta.json")) as f:
+            meta = json.load(f)
+        self.rows = meta["rows"]
+        self.block = meta["block"]
+        self.cols = {}
+        self._maps = []
+        for name, fmt in meta["columns"]:
+            with open(os.path.join(path, name + ".bin"), "rb") as f:
+                m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+            self._maps.append(m)
+            self.cols[name] = memoryview(m).cast(fmt)[:self.rows]
+        with open(os.path.join(path, "index.bin"), "rb") as f:
+            raw = f.read()
+        n = min(len(raw) // 8, (self.rows + self.block - 1) // self.block)
+        self.index = struct.unpack("<%dd" % n, raw[:n * 8])
+
+    def find(self, t):
+        """Returns the first row at or after t."""
+        b = bisect.bisect_right(self.index, t) - 1
+        lo = max(b, 0) * self.block
+        hi = min(lo + self.block, self.rows) if b >= 0 else lo
+        return bisect.bisect_left(self.cols["t"], t, lo, hi)
+
+    def window(self, t0, t1, columns=None, max_points=None):
+        """Returns {column: view} for the rows from t0 up to t1.
+
+        With max_points, every few rows are skipped so that at most that
+        many are returned. The views share memory with the files.
+        """
+        lo = self.find(t0)
+        hi = self.find(t1)
+        stride = 1
+        if max_points and hi - lo > max_points:
+            stride = -(-(hi - lo) // max_points)
+        names = columns or list(self.cols)
+        return {c: self.cols[c][lo:hi:stride] for c in names}
+
+
+def open_port(dev, baud):
+    fd = os.open(dev, os.O_RDONLY | os.O_NOCTTY)
+    if os.isatty(fd):
+        tty.setraw(fd)
+        if baud:
+            attrs = termios.tcgetattr(fd)
+            attrs[4] = attrs[5] = getattr(termios, "B%d" % baud)
+            termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def record(dev, path, baud):
+    fd = open_port(dev, baud)
+    writer = CaptureWriter(path)
+    parser = StreamParser(writer)
+    try:
+        while True:
+            data = os.read(fd, 4096)
+            if not data:
+                break
+            parser.feed(data)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        writer.close()
+        os.close(fd)
+    print("rows=%d" % writer.rows, file=sys.stderr)
+
+
+def query(path, t0, t1, max_points):
+    win = Capture(path).window(t0, t1, max_points=max_points)
+    names = list(win)
+    print(",".join(names))
+    for row in zip(*(win[c] for c in names)):
+        print(",".join("%g" % v for v in row))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("source", help="tty, pty or raw stream; capture "
+                        "directory with --query")
+    parser.add_argument("dest", nargs="?", help="capture directory")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--query", nargs=2, type=float, metavar=("T0", "T1"),
+                        help="print the rows between two times as CSV")
+    parser.add_argument("--max", type=int, help="most rows to print")
+    args = parser.parse_args()
+
+    if args.query:
+        query(args.source, args.query[0], args.query[1], args.max)
+    elif args.dest:
+        record(args.source, args.dest, args.baud)
+    else:
+        parser.error("missing capture directory")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Replays a recording through host builds of the firmware and diffs them.
+
+Runs the host replay harness (Host/Replay/replay.c, built with make -C Host
+replay) on the scans decoded by burst_decode.py and an optional script of
+encoder, button and UART events, and prints the #ACT and #LCD lines it logs.
+Given a second build with --against, runs both on the same inputs and prints
+a unified diff of the two logs instead, exit status 1 if they differ.
+
+    python3 burst_decode.py field.bin > field.csv
+    python3 replay.py field.csv --events field.ev > field.log
+    python3 replay.py field.csv --events field.ev --against old/replay
+
+The replay is deterministic, so any line of the diff is a difference in
+behaviour between the builds.
+"""
+
+import argparse
+import difflib
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+BUILD = os.path.normpath(os.path.join(HERE, "..", "Host", "build", "replay"))
+
+
+def start(build, recording, events):
+    """Starts a replay, returns the process."""
+    cmd = [build]
+    if events:
+        cmd += ["-e", events]
+    cmd.append(recording)
+    return subprocess.Popen(cmd, stdout=subprocess.PIPE, text=True)
+
+
+def finish(proc):
+    """Waits for a replay, returns its log lines."""
+    out, _ = proc.communicate()
+    if proc.returncode != 0:
+        sys.exit("%s failed" % proc.args[0])
+    return out.splitlines(keepends=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("recording", help="CSV from burst_decode.py")
+    parser.add_argument("--events", help="script of input events")
+    parser.add_argument("--build", default=BUILD,
+                        help="replay harness, Host/build/replay by default")
+    parser.add_argument("--against", help="replay harness of another build")
+    args = parser.parse_args()
+
+    # Both builds run at once
+    procs = [start(b, args.recording, args.events)
+             for b in (args.build, args.against) if b]
+    logs = [finish(p) for p in procs]
+
+    if len(logs) == 1:
+        sys.stdout.writelines(logs[0])
+        return
+
+    diff = list(difflib.unified_diff(logs[1], logs[0], args.against,
+                                     args.build))
+    sys.stdout.writelines(diff)
+    sys.exit(1 if diff else 0)
+
+
+if __name__ == "__main__":
+    main()